@@ -0,0 +1,125 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "CloudRenderingBinaryInput.h"
+
+#include <string.h>
+
+namespace CloudRenderingProtocol
+{
+namespace BinaryInput
+{
+    /// @cond PRIVATE
+
+    static const u8 cMagic = 0x49;
+
+    static inline u16 ReadU16(const uchar *p)
+    {
+        return static_cast<u16>(p[0] | (p[1] << 8));
+    }
+
+    static inline u32 ReadU32(const uchar *p)
+    {
+        return static_cast<u32>(p[0]) | (static_cast<u32>(p[1]) << 8) | (static_cast<u32>(p[2]) << 16) | (static_cast<u32>(p[3]) << 24);
+    }
+
+    static inline void WriteU16(uchar *p, u16 value)
+    {
+        p[0] = static_cast<uchar>(value);
+        p[1] = static_cast<uchar>(value >> 8);
+    }
+
+    static inline void WriteU32(uchar *p, u32 value)
+    {
+        p[0] = static_cast<uchar>(value);
+        p[1] = static_cast<uchar>(value >> 8);
+        p[2] = static_cast<uchar>(value >> 16);
+        p[3] = static_cast<uchar>(value >> 24);
+    }
+
+    static inline u16 ToFixed(float value)
+    {
+        if (value <= 0.0f)
+            return 0;
+        if (value >= 1.0f)
+            return 65535;
+        return static_cast<u16>(value * 65535.0f + 0.5f);
+    }
+
+    /// @endcond
+
+    InputEvent::InputEvent() :
+        type(IET_Invalid),
+        modifiers(0),
+        sequence(0),
+        timestamp(0),
+        x(0.0f),
+        y(0.0f),
+        buttons(0),
+        action(IA_Release),
+        button(0),
+        wheelDelta(0),
+        keyCode(0)
+    {
+    }
+
+    bool IsInputEvent(const char *data, int size)
+    {
+        return (data && size > 0 && static_cast<u8>(data[0]) == cMagic);
+    }
+
+    bool Decode(const char *data, int size, InputEvent &event)
+    {
+        if (!IsInputEvent(data, size) || size < cEventSize)
+            return false;
+
+        const uchar *p = reinterpret_cast<const uchar*>(data);
+        if (p[1] < cVersion || p[2] < IET_MouseMove || p[2] > IET_Key || p[17] > IA_DoublePress)
+            return false;
+
+        event.type = static_cast<EventType>(p[2]);
+        event.modifiers = p[3];
+        event.sequence = ReadU32(p + 4);
+        event.timestamp = ReadU32(p + 8);
+        event.x = static_cast<float>(ReadU16(p + 12)) / 65535.0f;
+        event.y = static_cast<float>(ReadU16(p + 14)) / 65535.0f;
+        event.buttons = p[16];
+        event.action = static_cast<Action>(p[17]);
+        event.button = p[18];
+        event.wheelDelta = (event.type == IET_MouseWheel ? static_cast<s16>(ReadU16(p + 20)) : 0);
+        event.keyCode = (event.type == IET_Key ? ReadU16(p + 20) : 0);
+        return true;
+    }
+
+    int Encode(const InputEvent &event, char *data, int size)
+    {
+        if (!data || size < cEventSize)
+            return 0;
+
+        uchar *p = reinterpret_cast<uchar*>(data);
+        memset(p, 0, cEventSize);
+        p[0] = cMagic;
+        p[1] = cVersion;
+        p[2] = static_cast<uchar>(event.type);
+        p[3] = event.modifiers;
+        WriteU32(p + 4, event.sequence);
+        WriteU32(p + 8, event.timestamp);
+        WriteU16(p + 12, ToFixed(event.x));
+        WriteU16(p + 14, ToFixed(event.y));
+        p[16] = event.buttons;
+        p[17] = static_cast<uchar>(event.action);
+        p[18] = event.button;
+        if (event.type == IET_MouseWheel)
+            WriteU16(p + 20, static_cast<u16>(event.wheelDelta));
+        else if (event.type == IET_Key)
+            WriteU16(p + 20, event.keyCode);
+        return cEventSize;
+    }
+}
+}
@@ -0,0 +1,119 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include "CoreTypes.h"
+
+namespace CloudRenderingProtocol
+{
+    /// Compact binary input events sent by web clients as binary data channel messages.
+    /** Replaces the "InputMouse" and "InputKeyboard" PeerCustomMessage JSON payloads, which are
+        still accepted. Every event is a fixed 24 byte message, multi byte fields are little endian.
+
+        @code
+        Offset  Size  Field
+        0       1     magic, always 0x49 ('I')
+        1       1     version, currently 1
+        2       1     type: 1 mouse move, 2 mouse button, 3 mouse wheel, 4 key
+        3       1     modifiers: bit 0 shift, bit 1 ctrl, bit 2 alt, bit 3 meta
+        4       4     sequence number, incremented by one for each event the client sends
+        8       4     client timestamp in milliseconds, eg. truncated performance.now()
+        12      2     x, 0 left edge to 65535 right edge of the video
+        14      2     y, 0 top edge to 65535 bottom edge of the video
+        16      1     buttons held down after the event: bit 0 left, bit 1 right, bit 2 middle
+        17      1     action: 0 release, 1 press, 2 double press. Mouse button and key events.
+        18      1     changed button as in DOM MouseEvent.which: 1 left, 2 middle, 3 right. Mouse button events.
+        19      1     reserved, 0
+        20      2     mouse wheel: signed delta, 120 per wheel step, positive away from the user.
+                      key: HTML keyCode.
+        22      2     reserved, 0
+        @endcode
+
+        Messages with a newer version may be longer, the first 24 bytes of version 1 are then decoded. */
+    namespace BinaryInput
+    {
+        /// Current format version.
+        static const u8 cVersion = 1;
+
+        /// Size of a version 1 event in bytes.
+        static const int cEventSize = 24;
+
+        enum EventType
+        {
+            IET_Invalid = 0,
+            IET_MouseMove = 1,
+            IET_MouseButton = 2,
+            IET_MouseWheel = 3,
+            IET_Key = 4
+        };
+
+        enum Modifier
+        {
+            IM_Shift = 0x1,
+            IM_Ctrl = 0x2,
+            IM_Alt = 0x4,
+            IM_Meta = 0x8
+        };
+
+        enum Button
+        {
+            IB_Left = 0x1,
+            IB_Right = 0x2,
+            IB_Middle = 0x4
+        };
+
+        enum Action
+        {
+            IA_Release = 0,
+            IA_Press = 1,
+            IA_DoublePress = 2
+        };
+
+        /// Decoded input event.
+        struct CLOUDRENDERING_API InputEvent
+        {
+            EventType type;
+            /// Modifier flags.
+            u8 modifiers;
+            u32 sequence;
+            /// Client timestamp in milliseconds.
+            u32 timestamp;
+            /// Position in [0.0, 1.0] range.
+            float x;
+            float y;
+            /// Button flags of the buttons held down.
+            u8 buttons;
+            /// Action of a mouse button or key event.
+            Action action;
+            /// Changed button of a mouse button event, 1 left, 2 middle, 3 right.
+            u8 button;
+            /// Mouse wheel delta, 120 per wheel step.
+            s16 wheelDelta;
+            /// HTML keyCode of a key event.
+            u16 keyCode;
+
+            InputEvent();
+        };
+
+        /// Returns if @c data starts with the binary input magic byte.
+        CLOUDRENDERING_API bool IsInputEvent(const char *data, int size);
+
+        /// Decodes an event from @c data. Does not allocate.
+        /** @return False if @c data is not a valid binary input event. */
+        CLOUDRENDERING_API bool Decode(const char *data, int size, InputEvent &event);
+
+        /// Encodes @c event to @c data, which must have room for cEventSize bytes.
+        /** @return Number of bytes written, 0 if @c size is too small. */
+        CLOUDRENDERING_API int Encode(const InputEvent &event, char *data, int size);
+    }
+}
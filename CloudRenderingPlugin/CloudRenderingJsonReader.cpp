@@ -0,0 +1,429 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "CloudRenderingJsonReader.h"
+
+#include <string.h>
+
+namespace CloudRenderingProtocol
+{
+    /// @cond PRIVATE
+
+    /// Nesting limit for Skip(), deeper documents are treated as errors.
+    static const int cMaxSkipDepth = 64;
+
+    static int HexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    static bool ReadHex4(const char *data, int pos, int end, uint &value)
+    {
+        if (pos + 4 > end)
+            return false;
+        value = 0;
+        for (int i=0; i<4; ++i)
+        {
+            int hex = HexValue(data[pos + i]);
+            if (hex < 0)
+                return false;
+            value = (value << 4) | static_cast<uint>(hex);
+        }
+        return true;
+    }
+
+    static void AppendUtf8(QByteArray &out, uint codePoint)
+    {
+        if (codePoint < 0x80)
+            out.append(static_cast<char>(codePoint));
+        else if (codePoint < 0x800)
+        {
+            out.append(static_cast<char>(0xC0 | (codePoint >> 6)));
+            out.append(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else if (codePoint < 0x10000)
+        {
+            out.append(static_cast<char>(0xE0 | (codePoint >> 12)));
+            out.append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            out.append(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else
+        {
+            out.append(static_cast<char>(0xF0 | (codePoint >> 18)));
+            out.append(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+            out.append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            out.append(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+    }
+
+    /// Decodes the raw contents of a string with escapes to UTF-8.
+    static bool Unescape(const char *data, int begin, int end, QByteArray &out)
+    {
+        out.reserve(end - begin);
+        for (int i=begin; i<end; ++i)
+        {
+            if (data[i] != '\\')
+            {
+                out.append(data[i]);
+                continue;
+            }
+            if (++i >= end)
+                return false;
+            switch(data[i])
+            {
+                case '"':  out.append('"'); break;
+                case '\\': out.append('\\'); break;
+                case '/':  out.append('/'); break;
+                case 'b':  out.append('\b'); break;
+                case 'f':  out.append('\f'); break;
+                case 'n':  out.append('\n'); break;
+                case 'r':  out.append('\r'); break;
+                case 't':  out.append('\t'); break;
+                case 'u':
+                {
+                    uint codePoint = 0;
+                    if (!ReadHex4(data, i + 1, end, codePoint))
+                        return false;
+                    i += 4;
+                    // Surrogate pair.
+                    if (codePoint >= 0xD800 && codePoint <= 0xDBFF)
+                    {
+                        uint low = 0;
+                        if (i + 2 < end && data[i + 1] == '\\' && data[i + 2] == 'u' && ReadHex4(data, i + 3, end, low) &&
+                            low >= 0xDC00 && low <= 0xDFFF)
+                        {
+                            codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                            i += 6;
+                        }
+                        else
+                            codePoint = 0xFFFD;
+                    }
+                    else if (codePoint >= 0xDC00 && codePoint <= 0xDFFF)
+                        codePoint = 0xFFFD;
+                    AppendUtf8(out, codePoint);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    /// @endcond
+
+    JsonReader::JsonReader(const QByteArray &json) :
+        data_(json.constData()),
+        size_(json.size()),
+        pos_(0),
+        error_(false),
+        keyBegin_(0),
+        keyEnd_(0),
+        keyEscaped_(false)
+    {
+    }
+
+    JsonReader::JsonReader(const char *data, int size) :
+        data_(data),
+        size_(data ? size : 0),
+        pos_(0),
+        error_(false),
+        keyBegin_(0),
+        keyEnd_(0),
+        keyEscaped_(false)
+    {
+    }
+
+    JsonReader::ValueType JsonReader::Peek()
+    {
+        if (error_)
+            return VT_Invalid;
+        SkipWhitespace();
+        if (pos_ >= size_)
+            return VT_Invalid;
+        switch(data_[pos_])
+        {
+            case '{': return VT_Object;
+            case '[': return VT_Array;
+            case '"': return VT_String;
+            case 't':
+            case 'f': return VT_Bool;
+            case 'n': return VT_Null;
+            case '-': return VT_Number;
+            default:
+                return (data_[pos_] >= '0' && data_[pos_] <= '9' ? VT_Number : VT_Invalid);
+        }
+    }
+
+    bool JsonReader::EnterObject()
+    {
+        if (Peek() != VT_Object)
+            return false;
+        pos_++;
+        return true;
+    }
+
+    bool JsonReader::NextKey()
+    {
+        if (error_)
+            return false;
+        SkipWhitespace();
+        if (pos_ < size_ && data_[pos_] == ',')
+        {
+            pos_++;
+            SkipWhitespace();
+        }
+        if (pos_ >= size_)
+            return Fail();
+        if (data_[pos_] == '}')
+        {
+            pos_++;
+            return false;
+        }
+        if (!ScanString(keyBegin_, keyEnd_, keyEscaped_))
+            return Fail();
+        SkipWhitespace();
+        if (pos_ >= size_ || data_[pos_] != ':')
+            return Fail();
+        pos_++;
+        return true;
+    }
+
+    bool JsonReader::KeyIs(const char *key) const
+    {
+        const int length = static_cast<int>(strlen(key));
+        return (!keyEscaped_ && keyEnd_ - keyBegin_ == length && memcmp(data_ + keyBegin_, key, length) == 0);
+    }
+
+    QString JsonReader::Key() const
+    {
+        if (!keyEscaped_)
+            return QString::fromUtf8(data_ + keyBegin_, keyEnd_ - keyBegin_);
+        QByteArray utf8;
+        Unescape(data_, keyBegin_, keyEnd_, utf8);
+        return QString::fromUtf8(utf8.constData(), utf8.size());
+    }
+
+    bool JsonReader::EnterArray()
+    {
+        if (Peek() != VT_Array)
+            return false;
+        pos_++;
+        return true;
+    }
+
+    bool JsonReader::NextElement()
+    {
+        if (error_)
+            return false;
+        SkipWhitespace();
+        if (pos_ < size_ && data_[pos_] == ',')
+        {
+            pos_++;
+            SkipWhitespace();
+        }
+        if (pos_ >= size_)
+            return Fail();
+        if (data_[pos_] == ']')
+        {
+            pos_++;
+            return false;
+        }
+        return true;
+    }
+
+    bool JsonReader::ReadString(QString &value)
+    {
+        if (Peek() != VT_String)
+            return false;
+        int begin = 0, end = 0;
+        bool escaped = false;
+        if (!ScanString(begin, end, escaped))
+            return Fail();
+        if (!escaped)
+        {
+            value = QString::fromUtf8(data_ + begin, end - begin);
+            return true;
+        }
+        QByteArray utf8;
+        if (!Unescape(data_, begin, end, utf8))
+            return Fail();
+        value = QString::fromUtf8(utf8.constData(), utf8.size());
+        return true;
+    }
+
+    bool JsonReader::ReadNumber(double &value)
+    {
+        if (Peek() != VT_Number)
+            return false;
+        int begin = 0, end = 0;
+        if (!ScanNumber(begin, end))
+            return Fail();
+        // QByteArray::toDouble() parses in the C locale, strtod() would follow the application locale.
+        bool ok = false;
+        value = QByteArray::fromRawData(data_ + begin, end - begin).toDouble(&ok);
+        return (ok ? true : Fail());
+    }
+
+    bool JsonReader::ReadInt(int &value)
+    {
+        double number = 0.0;
+        if (!ReadNumber(number))
+            return false;
+        value = static_cast<int>(number);
+        return true;
+    }
+
+    bool JsonReader::ReadBool(bool &value)
+    {
+        if (Peek() != VT_Bool)
+            return false;
+        if (size_ - pos_ >= 4 && memcmp(data_ + pos_, "true", 4) == 0)
+        {
+            value = true;
+            pos_ += 4;
+            return true;
+        }
+        if (size_ - pos_ >= 5 && memcmp(data_ + pos_, "false", 5) == 0)
+        {
+            value = false;
+            pos_ += 5;
+            return true;
+        }
+        return Fail();
+    }
+
+    bool JsonReader::Skip()
+    {
+        return SkipValue(0);
+    }
+
+    bool JsonReader::HasError() const
+    {
+        return error_;
+    }
+
+    int JsonReader::Position() const
+    {
+        return pos_;
+    }
+
+    void JsonReader::Seek(int position)
+    {
+        pos_ = qBound(0, position, size_);
+        error_ = false;
+    }
+
+    void JsonReader::SkipWhitespace()
+    {
+        while (pos_ < size_ && (data_[pos_] == ' ' || data_[pos_] == '\t' || data_[pos_] == '\n' || data_[pos_] == '\r'))
+            pos_++;
+    }
+
+    bool JsonReader::Fail()
+    {
+        error_ = true;
+        return false;
+    }
+
+    bool JsonReader::ScanString(int &begin, int &end, bool &escaped)
+    {
+        if (pos_ >= size_ || data_[pos_] != '"')
+            return false;
+        escaped = false;
+        begin = ++pos_;
+        while (pos_ < size_)
+        {
+            const char c = data_[pos_];
+            if (c == '"')
+            {
+                end = pos_++;
+                return true;
+            }
+            if (c == '\\')
+            {
+                escaped = true;
+                pos_++;
+            }
+            pos_++;
+        }
+        return false;
+    }
+
+    bool JsonReader::ScanNumber(int &begin, int &end)
+    {
+        begin = pos_;
+        if (pos_ < size_ && data_[pos_] == '-')
+            pos_++;
+        const int digits = pos_;
+        while (pos_ < size_ && ((data_[pos_] >= '0' && data_[pos_] <= '9') || data_[pos_] == '.' ||
+               data_[pos_] == 'e' || data_[pos_] == 'E' || data_[pos_] == '+' || data_[pos_] == '-'))
+            pos_++;
+        end = pos_;
+        return (end > digits);
+    }
+
+    bool JsonReader::SkipValue(int depth)
+    {
+        if (depth > cMaxSkipDepth)
+            return Fail();
+        switch(Peek())
+        {
+            case VT_Object:
+            {
+                pos_++;
+                while (NextKey())
+                    if (!SkipValue(depth + 1))
+                        return false;
+                return !error_;
+            }
+            case VT_Array:
+            {
+                pos_++;
+                while (NextElement())
+                    if (!SkipValue(depth + 1))
+                        return false;
+                return !error_;
+            }
+            case VT_String:
+            {
+                int begin = 0, end = 0;
+                bool escaped = false;
+                return (ScanString(begin, end, escaped) ? true : Fail());
+            }
+            case VT_Number:
+            {
+                int begin = 0, end = 0;
+                return (ScanNumber(begin, end) ? true : Fail());
+            }
+            case VT_Bool:
+            {
+                bool value = false;
+                return ReadBool(value);
+            }
+            case VT_Null:
+            {
+                if (size_ - pos_ >= 4 && memcmp(data_ + pos_, "null", 4) == 0)
+                {
+                    pos_ += 4;
+                    return true;
+                }
+                return Fail();
+            }
+            default:
+                return Fail();
+        }
+    }
+}
@@ -0,0 +1,128 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+
+#include <QByteArray>
+#include <QString>
+
+namespace CloudRenderingProtocol
+{
+    /// Pull parser for JSON text.
+    /** Reads values in document order straight into the callers variables. Nothing is built for the
+        parts of the document that are not read, they are stepped over with Skip(). This is the parser
+        of the message fast paths, the generic path builds the full QVariantMap tree with TundraJson.
+
+        @code
+        JsonReader reader(json);
+        if (!reader.EnterObject())
+            return false;
+        while (reader.NextKey())
+        {
+            if (reader.KeyIs("x"))
+                ok = reader.ReadNumber(x);
+            else
+                ok = reader.Skip();
+            if (!ok)
+                return false;
+        }
+        return !reader.HasError();
+        @endcode
+
+        A syntax error puts the reader in error state, all reads fail after that. Reading a value of
+        the wrong type fails without consuming it or entering the error state.
+        @note The reader references the data it was created with, the data must outlive the reader. */
+    class CLOUDRENDERING_API JsonReader
+    {
+    public:
+        /// Type of the next value.
+        enum ValueType
+        {
+            VT_Invalid = 0, ///< Syntax error or end of input.
+            VT_Object,
+            VT_Array,
+            VT_String,
+            VT_Number,
+            VT_Bool,
+            VT_Null
+        };
+
+        explicit JsonReader(const QByteArray &json);
+        JsonReader(const char *data, int size);
+
+        /// Returns the type of the next value without consuming it.
+        ValueType Peek();
+
+        /// Consumes the opening brace of an object.
+        bool EnterObject();
+
+        /// Advances to the next key of the current object, the value is read next.
+        /** @return False when the closing brace has been consumed or on error. */
+        bool NextKey();
+
+        /// Returns if the current key is @c key. Compares the raw key, keys with escapes never match.
+        bool KeyIs(const char *key) const;
+
+        /// Returns the current key.
+        QString Key() const;
+
+        /// Consumes the opening bracket of an array.
+        bool EnterArray();
+
+        /// Advances to the next element of the current array.
+        /** @return False when the closing bracket has been consumed or on error. */
+        bool NextElement();
+
+        /// Reads a string value.
+        bool ReadString(QString &value);
+
+        /// Reads a number value.
+        bool ReadNumber(double &value);
+
+        /// Reads a number value and truncates it to an int.
+        bool ReadInt(int &value);
+
+        /// Reads a true or false value.
+        bool ReadBool(bool &value);
+
+        /// Steps over the next value, including nested objects and arrays.
+        bool Skip();
+
+        /// Returns if there was a syntax error.
+        bool HasError() const;
+
+        /// Returns the current byte position.
+        int Position() const;
+
+        /// Moves to byte @c position and clears the error state, eg. to return to a value that was skipped earlier.
+        void Seek(int position);
+
+    private:
+        void SkipWhitespace();
+        bool Fail();
+
+        /// Scans the string at the current position, @c begin and @c end are the raw contents without quotes.
+        bool ScanString(int &begin, int &end, bool &escaped);
+
+        /// Scans the number at the current position.
+        bool ScanNumber(int &begin, int &end);
+
+        bool SkipValue(int depth);
+
+        const char *data_;
+        int size_;
+        int pos_;
+        bool error_;
+        int keyBegin_;
+        int keyEnd_;
+        bool keyEscaped_;
+    };
+}
@@ -0,0 +1,57 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "CloudRenderingMessageDispatcher.h"
+
+#include "CoreDefines.h"
+
+#include <string.h>
+
+namespace CloudRenderingProtocol
+{
+    MessageDispatcher::MessageDispatcher()
+    {
+        memset(handlers_, 0, sizeof(handlers_));
+    }
+
+    MessageDispatcher::~MessageDispatcher()
+    {
+        for (int i=0; i<cMaxMessageTypes; ++i)
+            SAFE_DELETE(handlers_[i]);
+    }
+
+    void MessageDispatcher::Set(MessageType type, IHandler *handler)
+    {
+        if (type <= MT_Invalid || static_cast<int>(type) >= cMaxMessageTypes)
+        {
+            delete handler;
+            return;
+        }
+        SAFE_DELETE(handlers_[type]);
+        handlers_[type] = handler;
+    }
+
+    bool MessageDispatcher::Handles(MessageType type) const
+    {
+        return (type > MT_Invalid && static_cast<int>(type) < cMaxMessageTypes && handlers_[type] != 0);
+    }
+
+    bool MessageDispatcher::Dispatch(IMessage *message) const
+    {
+        if (!message || !Handles(message->Type()))
+            return false;
+        handlers_[message->Type()]->Invoke(message);
+        return true;
+    }
+
+    bool MessageDispatcher::Dispatch(const MessageSharedPtr &message) const
+    {
+        return Dispatch(message.get());
+    }
+}
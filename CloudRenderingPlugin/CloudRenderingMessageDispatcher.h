@@ -0,0 +1,91 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+#include "CloudRenderingProtocol.h"
+
+namespace CloudRenderingProtocol
+{
+    /// Calls typed message handlers by message type.
+    /** Receivers subscribe a member function per message class, the handler receives the concrete message:
+
+        @code
+        dispatcher_.On<Signaling::OfferMessage>(this, &Renderer::HandleOffer);
+
+        void Renderer::HandleOffer(CloudRenderingProtocol::Signaling::OfferMessage *offer) { ... }
+        @endcode
+
+        The handler is found by indexing with IMessage::Type(), there is no lookup chain or RTTI cast.
+        The message must have been created as the class registered for its type, which is the case for
+        all messages from CreateMessage() and CreateMessageFromJSON(). One handler per message type,
+        subscribing again replaces the previous handler. */
+    class CLOUDRENDERING_API MessageDispatcher
+    {
+    public:
+        MessageDispatcher();
+        ~MessageDispatcher();
+
+        /// Subscribes @c handler of @c receiver to messages of class @c T.
+        template <typename T, typename Receiver>
+        void On(Receiver *receiver, void (Receiver::*handler)(T*))
+        {
+            Set(T::MessageTypeStatic(), (receiver && handler ? new MemberHandler<T, Receiver>(receiver, handler) : 0));
+        }
+
+        /// Unsubscribes the handler of messages of class @c T.
+        template <typename T>
+        void Off()
+        {
+            Set(T::MessageTypeStatic(), 0);
+        }
+
+        /// Returns if there is a handler for @c type.
+        bool Handles(MessageType type) const;
+
+        /// Calls the handler for the type of @c message.
+        /** @return True if a handler was called, false if there is none for the message type. */
+        bool Dispatch(IMessage *message) const;
+        bool Dispatch(const MessageSharedPtr &message) const;
+
+    private:
+        Q_DISABLE_COPY(MessageDispatcher)
+
+        /// @cond PRIVATE
+        struct IHandler
+        {
+            virtual ~IHandler() {}
+            virtual void Invoke(IMessage *message) = 0;
+        };
+
+        template <typename T, typename Receiver>
+        struct MemberHandler : public IHandler
+        {
+            typedef void (Receiver::*Method)(T*);
+
+            MemberHandler(Receiver *receiver_, Method method_) : receiver(receiver_), method(method_) {}
+
+            void Invoke(IMessage *message)
+            {
+                (receiver->*method)(static_cast<T*>(message));
+            }
+
+            Receiver *receiver;
+            Method method;
+        };
+        /// @endcond
+
+        void Set(MessageType type, IHandler *handler);
+
+        static const int cMaxMessageTypes = 64;
+        IHandler *handlers_[cMaxMessageTypes];
+    };
+}
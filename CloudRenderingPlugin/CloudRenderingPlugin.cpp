@@ -12,11 +12,17 @@
 
 #include "WebRTCRenderer.h"
 #include "WebRTCClient.h"
+#include "WebRTCBenchmark.h"
+#include "WebRTCConnectionFactory.h"
+#include "WebRTCLocalService.h"
+#include "WebRTCLoopback.h"
 
 #include "Framework.h"
 #include "CoreDefines.h"
 #include "CoreTypes.h"
 
+#include <QTimer>
+
 CloudRenderingPlugin::CloudRenderingPlugin() :
     IModule("CloudRendering"),
     LC("[CloudRendering]: ")
@@ -29,6 +35,45 @@ CloudRenderingPlugin::~CloudRenderingPlugin()
 
 void CloudRenderingPlugin::Initialize()
 {
+    // Benchmarks run alone so that the measurements are not disturbed.
+    if (framework_->HasCommandLineParameter("--cloudRenderingBenchmark"))
+    {
+        benchmark_ = WebRTCBenchmarkPtr(new WebRTC::Benchmark(this));
+        QTimer::singleShot(0, benchmark_.get(), SLOT(Run()));
+        return;
+    }
+
+    // Loopback benchmark runs a renderer and a client against the local service in this process.
+    bool loopback = framework_->HasCommandLineParameter("--cloudRenderingLoopback");
+
+    // Local stand-in for the Cloud Rendering Service, started before the renderer connects to it.
+    if (loopback || framework_->HasCommandLineParameter("--cloudRenderingLocalService"))
+    {
+        QStringList portParam = framework_->CommandLineParameters("--cloudRenderingLocalService");
+        u16 port = (!portParam.isEmpty() && portParam.first().toUShort() > 0 ? portParam.first().toUShort() : 9002);
+        WebRTC::LocalService::ScriptSettings script = WebRTC::LocalService::ScriptSettings::FromString(
+            framework_->CommandLineParameters("--cloudRenderingLocalServiceScript").value(0));
+
+        localService_ = WebRTCLocalServicePtr(new WebRTC::LocalService(port, script));
+        if (!localService_->Start())
+            localService_.reset();
+    }
+
+    if (loopback)
+    {
+        if (!localService_.get())
+        {
+            LogError(LC + "Local service failed to start, cannot run --cloudRenderingLoopback");
+            return;
+        }
+        double seconds = framework_->CommandLineParameters("--cloudRenderingLoopback").value(0).toDouble();
+        loopback_ = WebRTCLoopbackPtr(new WebRTC::Loopback(this, seconds));
+        renderer_ = WebRTCRendererPtr(new WebRTC::Renderer(this));
+        client_ = WebRTCClientPtr(new WebRTC::Client(this));
+        QTimer::singleShot(0, loopback_.get(), SLOT(Start()));
+        return;
+    }
+
     bool startRenderer = framework_->HasCommandLineParameter("--cloudRenderer");
     bool startClient = framework_->HasCommandLineParameter("--cloudRenderingClient");
     
@@ -46,8 +91,14 @@ void CloudRenderingPlugin::Initialize()
 
 void CloudRenderingPlugin::Uninitialize()
 {
+    loopback_.reset();
     renderer_.reset();
     client_.reset();
+    benchmark_.reset();
+    localService_.reset();
+    
+    // Released last, peers hold a reference to the factory.
+    connectionFactory_.reset();
 }
 
 WebRTCRendererPtr CloudRenderingPlugin::Renderer() const
@@ -70,6 +121,23 @@ bool CloudRenderingPlugin::IsClient() const
     return (client_.get() != 0);
 }
 
+WebRTCLocalServicePtr CloudRenderingPlugin::LocalService() const
+{
+    return localService_;
+}
+
+WebRTCLoopbackPtr CloudRenderingPlugin::Loopback() const
+{
+    return loopback_;
+}
+
+WebRTCConnectionFactoryPtr CloudRenderingPlugin::ConnectionFactory()
+{
+    if (!connectionFactory_.get())
+        connectionFactory_ = WebRTCConnectionFactoryPtr(new WebRTC::ConnectionFactory());
+    return connectionFactory_;
+}
+
 extern "C" DLLEXPORT void TundraPluginMain(Framework *fw)
 {
     Framework::SetInstance(fw); // Inside this DLL, remember the pointer to the global framework object.
@@ -35,9 +35,22 @@ public slots:
     bool IsRenderer() const;
     bool IsClient() const;
     
+    /// Returns the local signaling service started with --cloudRenderingLocalService, null if not running.
+    WebRTCLocalServicePtr LocalService() const;
+    
+    /// Returns the loopback benchmark started with --cloudRenderingLoopback, null if not running.
+    WebRTCLoopbackPtr Loopback() const;
+    
+    /// Returns the process wide PeerConnectionFactory, created on first call.
+    WebRTCConnectionFactoryPtr ConnectionFactory();
+    
 private:
     QString LC;
 
     WebRTCRendererPtr renderer_;
     WebRTCClientPtr client_;
+    WebRTCBenchmarkPtr benchmark_;
+    WebRTCLocalServicePtr localService_;
+    WebRTCLoopbackPtr loopback_;
+    WebRTCConnectionFactoryPtr connectionFactory_;
 };
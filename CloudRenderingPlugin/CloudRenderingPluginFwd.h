@@ -27,16 +27,34 @@ namespace WebRTC
     class Client;
 
     class PeerConnection;
+    class BroadcastSource;
+    class ConnectionFactory;
     class WebSocketClient;
     
     class TundraRenderer;
     class VideoRenderer;
+
+    class FrameBuffer;
+    class FrameBufferPool;
+    class WorkerPool;
+    class GLReadback;
+
+    class Benchmark;
+    class LocalService;
+    class Loopback;
 }
 
 typedef shared_ptr<WebRTC::Renderer> WebRTCRendererPtr;
 typedef shared_ptr<WebRTC::Client> WebRTCClientPtr;
 typedef shared_ptr<WebRTC::TundraRenderer> WebRTCTundraRendererPtr;
 typedef shared_ptr<WebRTC::WebSocketClient> WebRTCWebSocketClientPtr;
+typedef shared_ptr<WebRTC::FrameBuffer> WebRTCFrameBufferPtr;
+typedef shared_ptr<WebRTC::GLReadback> WebRTCGLReadbackPtr;
+typedef shared_ptr<WebRTC::Benchmark> WebRTCBenchmarkPtr;
+typedef shared_ptr<WebRTC::LocalService> WebRTCLocalServicePtr;
+typedef shared_ptr<WebRTC::Loopback> WebRTCLoopbackPtr;
 
 typedef shared_ptr<WebRTC::PeerConnection> WebRTCPeerConnectionPtr;
+typedef shared_ptr<WebRTC::BroadcastSource> WebRTCBroadcastSourcePtr;
+typedef shared_ptr<WebRTC::ConnectionFactory> WebRTCConnectionFactoryPtr;
 typedef QList<WebRTCPeerConnectionPtr> WebRTCPeerConnectionList;
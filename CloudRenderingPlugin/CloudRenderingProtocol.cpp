@@ -57,46 +57,163 @@ namespace CloudRenderingProtocol
         qDebug() << endl << qPrintable(TundraJson::Serialize(data, TundraJson::IndentFull)) << endl;
     }
 
-    // Message parser
+    // Message factory
 
-    MessageSharedPtr CreateMessageFromJSON(const QByteArray &json)
+    /// @cond PRIVATE
+
+    /// Upper bound for MessageType values.
+    static const int cMaxMessageTypes = 64;
+
+    /// Creators indexed by MessageType. Zero initialized before any registration runs.
+    static MessageCreator messageCreators[cMaxMessageTypes];
+
+    /// Registers the built in message classes when the plugin is loaded.
+    struct BuiltinMessageRegistrar
+    {
+        BuiltinMessageRegistrar()
+        {
+            // Signaling
+            RegisterMessageCreator<Signaling::OfferMessage>();
+            RegisterMessageCreator<Signaling::AnswerMessage>();
+            RegisterMessageCreator<Signaling::IceCandidatesMessage>();
+            // Room
+            RegisterMessageCreator<Room::RoomAssignedMessage>();
+            RegisterMessageCreator<Room::RoomUserJoinedMessage>();
+            RegisterMessageCreator<Room::RoomUserLeftMessage>();
+            // Application
+            RegisterMessageCreator<Application::RoomCustomMessage>();
+            RegisterMessageCreator<Application::PeerCustomMessage>();
+        }
+    };
+    static BuiltinMessageRegistrar builtinMessageRegistrar;
+
+    /// @endcond
+
+    void RegisterMessageCreator(MessageType type, MessageCreator creator)
+    {
+        if (type > MT_Invalid && static_cast<int>(type) < cMaxMessageTypes)
+            messageCreators[type] = creator;
+    }
+
+    MessageSharedPtr CreateMessage(MessageType type)
+    {
+        MessageCreator creator = (type > MT_Invalid && static_cast<int>(type) < cMaxMessageTypes ? messageCreators[type] : 0);
+        return (creator ? MessageSharedPtr(creator()) : MessageSharedPtr());
+    }
+
+    // Message envelope
+
+    /// @cond PRIVATE
+    static bool ParseEnvelope(const QByteArray &json, QString &channelTypeName, QString &messageTypeName, QVariantMap &data)
     {
         bool ok = false;
         QVariantMap in = TundraJson::Parse(json, &ok).toMap();
         if (!ok)
-            return MessageSharedPtr();
-        
-        // Read initial messageType information.
-        QString channelTypeName = TundraJson::ValueForAnyKey(in, QStringList() << "channel" << "Channel", "").toString().trimmed();
+            return false;
+
+        channelTypeName = TundraJson::ValueForAnyKey(in, QStringList() << "channel" << "Channel", "").toString().trimmed();
         QVariantMap msgData = TundraJson::ValueForAnyKey(in, QStringList() << "message" << "Message", QVariantMap()).toMap();
 
-        QString messageTypeName = TundraJson::ValueForAnyKey(msgData, QStringList() << "type" << "Type", "").toString().trimmed();
-        QVariantMap data = TundraJson::ValueForAnyKey(msgData, QStringList() << "data" << "Data", QVariantMap()).toMap();
+        messageTypeName = TundraJson::ValueForAnyKey(msgData, QStringList() << "type" << "Type", "").toString().trimmed();
+        data = TundraJson::ValueForAnyKey(msgData, QStringList() << "data" << "Data", QVariantMap()).toMap();
+        return true;
+    }
+    /// @endcond
+
+    QByteArray SerializeMessage(ChannelType channel, MessageType type, const QVariantMap &data, bool *ok)
+    {
+        QVariantMap msg;
+        msg["type"] = ToMessageTypeName(type);
+        msg["data"] = data;
+        
+        QVariantMap out;
+        out["channel"] = ToChannelTypeName(channel);
+        out["message"] = msg;
+
+        return TundraJson::Serialize(out, TundraJson::IndentNone, ok);
+    }
+
+    bool ParseMessage(const QByteArray &json, ChannelType &channel, MessageType &type, QVariantMap &data)
+    {
+        QString channelTypeName, messageTypeName;
+        if (!ParseEnvelope(json, channelTypeName, messageTypeName, data))
+            return false;
+        channel = ToChannelType(channelTypeName);
+        type = ToMessageType(messageTypeName);
+        return true;
+    }
+
+    bool ReadMessageEnvelope(JsonReader &reader, ChannelType &channel, MessageType &type, int &dataPosition)
+    {
+        channel = CT_Invalid;
+        type = MT_Invalid;
+        dataPosition = -1;
+        if (!reader.EnterObject())
+            return false;
+
+        QString name;
+        while (reader.NextKey())
+        {
+            if (reader.KeyIs("channel") || reader.KeyIs("Channel"))
+            {
+                if (!reader.ReadString(name))
+                    return false;
+                channel = ToChannelType(name.trimmed());
+            }
+            else if ((reader.KeyIs("message") || reader.KeyIs("Message")) && reader.EnterObject())
+            {
+                while (reader.NextKey())
+                {
+                    if (reader.KeyIs("type") || reader.KeyIs("Type"))
+                    {
+                        if (!reader.ReadString(name))
+                            return false;
+                        type = ToMessageType(name.trimmed());
+                    }
+                    else
+                    {
+                        // The data may come before the type, remember where it is.
+                        if ((reader.KeyIs("data") || reader.KeyIs("Data")) && reader.Peek() == JsonReader::VT_Object)
+                            dataPosition = reader.Position();
+                        if (!reader.Skip())
+                            return false;
+                    }
+                }
+            }
+            else if (!reader.Skip())
+                return false;
+        }
+        return !reader.HasError();
+    }
+
+    // Message parser
+
+    MessageSharedPtr CreateMessageFromJSON(const QByteArray &json)
+    {
+        // ICE candidates arrive in bursts, read them with the streaming fast path when possible.
+        {
+            JsonReader reader(json);
+            ChannelType channelType = CT_Invalid;
+            MessageType messageType = MT_Invalid;
+            int dataPosition = -1;
+            if (ReadMessageEnvelope(reader, channelType, messageType, dataPosition) && messageType == MT_IceCandidates && dataPosition >= 0)
+            {
+                Signaling::IceCandidatesValue value;
+                reader.Seek(dataPosition);
+                if (value.Deserialize(reader))
+                    return MessageSharedPtr(new Signaling::IceCandidatesMessage(value));
+            }
+        }
+
+        // Read initial messageType information.
+        QString channelTypeName, messageTypeName;
+        QVariantMap data;
+        if (!ParseEnvelope(json, channelTypeName, messageTypeName, data))
+            return MessageSharedPtr();
         MessageType messageType = ToMessageType(messageTypeName);           
         
         // Construct the correct message.
-        MessageSharedPtr message;
-
-        // Signaling
-        if (messageType == Signaling::OfferMessage::MessageTypeStatic())
-            message = MessageSharedPtr(new Signaling::OfferMessage());
-        else if (messageType == Signaling::AnswerMessage::MessageTypeStatic())
-            message = MessageSharedPtr(new Signaling::AnswerMessage());
-        else if (messageType == Signaling::IceCandidatesMessage::MessageTypeStatic())
-            message = MessageSharedPtr(new Signaling::IceCandidatesMessage());
-        // Room
-        else if (messageType == Room::RoomAssignedMessage::MessageTypeStatic())
-            message = MessageSharedPtr(new Room::RoomAssignedMessage());
-        else if (messageType == Room::RoomUserJoinedMessage::MessageTypeStatic())
-            message = MessageSharedPtr(new Room::RoomUserJoinedMessage());
-        else if (messageType == Room::RoomUserLeftMessage::MessageTypeStatic())
-            message = MessageSharedPtr(new Room::RoomUserLeftMessage());
-        // Application
-        else if (messageType == Application::RoomCustomMessage::MessageTypeStatic())
-            message = MessageSharedPtr(new Application::RoomCustomMessage());
-        else if (messageType == Application::PeerCustomMessage::MessageTypeStatic())
-            message = MessageSharedPtr(new Application::PeerCustomMessage());
-
+        MessageSharedPtr message = CreateMessage(messageType);
         if (message.get())
         {
             // If from data deserialization fails, return a null ptr.
@@ -165,23 +282,12 @@ namespace CloudRenderingProtocol
     
     bool IMessage::FromJSON(const QByteArray &json)
     {
-        bool ok = false;
-        QVariantMap in = TundraJson::Parse(json, &ok).toMap();
-        if (ok)
-        {
-            // Parse preliminary information.
-            QString channelTypeName = TundraJson::ValueForAnyKey(in, QStringList() << "channel" << "Channel", "").toString().trimmed();
-            channelType = ToChannelType(channelTypeName);
-            QVariantMap msgData = TundraJson::ValueForAnyKey(in, QStringList() << "message" << "Message", QVariantMap()).toMap();
-            
-            QString messageTypeName = TundraJson::ValueForAnyKey(msgData, QStringList() << "type" << "Type", "").toString().trimmed();
-            messageType = ToMessageType(messageTypeName);
-            data = TundraJson::ValueForAnyKey(msgData, QStringList() << "data" << "Data", QVariantMap()).toMap();
-
-            // Request the implementation to parse its contents from data.
-            if (IsValid())
-                ok = Deserialize();
-        }
+        // Parse preliminary information.
+        bool ok = ParseMessage(json, channelType, messageType, data);
+        
+        // Request the implementation to parse its contents from data.
+        if (ok && IsValid())
+            ok = Deserialize();
         return ok;
     }
     
@@ -205,15 +311,7 @@ namespace CloudRenderingProtocol
         // Request the implementation to update the data member.
         Serialize();
 
-        QVariantMap msg;
-        msg["type"] = MessageTypeName();
-        msg["data"] = data;
-        
-        QVariantMap out;
-        out["channel"] = ChannelTypeName();
-        out["message"] = msg;
-
-        return TundraJson::Serialize(out, TundraJson::IndentNone, ok);
+        return SerializeMessage(channelType, messageType, data, ok);
     }
 
     namespace Signaling
@@ -322,24 +420,22 @@ namespace CloudRenderingProtocol
             return ok;
         }
         
-        // IceCandidatesMessage
-        
-        IceCandidatesMessage::IceCandidatesMessage(const QString &receiverId_, WebRTC::ICECandidateList iceCandidates_) :
-            IMessage(ChannelTypeStatic(), MessageTypeStatic()),
+        // IceCandidatesValue
+
+        IceCandidatesValue::IceCandidatesValue(const QString &receiverId_, const WebRTC::ICECandidateList &iceCandidates_) :
             receiverId(receiverId_),
             iceCandidates(iceCandidates_)
         {
         }
-        
-        IceCandidatesMessage::IceCandidatesMessage(int receiverId_, WebRTC::ICECandidateList iceCandidates_) :
-            IMessage(ChannelTypeStatic(), MessageTypeStatic()),
-            iceCandidates(iceCandidates_)
+
+        void IceCandidatesValue::Swap(IceCandidatesValue &other)
         {
-            if (receiverId_ != -10000)
-                receiverId = QString::number(receiverId_);
+            qSwap(receiverId, other.receiverId);
+            qSwap(senderId, other.senderId);
+            qSwap(iceCandidates, other.iceCandidates);
         }
-        
-        void IceCandidatesMessage::Serialize()
+
+        void IceCandidatesValue::Serialize(QVariantMap &data) const
         {
             data["receiverId"] = receiverId;
             if (!senderId.isEmpty())
@@ -348,7 +444,71 @@ namespace CloudRenderingProtocol
             data["iceCandidates"] = WebRTC::VariantFromIceCandidates(iceCandidates);
         }
 
-        bool IceCandidatesMessage::Deserialize()
+        bool IceCandidatesValue::Deserialize(JsonReader &reader)
+        {
+            // Anything but strings for the ids and candidate objects with the expected
+            // value types is left for the generic path, which also logs the errors.
+            bool hasSender = false, hasReceiver = false;
+            QString sender, receiver;
+            WebRTC::ICECandidateList candidates;
+            if (!reader.EnterObject())
+                return false;
+            while (reader.NextKey())
+            {
+                if (reader.KeyIs("senderId"))
+                {
+                    if (!reader.ReadString(sender))
+                        return false;
+                    hasSender = true;
+                }
+                else if (reader.KeyIs("receiverId"))
+                {
+                    if (!reader.ReadString(receiver))
+                        return false;
+                    hasReceiver = true;
+                }
+                else if (reader.KeyIs("iceCandidates"))
+                {
+                    candidates.clear();
+                    if (!reader.EnterArray())
+                        return false;
+                    while (reader.NextElement())
+                    {
+                        WebRTC::ICECandidate candidate;
+                        if (!reader.EnterObject())
+                            return false;
+                        while (reader.NextKey())
+                        {
+                            bool ok = true;
+                            if (reader.KeyIs("sdpMLineIndex"))
+                                ok = reader.ReadInt(candidate.sdpMLineIndex);
+                            else if (reader.KeyIs("sdpMid"))
+                                ok = reader.ReadString(candidate.sdpMid);
+                            else if (reader.KeyIs("candidate"))
+                                ok = reader.ReadString(candidate.candidate);
+                            else
+                                ok = reader.Skip();
+                            if (!ok)
+                                return false;
+                        }
+                        if (!candidate.sdpMid.isEmpty() && !candidate.candidate.isEmpty())
+                            candidates << candidate;
+                    }
+                }
+                else if (!reader.Skip())
+                    return false;
+            }
+            if (reader.HasError() || !hasSender)
+                return false;
+
+            senderId = sender;
+            if (hasReceiver)
+                receiverId = receiver;
+            iceCandidates = candidates;
+            return (!iceCandidates.isEmpty());
+        }
+
+        bool IceCandidatesValue::Deserialize(const QVariantMap &data)
         {
             bool ok = data.contains("senderId");
             if (ok)
@@ -364,6 +524,53 @@ namespace CloudRenderingProtocol
             
             return (!iceCandidates.isEmpty());
         }
+
+        // IceCandidatesMessage
+        
+        IceCandidatesMessage::IceCandidatesMessage(const QString &receiverId_, WebRTC::ICECandidateList iceCandidates_) :
+            IMessage(ChannelTypeStatic(), MessageTypeStatic()),
+            receiverId(receiverId_),
+            iceCandidates(iceCandidates_)
+        {
+        }
+        
+        IceCandidatesMessage::IceCandidatesMessage(int receiverId_, WebRTC::ICECandidateList iceCandidates_) :
+            IMessage(ChannelTypeStatic(), MessageTypeStatic()),
+            iceCandidates(iceCandidates_)
+        {
+            if (receiverId_ != -10000)
+                receiverId = QString::number(receiverId_);
+        }
+        
+        IceCandidatesMessage::IceCandidatesMessage(const IceCandidatesValue &value) :
+            IMessage(ChannelTypeStatic(), MessageTypeStatic()),
+            receiverId(value.receiverId),
+            senderId(value.senderId),
+            iceCandidates(value.iceCandidates)
+        {
+        }
+
+        IceCandidatesValue IceCandidatesMessage::Value() const
+        {
+            IceCandidatesValue value(receiverId, iceCandidates);
+            value.senderId = senderId;
+            return value;
+        }
+        
+        void IceCandidatesMessage::Serialize()
+        {
+            Value().Serialize(data);
+        }
+
+        bool IceCandidatesMessage::Deserialize()
+        {
+            IceCandidatesValue value(receiverId);
+            bool ok = value.Deserialize(data);
+            receiverId = value.receiverId;
+            senderId = value.senderId;
+            iceCandidates = value.iceCandidates;
+            return ok;
+        }
     }
 
     namespace State
@@ -400,6 +607,8 @@ namespace CloudRenderingProtocol
             data["registrant"] = ToRegistrantTypeName(registrant);
             if (registrant == R_Client && !roomId.isEmpty())
                 data["roomId"] = roomId;
+            if (registrant == R_Renderer && !resumeToken.isEmpty())
+                data["resumeToken"] = resumeToken;
         }
 
         bool RegistrationMessage::Deserialize() 
@@ -412,6 +621,8 @@ namespace CloudRenderingProtocol
             }
             if (registrant == R_Client)
                 roomId = data.value("roomId", "").toString();
+            else
+                resumeToken = data.value("resumeToken", "").toString();
             return true;
         }
         
@@ -448,7 +659,8 @@ namespace CloudRenderingProtocol
         RoomAssignedMessage::RoomAssignedMessage(const QString &roomId_, RoomRequestError error_) :
             IMessage(ChannelTypeStatic(), MessageTypeStatic()),
             roomId(roomId_),
-            error(error_)
+            error(error_),
+            resumed(false)
         {
         }
 
@@ -460,6 +672,11 @@ namespace CloudRenderingProtocol
             {
                 data["roomId"] = roomId;
                 data["peerId"] = peerId;
+                if (!resumeToken.isEmpty())
+                {
+                    data["resumeToken"] = resumeToken;
+                    data["resumed"] = resumed;
+                }
             }
         }
 
@@ -481,6 +698,8 @@ namespace CloudRenderingProtocol
                     LogError("RoomAssignedMessage::Deserialize: Peer id is not set AND no error enum is set!");
                     return false;
                 }
+                resumeToken = data.value("resumeToken", "").toString();
+                resumed = data.value("resumed", false).toBool();
             }
             return true;
         }
@@ -526,23 +745,29 @@ namespace CloudRenderingProtocol
    
     namespace Application
     {
-        // RoomCustomMessage
+        // RoomCustomValue
 
-        RoomCustomMessage::RoomCustomMessage(const QVariantList &receivers_, const QVariantMap &payload_) :
-            IMessage(ChannelTypeStatic(), MessageTypeStatic()),
+        RoomCustomValue::RoomCustomValue(const QVariantList &receivers_, const QVariantMap &payload_) :
             receivers(receivers_),
             payload(payload_)
         {
         }
 
-        void RoomCustomMessage::Serialize()
+        void RoomCustomValue::Swap(RoomCustomValue &other)
+        {
+            qSwap(sender, other.sender);
+            qSwap(receivers, other.receivers);
+            qSwap(payload, other.payload);
+        }
+
+        void RoomCustomValue::Serialize(QVariantMap &data) const
         {
             // The service will inject "sender" property.
             data["receivers"] = receivers;
             data["payload"] = payload;
         }
 
-        bool RoomCustomMessage::Deserialize() 
+        bool RoomCustomValue::Deserialize(const QVariantMap &data)
         {
             sender = data.value("sender", QVariant());
             receivers = data.value("receivers", QVariantList()).toList();
@@ -550,6 +775,267 @@ namespace CloudRenderingProtocol
             return true;
         }
 
+        // RoomCustomMessage
+
+        RoomCustomMessage::RoomCustomMessage(const QVariantList &receivers_, const QVariantMap &payload_) :
+            IMessage(ChannelTypeStatic(), MessageTypeStatic()),
+            receivers(receivers_),
+            payload(payload_)
+        {
+        }
+
+        RoomCustomMessage::RoomCustomMessage(const RoomCustomValue &value) :
+            IMessage(ChannelTypeStatic(), MessageTypeStatic()),
+            sender(value.sender),
+            receivers(value.receivers),
+            payload(value.payload)
+        {
+        }
+
+        RoomCustomValue RoomCustomMessage::Value() const
+        {
+            RoomCustomValue value(receivers, payload);
+            value.sender = sender;
+            return value;
+        }
+
+        void RoomCustomMessage::Serialize()
+        {
+            Value().Serialize(data);
+        }
+
+        bool RoomCustomMessage::Deserialize() 
+        {
+            RoomCustomValue value;
+            bool ok = value.Deserialize(data);
+            sender = value.sender;
+            receivers = value.receivers;
+            payload = value.payload;
+            return ok;
+        }
+
+        // InputPayload
+
+        InputPayload::InputPayload() :
+            type(IPT_None),
+            action(IPA_None),
+            key(0),
+            altKey(false),
+            shiftKey(false),
+            ctrlKey(false),
+            metaKey(false),
+            hasPosition(false),
+            x(0.0f),
+            y(0.0f),
+            which(-1),
+            button(-1),
+            leftButton(false),
+            rightButton(false),
+            middleButton(false)
+        {
+        }
+
+        InputPayload::Action InputPayload::ActionFromName(const QString &name)
+        {
+            if (name.isEmpty())
+                return IPA_None;
+            else if (name == "keyDown")
+                return IPA_KeyDown;
+            else if (name == "keyUp")
+                return IPA_KeyUp;
+            else if (name == "move")
+                return IPA_Move;
+            else if (name == "press")
+                return IPA_Press;
+            else if (name == "doublepress")
+                return IPA_DoublePress;
+            return IPA_Release;
+        }
+
+        QVariantMap InputPayload::ToVariant() const
+        {
+            const char *actions[] = { "", "keyDown", "keyUp", "move", "press", "doublepress", "release" };
+            QVariantMap payload;
+            if (type == IPT_Keyboard)
+            {
+                payload["type"] = "InputKeyboard";
+                payload["key"] = key;
+                payload["altKey"] = altKey;
+                payload["shiftKey"] = shiftKey;
+                payload["ctrlKey"] = ctrlKey;
+                payload["metaKey"] = metaKey;
+            }
+            else if (type == IPT_Mouse)
+            {
+                payload["type"] = "InputMouse";
+                if (hasPosition)
+                {
+                    payload["x"] = static_cast<double>(x);
+                    payload["y"] = static_cast<double>(y);
+                }
+                if (which != -1)
+                    payload["which"] = which;
+                if (button != -1)
+                    payload["button"] = button;
+                payload["leftButton"] = leftButton;
+                payload["rightButton"] = rightButton;
+                payload["middleButton"] = middleButton;
+            }
+            else
+                return payload;
+            if (action != IPA_None)
+                payload["action"] = actions[action];
+            return payload;
+        }
+
+        InputPayload InputPayload::FromVariant(const QVariantMap &payload)
+        {
+            InputPayload input;
+            const QString typeName = payload.value("type", "").toString();
+            if (typeName == "InputMouse")
+                input.type = IPT_Mouse;
+            else if (typeName == "InputKeyboard")
+                input.type = IPT_Keyboard;
+            else
+                return input;
+
+            input.action = ActionFromName(payload.value("action", "").toString());
+            input.key = payload.value("key").toInt();
+            input.altKey = payload.value("altKey", false).toBool();
+            input.shiftKey = payload.value("shiftKey", false).toBool();
+            input.ctrlKey = payload.value("ctrlKey", false).toBool();
+            input.metaKey = payload.value("metaKey", false).toBool();
+
+            if (payload.contains("x") && payload.contains("y"))
+            {
+                bool okX = false, okY = false;
+                input.x = payload.value("x").toFloat(&okX);
+                input.y = payload.value("y").toFloat(&okY);
+                input.hasPosition = (okX && okY);
+            }
+            input.which = payload.value("which", -1).toInt();
+            input.button = payload.value("button", -1).toInt();
+            input.leftButton = payload.value("leftButton", false).toBool();
+            input.rightButton = payload.value("rightButton", false).toBool();
+            input.middleButton = payload.value("middleButton", false).toBool();
+            return input;
+        }
+
+        bool InputPayload::Deserialize(JsonReader &reader)
+        {
+            // Only the value types the web client sends are read here,
+            // anything else is left for FromVariant() and its QVariant conversions.
+            *this = InputPayload();
+            bool hasX = false, hasY = false;
+            QString name;
+            if (!reader.EnterObject())
+                return false;
+            while (reader.NextKey())
+            {
+                bool ok = true;
+                double number = 0.0;
+                if (reader.KeyIs("type"))
+                {
+                    ok = reader.ReadString(name);
+                    if (ok && name == "InputMouse")
+                        type = IPT_Mouse;
+                    else if (ok && name == "InputKeyboard")
+                        type = IPT_Keyboard;
+                    else
+                        return false;
+                }
+                else if (reader.KeyIs("action"))
+                {
+                    ok = reader.ReadString(name);
+                    action = ActionFromName(name);
+                }
+                else if (reader.KeyIs("x"))
+                {
+                    ok = hasX = reader.ReadNumber(number);
+                    x = static_cast<float>(number);
+                }
+                else if (reader.KeyIs("y"))
+                {
+                    ok = hasY = reader.ReadNumber(number);
+                    y = static_cast<float>(number);
+                }
+                else if (reader.KeyIs("key"))
+                    ok = reader.ReadInt(key);
+                else if (reader.KeyIs("which"))
+                    ok = reader.ReadInt(which);
+                else if (reader.KeyIs("button"))
+                    ok = reader.ReadInt(button);
+                else if (reader.KeyIs("leftButton"))
+                    ok = reader.ReadBool(leftButton);
+                else if (reader.KeyIs("rightButton"))
+                    ok = reader.ReadBool(rightButton);
+                else if (reader.KeyIs("middleButton"))
+                    ok = reader.ReadBool(middleButton);
+                else if (reader.KeyIs("altKey"))
+                    ok = reader.ReadBool(altKey);
+                else if (reader.KeyIs("shiftKey"))
+                    ok = reader.ReadBool(shiftKey);
+                else if (reader.KeyIs("ctrlKey"))
+                    ok = reader.ReadBool(ctrlKey);
+                else if (reader.KeyIs("metaKey"))
+                    ok = reader.ReadBool(metaKey);
+                else
+                    ok = reader.Skip();
+                if (!ok)
+                    return false;
+            }
+            hasPosition = (hasX && hasY);
+            return (!reader.HasError() && type != IPT_None);
+        }
+
+        // PeerCustomValue
+
+        PeerCustomValue::PeerCustomValue(const QVariantMap &payload_) :
+            payload(payload_),
+            input(InputPayload::FromVariant(payload_))
+        {
+        }
+
+        void PeerCustomValue::Swap(PeerCustomValue &other)
+        {
+            qSwap(payload, other.payload);
+            qSwap(input, other.input);
+        }
+
+        void PeerCustomValue::Serialize(QVariantMap &data) const
+        {
+            data["payload"] = (payload.isEmpty() && input.IsValid() ? input.ToVariant() : payload);
+        }
+
+        bool PeerCustomValue::Deserialize(const QVariantMap &data)
+        {
+            payload = data.value("payload", QVariantMap()).toMap();
+            input = InputPayload::FromVariant(payload);
+            return true;
+        }
+
+        bool PeerCustomValue::Deserialize(JsonReader &reader)
+        {
+            if (!reader.EnterObject())
+                return false;
+            bool hasInput = false;
+            while (reader.NextKey())
+            {
+                if (reader.KeyIs("payload"))
+                {
+                    if (!input.Deserialize(reader))
+                        return false;
+                    hasInput = true;
+                }
+                else if (!reader.Skip())
+                    return false;
+            }
+            if (reader.HasError() || !hasInput)
+                return false;
+            payload.clear();
+            return true;
+        }
+
         // PeerCustomMessage
 
         PeerCustomMessage::PeerCustomMessage(const QVariantMap &payload_) :
@@ -558,15 +1044,28 @@ namespace CloudRenderingProtocol
         {
         }
 
+        PeerCustomMessage::PeerCustomMessage(const PeerCustomValue &value) :
+            IMessage(ChannelTypeStatic(), MessageTypeStatic()),
+            payload(value.payload.isEmpty() && value.input.IsValid() ? value.input.ToVariant() : value.payload)
+        {
+        }
+
+        PeerCustomValue PeerCustomMessage::Value() const
+        {
+            return PeerCustomValue(payload);
+        }
+
         void PeerCustomMessage::Serialize()
         {
-            data["payload"] = payload;
+            Value().Serialize(data);
         }
 
         bool PeerCustomMessage::Deserialize()
         {
-            payload = data.value("payload", QVariantMap()).toMap();
-            return true;
+            PeerCustomValue value;
+            bool ok = value.Deserialize(data);
+            payload = value.payload;
+            return ok;
         }
     }
 }
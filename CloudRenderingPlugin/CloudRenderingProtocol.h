@@ -12,6 +12,7 @@
 #include "CloudRenderingPluginApi.h"
 #include "CloudRenderingPluginFwd.h"
 #include "CloudRenderingDefines.h"
+#include "CloudRenderingJsonReader.h"
 
 #include "CoreTypes.h"
 
@@ -315,6 +316,247 @@ namespace CloudRenderingProtocol
     /// Binary message.
     typedef QByteArray BinaryMessageData;
 
+    /// Serializes message @c data into the JSON envelope documented in IMessage.
+    /** @param ok If given, set to true if serialization succeeded. */
+    QByteArray SerializeMessage(ChannelType channel, MessageType type, const QVariantMap &data, bool *ok = 0);
+
+    /// Parses the JSON envelope documented in IMessage.
+    /** @return True if @c json parsed, @c type is MT_Invalid if the message type is not known. */
+    bool ParseMessage(const QByteArray &json, ChannelType &channel, MessageType &type, QVariantMap &data);
+
+    /// Reads the JSON envelope documented in IMessage with the streaming fast path.
+    /** Only the channel and message type are read, the message data is skipped. Seek @c reader to
+        @c dataPosition to read the data object with the Deserialize(JsonReader&) of a value message.
+        @param dataPosition Set to the position of the data object, -1 if there is none.
+        @return True if @c reader had a well formed envelope, @c type is MT_Invalid if the message type is not known. */
+    bool ReadMessageEnvelope(JsonReader &reader, ChannelType &channel, MessageType &type, int &dataPosition);
+
+    // Value messages
+    //
+    // Plain value counterparts of the messages that are sent and received at a high rate.
+    // They are not QObjects: they live on the stack or by value inside containers and queued
+    // signals, there is no heap allocated message object, shared ptr or deleteLater() per message.
+    // The members are Qt implicitly shared types, so copying a value only bumps reference counts,
+    // and Swap() hands the content over without copying, the C++03 equivalent of a move.
+    // The JSON format is the same as with the IMessage class of the same type. The IMessage
+    // classes remain for the script exposed API and the less frequent message types.
+
+    namespace Signaling
+    {
+        /// Value counterpart of IceCandidatesMessage.
+        struct CLOUDRENDERING_API IceCandidatesValue
+        {
+            IceCandidatesValue(const QString &receiverId_ = "", const WebRTC::ICECandidateList &iceCandidates_ = WebRTC::ICECandidateList());
+
+            /// Receivers peer ID.
+            QString receiverId;
+
+            /// Senders peer ID.
+            QString senderId;
+
+            /// ICE candidates.
+            WebRTC::ICECandidateList iceCandidates;
+
+            /// Swaps the content with @c other.
+            void Swap(IceCandidatesValue &other);
+
+            /// Writes the message properties to @c data.
+            void Serialize(QVariantMap &data) const;
+
+            /// Reads the message properties from @c data.
+            /** @return True if @c data has a sender and at least one candidate. */
+            bool Deserialize(const QVariantMap &data);
+
+            /// Reads the message properties from the data object at the position of @c reader.
+            /** @return False if the data is not in the form the web client sends, use the QVariantMap overload then. */
+            bool Deserialize(JsonReader &reader);
+
+            /// Channel type.
+            static ChannelType ChannelTypeStatic() { return CT_Signaling; }
+
+            /// Message type.
+            static MessageType MessageTypeStatic() { return MT_IceCandidates; }
+        };
+    }
+
+    namespace Application
+    {
+        /// Typed "InputMouse" and "InputKeyboard" PeerCustomMessage payload.
+        /** The web client sends input as PeerCustomMessages with these payloads:
+
+            @code
+            { "type" : "InputMouse", "action" : "move" | "press" | "doublepress" | "release",
+              "x" : <0.0-1.0>, "y" : <0.0-1.0>, "which" : <DOM MouseEvent.which>, "button" : <DOM MouseEvent.button>,
+              "leftButton" : <bool>, "rightButton" : <bool>, "middleButton" : <bool> }
+
+            { "type" : "InputKeyboard", "action" : "keyDown" | "keyUp", "key" : <HTML keyCode>,
+              "altKey" : <bool>, "shiftKey" : <bool>, "ctrlKey" : <bool>, "metaKey" : <bool> }
+            @endcode */
+        struct CLOUDRENDERING_API InputPayload
+        {
+            enum Type
+            {
+                IPT_None = 0,   ///< Not an input payload.
+                IPT_Mouse,
+                IPT_Keyboard
+            };
+
+            /// Payload action. Keyboard actions other than "keyDown" release the key, mouse actions
+            /// other than "move", "press" and "doublepress" release the button.
+            enum Action
+            {
+                IPA_None = 0,   ///< Missing or empty action.
+                IPA_KeyDown,
+                IPA_KeyUp,
+                IPA_Move,
+                IPA_Press,
+                IPA_DoublePress,
+                IPA_Release
+            };
+
+            InputPayload();
+
+            Type type;
+            Action action;
+
+            /// HTML keyCode of keyboard events.
+            int key;
+            bool altKey;
+            bool shiftKey;
+            bool ctrlKey;
+            bool metaKey;
+
+            /// Mouse position in [0.0, 1.0] range, valid if @c hasPosition is true.
+            bool hasPosition;
+            float x;
+            float y;
+
+            /// DOM MouseEvent.which and MouseEvent.button, -1 if not set.
+            int which;
+            int button;
+            bool leftButton;
+            bool rightButton;
+            bool middleButton;
+
+            /// Returns if this is an input payload.
+            bool IsValid() const { return type != IPT_None; }
+
+            /// Returns if this is a mouse move.
+            bool IsMove() const { return type == IPT_Mouse && action == IPA_Move; }
+
+            /// Returns the payload as a variant map.
+            QVariantMap ToVariant() const;
+
+            /// Reads the payload from a variant map, the type is IPT_None if @c payload is not input.
+            static InputPayload FromVariant(const QVariantMap &payload);
+
+            /// Reads the payload object at the position of @c reader.
+            /** @return False if the payload is not input or has values of unexpected types, read it with FromVariant() then. */
+            bool Deserialize(JsonReader &reader);
+
+            /// Returns the action for an action name.
+            static Action ActionFromName(const QString &name);
+        };
+
+        /// Value counterpart of RoomCustomMessage.
+        struct CLOUDRENDERING_API RoomCustomValue
+        {
+            RoomCustomValue(const QVariantList &receivers_ = QVariantList(), const QVariantMap &payload_ = QVariantMap());
+
+            /// Sender of the message, injected by the service.
+            QVariant sender;
+
+            /// Receiving peer id:s, empty sends to everyone in the room.
+            QVariantList receivers;
+
+            /// Message payload.
+            QVariantMap payload;
+
+            /// Swaps the content with @c other.
+            void Swap(RoomCustomValue &other);
+
+            /// Writes the message properties to @c data.
+            void Serialize(QVariantMap &data) const;
+
+            /// Reads the message properties from @c data.
+            bool Deserialize(const QVariantMap &data);
+
+            /// Channel type.
+            static ChannelType ChannelTypeStatic() { return CT_Application; }
+
+            /// Message type.
+            static MessageType MessageTypeStatic() { return MT_RoomCustomMessage; }
+        };
+
+        /// Value counterpart of PeerCustomMessage, eg. the input events from the data channel.
+        /** Input payloads are in @c input. When read with the fast path @c payload is left empty for them. */
+        struct CLOUDRENDERING_API PeerCustomValue
+        {
+            PeerCustomValue(const QVariantMap &payload_ = QVariantMap());
+
+            /// Message payload.
+            QVariantMap payload;
+
+            /// Typed input payload, IPT_None if the payload is not input.
+            InputPayload input;
+
+            /// Swaps the content with @c other.
+            void Swap(PeerCustomValue &other);
+
+            /// Writes the message properties to @c data.
+            void Serialize(QVariantMap &data) const;
+
+            /// Reads the message properties from @c data.
+            bool Deserialize(const QVariantMap &data);
+
+            /// Reads an input payload from the data object at the position of @c reader.
+            /** @return False if the payload is not input, use the QVariantMap overload then. */
+            bool Deserialize(JsonReader &reader);
+
+            /// Channel type.
+            static ChannelType ChannelTypeStatic() { return CT_Application; }
+
+            /// Message type.
+            static MessageType MessageTypeStatic() { return MT_PeerCustomMessage; }
+        };
+    }
+
+    /// Serializes a value message to JSON.
+    template <typename T>
+    QByteArray ToJSON(const T &value, bool *ok = 0)
+    {
+        QVariantMap data;
+        value.Serialize(data);
+        return SerializeMessage(T::ChannelTypeStatic(), T::MessageTypeStatic(), data, ok);
+    }
+
+    /// Parses a value message from JSON.
+    /** @return True if @c json is a message of type @c T and it deserialized to @c value. */
+    template <typename T>
+    bool FromJSON(const QByteArray &json, T &value)
+    {
+        ChannelType channel = CT_Invalid;
+        MessageType type = MT_Invalid;
+        QVariantMap data;
+        return (ParseMessage(json, channel, type, data) && type == T::MessageTypeStatic() && value.Deserialize(data));
+    }
+
+    /// Parses a value message from JSON with the streaming fast path, without building a QVariantMap tree.
+    /** Implemented for IceCandidatesValue and for the input payloads of PeerCustomValue.
+        @return True if @c json is a message of type @c T and the fast path could read it. If false, use FromJSON(). */
+    template <typename T>
+    bool FromJSONFast(const QByteArray &json, T &value)
+    {
+        JsonReader reader(json);
+        ChannelType channel = CT_Invalid;
+        MessageType type = MT_Invalid;
+        int dataPosition = -1;
+        if (!ReadMessageEnvelope(reader, channel, type, dataPosition) || type != T::MessageTypeStatic() || dataPosition < 0)
+            return false;
+        reader.Seek(dataPosition);
+        return value.Deserialize(reader);
+    }
+
     /// Register script types.
     inline static void RegisterMetaTypes()
     {
@@ -324,12 +566,43 @@ namespace CloudRenderingProtocol
         qRegisterMetaType<CloudRenderingProtocol::MessageSharedPtr>("CloudRenderingProtocol::MessageSharedPtr");
         qRegisterMetaType<CloudRenderingProtocol::MessageSharedPtrList>("CloudRenderingProtocol::MessageSharedPtrList");
         qRegisterMetaType<CloudRenderingProtocol::BinaryMessageData>("CloudRenderingProtocol::BinaryMessageData");
+        qRegisterMetaType<CloudRenderingProtocol::Signaling::IceCandidatesValue>("CloudRenderingProtocol::Signaling::IceCandidatesValue");
+        qRegisterMetaType<CloudRenderingProtocol::Application::RoomCustomValue>("CloudRenderingProtocol::Application::RoomCustomValue");
+        qRegisterMetaType<CloudRenderingProtocol::Application::PeerCustomValue>("CloudRenderingProtocol::Application::PeerCustomValue");
     }
 
     /// Parses a message from input JSON data.
-    /** @param json JSON data.
+    /** The message class is created with CreateMessage() for the message type.
+        IceCandidatesMessages are read with the streaming fast path, IMessage::data is left empty for them.
+        @param json JSON data.
         @return Created message, null if parsing from @c json failed. */
     MessageSharedPtr CreateMessageFromJSON(const QByteArray &json);
+
+    /// Function that creates a new default constructed message.
+    typedef IMessage *(*MessageCreator)();
+
+    /// Registers @c creator for messages of @c type, replacing a previous registration.
+    /** The built in message classes are registered when the plugin is loaded. Register custom
+        message classes before messages of their type are parsed. */
+    void RegisterMessageCreator(MessageType type, MessageCreator creator);
+
+    /// Returns a new default constructed message of @c type, null if no class is registered for @c type.
+    MessageSharedPtr CreateMessage(MessageType type);
+
+    /// @cond PRIVATE
+    template <typename T>
+    IMessage *NewMessage()
+    {
+        return new T();
+    }
+    /// @endcond
+
+    /// Registers message class @c T for T::MessageTypeStatic().
+    template <typename T>
+    void RegisterMessageCreator()
+    {
+        RegisterMessageCreator(T::MessageTypeStatic(), &NewMessage<T>);
+    }
     
     /// Dump json with pretty indentation to stdout.
     void DumpPrettyJSON(const QByteArray &json);
@@ -608,6 +881,7 @@ namespace CloudRenderingProtocol
         public:
             IceCandidatesMessage(const QString &receiverId_ = "", WebRTC::ICECandidateList iceCandidates_ = WebRTC::ICECandidateList());
             IceCandidatesMessage(int receiverId_, WebRTC::ICECandidateList iceCandidates_ = WebRTC::ICECandidateList());
+            explicit IceCandidatesMessage(const IceCandidatesValue &value);
 
             /// Receivers peer ID.
             QString receiverId;
@@ -618,6 +892,9 @@ namespace CloudRenderingProtocol
             /// ICE candidates.
             WebRTC::ICECandidateList iceCandidates;
 
+            /// Returns the message as a value.
+            IceCandidatesValue Value() const;
+
             /// Channel type.
             static ChannelType ChannelTypeStatic() { return CT_Signaling; }
 
@@ -663,6 +940,10 @@ namespace CloudRenderingProtocol
             The "createPrivateRoom" boolean property is defaulted to false if not defined. The
             renderer MUST set this property to true if it wants a private room assignment after the
             registration.
+
+            A renderer that lost its service connection sets "resumeToken" to the token it got in its
+            last RoomAssignedMessage. If the service still holds the room for the token, the renderer is
+            assigned back to the same room and the clients in it stay connected to the renderer.
             
             <b>Client Registration</b>
             
@@ -704,6 +985,7 @@ namespace CloudRenderingProtocol
                     {
                         "registrant"        : "renderer",
                         "createPrivateRoom" : <boolean>,
+                        "resumeToken"       : <optional-token-from-last-room-assignment-as-string>,
 
                         // The remaining structure of the data is decided by the Cloud Rendering GE
                         // implementation. For example auth tokens to authenticate the registrant.
@@ -740,6 +1022,11 @@ namespace CloudRenderingProtocol
                 to join a existing room instead of creating a new room. */
             QString roomId;
 
+            /// Resume token from the last RoomAssignedMessage.
+            /** @note This property is only relevant for renderer registrations
+                to re-claim the room after a reconnect. */
+            QString resumeToken;
+
             /// Returns a valid registrant type name "renderer" or "client" for @c reg.
             QString ToRegistrantTypeName(Registrant reg);
 
@@ -837,6 +1124,10 @@ namespace CloudRenderingProtocol
             This message is followed by a RoomUserJoined message that will have
             the full list of peer id:s currently in the channel. This set will also
             includes your own peer id that has been sent to you in this message.
+
+            A renderer MAY be given a "resumeToken". The renderer sends it back in its
+            RegistrationMessage after a reconnect to be assigned to the same room, "resumed"
+            is then true. The clients of a resumed room are not notified of the reconnect.
             
             @code
             {
@@ -849,7 +1140,11 @@ namespace CloudRenderingProtocol
                         "error"  : <error-as-number>,
                         
                         "roomId" : <room-id-as-string>,
-                        "peerId" : <your-peer-id-in-the-room-as-number>
+                        "peerId" : <your-peer-id-in-the-room-as-number>,
+
+                        // Renderer only
+                        "resumeToken" : <optional-token-as-string>,
+                        "resumed"     : <optional-boolean>
                     }
                 }
             }
@@ -885,6 +1180,12 @@ namespace CloudRenderingProtocol
             /// Request error.
             RoomRequestError error;
 
+            /// Token the renderer can use to re-claim this room after a reconnect, empty if not given.
+            QString resumeToken;
+
+            /// If the renderer was assigned back to the room of its resume token.
+            bool resumed;
+
             /// Channel type.
             static ChannelType ChannelTypeStatic() { return CT_Room; }
 
@@ -1123,6 +1424,7 @@ namespace CloudRenderingProtocol
 
         public:
             RoomCustomMessage(const QVariantList &receivers_ = QVariantList(), const QVariantMap &payload_ = QVariantMap());
+            explicit RoomCustomMessage(const RoomCustomValue &value);
             
             /// Sender of the message.
             /** Either a valid peer id as a number or a special string identifier "renderer" or "service". */
@@ -1137,6 +1439,9 @@ namespace CloudRenderingProtocol
 
             /// Message payload.
             QVariantMap payload;
+
+            /// Returns the message as a value.
+            RoomCustomValue Value() const;
             
             /// Channel type.
             static ChannelType ChannelTypeStatic() { return CT_Application; }
@@ -1187,10 +1492,14 @@ namespace CloudRenderingProtocol
 
         public:
             PeerCustomMessage(const QVariantMap &payload_ = QVariantMap());
+            explicit PeerCustomMessage(const PeerCustomValue &value);
 
             /// Message payload.
             QVariantMap payload;
 
+            /// Returns the message as a value.
+            PeerCustomValue Value() const;
+
             /// Channel type.
             static ChannelType ChannelTypeStatic() { return CT_Application; }
 
@@ -0,0 +1,2164 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#ifdef _WIN32
+#include "Win.h"
+#else
+#include <sys/resource.h>
+#endif
+
+#include "WebRTCBenchmark.h"
+#include "WebRTCFrameBuffer.h"
+#include "WebRTCColorConversion.h"
+#include "WebRTCWorkerPool.h"
+#include "WebRTCTundraCapturer.h"
+#include "WebRTCConnectionFactory.h"
+#include "WebRTCMediaConstraints.h"
+#include "WebRTCUtils.h"
+#include "WebRTCInputInjector.h"
+#include "WebRTCWebSocketClient.h"
+#include "WebRTCLocalService.h"
+#include "WebRTCRenderer.h"
+#include "WebRTCClient.h"
+#include "CloudRenderingPlugin.h"
+#include "CloudRenderingProtocol.h"
+#include "CloudRenderingMessageDispatcher.h"
+#include "CloudRenderingBinaryInput.h"
+
+#include "Framework.h"
+#include "WebRTCClock.h"
+#include "CoreJsonUtils.h"
+#include "LoggingFunctions.h"
+
+#include <QApplication>
+#include <QEventLoop>
+#include <QFile>
+#include <QGraphicsScene>
+#include <QGraphicsView>
+#include <QImage>
+#include <QKeyEvent>
+#include <QPair>
+#include <QThread>
+#include <QTimer>
+#include <QScopedPointer>
+
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef __GLIBC__
+#if !__GLIBC_PREREQ(2, 34)
+#include <malloc.h>
+/// The glibc allocation functions the counting malloc hooks forward to.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+#define WEBRTC_COUNT_ALLOCATIONS
+#endif
+#endif
+
+#include "talk/media/base/videocommon.h"
+
+namespace WebRTC
+{
+    /// @cond PRIVATE
+
+    /// Minimum time and iteration count for a single measurement.
+    static const double cMinMeasureSeconds = 0.5;
+    static const int cMinMeasureIterations = 10;
+    static const int cMaxMeasureIterations = 5000;
+
+    /// Runs @c func until enough samples have been gathered, returns timing results.
+    template <typename Func>
+    static QVariantMap Measure(Func &func, double pixelsPerIteration)
+    {
+        // Warm up caches and the frame pool.
+        func();
+
+        int iterations = 0;
+        double elapsed = 0.0;
+        tick_t start = GetCurrentClockTime();
+        while(iterations < cMaxMeasureIterations && (iterations < cMinMeasureIterations || elapsed < cMinMeasureSeconds))
+        {
+            func();
+            ++iterations;
+            elapsed = SecondsSince(start);
+        }
+
+        const double secondsPerIteration = elapsed / static_cast<double>(iterations);
+        QVariantMap result;
+        result["iterations"] = iterations;
+        result["msPerFrame"] = secondsPerIteration * 1000.0;
+        result["fps"] = (secondsPerIteration > 0.0 ? 1.0 / secondsPerIteration : 0.0);
+        result["megapixelsPerSecond"] = (secondsPerIteration > 0.0 ? pixelsPerIteration / secondsPerIteration / 1000000.0 : 0.0);
+        return result;
+    }
+
+    struct ConversionRun
+    {
+        ConversionRun(FrameBufferPool *pool_, const WebRTCFrameBufferPtr &source_, u32 fourcc_, ColorConversion::Implementation impl_) :
+            pool(pool_), source(source_), fourcc(fourcc_), impl(impl_)
+        {
+        }
+
+        void operator()()
+        {
+            result = ColorConversion::ConvertFrame(pool, source, fourcc, impl);
+        }
+
+        FrameBufferPool *pool;
+        WebRTCFrameBufferPtr source;
+        WebRTCFrameBufferPtr result;
+        u32 fourcc;
+        ColorConversion::Implementation impl;
+    };
+
+    struct ScaleRun
+    {
+        ScaleRun(FrameBufferPool *pool_, const WebRTCFrameBufferPtr &source_, int width_, int height_, WorkerPool *workers_) :
+            pool(pool_), source(source_), width(width_), height(height_), workers(workers_)
+        {
+        }
+
+        void operator()()
+        {
+            result = ColorConversion::ScaleFrame(pool, source, width, height, workers);
+        }
+
+        FrameBufferPool *pool;
+        WebRTCFrameBufferPtr source;
+        WebRTCFrameBufferPtr result;
+        int width;
+        int height;
+        WorkerPool *workers;
+    };
+
+    struct ParallelConversionRun
+    {
+        ParallelConversionRun(FrameBufferPool *pool_, const WebRTCFrameBufferPtr &source_, WorkerPool *workers_) :
+            pool(pool_), source(source_), workers(workers_)
+        {
+        }
+
+        void operator()()
+        {
+            result = ColorConversion::ConvertFrame(pool, source, cricket::FOURCC_I420, ColorConversion::CCI_Auto, workers);
+        }
+
+        FrameBufferPool *pool;
+        WebRTCFrameBufferPtr source;
+        WebRTCFrameBufferPtr result;
+        WorkerPool *workers;
+    };
+
+    /// Returns the user and kernel CPU time consumed by all threads of the process.
+    static double ProcessCpuSeconds()
+    {
+#ifdef _WIN32
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+            return 0.0;
+        const u64 kernel = (static_cast<u64>(kernelTime.dwHighDateTime) << 32) | kernelTime.dwLowDateTime;
+        const u64 user = (static_cast<u64>(userTime.dwHighDateTime) << 32) | userTime.dwLowDateTime;
+        return static_cast<double>(kernel + user) / 10000000.0; // 100 ns units
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0.0;
+        return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+            static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+#endif
+    }
+
+#ifdef WEBRTC_COUNT_ALLOCATIONS
+    /// Thread whose allocations the malloc hooks count, null while not counting.
+    static Qt::HANDLE allocationThread = 0;
+    static int allocationCount = 0;
+
+    static void *CountingMalloc(size_t size, const void * /*caller*/)
+    {
+        if (QThread::currentThreadId() == allocationThread)
+            allocationCount++;
+        return __libc_malloc(size);
+    }
+
+    static void *CountingRealloc(void *ptr, size_t size, const void * /*caller*/)
+    {
+        if (QThread::currentThreadId() == allocationThread)
+            allocationCount++;
+        return __libc_realloc(ptr, size);
+    }
+#endif
+
+    /// Returns the heap allocations one call of @c func makes on the calling thread, -1 if they can not be counted on this platform.
+    /** Counts the malloc, calloc and realloc calls with the glibc malloc hooks, which covers operator new and the Qt containers too.
+        The hooks are only installed for this one call so they do not show up in the Measure() timings. */
+    template <typename Func>
+    static int CountAllocations(Func &func)
+    {
+#ifdef WEBRTC_COUNT_ALLOCATIONS
+        void *(*previousMalloc)(size_t, const void*) = __malloc_hook;
+        void *(*previousRealloc)(void*, size_t, const void*) = __realloc_hook;
+        allocationCount = 0;
+        allocationThread = QThread::currentThreadId();
+        __malloc_hook = CountingMalloc;
+        __realloc_hook = CountingRealloc;
+        func();
+        __malloc_hook = previousMalloc;
+        __realloc_hook = previousRealloc;
+        allocationThread = 0;
+        return allocationCount;
+#else
+        Q_UNUSED(func);
+        return -1;
+#endif
+    }
+
+    /// Returns the voluntary and involuntary context switches of the process so far, -1 if they are not available on this platform.
+    static long ProcessContextSwitches()
+    {
+#ifdef _WIN32
+        return -1;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return -1;
+        return usage.ru_nvcsw + usage.ru_nivcsw;
+#endif
+    }
+
+    /// Runs the event loop for @c msec milliseconds.
+    static void RunEventLoop(int msec)
+    {
+        QEventLoop loop;
+        QTimer::singleShot(msec, &loop, SLOT(quit()));
+        loop.exec();
+    }
+
+    /// Stands in for the video track of a peer, counts the frames it receives.
+    struct FrameCountSink : public sigslot::has_slots<>
+    {
+        FrameCountSink() : frames(0), checksum(0) {}
+
+        void OnFrameCaptured(cricket::VideoCapturer* /*capturer*/, const cricket::CapturedFrame *frame)
+        {
+            frames++;
+            if (frame->data && frame->data_size > 0)
+                checksum += static_cast<const uchar*>(frame->data)[frame->data_size / 2];
+        }
+
+        int frames;
+        u32 checksum;
+    };
+
+    /// Delivers a frame to every capturer, same as TundraRenderer does for its consumers.
+    struct BroadcastRun
+    {
+        BroadcastRun(const QList<TundraCapturer*> &capturers_, const WebRTCFrameBufferPtr &source_) :
+            capturers(capturers_), source(source_)
+        {
+        }
+
+        void operator()()
+        {
+            foreach(TundraCapturer *capturer, capturers)
+                capturer->OnTundraFrame(source);
+        }
+
+        QList<TundraCapturer*> capturers;
+        WebRTCFrameBufferPtr source;
+    };
+
+    /// Feeds synthetic frames to a capturer the way TundraRenderer does: the image is copied
+    /// to a pooled buffer, which stands in for the readback, and handed to the capturer.
+    struct CaptureRun
+    {
+        CaptureRun(TundraCapturer *capturer_, FrameBufferPool *pool_, const QList<QImage> &images_) :
+            capturer(capturer_), pool(pool_), images(images_), index(0)
+        {
+        }
+
+        void operator()()
+        {
+            const QImage &image = images[index++ % images.size()];
+            WebRTCFrameBufferPtr frame = pool->AcquireARGB(image.width(), image.height());
+            for (int y=0; y<image.height(); ++y)
+                memcpy(frame->Data() + y * frame->stride, image.constScanLine(y), frame->stride);
+            pool->RecordCopy(frame->size);
+            capturer->OnTundraFrame(frame);
+        }
+
+        TundraCapturer *capturer;
+        FrameBufferPool *pool;
+        QList<QImage> images;
+        int index;
+    };
+
+    /// SDP of a Chrome offer with audio, video and a RTP data channel.
+    static const char *cBenchmarkSDP =
+        "v=0\r\no=- 4327019215413421396 2 IN IP4 127.0.0.1\r\ns=-\r\nt=0 0\r\na=group:BUNDLE audio video data\r\n"
+        "a=msid-semantic: WMS stream_label\r\n"
+        "m=audio 1 RTP/SAVPF 111 103 104 0 8 106 105 13 126\r\nc=IN IP4 0.0.0.0\r\na=rtcp:1 IN IP4 0.0.0.0\r\n"
+        "a=ice-ufrag:7sFvz2gdLkEwjZEr\r\na=ice-pwd:dOTZKZNVlO9RSGsEGM63JXT2\r\na=ice-options:google-ice\r\n"
+        "a=fingerprint:sha-256 3C:A8:D2:9B:34:9C:F1:94:F5:FD:AD:61:1D:79:21:4D:75:32:23:BB:ED:2E:85:02:79:C9:80:1D:A8:BB:A9:8A\r\n"
+        "a=setup:actpass\r\na=mid:audio\r\na=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level\r\na=sendrecv\r\na=rtcp-mux\r\n"
+        "a=crypto:1 AES_CM_128_HMAC_SHA1_80 inline:rRQxZTpdaoBMvMkZs2c7dhN4ajYqnVgx0s8bNrJl\r\n"
+        "a=rtpmap:111 opus/48000/2\r\na=fmtp:111 minptime=10\r\na=rtpmap:103 ISAC/16000\r\na=rtpmap:104 ISAC/32000\r\n"
+        "a=rtpmap:0 PCMU/8000\r\na=rtpmap:8 PCMA/8000\r\na=rtpmap:106 CN/32000\r\na=rtpmap:105 CN/16000\r\n"
+        "a=rtpmap:13 CN/8000\r\na=rtpmap:126 telephone-event/8000\r\na=maxptime:60\r\n"
+        "a=ssrc:2461380212 cname:8zM2xn5Hk7BVfUAJ\r\na=ssrc:2461380212 msid:stream_label audio_label\r\n"
+        "a=ssrc:2461380212 mslabel:stream_label\r\na=ssrc:2461380212 label:audio_label\r\n"
+        "m=video 1 RTP/SAVPF 100 116 117\r\nc=IN IP4 0.0.0.0\r\na=rtcp:1 IN IP4 0.0.0.0\r\n"
+        "a=ice-ufrag:7sFvz2gdLkEwjZEr\r\na=ice-pwd:dOTZKZNVlO9RSGsEGM63JXT2\r\na=ice-options:google-ice\r\n"
+        "a=fingerprint:sha-256 3C:A8:D2:9B:34:9C:F1:94:F5:FD:AD:61:1D:79:21:4D:75:32:23:BB:ED:2E:85:02:79:C9:80:1D:A8:BB:A9:8A\r\n"
+        "a=setup:actpass\r\na=mid:video\r\na=extmap:2 urn:ietf:params:rtp-hdrext:toffset\r\na=sendrecv\r\na=rtcp-mux\r\n"
+        "a=crypto:1 AES_CM_128_HMAC_SHA1_80 inline:rRQxZTpdaoBMvMkZs2c7dhN4ajYqnVgx0s8bNrJl\r\n"
+        "a=rtpmap:100 VP8/90000\r\na=rtcp-fb:100 ccm fir\r\na=rtcp-fb:100 nack\r\na=rtcp-fb:100 goog-remb\r\n"
+        "a=rtpmap:116 red/90000\r\na=rtpmap:117 ulpfec/90000\r\n"
+        "a=ssrc:1526658012 cname:8zM2xn5Hk7BVfUAJ\r\na=ssrc:1526658012 msid:stream_label video_label\r\n"
+        "a=ssrc:1526658012 mslabel:stream_label\r\na=ssrc:1526658012 label:video_label\r\n"
+        "m=application 1 RTP/SAVPF 101\r\nc=IN IP4 0.0.0.0\r\na=rtcp:1 IN IP4 0.0.0.0\r\n"
+        "a=ice-ufrag:7sFvz2gdLkEwjZEr\r\na=ice-pwd:dOTZKZNVlO9RSGsEGM63JXT2\r\na=ice-options:google-ice\r\n"
+        "a=fingerprint:sha-256 3C:A8:D2:9B:34:9C:F1:94:F5:FD:AD:61:1D:79:21:4D:75:32:23:BB:ED:2E:85:02:79:C9:80:1D:A8:BB:A9:8A\r\n"
+        "a=setup:actpass\r\na=mid:data\r\nb=AS:30\r\na=sendrecv\r\na=rtcp-mux\r\n"
+        "a=crypto:1 AES_CM_128_HMAC_SHA1_80 inline:rRQxZTpdaoBMvMkZs2c7dhN4ajYqnVgx0s8bNrJl\r\n"
+        "a=rtpmap:101 google-data/90000\r\na=ssrc:3079389203 cname:NxJ0l0pMSNfEtVbR\r\n"
+        "a=ssrc:3079389203 msid:data_label data_label\r\na=ssrc:3079389203 mslabel:data_label\r\na=ssrc:3079389203 label:data_label\r\n";
+
+    /// Host, server reflexive and relay candidates as Chrome gathers them.
+    static WebRTC::ICECandidateList BenchmarkCandidates(int count)
+    {
+        const char *candidates[4] = {
+            "a=candidate:1467250027 1 udp 2122260223 192.168.0.196 46243 typ host generation 0",
+            "a=candidate:435653019 1 tcp 1845501695 192.168.0.196 0 typ host tcptype active generation 0",
+            "a=candidate:3812381403 1 udp 1686052607 84.250.101.12 46243 typ srflx raddr 192.168.0.196 rport 46243 generation 0",
+            "a=candidate:2725543658 1 udp 41885439 130.230.12.44 56870 typ relay raddr 84.250.101.12 rport 46243 generation 0"
+        };
+        const char *mids[3] = { "audio", "video", "data" };
+        WebRTC::ICECandidateList list;
+        for (int i=0; i<count; ++i)
+            list << WebRTC::ICECandidate(i % 3, mids[i % 3], candidates[i % 4]);
+        return list;
+    }
+
+    /// Named set of serialized messages.
+    struct ProtocolCorpusEntry
+    {
+        QString name;
+        QList<QByteArray> messages;
+    };
+
+    /// Builds the message corpus with the protocol classes so that it matches what peers send.
+    static QList<ProtocolCorpusEntry> BuildProtocolCorpus()
+    {
+        QList<ProtocolCorpusEntry> corpus;
+        const int batch = 50;
+
+        ProtocolCorpusEntry offers, answers, ice, joined, custom, input;
+        offers.name = "Offer";
+        answers.name = "Answer";
+        ice.name = "IceCandidates";
+        joined.name = "RoomUserJoined";
+        custom.name = "RoomCustomMessage";
+        input.name = "PeerCustomMessage";
+
+        for (int i=0; i<batch; ++i)
+        {
+            CloudRenderingProtocol::Signaling::OfferMessage offer(QString::number(i + 1));
+            offer.senderId = "renderer";
+            offer.sdp = WebRTC::SDP("offer", cBenchmarkSDP);
+            offer.iceCandidates = BenchmarkCandidates(4);
+            offers.messages << offer.ToJSON();
+
+            CloudRenderingProtocol::Signaling::AnswerMessage answer("renderer");
+            answer.senderId = QString::number(i + 1);
+            answer.sdp = WebRTC::SDP("answer", cBenchmarkSDP);
+            answers.messages << answer.ToJSON();
+
+            // Trickled one by one.
+            CloudRenderingProtocol::Signaling::IceCandidatesMessage candidate(QString::number(i + 1), BenchmarkCandidates(i % 4 + 1).mid(i % 4, 1));
+            candidate.senderId = "renderer";
+            ice.messages << candidate.ToJSON();
+
+            QStringList peerIds;
+            for (int p=0; p<200; ++p)
+                peerIds << QString::number(1000 + i * 200 + p);
+            CloudRenderingProtocol::Room::RoomUserJoinedMessage join(peerIds);
+            joined.messages << join.ToJSON();
+
+            // Application state sync between the clients and the renderer, relayed by the service.
+            QVariantMap state;
+            state["type"] = "CameraState";
+            state["peerId"] = QString::number(i + 1);
+            state["position"] = QVariantList() << i * 0.5 << 1.8 << -i * 0.25;
+            state["orientation"] = QVariantList() << 0.0 << 0.707 << 0.0 << 0.707;
+            CloudRenderingProtocol::Application::RoomCustomMessage roomMessage(QVariantList() << "renderer" << QString::number(i + 2), state);
+            custom.messages << roomMessage.ToJSON();
+
+            // Mostly mouse moves, same as a user driving the camera.
+            QVariantMap payload;
+            if (i % 5 != 4)
+            {
+                payload["type"] = "InputMouse";
+                payload["action"] = "move";
+                payload["x"] = static_cast<double>(i) / batch;
+                payload["y"] = 1.0 - static_cast<double>(i) / batch;
+                payload["leftButton"] = (i % 2 == 0);
+                payload["rightButton"] = false;
+                payload["middleButton"] = false;
+            }
+            else
+            {
+                payload["type"] = "InputKeyboard";
+                payload["action"] = "keyDown";
+                payload["key"] = 87;
+                payload["altKey"] = false;
+                payload["shiftKey"] = false;
+                payload["ctrlKey"] = false;
+                payload["metaKey"] = false;
+            }
+            CloudRenderingProtocol::Application::PeerCustomMessage peerMessage(payload);
+            input.messages << peerMessage.ToJSON();
+        }
+        corpus << offers << answers << ice << joined << custom << input;
+        return corpus;
+    }
+
+    struct ProtocolParseRun
+    {
+        ProtocolParseRun(const QList<QByteArray> &messages_) : messages(messages_), failed(0) {}
+
+        void operator()()
+        {
+            foreach(const QByteArray &json, messages)
+                if (!CloudRenderingProtocol::CreateMessageFromJSON(json).get())
+                    failed++;
+        }
+
+        QList<QByteArray> messages;
+        int failed;
+    };
+
+    struct ProtocolSerializeRun
+    {
+        ProtocolSerializeRun(const CloudRenderingProtocol::MessageSharedPtrList &messages_) : messages(messages_), bytes(0) {}
+
+        void operator()()
+        {
+            foreach(const CloudRenderingProtocol::MessageSharedPtr &message, messages)
+                bytes += message->ToJSON().size();
+        }
+
+        CloudRenderingProtocol::MessageSharedPtrList messages;
+        qint64 bytes;
+    };
+
+    /// Counts the messages handed to it, stand-in for Renderer and Client in the dispatch measurement.
+    struct ProtocolDispatchReceiver
+    {
+        ProtocolDispatchReceiver() : handled(0) {}
+
+        template <typename T>
+        void Handle(T *message)
+        {
+            if (message)
+                handled++;
+        }
+
+        qint64 handled;
+    };
+
+    /// Message construction as the parser did it before the creator table, an if/else chain over the types.
+    static CloudRenderingProtocol::MessageSharedPtr LegacyCreateMessage(CloudRenderingProtocol::MessageType type)
+    {
+        using namespace CloudRenderingProtocol;
+        if (type == Signaling::OfferMessage::MessageTypeStatic())
+            return MessageSharedPtr(new Signaling::OfferMessage());
+        else if (type == Signaling::AnswerMessage::MessageTypeStatic())
+            return MessageSharedPtr(new Signaling::AnswerMessage());
+        else if (type == Signaling::IceCandidatesMessage::MessageTypeStatic())
+            return MessageSharedPtr(new Signaling::IceCandidatesMessage());
+        else if (type == Room::RoomAssignedMessage::MessageTypeStatic())
+            return MessageSharedPtr(new Room::RoomAssignedMessage());
+        else if (type == Room::RoomUserJoinedMessage::MessageTypeStatic())
+            return MessageSharedPtr(new Room::RoomUserJoinedMessage());
+        else if (type == Room::RoomUserLeftMessage::MessageTypeStatic())
+            return MessageSharedPtr(new Room::RoomUserLeftMessage());
+        else if (type == Application::RoomCustomMessage::MessageTypeStatic())
+            return MessageSharedPtr(new Application::RoomCustomMessage());
+        else if (type == Application::PeerCustomMessage::MessageTypeStatic())
+            return MessageSharedPtr(new Application::PeerCustomMessage());
+        return MessageSharedPtr();
+    }
+
+    template <typename T>
+    static bool LegacyHandle(ProtocolDispatchReceiver &receiver, CloudRenderingProtocol::IMessage *message)
+    {
+        T *typed = dynamic_cast<T*>(message);
+        if (!typed)
+            return false;
+        receiver.Handle(typed);
+        return true;
+    }
+
+    /// Message handling as Renderer and Client did it before MessageDispatcher, a channel and type switch with a dynamic_cast per case.
+    static bool LegacyDispatch(ProtocolDispatchReceiver &receiver, CloudRenderingProtocol::IMessage *message)
+    {
+        using namespace CloudRenderingProtocol;
+        switch (message->Channel())
+        {
+            case CT_Signaling:
+            {
+                switch (message->Type())
+                {
+                    case MT_Offer: return LegacyHandle<Signaling::OfferMessage>(receiver, message);
+                    case MT_Answer: return LegacyHandle<Signaling::AnswerMessage>(receiver, message);
+                    case MT_IceCandidates: return LegacyHandle<Signaling::IceCandidatesMessage>(receiver, message);
+                    default: return false;
+                }
+            }
+            case CT_Room:
+            {
+                switch (message->Type())
+                {
+                    case MT_RoomAssigned: return LegacyHandle<Room::RoomAssignedMessage>(receiver, message);
+                    case MT_RoomUserJoined: return LegacyHandle<Room::RoomUserJoinedMessage>(receiver, message);
+                    case MT_RoomUserLeft: return LegacyHandle<Room::RoomUserLeftMessage>(receiver, message);
+                    default: return false;
+                }
+            }
+            case CT_Application:
+            {
+                switch (message->Type())
+                {
+                    case MT_RoomCustomMessage: return LegacyHandle<Application::RoomCustomMessage>(receiver, message);
+                    case MT_PeerCustomMessage: return LegacyHandle<Application::PeerCustomMessage>(receiver, message);
+                    default: return false;
+                }
+            }
+            default:
+                return false;
+        }
+    }
+
+    /// Creates a message per type and hands it to the receiver, either the legacy way or with CreateMessage() and MessageDispatcher.
+    /** This is the part of CreateMessageFromJSON and the message handling that the creator table and the dispatcher replaced,
+        JSON parsing and FromData() are left out as they are the same for both. */
+    struct ProtocolDispatchRun
+    {
+        ProtocolDispatchRun(const QList<CloudRenderingProtocol::MessageType> &types_, bool legacy_) :
+            types(types_), legacy(legacy_), unhandled(0)
+        {
+            dispatcher.On(&receiver, &ProtocolDispatchReceiver::Handle<CloudRenderingProtocol::Signaling::OfferMessage>);
+            dispatcher.On(&receiver, &ProtocolDispatchReceiver::Handle<CloudRenderingProtocol::Signaling::AnswerMessage>);
+            dispatcher.On(&receiver, &ProtocolDispatchReceiver::Handle<CloudRenderingProtocol::Signaling::IceCandidatesMessage>);
+            dispatcher.On(&receiver, &ProtocolDispatchReceiver::Handle<CloudRenderingProtocol::Room::RoomAssignedMessage>);
+            dispatcher.On(&receiver, &ProtocolDispatchReceiver::Handle<CloudRenderingProtocol::Room::RoomUserJoinedMessage>);
+            dispatcher.On(&receiver, &ProtocolDispatchReceiver::Handle<CloudRenderingProtocol::Room::RoomUserLeftMessage>);
+            dispatcher.On(&receiver, &ProtocolDispatchReceiver::Handle<CloudRenderingProtocol::Application::RoomCustomMessage>);
+            dispatcher.On(&receiver, &ProtocolDispatchReceiver::Handle<CloudRenderingProtocol::Application::PeerCustomMessage>);
+        }
+
+        void operator()()
+        {
+            foreach(CloudRenderingProtocol::MessageType type, types)
+            {
+                CloudRenderingProtocol::MessageSharedPtr message = (legacy ? LegacyCreateMessage(type) : CloudRenderingProtocol::CreateMessage(type));
+                if (!message.get() || !(legacy ? LegacyDispatch(receiver, message.get()) : dispatcher.Dispatch(message)))
+                    unhandled++;
+            }
+        }
+
+        QList<CloudRenderingProtocol::MessageType> types;
+        bool legacy;
+        ProtocolDispatchReceiver receiver;
+        CloudRenderingProtocol::MessageDispatcher dispatcher;
+        int unhandled;
+    };
+
+    /// Receives and sends one message type either as IMessage objects or as value messages.
+    /** Receive is the parse of an incoming message, as the WebSocket and data channel paths do it.
+        Send is building an outgoing message from its fields and serializing it, as Renderer does it. */
+    template <typename Value, typename Message>
+    struct ProtocolValueRun
+    {
+        ProtocolValueRun(const QList<QByteArray> &messages_, bool values_, bool send_) :
+            messages(messages_), values(values_), send(send_), failed(0), bytes(0)
+        {
+            foreach(const QByteArray &json, messages)
+            {
+                Value value;
+                if (CloudRenderingProtocol::FromJSON(json, value))
+                    parsed << value;
+            }
+        }
+
+        void operator()()
+        {
+            if (send)
+            {
+                foreach(const Value &value, parsed)
+                {
+                    if (values)
+                        bytes += CloudRenderingProtocol::ToJSON(value).size();
+                    else
+                    {
+                        // Was new + deleteLater() before, here deleted right away as there is no event loop running.
+                        Message *message = new Message(value);
+                        bytes += message->ToJSON().size();
+                        delete message;
+                    }
+                }
+                return;
+            }
+            foreach(const QByteArray &json, messages)
+            {
+                if (values)
+                {
+                    Value value;
+                    if (!CloudRenderingProtocol::FromJSON(json, value))
+                        failed++;
+                }
+                else if (!CloudRenderingProtocol::CreateMessageFromJSON(json).get())
+                    failed++;
+            }
+        }
+
+        QList<QByteArray> messages;
+        QList<Value> parsed;
+        bool values;
+        bool send;
+        int failed;
+        qint64 bytes;
+    };
+
+    /// Measures object and value messages of one type, see ProtocolValueRun.
+    template <typename Value, typename Message>
+    static QVariantMap MeasureValueMessages(const QString &name, const QList<QByteArray> &messages, QVariantMap &metrics)
+    {
+        QVariantMap results;
+        const double count = static_cast<double>(messages.size());
+        if (messages.isEmpty())
+            return results;
+
+        const char *models[2] = { "object", "value" };
+        const char *directions[2] = { "receive", "send" };
+        for (int m=0; m<2; ++m)
+        {
+            QVariantMap model;
+            for (int d=0; d<2; ++d)
+            {
+                ProtocolValueRun<Value, Message> run(messages, m == 1, d == 1);
+                QVariantMap measured = Measure(run, count);
+                const double ms = measured.value("msPerFrame").toDouble();
+                const int allocations = CountAllocations(run);
+
+                QVariantMap result;
+                result["iterations"] = measured.value("iterations");
+                result["messagesPerSecond"] = (ms > 0.0 ? count * 1000.0 / ms : 0.0);
+                result["nsPerMessage"] = ms * 1000000.0 / count;
+                if (allocations >= 0)
+                    result["allocationsPerMessage"] = static_cast<double>(allocations) / count;
+                result["failed"] = run.failed;
+                model[directions[d]] = result;
+
+                const QString key = QString("protocol.values.%1.%2.%3.").arg(name).arg(models[m]).arg(directions[d]);
+                metrics[key + "nsPerMessage"] = result["nsPerMessage"];
+                if (allocations >= 0)
+                    metrics[key + "allocationsPerMessage"] = result["allocationsPerMessage"];
+            }
+            results[models[m]] = model;
+        }
+        return results;
+    }
+
+    /// Parses one message type into its value message either with the generic QVariantMap path or the streaming fast path.
+    template <typename Value>
+    struct ProtocolFastRun
+    {
+        ProtocolFastRun(const QList<QByteArray> &messages_, bool fast_) :
+            messages(messages_), fast(fast_), failed(0), fallbacks(0)
+        {
+        }
+
+        void operator()()
+        {
+            foreach(const QByteArray &json, messages)
+            {
+                Value value;
+                if (fast && CloudRenderingProtocol::FromJSONFast(json, value))
+                    continue;
+                if (fast)
+                    fallbacks++;
+                if (!CloudRenderingProtocol::FromJSON(json, value))
+                    failed++;
+            }
+        }
+
+        QList<QByteArray> messages;
+        bool fast;
+        int failed;
+        int fallbacks;
+    };
+
+    /// Measures the generic and fast path parse of one message type, see ProtocolFastRun.
+    template <typename Value>
+    static QVariantMap MeasureFastParse(const QString &name, const QList<QByteArray> &messages, QVariantMap &metrics)
+    {
+        QVariantMap results;
+        const double count = static_cast<double>(messages.size());
+        if (messages.isEmpty())
+            return results;
+
+        const char *names[2] = { "generic", "fast" };
+        double nsPerMessage[2] = { 0.0, 0.0 };
+        for (int i=0; i<2; ++i)
+        {
+            ProtocolFastRun<Value> run(messages, i == 1);
+            QVariantMap measured = Measure(run, count);
+            const double ms = measured.value("msPerFrame").toDouble();
+            nsPerMessage[i] = ms * 1000000.0 / count;
+
+            QVariantMap result;
+            result["iterations"] = measured.value("iterations");
+            result["messagesPerSecond"] = (ms > 0.0 ? count * 1000.0 / ms : 0.0);
+            result["nsPerMessage"] = nsPerMessage[i];
+            result["failed"] = run.failed;
+            if (i == 1)
+                result["fallbacks"] = run.fallbacks;
+            results[names[i]] = result;
+
+            metrics[QString("protocol.fast.%1.%2.nsPerMessage").arg(name).arg(names[i])] = result["nsPerMessage"];
+        }
+        results["speedup"] = (nsPerMessage[1] > 0.0 ? nsPerMessage[0] / nsPerMessage[1] : 0.0);
+        metrics[QString("protocol.fast.%1.speedup").arg(name)] = results["speedup"];
+        return results;
+    }
+
+    /// Stand-in for UiGraphicsView that timestamps the input events delivered to it.
+    class InputBenchmarkView : public QGraphicsView
+    {
+    public:
+        InputBenchmarkView() :
+            lastDelivery(0)
+        {
+            setScene(&scene_);
+            resize(1280, 720);
+        }
+
+        tick_t lastDelivery;
+
+    protected:
+        bool viewportEvent(QEvent *e)
+        {
+            if (e->type() == QEvent::MouseMove || e->type() == QEvent::MouseButtonPress ||
+                e->type() == QEvent::MouseButtonRelease || e->type() == QEvent::MouseButtonDblClick)
+                lastDelivery = GetCurrentClockTime();
+            return QGraphicsView::viewportEvent(e);
+        }
+
+        void keyPressEvent(QKeyEvent *e)
+        {
+            lastDelivery = GetCurrentClockTime();
+            QGraphicsView::keyPressEvent(e);
+        }
+
+        void keyReleaseEvent(QKeyEvent *e)
+        {
+            lastDelivery = GetCurrentClockTime();
+            QGraphicsView::keyReleaseEvent(e);
+        }
+
+    private:
+        QGraphicsScene scene_;
+    };
+
+    /// Runs one data channel message through the same path as PeerConnection::OnMessage and Renderer::OnDataChannelMessage.
+    /** @return True if an input event was delivered to @c view. */
+    static bool ReplayInputMessage(InputInjector &injector, InputBenchmarkView &view, const QByteArray &json)
+    {
+        CloudRenderingProtocol::Application::PeerCustomValue message;
+        if (!CloudRenderingProtocol::FromJSONFast(json, message) && !CloudRenderingProtocol::FromJSON(json, message))
+            return false;
+
+        if (message.input.type == CloudRenderingProtocol::Application::InputPayload::IPT_Keyboard)
+            return injector.PostKeyboardEvent(&view, message.input);
+        else if (message.input.type == CloudRenderingProtocol::Application::InputPayload::IPT_Mouse)
+            return injector.PostMouseEvent(&view, &view, message.input);
+        return false;
+    }
+
+    /// Runs one binary data channel message through the same path as Renderer::OnDataChannelMessage.
+    /** @return True if an input event was delivered to @c view. */
+    static bool ReplayBinaryInput(InputInjector &injector, InputBenchmarkView &view, const QByteArray &data)
+    {
+        CloudRenderingProtocol::BinaryInput::InputEvent event;
+        if (!CloudRenderingProtocol::BinaryInput::Decode(data.constData(), data.size(), event))
+            return false;
+        return injector.PostEvent(&view, &view, event);
+    }
+
+    /// Returns the input type of a JSON data channel message, or if @c binary the event type of a binary one.
+    /** This is the decode step alone, the same work Renderer does before handing the event to InputInjector. */
+    static int DecodeInputMessage(const QByteArray &data, bool binary)
+    {
+        if (binary)
+        {
+            CloudRenderingProtocol::BinaryInput::InputEvent event;
+            return (CloudRenderingProtocol::BinaryInput::Decode(data.constData(), data.size(), event) ? static_cast<int>(event.type) : 0);
+        }
+        CloudRenderingProtocol::Application::PeerCustomValue message;
+        if (!CloudRenderingProtocol::FromJSONFast(data, message) && !CloudRenderingProtocol::FromJSON(data, message))
+            return 0;
+        return static_cast<int>(message.input.type);
+    }
+
+    /// Encodes the InputMouse and InputKeyboard payloads of a JSON input stream as binary input events.
+    static QList<QByteArray> ToBinaryInputStream(const QList<QByteArray> &stream)
+    {
+        using namespace CloudRenderingProtocol::BinaryInput;
+
+        QList<QByteArray> binary;
+        u32 sequence = 0;
+        foreach(const QByteArray &json, stream)
+        {
+            CloudRenderingProtocol::MessageSharedPtr message = CloudRenderingProtocol::CreateMessageFromJSON(json);
+            CloudRenderingProtocol::Application::PeerCustomMessage *peerMessage = dynamic_cast<CloudRenderingProtocol::Application::PeerCustomMessage*>(message.get());
+            if (!peerMessage)
+                continue;
+
+            const QVariantMap &payload = peerMessage->payload;
+            InputEvent event;
+            event.sequence = ++sequence;
+            event.timestamp = sequence * 16;
+            if (payload.value("shiftKey", false).toBool())
+                event.modifiers |= IM_Shift;
+            if (payload.value("ctrlKey", false).toBool())
+                event.modifiers |= IM_Ctrl;
+            if (payload.value("altKey", false).toBool())
+                event.modifiers |= IM_Alt;
+            if (payload.value("metaKey", false).toBool())
+                event.modifiers |= IM_Meta;
+
+            const QString type = payload.value("type", "").toString();
+            const QString action = payload.value("action", "").toString();
+            if (type == "InputKeyboard")
+            {
+                event.type = IET_Key;
+                event.keyCode = static_cast<u16>(payload.value("key").toInt());
+                event.action = (action == "keyDown" ? IA_Press : IA_Release);
+            }
+            else if (type == "InputMouse")
+            {
+                event.x = payload.value("x").toFloat();
+                event.y = payload.value("y").toFloat();
+                if (payload.value("leftButton", false).toBool())
+                    event.buttons |= IB_Left;
+                if (payload.value("rightButton", false).toBool())
+                    event.buttons |= IB_Right;
+                if (payload.value("middleButton", false).toBool())
+                    event.buttons |= IB_Middle;
+                if (action == "move")
+                    event.type = IET_MouseMove;
+                else
+                {
+                    event.type = IET_MouseButton;
+                    event.action = (action == "press" ? IA_Press : (action == "doublepress" ? IA_DoublePress : IA_Release));
+                    event.button = static_cast<u8>(payload.value("which", payload.value("button", 0)).toInt());
+                }
+            }
+            else
+                continue;
+
+            QByteArray data(cEventSize, 0);
+            Encode(event, data.data(), data.size());
+            binary << data;
+        }
+        return binary;
+    }
+
+    /// Builds an input stream of a user orbiting the camera: free moves, a drag, a double click and modifier keys.
+    static QList<QByteArray> BuildInputStream()
+    {
+        QList<QVariantMap> payloads;
+        for (int i=0; i<120; ++i)
+        {
+            const int step = i % 60;
+            QVariantMap mouse;
+            mouse["type"] = "InputMouse";
+            mouse["x"] = 0.25 + step * 0.008;
+            mouse["y"] = 0.5 + (i < 60 ? 0.002 : -0.002) * step;
+            mouse["action"] = "move";
+            const bool dragging = (i >= 60 && step > 0 && step < 59);
+            mouse["leftButton"] = dragging;
+            mouse["rightButton"] = false;
+            mouse["middleButton"] = false;
+            if (i >= 60 && step == 0)
+            {
+                mouse["action"] = "press";
+                mouse["which"] = 1;
+                mouse["leftButton"] = true;
+            }
+            else if (i >= 60 && step == 59)
+            {
+                mouse["action"] = "release";
+                mouse["which"] = 1;
+            }
+            payloads << mouse;
+        }
+
+        QVariantMap doubleClick;
+        doubleClick["type"] = "InputMouse";
+        doubleClick["x"] = 0.5;
+        doubleClick["y"] = 0.5;
+        doubleClick["action"] = "doublepress";
+        doubleClick["which"] = 1;
+        payloads << doubleClick;
+
+        // Letter keys have no HTML keyCode mapping yet, use keys that are delivered.
+        const int keys[3] = { 16, 9, 13 };
+        for (int i=0; i<3; ++i)
+        {
+            QVariantMap key;
+            key["type"] = "InputKeyboard";
+            key["key"] = keys[i];
+            key["altKey"] = false;
+            key["shiftKey"] = (keys[i] == 16);
+            key["ctrlKey"] = false;
+            key["metaKey"] = false;
+            key["action"] = "keyDown";
+            payloads << key;
+            key["action"] = "keyUp";
+            payloads << key;
+        }
+
+        QList<QByteArray> stream;
+        foreach(const QVariantMap &payload, payloads)
+        {
+            CloudRenderingProtocol::Application::PeerCustomMessage message(payload);
+            stream << message.ToJSON();
+        }
+        return stream;
+    }
+
+    /// Observer for peer connections that are created and released without connecting anywhere.
+    struct NullPeerObserver : public webrtc::PeerConnectionObserver
+    {
+        void OnError() {}
+        void OnSignalingChange(webrtc::PeerConnectionInterface::SignalingState /*new_state*/) {}
+        void OnStateChange(StateType /*state_changed*/) {}
+        void OnAddStream(webrtc::MediaStreamInterface* /*stream*/) {}
+        void OnRemoveStream(webrtc::MediaStreamInterface* /*stream*/) {}
+        void OnDataChannel(webrtc::DataChannelInterface* /*data_channel*/) {}
+        void OnRenegotiationNeeded() {}
+        void OnIceConnectionChange(webrtc::PeerConnectionInterface::IceConnectionState /*new_state*/) {}
+        void OnIceGatheringChange(webrtc::PeerConnectionInterface::IceGatheringState /*new_state*/) {}
+        void OnIceCandidate(const webrtc::IceCandidateInterface* /*candidate*/) {}
+        void OnIceComplete() {}
+    };
+
+    /// Fills an ARGB frame with gradients and noise, same content on every run.
+    static void FillTestFrame(const WebRTCFrameBufferPtr &frame)
+    {
+        u32 seed = 0x12345678;
+        for (int y=0; y<frame->height; ++y)
+        {
+            uchar *line = frame->Data() + y * frame->stride;
+            for (int x=0; x<frame->width; ++x)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                const int noise = static_cast<int>(seed >> 28);
+                line[x*4]   = static_cast<uchar>((x * 255 / frame->width + noise) & 0xFF);
+                line[x*4+1] = static_cast<uchar>((y * 255 / frame->height + noise) & 0xFF);
+                line[x*4+2] = static_cast<uchar>(((x + y) + noise) & 0xFF);
+                line[x*4+3] = 255;
+            }
+        }
+    }
+
+    /// @endcond
+
+    Benchmark::Benchmark(CloudRenderingPlugin *plugin) :
+        LC("[WebRTC::Benchmark]: "),
+        plugin_(plugin)
+    {
+    }
+
+    Benchmark::~Benchmark()
+    {
+    }
+
+    QStringList Benchmark::Suites()
+    {
+        return QStringList() << "conversion" << "workers" << "broadcast" << "peers" << "capture" << "protocol" << "input" << "signaling" << "reconnect";
+    }
+
+    QStringList Benchmark::RequestedSuites() const
+    {
+        QStringList suites;
+        foreach(const QString &param, plugin_->GetFramework()->CommandLineParameters("--cloudRenderingBenchmark"))
+            foreach(const QString &name, param.split(",", QString::SkipEmptyParts))
+                suites << name.trimmed().toLower();
+        if (suites.isEmpty() || suites.contains("all"))
+            return Suites();
+        return suites;
+    }
+
+    void Benchmark::Run()
+    {
+        QVariantMap report;
+        QVariantMap suites;
+        QStringList failed;
+        foreach(const QString &name, RequestedSuites())
+        {
+            if (!Suites().contains(name))
+            {
+                LogError(LC + "Unknown benchmark suite '" + name + "', available suites: " + Suites().join(", "));
+                continue;
+            }
+            LogInfo(LC + "Running " + name);
+            tick_t start = GetCurrentClockTime();
+            QVariantMap results = RunSuite(name);
+            results["suiteSeconds"] = SecondsSince(start);
+            suites[name] = results;
+            if (results.contains("error"))
+            {
+                LogError(LC + name + " failed: " + results["error"].toString());
+                failed << name;
+            }
+        }
+        report["suites"] = suites;
+        report["failedSuites"] = failed;
+        report["cpu"] = ColorConversion::ImplementationName(ColorConversion::DetectImplementation());
+        WriteReport(report);
+
+        // Framework::Exit() has no exit code, a failed suite has to be visible to the build server.
+        if (!failed.isEmpty())
+            exit(EXIT_FAILURE);
+        plugin_->GetFramework()->Exit();
+    }
+
+    QVariantMap Benchmark::RunSuite(const QString &name)
+    {
+        if (name == "conversion")
+            return RunConversion();
+        else if (name == "workers")
+            return RunWorkers();
+        else if (name == "broadcast")
+            return RunBroadcast();
+        else if (name == "peers")
+            return RunPeers();
+        else if (name == "capture")
+            return RunCapture();
+        else if (name == "protocol")
+            return RunProtocol();
+        else if (name == "input")
+            return RunInput();
+        else if (name == "signaling")
+            return RunSignaling();
+        else if (name == "reconnect")
+            return RunReconnect();
+        return QVariantMap();
+    }
+
+    QVariantMap Benchmark::RunConversion()
+    {
+        // Odd sizes exercise the scalar tail of the SIMD kernels and the last chroma row and column.
+        const int sizes[5][2] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 }, { 1279, 719 }, { 33, 17 } };
+        const u32 fourccs[2] = { cricket::FOURCC_I420, cricket::FOURCC_NV12 };
+        const ColorConversion::Implementation impls[3] = { ColorConversion::CCI_Scalar, ColorConversion::CCI_SSE2, ColorConversion::CCI_AVX2 };
+
+        FrameBufferPool pool;
+        QVariantList resolutions;
+        QStringList mismatches;
+        for (int s=0; s<5; ++s)
+        {
+            WebRTCFrameBufferPtr source = pool.AcquireARGB(sizes[s][0], sizes[s][1]);
+            FillTestFrame(source);
+            const double pixels = static_cast<double>(source->width * source->height);
+
+            QVariantMap resolution;
+            resolution["width"] = source->width;
+            resolution["height"] = source->height;
+            for (int f=0; f<2; ++f)
+            {
+                QVariantMap format;
+                WebRTCFrameBufferPtr reference;
+                double scalarSeconds = 0.0;
+                for (int i=0; i<3; ++i)
+                {
+                    const QString implName = ColorConversion::ImplementationName(impls[i]);
+                    if (!ColorConversion::IsSupported(impls[i]))
+                    {
+                        QVariantMap unsupported;
+                        unsupported["supported"] = false;
+                        format[implName] = unsupported;
+                        continue;
+                    }
+
+                    ConversionRun run(&pool, source, fourccs[f], impls[i]);
+                    QVariantMap result = Measure(run, pixels);
+                    result["supported"] = true;
+                    
+                    const double seconds = result["msPerFrame"].toDouble() / 1000.0;
+                    if (impls[i] == ColorConversion::CCI_Scalar)
+                    {
+                        reference = run.result;
+                        scalarSeconds = seconds;
+                    }
+                    result["speedupVsScalar"] = (seconds > 0.0 ? scalarSeconds / seconds : 0.0);
+                    const bool matches = (reference.get() && run.result.get() && reference->size == run.result->size &&
+                        memcmp(reference->Data(), run.result->Data(), reference->size) == 0);
+                    result["matchesScalar"] = matches;
+                    if (!matches)
+                        mismatches << QString("%1 %2 %3x%4").arg(implName).arg(fourccs[f] == cricket::FOURCC_I420 ? "I420" : "NV12")
+                            .arg(source->width).arg(source->height);
+                    format[implName] = result;
+                }
+                resolution[fourccs[f] == cricket::FOURCC_I420 ? "I420" : "NV12"] = format;
+            }
+            resolutions << resolution;
+        }
+
+        QVariantMap results;
+        results["resolutions"] = resolutions;
+        results["framePool"] = pool.Stats().ToVariant();
+        if (!mismatches.isEmpty())
+            results["error"] = "Conversion output does not match the scalar implementation: " + mismatches.join(", ");
+        return results;
+    }
+
+    QVariantMap Benchmark::RunWorkers()
+    {
+        // Thread counts from single threaded up to one worker per core.
+        QList<int> threadCounts;
+        const int cores = qMax(1, QThread::idealThreadCount());
+        threadCounts << 0;
+        for (int n=1; n<=cores; n*=2)
+            threadCounts << n;
+        if (!threadCounts.contains(cores))
+            threadCounts << cores;
+
+        const int sizes[2][2] = { { 1920, 1080 }, { 3840, 2160 } };
+
+        FrameBufferPool pool;
+        QVariantList resolutions;
+        for (int s=0; s<2; ++s)
+        {
+            WebRTCFrameBufferPtr source = pool.AcquireARGB(sizes[s][0], sizes[s][1]);
+            FillTestFrame(source);
+            const double pixels = static_cast<double>(source->width * source->height);
+            const int scaledWidth = source->width / 2;
+            const int scaledHeight = source->height / 2;
+
+            QVariantList runs;
+            double singleConvertMs = 0.0, singleScaleMs = 0.0;
+            foreach(int numThreads, threadCounts)
+            {
+                WorkerPool workers(numThreads);
+                QVariantMap run;
+                run["threads"] = numThreads;
+
+                ParallelConversionRun convert(&pool, source, &workers);
+                QVariantMap convertResult = Measure(convert, pixels);
+                convertResult["bands"] = workers.Statistics().value("lastJob");
+
+                workers.ResetStatistics();
+                ScaleRun scale(&pool, source, scaledWidth, scaledHeight, &workers);
+                QVariantMap scaleResult = Measure(scale, static_cast<double>(scaledWidth * scaledHeight));
+                scaleResult["bands"] = workers.Statistics().value("lastJob");
+
+                const double convertMs = convertResult["msPerFrame"].toDouble();
+                const double scaleMs = scaleResult["msPerFrame"].toDouble();
+                if (numThreads == 0)
+                {
+                    singleConvertMs = convertMs;
+                    singleScaleMs = scaleMs;
+                }
+                convertResult["speedupVsSingleThread"] = (convertMs > 0.0 ? singleConvertMs / convertMs : 0.0);
+                scaleResult["speedupVsSingleThread"] = (scaleMs > 0.0 ? singleScaleMs / scaleMs : 0.0);
+
+                run["convertI420"] = convertResult;
+                run["scaleHalf"] = scaleResult;
+                runs << run;
+            }
+
+            QVariantMap resolution;
+            resolution["width"] = source->width;
+            resolution["height"] = source->height;
+            resolution["runs"] = runs;
+            resolutions << resolution;
+        }
+
+        QVariantMap results;
+        results["cores"] = cores;
+        results["resolutions"] = resolutions;
+        return results;
+    }
+
+    QVariantMap Benchmark::RunBroadcast()
+    {
+        // A 1080p window frame scaled and converted to a 720p I420 stream, which
+        // is what every peer negotiates with the default capturer formats.
+        const int peerCounts[5] = { 1, 2, 4, 8, 16 };
+        const cricket::VideoFormat format(1280, 720, cricket::VideoFormat::FpsToInterval(30), cricket::FOURCC_I420);
+
+        FrameBufferPool pool;
+        WebRTCFrameBufferPtr source = pool.AcquireARGB(1920, 1080);
+        FillTestFrame(source);
+        const double pixels = static_cast<double>(source->width * source->height);
+
+        QVariantList runs;
+        for (int p=0; p<5; ++p)
+        {
+            const int peers = peerCounts[p];
+            QVariantMap run;
+            run["peers"] = peers;
+
+            for (int mode=0; mode<2; ++mode)
+            {
+                const bool shared = (mode == 1);
+                const int numCapturers = (shared ? 1 : peers);
+
+                QList<TundraCapturer*> capturers;
+                for (int i=0; i<numCapturers; ++i)
+                {
+                    TundraCapturer *capturer = new TundraCapturer(plugin_->GetFramework());
+                    capturer->Start(format);
+                    capturers << capturer;
+                }
+                QList<FrameCountSink*> sinks;
+                for (int i=0; i<peers; ++i)
+                {
+                    FrameCountSink *sink = new FrameCountSink();
+                    capturers[shared ? 0 : i]->SignalFrameCaptured.connect(sink, &FrameCountSink::OnFrameCaptured);
+                    sinks << sink;
+                }
+
+                BroadcastRun broadcast(capturers, source);
+                const double cpuStart = ProcessCpuSeconds();
+                QVariantMap result = Measure(broadcast, pixels);
+                const double cpuSeconds = ProcessCpuSeconds() - cpuStart;
+                const int calls = result["iterations"].toInt() + 1; // Measure() does one warm up call
+
+                result["capturers"] = numCapturers;
+                result["cpuMsPerFrame"] = cpuSeconds * 1000.0 / calls;
+                result["cpuMsPerFramePerPeer"] = cpuSeconds * 1000.0 / calls / peers;
+
+                // Every peer must have received every frame in both modes.
+                bool allDelivered = true;
+                foreach(FrameCountSink *sink, sinks)
+                    if (sink->frames != calls)
+                        allDelivered = false;
+                result["allPeersReceivedFrames"] = allDelivered;
+                run[shared ? "shared" : "perPeer"] = result;
+
+                foreach(TundraCapturer *capturer, capturers)
+                {
+                    capturer->Stop();
+                    delete capturer;
+                }
+                qDeleteAll(sinks);
+            }
+
+            const double perPeerMs = run["perPeer"].toMap()["cpuMsPerFrame"].toDouble();
+            const double sharedMs = run["shared"].toMap()["cpuMsPerFrame"].toDouble();
+            run["cpuSaving"] = (sharedMs > 0.0 ? perPeerMs / sharedMs : 0.0);
+            runs << run;
+        }
+
+        QVariantMap results;
+        results["sourceWidth"] = source->width;
+        results["sourceHeight"] = source->height;
+        results["streamWidth"] = format.width;
+        results["streamHeight"] = format.height;
+        results["runs"] = runs;
+        results["note"] = "Encoding is not included, libjingle encodes once per peer connection in both modes.";
+        return results;
+    }
+
+    QVariantMap Benchmark::RunPeers()
+    {
+        // Renderer peers are created with a data channel, same constraints here.
+        // Media streams are left out, they cost the same in both modes.
+        const int peerCounts[4] = { 1, 5, 10, 20 };
+
+        webrtc::PeerConnectionInterface::IceServer server;
+        server.uri = WebRTC::GetPeerConnectionString();
+        webrtc::PeerConnectionInterface::IceServers servers;
+        servers.push_back(server);
+        MediaConstraints constraints;
+        constraints.SetAllowRtpDataChannels();
+        NullPeerObserver observer;
+
+        // Also keeps SSL initialized for the per peer factories.
+        const int threadsAtStart = ConnectionFactory::ProcessThreadCount();
+        ConnectionFactory shared;
+        if (!shared.Factory())
+        {
+            QVariantMap results;
+            results["error"] = "Failed to create PeerConnectionFactory";
+            return results;
+        }
+
+        QVariantList runs;
+        for (int p=0; p<4; ++p)
+        {
+            const int peers = peerCounts[p];
+            QVariantMap run;
+            run["peers"] = peers;
+
+            for (int mode=0; mode<2; ++mode)
+            {
+                const bool sharedFactory = (mode == 1);
+                const int threadsBefore = ConnectionFactory::ProcessThreadCount();
+
+                std::vector<talk_base::scoped_refptr<webrtc::PeerConnectionFactoryInterface> > factories;
+                std::vector<talk_base::scoped_refptr<webrtc::PeerConnectionInterface> > connections;
+                double totalMs = 0.0, maxMs = 0.0;
+                int failed = 0;
+                for (int i=0; i<peers; ++i)
+                {
+                    tick_t start = GetCurrentClockTime();
+                    talk_base::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory = (sharedFactory ? 
+                        talk_base::scoped_refptr<webrtc::PeerConnectionFactoryInterface>(shared.Factory()) : webrtc::CreatePeerConnectionFactory());
+                    talk_base::scoped_refptr<webrtc::PeerConnectionInterface> connection;
+                    if (factory.get())
+                        connection = factory->CreatePeerConnection(servers, &constraints, NULL, &observer);
+                    const double ms = SecondsSince(start) * 1000.0;
+
+                    if (!connection.get())
+                        failed++;
+                    else if (sharedFactory)
+                        shared.RecordPeerCreated(ms);
+                    totalMs += ms;
+                    maxMs = qMax(maxMs, ms);
+                    factories.push_back(factory);
+                    connections.push_back(connection);
+                }
+                const int threadsAfter = ConnectionFactory::ProcessThreadCount();
+
+                // Connections first, the factories own the threads they run on.
+                connections.clear();
+                factories.clear();
+
+                QVariantMap result;
+                result["averagePeerCreateMs"] = totalMs / peers;
+                result["maxPeerCreateMs"] = maxMs;
+                result["failed"] = failed;
+                result["threadsBefore"] = threadsBefore;
+                result["threadsAfter"] = threadsAfter;
+                result["threadsAdded"] = (threadsBefore >= 0 && threadsAfter >= 0 ? threadsAfter - threadsBefore : -1);
+                run[sharedFactory ? "shared" : "perPeer"] = result;
+            }
+            runs << run;
+        }
+
+        QVariantMap results;
+        results["threadsAtStart"] = threadsAtStart;
+        results["sharedFactory"] = shared.Statistics();
+        results["runs"] = runs;
+        return results;
+    }
+
+    QVariantMap Benchmark::RunCapture()
+    {
+        // Frames larger than the negotiated 720p stream are scaled down by the capturer, like window captures are.
+        const int sizes[4][2] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+        const u32 fourccs[2] = { cricket::FOURCC_I420, cricket::FOURCC_NV12 };
+        const int numImages = 4;
+
+        QVariantList resolutions;
+        QVariantMap metrics;
+        for (int s=0; s<4; ++s)
+        {
+            // A few distinct frames so that consecutive frames differ, like in a moving scene.
+            QList<QImage> images;
+            for (int i=0; i<numImages; ++i)
+            {
+                QImage image(sizes[s][0], sizes[s][1], QImage::Format_ARGB32);
+                u32 seed = 0x9E3779B9u * static_cast<u32>(i + 1);
+                for (int y=0; y<image.height(); ++y)
+                {
+                    QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+                    for (int x=0; x<image.width(); ++x)
+                    {
+                        seed = seed * 1664525u + 1013904223u;
+                        line[x] = qRgb((x + i * 8) & 0xFF, (y + i * 8) & 0xFF, ((x ^ y) + (seed >> 29)) & 0xFF);
+                    }
+                }
+                images << image;
+            }
+
+            QVariantMap resolution;
+            resolution["width"] = sizes[s][0];
+            resolution["height"] = sizes[s][1];
+            for (int f=0; f<2; ++f)
+            {
+                const cricket::VideoFormat format(1280, 720, cricket::VideoFormat::FpsToInterval(30), fourccs[f]);
+                const QString formatName = (fourccs[f] == cricket::FOURCC_I420 ? "I420" : "NV12");
+
+                TundraCapturer capturer(plugin_->GetFramework());
+                capturer.Start(format);
+                FrameCountSink sink;
+                capturer.SignalFrameCaptured.connect(&sink, &FrameCountSink::OnFrameCaptured);
+
+                FrameBufferPool pool;
+                CaptureRun run(&capturer, &pool, images);
+
+                // Warm up the pools first, steady state allocations are what matters.
+                for (int i=0; i<numImages; ++i)
+                    run();
+                pool.ResetStats();
+                const FrameBufferPool::Statistics conversionBefore = capturer.ConversionStatistics();
+                const int framesBefore = sink.frames;
+
+                QVariantMap result = Measure(run, static_cast<double>(sizes[s][0] * sizes[s][1]));
+
+                const FrameBufferPool::Statistics input = pool.Stats();
+                const FrameBufferPool::Statistics conversion = capturer.ConversionStatistics();
+                const double frames = static_cast<double>(result["iterations"].toInt() + 1); // Measure() does one warm up call
+                const double nsPerFrame = result["msPerFrame"].toDouble() * 1000000.0;
+
+                result["nsPerFrame"] = nsPerFrame;
+                result["framesCaptured"] = sink.frames - framesBefore;
+                result["allFramesCaptured"] = (sink.frames - framesBefore == static_cast<int>(frames));
+                result["bytesCopiedPerFrame"] = static_cast<double>(input.bytesCopied + conversion.bytesCopied - conversionBefore.bytesCopied) / frames;
+                result["allocationsPerFrame"] = static_cast<double>(input.allocations + conversion.allocations - conversionBefore.allocations) / frames;
+                result["bytesAllocatedPerFrame"] = static_cast<double>(input.bytesAllocated + conversion.bytesAllocated - conversionBefore.bytesAllocated) / frames;
+                resolution[formatName] = result;
+
+                // Flat copy of the headline numbers for regression gating scripts.
+                const QString key = QString("capture.%1x%2.%3.").arg(sizes[s][0]).arg(sizes[s][1]).arg(formatName);
+                metrics[key + "fps"] = result["fps"];
+                metrics[key + "nsPerFrame"] = nsPerFrame;
+                metrics[key + "bytesCopiedPerFrame"] = result["bytesCopiedPerFrame"];
+                metrics[key + "allocationsPerFrame"] = result["allocationsPerFrame"];
+
+                capturer.Stop();
+            }
+            resolutions << resolution;
+        }
+
+        QVariantMap results;
+        results["streamWidth"] = 1280;
+        results["streamHeight"] = 720;
+        results["resolutions"] = resolutions;
+        results["metrics"] = metrics;
+        return results;
+    }
+
+    QVariantMap Benchmark::RunProtocol()
+    {
+        QList<ProtocolCorpusEntry> corpus = BuildProtocolCorpus();
+
+        ProtocolCorpusEntry recorded;
+        recorded.name = "recorded";
+        recorded.messages = RecordedCorpus();
+        if (!recorded.messages.isEmpty())
+            corpus << recorded;
+
+        QVariantMap types;
+        QVariantMap metrics;
+        QList<CloudRenderingProtocol::MessageType> dispatchTypes;
+        foreach(const ProtocolCorpusEntry &entry, corpus)
+        {
+            const double count = static_cast<double>(entry.messages.size());
+            qint64 corpusBytes = 0;
+            CloudRenderingProtocol::MessageSharedPtrList parsed;
+            foreach(const QByteArray &json, entry.messages)
+            {
+                corpusBytes += json.size();
+                CloudRenderingProtocol::MessageSharedPtr message = CloudRenderingProtocol::CreateMessageFromJSON(json);
+                if (!message.get())
+                    continue;
+                parsed << message;
+                dispatchTypes << message->Type();
+            }
+            if (parsed.isEmpty())
+                continue;
+
+            ProtocolParseRun parse(entry.messages);
+            QVariantMap parseResult = Measure(parse, count);
+            const int parseAllocations = CountAllocations(parse);
+            ProtocolSerializeRun serialize(parsed);
+            QVariantMap serializeResult = Measure(serialize, count);
+            const int serializeAllocations = CountAllocations(serialize);
+
+            QVariantMap type;
+            type["messages"] = entry.messages.size();
+            type["failedToParse"] = entry.messages.size() - parsed.size();
+            type["averageBytes"] = static_cast<double>(corpusBytes) / count;
+            const QVariantMap *results[2] = { &parseResult, &serializeResult };
+            const int allocations[2] = { parseAllocations, serializeAllocations };
+            const double allocationMessages[2] = { count, static_cast<double>(parsed.size()) };
+            const char *names[2] = { "parse", "serialize" };
+            for (int i=0; i<2; ++i)
+            {
+                const double ms = results[i]->value("msPerFrame").toDouble();
+                QVariantMap result;
+                result["iterations"] = results[i]->value("iterations");
+                result["messagesPerSecond"] = (ms > 0.0 ? count * 1000.0 / ms : 0.0);
+                result["nsPerMessage"] = ms * 1000000.0 / count;
+                if (allocations[i] >= 0)
+                    result["allocationsPerMessage"] = static_cast<double>(allocations[i]) / allocationMessages[i];
+                type[names[i]] = result;
+
+                const QString key = QString("protocol.%1.%2.").arg(entry.name).arg(names[i]);
+                metrics[key + "messagesPerSecond"] = result["messagesPerSecond"];
+                if (allocations[i] >= 0)
+                    metrics[key + "allocationsPerMessage"] = result["allocationsPerMessage"];
+            }
+            types[entry.name] = type;
+        }
+
+        // Message creation and handler dispatch over the whole corpus, the if/else chain
+        // and dynamic_cast switch used before vs. the creator table and MessageDispatcher.
+        QVariantMap dispatch;
+        if (!dispatchTypes.isEmpty())
+        {
+            const double count = static_cast<double>(dispatchTypes.size());
+            const char *names[2] = { "legacy", "table" };
+            double nsPerMessage[2] = { 0.0, 0.0 };
+            for (int i=0; i<2; ++i)
+            {
+                ProtocolDispatchRun run(dispatchTypes, i == 0);
+                QVariantMap measured = Measure(run, count);
+                const double ms = measured.value("msPerFrame").toDouble();
+                nsPerMessage[i] = ms * 1000000.0 / count;
+
+                QVariantMap result;
+                result["iterations"] = measured.value("iterations");
+                result["messagesPerSecond"] = (ms > 0.0 ? count * 1000.0 / ms : 0.0);
+                result["nsPerMessage"] = nsPerMessage[i];
+                result["unhandled"] = run.unhandled;
+                dispatch[names[i]] = result;
+
+                const QString key = QString("protocol.dispatch.%1.").arg(names[i]);
+                metrics[key + "nsPerMessage"] = result["nsPerMessage"];
+                metrics[key + "messagesPerSecond"] = result["messagesPerSecond"];
+            }
+            dispatch["messages"] = dispatchTypes.size();
+            dispatch["speedup"] = (nsPerMessage[1] > 0.0 ? nsPerMessage[0] / nsPerMessage[1] : 0.0);
+            metrics["protocol.dispatch.speedup"] = dispatch["speedup"];
+        }
+
+        // IMessage objects vs. value messages for the high rate message types.
+        QVariantMap values;
+        foreach(const ProtocolCorpusEntry &entry, corpus)
+        {
+            if (entry.name == CloudRenderingProtocol::IceCandidates)
+                values[entry.name] = MeasureValueMessages<CloudRenderingProtocol::Signaling::IceCandidatesValue,
+                    CloudRenderingProtocol::Signaling::IceCandidatesMessage>(entry.name, entry.messages, metrics);
+            else if (entry.name == CloudRenderingProtocol::RoomCustom)
+                values[entry.name] = MeasureValueMessages<CloudRenderingProtocol::Application::RoomCustomValue,
+                    CloudRenderingProtocol::Application::RoomCustomMessage>(entry.name, entry.messages, metrics);
+            else if (entry.name == CloudRenderingProtocol::PeerCustom)
+                values[entry.name] = MeasureValueMessages<CloudRenderingProtocol::Application::PeerCustomValue,
+                    CloudRenderingProtocol::Application::PeerCustomMessage>(entry.name, entry.messages, metrics);
+        }
+
+        // Generic QVariantMap parse vs. the streaming fast path of the hot message types.
+        QVariantMap fast;
+        foreach(const ProtocolCorpusEntry &entry, corpus)
+        {
+            if (entry.name == CloudRenderingProtocol::IceCandidates)
+                fast[entry.name] = MeasureFastParse<CloudRenderingProtocol::Signaling::IceCandidatesValue>(entry.name, entry.messages, metrics);
+            else if (entry.name == CloudRenderingProtocol::PeerCustom)
+                fast[entry.name] = MeasureFastParse<CloudRenderingProtocol::Application::PeerCustomValue>(entry.name, entry.messages, metrics);
+        }
+
+        QVariantMap results;
+        results["types"] = types;
+        results["dispatch"] = dispatch;
+        results["values"] = values;
+        results["fast"] = fast;
+        results["metrics"] = metrics;
+        results["note"] = "Allocation counts are the malloc, calloc and realloc calls of one pass over the corpus after the timed runs, "
+            "they are left out where the glibc malloc hooks are not available.";
+        return results;
+    }
+
+    QVariantMap Benchmark::RunInput()
+    {
+        QVariantMap results;
+        if (QApplication::type() == QApplication::Tty)
+        {
+            results["error"] = "Input injection needs a GUI QApplication";
+            return results;
+        }
+
+        // Each JSON stream is replayed as is and encoded as binary input events.
+        QList<QPair<QString, QList<QByteArray> > > streams;
+        QList<QByteArray> synthetic = BuildInputStream();
+        streams << qMakePair(QString("synthetic"), synthetic);
+        streams << qMakePair(QString("synthetic.binary"), ToBinaryInputStream(synthetic));
+        QList<QByteArray> recorded;
+        foreach(const QByteArray &json, RecordedCorpus())
+            if (json.contains("PeerCustomMessage"))
+                recorded << json;
+        if (!recorded.isEmpty())
+        {
+            streams << qMakePair(QString("recorded"), recorded);
+            streams << qMakePair(QString("recorded.binary"), ToBinaryInputStream(recorded));
+        }
+
+        InputBenchmarkView view;
+        InputInjector injector;
+
+        QVariantMap metrics;
+        for (int s=0; s<streams.size(); ++s)
+        {
+            const QList<QByteArray> &messages = streams[s].second;
+            const bool binary = streams[s].first.endsWith(".binary");
+            if (messages.isEmpty())
+                continue;
+
+            qint64 bytes = 0;
+            for (int i=0; i<messages.size(); ++i)
+                bytes += messages[i].size();
+
+            // Decode alone, warm up then decode for at least a quarter second.
+            u64 decoded = 0;
+            for (int i=0; i<messages.size(); ++i)
+                decoded += DecodeInputMessage(messages[i], binary);
+            u64 decodes = 0;
+            tick_t decodeStart = GetCurrentClockTime();
+            while(decodes == 0 || SecondsSince(decodeStart) < 0.25)
+            {
+                for (int i=0; i<messages.size(); ++i)
+                    decoded += DecodeInputMessage(messages[i], binary);
+                decodes += messages.size();
+            }
+            const double decodeSeconds = SecondsSince(decodeStart);
+
+            // Warm up, then replay for at least a second.
+            for (int i=0; i<messages.size(); ++i)
+            {
+                if (binary)
+                    ReplayBinaryInput(injector, view, messages[i]);
+                else
+                    ReplayInputMessage(injector, view, messages[i]);
+            }
+
+            std::vector<double> latencies;
+            latencies.reserve(messages.size() * 16);
+            u64 replayed = 0, delivered = 0;
+            tick_t start = GetCurrentClockTime();
+            while(replayed == 0 || SecondsSince(start) < 1.0)
+            {
+                for (int i=0; i<messages.size(); ++i)
+                {
+                    // Receive time is taken before parsing, as the data channel hands over the raw message.
+                    tick_t received = GetCurrentClockTime();
+                    if (binary ? ReplayBinaryInput(injector, view, messages[i]) : ReplayInputMessage(injector, view, messages[i]))
+                    {
+                        latencies.push_back(TicksToMs(view.lastDelivery - received) * 1000.0);
+                        delivered++;
+                    }
+                    replayed++;
+                }
+            }
+            const double seconds = SecondsSince(start);
+            injector.Reset();
+
+            QVariantMap stream;
+            stream["messages"] = messages.size();
+            stream["bytesPerMessage"] = static_cast<double>(bytes) / static_cast<double>(messages.size());
+            stream["decodeNsPerMessage"] = decodeSeconds * 1000000000.0 / static_cast<double>(decodes);
+            stream["decodeChecksum"] = static_cast<qulonglong>(decoded); // Keeps the decode loop from being optimized away.
+            stream["replayed"] = static_cast<qulonglong>(replayed);
+            stream["delivered"] = static_cast<qulonglong>(delivered);
+            const double eventsPerSecond = (seconds > 0.0 ? static_cast<double>(replayed) / seconds : 0.0);
+            stream["eventsPerSecond"] = eventsPerSecond;
+            // Browsers send mouse moves at the display rate, about 60 per second for an active user.
+            stream["interactiveUsersAt60Hz"] = eventsPerSecond / 60.0;
+            if (!latencies.empty())
+            {
+                std::sort(latencies.begin(), latencies.end());
+                stream["latencyP50Us"] = latencies[latencies.size() / 2];
+                stream["latencyP99Us"] = latencies[qMin(latencies.size() - 1, latencies.size() * 99 / 100)];
+                stream["latencyMaxUs"] = latencies.back();
+            }
+            results[streams[s].first] = stream;
+
+            const QString key = QString("input.%1.").arg(streams[s].first);
+            metrics[key + "eventsPerSecond"] = stream["eventsPerSecond"];
+            metrics[key + "latencyP50Us"] = stream["latencyP50Us"];
+            metrics[key + "latencyP99Us"] = stream["latencyP99Us"];
+            metrics[key + "bytesPerMessage"] = stream["bytesPerMessage"];
+            metrics[key + "decodeNsPerMessage"] = stream["decodeNsPerMessage"];
+        }
+        results["metrics"] = metrics;
+        return results;
+    }
+
+    QVariantMap Benchmark::RunSignaling()
+    {
+        QVariantMap results;
+        const u16 port = 9102;
+        const int roundTrips = 500;
+        const int burst = 200;
+
+        LocalService service(port);
+        if (!service.Start())
+        {
+            results["error"] = QString("Failed to start the local service on port %1").arg(port);
+            return results;
+        }
+
+        // Both ends are in this process, the main loop only runs while waiting here.
+        SignalingProbe probe(plugin_, service.Host(), roundTrips, burst);
+        QEventLoop loop;
+        connect(&probe, SIGNAL(Finished()), &loop, SLOT(quit()));
+        QTimer::singleShot(30000, &loop, SLOT(quit()));
+        tick_t start = GetCurrentClockTime();
+        probe.Start();
+        loop.exec();
+        const double seconds = SecondsSince(start);
+
+        if (probe.roundTripsMs.size() < static_cast<size_t>(roundTrips) || probe.burstMs < 0.0 || probe.iceBurstMs < 0.0)
+            results["error"] = (!probe.Error().isEmpty() ? probe.Error() : QString("Timed out after %1 of %2 round trips").arg(probe.roundTripsMs.size()).arg(roundTrips));
+        else
+        {
+            // Idle with both connections open. The WebSocket threads and the service block in their
+            // io_service, so the only context switches left are from the rest of the process.
+            const long switchesBefore = ProcessContextSwitches();
+            if (switchesBefore >= 0)
+            {
+                QEventLoop idle;
+                QTimer::singleShot(1000, &idle, SLOT(quit()));
+                tick_t idleStart = GetCurrentClockTime();
+                idle.exec();
+                const double idleSeconds = SecondsSince(idleStart);
+                const long switches = ProcessContextSwitches() - switchesBefore;
+                results["idleContextSwitchesPerSecond"] = (idleSeconds > 0.0 ? static_cast<double>(switches) / idleSeconds : 0.0);
+            }
+            else
+                results["idleContextSwitchesPerSecond"] = "unavailable";
+        }
+
+        std::vector<double> sorted = probe.roundTripsMs;
+        if (!sorted.empty())
+        {
+            std::sort(sorted.begin(), sorted.end());
+            results["roundTrips"] = static_cast<int>(sorted.size());
+            results["roundTripP50Ms"] = sorted[sorted.size() / 2];
+            results["roundTripP99Ms"] = sorted[qMin(sorted.size() - 1, sorted.size() * 99 / 100)];
+            results["roundTripMaxMs"] = sorted.back();
+            // A round trip is two relayed messages, client to renderer and back.
+            results["messageLatencyMaxMs"] = sorted.back() / 2.0;
+        }
+        // Inbound handoff stress test.
+        {
+            const int messages = 100000;
+            HandoffProbe handoff(messages);
+            QEventLoop handoffLoop;
+            connect(&handoff, SIGNAL(Finished()), &handoffLoop, SLOT(quit()));
+            QTimer::singleShot(30000, &handoffLoop, SLOT(quit()));
+            tick_t handoffStart = GetCurrentClockTime();
+            handoff.start();
+            handoffLoop.exec();
+            const double handoffSeconds = SecondsSince(handoffStart);
+            handoff.wait();
+
+            QVariantMap result;
+            result["messages"] = messages;
+            result["received"] = handoff.received;
+            result["outOfOrder"] = handoff.outOfOrder;
+            result["wakeups"] = handoff.wakeups;
+            result["wakeupsPerMessage"] = (handoff.received > 0 ? static_cast<double>(handoff.wakeups) / handoff.received : 0.0);
+            result["messagesPerSecond"] = (handoffSeconds > 0.0 ? handoff.received / handoffSeconds : 0.0);
+            results["handoff"] = result;
+            if (handoff.received != messages || handoff.outOfOrder > 0)
+                results["error"] = QString("Handoff delivered %1 of %2 messages, %3 out of order").arg(handoff.received).arg(messages).arg(handoff.outOfOrder);
+        }
+
+        results["burstMessages"] = burst;
+        results["burstMs"] = probe.burstMs;
+        results["iceBurstCandidates"] = burst;
+        results["iceBurstMessagesReceived"] = probe.iceMessagesReceived;
+        results["iceBurstMs"] = probe.iceBurstMs;
+        results["outbound"] = probe.OutboundStatistics();
+        results["seconds"] = seconds;
+        results["service"] = service.Statistics();
+        service.Stop();
+
+        QVariantMap metrics;
+        metrics["signaling.roundTripP50Ms"] = results.value("roundTripP50Ms");
+        metrics["signaling.roundTripP99Ms"] = results.value("roundTripP99Ms");
+        metrics["signaling.messageLatencyMaxMs"] = results.value("messageLatencyMaxMs");
+        metrics["signaling.idleContextSwitchesPerSecond"] = results.value("idleContextSwitchesPerSecond");
+        metrics["signaling.burstMs"] = results.value("burstMs");
+        metrics["signaling.handoff.messagesPerSecond"] = results.value("handoff").toMap().value("messagesPerSecond");
+        metrics["signaling.handoff.wakeupsPerMessage"] = results.value("handoff").toMap().value("wakeupsPerMessage");
+        const QVariantMap clientOutbound = results.value("outbound").toMap().value("client").toMap();
+        metrics["signaling.outbound.messagesPerDrain"] = clientOutbound.value("messagesPerDrain");
+        metrics["signaling.outbound.merged"] = clientOutbound.value("merged");
+        metrics["signaling.iceBurst.messagesPerCandidate"] = (burst > 0 ? static_cast<double>(probe.iceMessagesReceived) / burst : 0.0);
+        metrics["signaling.outbound.latencyMaxMs"] = clientOutbound.value("latencyMaxMs");
+        metrics["signaling.outbound.maxDepth"] = clientOutbound.value("maxDepth");
+        results["metrics"] = metrics;
+        return results;
+    }
+
+    // SignalingProbe
+
+    SignalingProbe::SignalingProbe(CloudRenderingPlugin *plugin, const QString &host, int roundTrips, int burst) :
+        burstMs(-1.0),
+        iceBurstMs(-1.0),
+        iceMessagesReceived(0),
+        host_(host),
+        roundTrips_(roundTrips),
+        burst_(burst),
+        burstReceived_(0),
+        iceCandidatesReceived_(0),
+        sent_(0),
+        renderer_(new WebSocketClient(plugin)),
+        client_(new WebSocketClient(plugin))
+    {
+        roundTripsMs.reserve(roundTrips);
+        connect(renderer_, SIGNAL(Connected()), this, SLOT(OnRendererConnected()));
+        connect(renderer_, SIGNAL(ConnectingFailed()), this, SLOT(OnConnectingFailed()));
+        connect(renderer_, SIGNAL(Message(CloudRenderingProtocol::MessageSharedPtr)), this, SLOT(OnRendererMessage(CloudRenderingProtocol::MessageSharedPtr)));
+        connect(client_, SIGNAL(Connected()), this, SLOT(OnClientConnected()));
+        connect(client_, SIGNAL(ConnectingFailed()), this, SLOT(OnConnectingFailed()));
+        connect(client_, SIGNAL(Message(CloudRenderingProtocol::MessageSharedPtr)), this, SLOT(OnClientMessage(CloudRenderingProtocol::MessageSharedPtr)));
+    }
+
+    SignalingProbe::~SignalingProbe()
+    {
+        SAFE_DELETE(client_);
+        SAFE_DELETE(renderer_);
+    }
+
+    void SignalingProbe::Start()
+    {
+        renderer_->Connect(host_);
+    }
+
+    QString SignalingProbe::Error() const
+    {
+        return error_;
+    }
+
+    QVariantMap SignalingProbe::OutboundStatistics() const
+    {
+        QVariantMap stats;
+        stats["client"] = client_->OutboundStatistics();
+        stats["renderer"] = renderer_->OutboundStatistics();
+        return stats;
+    }
+
+    void SignalingProbe::Fail(const QString &error)
+    {
+        error_ = error;
+        emit Finished();
+    }
+
+    void SignalingProbe::OnRendererConnected()
+    {
+        CloudRenderingProtocol::State::RegistrationMessage message(CloudRenderingProtocol::State::RegistrationMessage::R_Renderer);
+        renderer_->Send(&message);
+    }
+
+    void SignalingProbe::OnClientConnected()
+    {
+        CloudRenderingProtocol::State::RegistrationMessage message(CloudRenderingProtocol::State::RegistrationMessage::R_Client, roomId_);
+        client_->Send(&message);
+    }
+
+    void SignalingProbe::OnConnectingFailed()
+    {
+        Fail("Failed to connect to " + host_);
+    }
+
+    void SignalingProbe::OnRendererMessage(CloudRenderingProtocol::MessageSharedPtr message)
+    {
+        if (message->Type() == CloudRenderingProtocol::MT_RoomAssigned)
+        {
+            CloudRenderingProtocol::Room::RoomAssignedMessage *assigned = static_cast<CloudRenderingProtocol::Room::RoomAssignedMessage*>(message.get());
+            roomId_ = assigned->roomId;
+            client_->Connect(host_);
+        }
+        else if (message->Type() == CloudRenderingProtocol::MT_RoomCustomMessage)
+        {
+            CloudRenderingProtocol::Application::RoomCustomValue ping = static_cast<CloudRenderingProtocol::Application::RoomCustomMessage*>(message.get())->Value();
+            CloudRenderingProtocol::Application::RoomCustomValue pong(QVariantList() << ping.sender, ping.payload);
+            renderer_->Send(pong);
+        }
+        else if (message->Type() == CloudRenderingProtocol::MT_IceCandidates)
+        {
+            iceMessagesReceived++;
+            iceCandidatesReceived_ += static_cast<CloudRenderingProtocol::Signaling::IceCandidatesMessage*>(message.get())->iceCandidates.size();
+            if (iceCandidatesReceived_ == burst_)
+            {
+                iceBurstMs = SecondsSince(sent_) * 1000.0;
+                emit Finished();
+            }
+        }
+    }
+
+    void SignalingProbe::OnClientMessage(CloudRenderingProtocol::MessageSharedPtr message)
+    {
+        if (message->Type() == CloudRenderingProtocol::MT_RoomAssigned)
+            SendPing();
+        else if (message->Type() == CloudRenderingProtocol::MT_RoomCustomMessage)
+        {
+            if (static_cast<int>(roundTripsMs.size()) >= roundTrips_)
+            {
+                if (++burstReceived_ == burst_)
+                {
+                    burstMs = SecondsSince(sent_) * 1000.0;
+                    SendIceBurst();
+                }
+                return;
+            }
+            roundTripsMs.push_back(SecondsSince(sent_) * 1000.0);
+            if (static_cast<int>(roundTripsMs.size()) < roundTrips_)
+                SendPing();
+            else if (burst_ > 0)
+                SendBurst();
+            else
+            {
+                burstMs = 0.0;
+                iceBurstMs = 0.0;
+                emit Finished();
+            }
+        }
+    }
+
+    void SignalingProbe::SendBurst()
+    {
+        sent_ = GetCurrentClockTime();
+        for (int i=0; i<burst_; ++i)
+        {
+            QVariantMap payload;
+            payload["sequence"] = roundTrips_ + i;
+            CloudRenderingProtocol::Application::RoomCustomValue message(QVariantList() << QString("renderer"), payload);
+            if (!client_->Send(message))
+            {
+                Fail("Failed to send RoomCustomMessage");
+                return;
+            }
+        }
+    }
+
+    void SignalingProbe::SendIceBurst()
+    {
+        sent_ = GetCurrentClockTime();
+        for (int i=0; i<burst_; ++i)
+        {
+            WebRTC::ICECandidateList candidates;
+            candidates << WebRTC::ICECandidate(0, "video", QString("a=candidate:%1 1 udp 2122260223 192.168.0.196 %2 typ host generation 0").arg(i).arg(40000 + i));
+            CloudRenderingProtocol::Signaling::IceCandidatesValue message("renderer", candidates);
+            if (!client_->Send(message))
+            {
+                Fail("Failed to send IceCandidatesMessage");
+                return;
+            }
+        }
+    }
+
+    void SignalingProbe::SendPing()
+    {
+        QVariantMap payload;
+        payload["sequence"] = static_cast<int>(roundTripsMs.size());
+        CloudRenderingProtocol::Application::RoomCustomValue ping(QVariantList() << QString("renderer"), payload);
+        sent_ = GetCurrentClockTime();
+        if (!client_->Send(ping))
+            Fail("Failed to send RoomCustomMessage");
+    }
+
+    QVariantMap Benchmark::RunReconnect()
+    {
+        QVariantMap results;
+        const u16 port = 9103;
+        const int downtimeMsec = 500;
+
+        QScopedPointer<LocalService> service(new LocalService(port));
+        if (!service->Start())
+        {
+            results["error"] = QString("Failed to start the local service on port %1").arg(port);
+            return results;
+        }
+
+        // A real renderer and client as in the loopback benchmark, the peer connection runs over the loopback interface.
+        QScopedPointer<Renderer> renderer(new Renderer(plugin_, service->Host()));
+        QScopedPointer<Client> client(new Client(plugin_));
+
+        tick_t start = GetCurrentClockTime();
+        while (renderer->Room().id.isEmpty() && SecondsSince(start) < 10.0)
+            RunEventLoop(10);
+        const QString roomId = renderer->Room().id;
+        if (roomId.isEmpty())
+        {
+            results["error"] = QString("Renderer was not assigned a room on %1").arg(service->Host());
+            return results;
+        }
+
+        client->Connect(service->Host(), roomId);
+        start = GetCurrentClockTime();
+        while (renderer->ReconnectStatistics().value("peersConnected").toInt() == 0 && SecondsSince(start) < 30.0)
+            RunEventLoop(10);
+        results["peerConnectMs"] = SecondsSince(start) * 1000.0;
+        if (renderer->ReconnectStatistics().value("peersConnected").toInt() == 0)
+        {
+            results["error"] = "Client peer connection to the renderer was not established";
+            return results;
+        }
+
+        // Renderer connection dropped by the service, the room is resumed and the peer kept.
+        {
+            const QVariantMap before = renderer->ReconnectStatistics();
+            start = GetCurrentClockTime();
+            service->DropRenderers();
+            while (renderer->ReconnectStatistics().value("resumes") == before.value("resumes") &&
+                renderer->ReconnectStatistics().value("roomsLost") == before.value("roomsLost") && SecondsSince(start) < 10.0)
+                RunEventLoop(5);
+            const QVariantMap after = renderer->ReconnectStatistics();
+
+            QVariantMap drop;
+            drop["recoverMs"] = SecondsSince(start) * 1000.0;
+            drop["rendererRecoveryMs"] = after.value("lastRecoveryMs");
+            drop["resumed"] = (after.value("resumes").toULongLong() > before.value("resumes").toULongLong() && renderer->Room().id == roomId);
+            drop["peersKept"] = after.value("peersKept");
+            drop["attempts"] = after.value("reconnectAttempts").toULongLong() - before.value("reconnectAttempts").toULongLong();
+            results["drop"] = drop;
+            if (!after.value("connected").toBool())
+                results["error"] = "Renderer did not recover from a dropped connection";
+            else if (!drop["resumed"].toBool() || drop["peersKept"].toInt() == 0)
+                results["error"] = QString("Renderer was not resumed to room %1 with its client peer").arg(roomId);
+        }
+
+        // Service killed and restarted, there is nothing to resume.
+        if (!results.contains("error"))
+        {
+            const QVariantMap before = renderer->ReconnectStatistics();
+            results["serviceBeforeRestart"] = service->Statistics();
+            start = GetCurrentClockTime();
+            service.reset();
+            RunEventLoop(downtimeMsec);
+
+            service.reset(new LocalService(port));
+            tick_t restarted = GetCurrentClockTime();
+            if (!service->Start())
+                results["error"] = QString("Failed to restart the local service on port %1").arg(port);
+            else
+            {
+                while (renderer->ReconnectStatistics().value("roomsLost") == before.value("roomsLost") && SecondsSince(start) < 30.0)
+                    RunEventLoop(5);
+                const QVariantMap after = renderer->ReconnectStatistics();
+
+                QVariantMap restart;
+                restart["downtimeMs"] = downtimeMsec;
+                restart["recoverMs"] = SecondsSince(start) * 1000.0;
+                restart["afterRestartMs"] = SecondsSince(restarted) * 1000.0;
+                restart["rendererRecoveryMs"] = after.value("lastRecoveryMs");
+                restart["resumed"] = (after.value("resumes").toULongLong() > before.value("resumes").toULongLong());
+                restart["attempts"] = after.value("reconnectAttempts").toULongLong() - before.value("reconnectAttempts").toULongLong();
+                results["restart"] = restart;
+                if (after.value("roomsLost") == before.value("roomsLost") || !after.value("connected").toBool())
+                    results["error"] = "Renderer did not recover from a service restart";
+            }
+        }
+        results["renderer"] = renderer->ReconnectStatistics();
+        if (service->isRunning())
+            results["service"] = service->Statistics();
+        client.reset();
+        renderer.reset();
+        service->Stop();
+
+        QVariantMap metrics;
+        metrics["reconnect.drop.recoverMs"] = results.value("drop").toMap().value("recoverMs");
+        metrics["reconnect.drop.resumed"] = results.value("drop").toMap().value("resumed");
+        metrics["reconnect.drop.peersKept"] = results.value("drop").toMap().value("peersKept");
+        metrics["reconnect.restart.recoverMs"] = results.value("restart").toMap().value("recoverMs");
+        metrics["reconnect.restart.afterRestartMs"] = results.value("restart").toMap().value("afterRestartMs");
+        metrics["reconnect.restart.attempts"] = results.value("restart").toMap().value("attempts");
+        results["metrics"] = metrics;
+        return results;
+    }
+
+    // HandoffProbe
+
+    HandoffProbe::HandoffProbe(int messages) :
+        received(0),
+        outOfOrder(0),
+        wakeups(0)
+    {
+        messages_.reserve(messages);
+        for (int i=0; i<messages; ++i)
+            messages_.push_back(CloudRenderingProtocol::MessageSharedPtr(new CloudRenderingProtocol::Application::RoomCustomMessage()));
+        connect(this, SIGNAL(NewMessages()), this, SLOT(OnNewMessages()), Qt::QueuedConnection);
+    }
+
+    void HandoffProbe::run()
+    {
+        for (size_t i=0; i<messages_.size(); ++i)
+            if (queue_.Push(messages_[i]))
+                emit NewMessages();
+    }
+
+    void HandoffProbe::OnNewMessages()
+    {
+        wakeups++;
+        queue_.BeginDrain();
+        CloudRenderingProtocol::MessageSharedPtr message;
+        while (queue_.Pop(message))
+        {
+            if (static_cast<size_t>(received) >= messages_.size() || message.get() != messages_[received].get())
+                outOfOrder++;
+            received++;
+        }
+        if (static_cast<size_t>(received) == messages_.size())
+            emit Finished();
+    }
+
+    QList<QByteArray> Benchmark::RecordedCorpus() const
+    {
+        QList<QByteArray> messages;
+        QStringList corpusParam = plugin_->GetFramework()->CommandLineParameters("--cloudRenderingBenchmarkCorpus");
+        if (corpusParam.isEmpty())
+            return messages;
+
+        QFile file(corpusParam.first());
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            LogError(LC + "Failed to open corpus " + corpusParam.first() + ": " + file.errorString());
+            return messages;
+        }
+        foreach(const QByteArray &line, file.readAll().split('\n'))
+            if (!line.trimmed().isEmpty())
+                messages << line.trimmed();
+        return messages;
+    }
+
+    void Benchmark::WriteReport(const QVariantMap &report)
+    {
+        QByteArray json = TundraJson::Serialize(report, TundraJson::IndentFull);
+        QStringList output = plugin_->GetFramework()->CommandLineParameters("--cloudRenderingBenchmarkOutput");
+        if (output.isEmpty())
+        {
+            LogInfo(LC + "Results" + "\n" + QString::fromUtf8(json));
+            return;
+        }
+
+        QFile file(output.first());
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            LogError(LC + "Failed to open " + output.first() + " for writing: " + file.errorString());
+            LogInfo(LC + "Results" + "\n" + QString::fromUtf8(json));
+            return;
+        }
+        file.write(json);
+        file.close();
+        LogInfo(LC + "Results written to " + output.first());
+    }
+}
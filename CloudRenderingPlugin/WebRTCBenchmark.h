@@ -0,0 +1,205 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+#include "CloudRenderingProtocol.h"
+#include "HighPerfClock.h"
+#include "WebRTCSpscQueue.h"
+
+#include <QObject>
+#include <QThread>
+#include <QStringList>
+#include <QVariant>
+
+#include <vector>
+
+namespace WebRTC
+{
+    /// Built in performance benchmarks.
+    /** Started with --cloudRenderingBenchmark [suite,suite,...|all]. The requested suites are run
+        once the main loop is up, the results are written as JSON to the file given with
+        --cloudRenderingBenchmarkOutput <file> or to the log, after which Tundra exits. If a suite reports an
+        error Tundra exits with a non-zero exit code.
+        None of the suites need a window or a GPU, they can be run with --headless. The input suite
+        creates widgets that are never shown, so on Linux it needs a X display, eg. Xvfb.
+
+        Available suites:
+        - conversion: ARGB to I420/NV12 color conversion for each supported kernel implementation. The output of each
+          kernel is compared to the scalar implementation, also for odd sizes, and a mismatch fails the suite.
+        - workers: Band parallel conversion and scaling with different worker thread counts.
+        - broadcast: Capture pipeline cost per frame for a growing peer count, one capturer per peer vs. one shared capturer.
+        - capture: TundraCapturer frame path with synthetic QImage frames from 480p to 4K, copy and allocation counters per frame.
+        - protocol: CloudRenderingProtocol message parsing and serialization over a corpus of signaling, room and input messages,
+          with the heap allocations per message where glibc malloc hooks are available.
+          Messages recorded from a live session can be added with --cloudRenderingBenchmarkCorpus <file>, one JSON message per line.
+          Message creation and handler dispatch is measured over the corpus both with the creator table and MessageDispatcher
+          and with the if/else chain and dynamic_cast switch they replaced. ICE candidate, room custom and peer custom
+          messages are received and sent both as IMessage objects and as value messages, with the heap allocations per message.
+          ICE candidate and peer custom input messages are parsed both through the QVariantMap tree and the streaming JsonReader fast path.
+        - input: Browser input events from data channel message to widget delivery through InputInjector with a
+          stand-in view, events per second and p50/p99 latency. PeerCustomMessage input events of the corpus are replayed too.
+          Each stream is also replayed as CloudRenderingProtocol::BinaryInput events, message size and decode cost are reported for both.
+        - peers: Peer connection creation latency and process thread count, one factory per peer vs. the shared ConnectionFactory.
+        - signaling: WebSocketClient message latency through a LocalService relay on port 9102, a renderer and a client
+          bounce RoomCustomMessages, p50/p99/max round trip. Then a burst of messages at once for the outbound queue
+          drains per message and queue latency. A burst of single candidate ICE messages for the merged messages per candidate. Context switches of the idle process with both connections open, not available on Windows.
+          The inbound handoff of WebSocketThread is stress tested with 100k messages from a producer thread,
+          ordering, throughput and wakeup signals per message.
+        - reconnect: Time to recover the renderer service connection against a LocalService on port 9103, with a Renderer
+          and a Client that have a peer connection over the loopback interface. The service first drops the renderer
+          connection, the renderer reconnects, resumes its room with the resume token and keeps the connected peer.
+          Then the service is killed and restarted after 500 ms, the renderer reconnects with backoff and is
+          assigned a new room as the restarted service has no memory of the old one. Renderer::ReconnectStatistics()
+          is reported for both. */
+    class CLOUDRENDERING_API Benchmark : public QObject
+    {
+        Q_OBJECT
+
+    public:
+        Benchmark(CloudRenderingPlugin *plugin);
+        ~Benchmark();
+        
+        /// Returns names of all available suites.
+        static QStringList Suites();
+
+    public slots:
+        /// Runs the suites requested from the command line, writes the report and exits.
+        void Run();
+
+        /// Runs a single suite and returns its results.
+        /** @return Results or an empty map if @c name is not a known suite. */
+        QVariantMap RunSuite(const QString &name);
+
+        /// Writes @c report as JSON to --cloudRenderingBenchmarkOutput <file> or to the log.
+        void WriteReport(const QVariantMap &report);
+
+    private:
+        QVariantMap RunConversion();
+        QVariantMap RunWorkers();
+        QVariantMap RunBroadcast();
+        QVariantMap RunPeers();
+        QVariantMap RunCapture();
+        QVariantMap RunProtocol();
+        QVariantMap RunInput();
+        QVariantMap RunSignaling();
+        QVariantMap RunReconnect();
+
+        /// Returns the messages of --cloudRenderingBenchmarkCorpus, one JSON message per line.
+        QList<QByteArray> RecordedCorpus() const;
+
+        /// Returns the suites given with --cloudRenderingBenchmark.
+        QStringList RequestedSuites() const;
+
+        QString LC;
+        CloudRenderingPlugin *plugin_;
+    };
+
+    /// @cond PRIVATE
+
+    /// Renderer and client WebSocketClient pair of the signaling suite.
+    /** Registers both to the same room, then the client sends RoomCustomMessages to the renderer
+        which sends each one straight back. One message is in flight at a time. After the round trips
+        the client sends a burst of messages at once, which exercises the outbound queue draining.
+        Last the client sends a burst of single candidate IceCandidates messages to the renderer,
+        which the outbound queue drain merges. */
+    class SignalingProbe : public QObject
+    {
+        Q_OBJECT
+
+    public:
+        SignalingProbe(CloudRenderingPlugin *plugin, const QString &host, int roundTrips, int burst);
+        ~SignalingProbe();
+
+        /// Connects the renderer, Finished() is emitted once all round trips are done or on error.
+        void Start();
+
+        /// Returns the error, empty if none.
+        QString Error() const;
+
+        /// Returns the outbound queue statistics of the client and the renderer connection.
+        QVariantMap OutboundStatistics() const;
+
+        /// Round trip times in milliseconds.
+        std::vector<double> roundTripsMs;
+
+        /// Milliseconds from sending the burst to receiving all of it back, negative if not done.
+        double burstMs;
+
+        /// Milliseconds from sending the ICE burst to the renderer receiving all candidates, negative if not done.
+        double iceBurstMs;
+
+        /// Number of IceCandidates messages the renderer received for the ICE burst.
+        int iceMessagesReceived;
+
+    signals:
+        void Finished();
+
+    private slots:
+        void OnRendererConnected();
+        void OnClientConnected();
+        void OnConnectingFailed();
+        void OnRendererMessage(CloudRenderingProtocol::MessageSharedPtr message);
+        void OnClientMessage(CloudRenderingProtocol::MessageSharedPtr message);
+
+    private:
+        void SendPing();
+        void SendBurst();
+        void SendIceBurst();
+        void Fail(const QString &error);
+
+        QString host_;
+        int roundTrips_;
+        int burst_;
+        int burstReceived_;
+        int iceCandidatesReceived_;
+        QString roomId_;
+        QString error_;
+        tick_t sent_;
+        WebSocketClient *renderer_;
+        WebSocketClient *client_;
+    };
+
+    /// Producer thread of the signaling suite handoff stress test.
+    /** Pushes pre-created messages through the same SpscQueue and wakeup signal WebSocketThread uses,
+        the main thread drains them and checks they arrive in order. */
+    class HandoffProbe : public QThread
+    {
+        Q_OBJECT
+
+    public:
+        explicit HandoffProbe(int messages);
+
+        /// Messages received in the main thread.
+        int received;
+        /// Messages that were not the next one expected.
+        int outOfOrder;
+        /// NewMessages() signals handled.
+        int wakeups;
+
+    signals:
+        void NewMessages();
+        void Finished();
+
+    protected:
+        /// QThread override.
+        void run();
+
+    private slots:
+        void OnNewMessages();
+
+    private:
+        std::vector<CloudRenderingProtocol::MessageSharedPtr> messages_;
+        SpscQueue<CloudRenderingProtocol::MessageSharedPtr> queue_;
+    };
+
+    /// @endcond
+}
@@ -0,0 +1,77 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "WebRTCBroadcastSource.h"
+#include "WebRTCTundraCapturer.h"
+#include "WebRTCConnectionFactory.h"
+#include "CloudRenderingPlugin.h"
+
+#include "Framework.h"
+#include "LoggingFunctions.h"
+
+#include "talk/app/webrtc/videosourceinterface.h"
+
+namespace WebRTC
+{
+    BroadcastSource::BroadcastSource(Framework *framework) :
+        LC("[WebRTC::BroadcastSource]: "),
+        framework_(framework),
+        tracks_(0)
+    {
+        CloudRenderingPlugin *plugin = framework_->Module<CloudRenderingPlugin>();
+        WebRTCConnectionFactoryPtr connectionFactory = (plugin ? plugin->ConnectionFactory() : WebRTCConnectionFactoryPtr());
+        if (connectionFactory.get())
+            factory_ = connectionFactory->Factory();
+        if (!factory_.get())
+            LogError(LC + "Shared PeerConnectionFactory not available!");
+    }
+
+    BroadcastSource::~BroadcastSource()
+    {
+        // Tracks hold their own reference to the source, peers that are
+        // still connected keep receiving frames after this is gone.
+        source_ = 0;
+        factory_ = 0;
+    }
+
+    talk_base::scoped_refptr<webrtc::VideoTrackInterface> BroadcastSource::CreateVideoTrack(const std::string &label)
+    {
+        if (!factory_.get())
+            return talk_base::scoped_refptr<webrtc::VideoTrackInterface>();
+
+        if (!source_.get())
+        {
+            LogDebug(LC + "Creating shared Tundra video source");
+            source_ = factory_->CreateVideoSource(new WebRTC::TundraCapturer(framework_), NULL);
+            if (!source_.get())
+            {
+                LogError(LC + "Failed to create shared video source!");
+                return talk_base::scoped_refptr<webrtc::VideoTrackInterface>();
+            }
+        }
+
+        talk_base::scoped_refptr<webrtc::VideoTrackInterface> track = factory_->CreateVideoTrack(label, source_);
+        if (track.get())
+            tracks_++;
+        return track;
+    }
+
+    int BroadcastSource::TrackCount() const
+    {
+        return tracks_;
+    }
+
+    QVariantMap BroadcastSource::Statistics() const
+    {
+        QVariantMap stats;
+        stats["tracks"] = tracks_;
+        stats["sourceCreated"] = (source_.get() != 0);
+        return stats;
+    }
+}
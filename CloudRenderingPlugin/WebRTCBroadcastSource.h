@@ -0,0 +1,54 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include "talk/app/webrtc/peerconnectioninterface.h"
+#include "talk/app/webrtc/mediastreaminterface.h"
+#include "talk/base/scoped_ref_ptr.h"
+
+#include <QVariant>
+
+namespace WebRTC
+{
+    /// One Tundra capturer and video source shared by all peers of a Renderer.
+    /** In broadcast mode every PeerConnection attaches its own video track to this source
+        instead of creating a capturer of its own. Readback, scaling and color conversion
+        are then done once per frame regardless of the number of peers.
+
+        @note The source is created with the plugins shared ConnectionFactory, which every
+        peer connection uses. Encoding is still done once per peer connection, libjingle
+        binds encoders to the send channels. */
+    class CLOUDRENDERING_API BroadcastSource
+    {
+    public:
+        BroadcastSource(Framework *framework);
+        ~BroadcastSource();
+
+        /// Creates a new track for the shared video source, creating the source on first call.
+        talk_base::scoped_refptr<webrtc::VideoTrackInterface> CreateVideoTrack(const std::string &label);
+
+        /// Returns the number of tracks attached to the shared source.
+        int TrackCount() const;
+
+        /// Returns source information for diagnostics.
+        QVariantMap Statistics() const;
+
+    private:
+        QString LC;
+        Framework *framework_;
+        int tracks_;
+
+        talk_base::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory_;
+        talk_base::scoped_refptr<webrtc::VideoSourceInterface> source_;
+    };
+}
@@ -32,15 +32,26 @@ namespace WebRTC
         connect(websocket_.get(), SIGNAL(Message(CloudRenderingProtocol::MessageSharedPtr)),
             SLOT(OnServiceMessage(CloudRenderingProtocol::MessageSharedPtr)));
 
+        dispatcher_.On(this, &Client::HandleOffer);
+        dispatcher_.On(this, &Client::HandleAnswer);
+        dispatcher_.On(this, &Client::HandleIceCandidates);
+        dispatcher_.On(this, &Client::HandleRoomAssigned);
+        dispatcher_.On(this, &Client::HandleRoomUserJoined);
+        dispatcher_.On(this, &Client::HandleRoomUserLeft);
+
         serverPeer_ = WebRTCPeerConnectionPtr(new WebRTC::PeerConnection(plugin_->GetFramework(), 0)); /// @todo Will this be the reserver server id?
         connect(serverPeer_.get(), SIGNAL(LocalConnectionDataResolved(WebRTC::SDP, WebRTC::ICECandidateList)), 
             SLOT(OnLocalConnectionDataResolved(WebRTC::SDP, WebRTC::ICECandidateList)), Qt::QueuedConnection);
-
-        // Connect to service
-        serviceHost_ = WebRTC::WebSocketClient::CleanHost(plugin_->GetFramework()->CommandLineParameters("--cloudRenderingClient").first());
-        if (!serviceHost_.isEmpty())
-            websocket_->Connect(serviceHost_);
-        else
+        connect(serverPeer_.get(), SIGNAL(LocalSDPResolved(WebRTC::SDP)), SLOT(OnLocalSDPResolved(WebRTC::SDP)), Qt::QueuedConnection);
+        connect(serverPeer_.get(), SIGNAL(LocalIceCandidatesTrickled(WebRTC::ICECandidateList)), 
+            SLOT(OnLocalIceCandidatesTrickled(WebRTC::ICECandidateList)), Qt::QueuedConnection);
+
+        // Connect to service. The loopback and reconnect benchmarks connect once the renderer has a room.
+        QString host = plugin_->GetFramework()->CommandLineParameters("--cloudRenderingClient").value(0);
+        if (!host.isEmpty())
+            Connect(host);
+        else if (!plugin_->GetFramework()->HasCommandLineParameter("--cloudRenderingLoopback") &&
+            !plugin_->GetFramework()->HasCommandLineParameter("--cloudRenderingBenchmark"))
             LogError(LC + "--cloudRenderingClient <cloudRenderingServiceHost> parameter not defined, cannot connect to service for client registration!");
     }
     
@@ -54,13 +65,21 @@ namespace WebRTC
     {
         return room_;
     }
+
+    void Client::Connect(const QString &host, const QString &roomId)
+    {
+        serviceHost_ = WebRTC::WebSocketClient::CleanHost(host);
+        roomId_ = roomId;
+        if (!serviceHost_.isEmpty())
+            websocket_->Connect(serviceHost_);
+        else
+            LogError(LC + "Cannot connect to Cloud Rendering Service, host is empty");
+    }
     
     void Client::OnServiceConnected()
     {
-        CloudRenderingProtocol::State::RegistrationMessage *message = new CloudRenderingProtocol::State::RegistrationMessage(
-            CloudRenderingProtocol::State::RegistrationMessage::R_Client);
-        message->deleteLater();
-        websocket_->Send(message);
+        CloudRenderingProtocol::State::RegistrationMessage message(CloudRenderingProtocol::State::RegistrationMessage::R_Client, roomId_);
+        websocket_->Send(&message);
 
         room_.Reset();
     }
@@ -82,106 +101,59 @@ namespace WebRTC
         if (!serverPeer_)
             return;
 
-        switch (message->Channel())
+        if (!dispatcher_.Dispatch(message))
+            LogDebug(LC + "No handler for " + message->MessageTypeName() + " message");
+    }
+
+    void Client::HandleOffer(CloudRenderingProtocol::Signaling::OfferMessage *offer)
+    {
+        // A renderer in trickle mode sends its offer without candidates, answer the same way.
+        if (offer->iceCandidates.isEmpty() && !serverPeer_->IsTrickleIce())
+            serverPeer_->SetTrickleIce(true);
+        serverPeer_->HandleOfferOrAnswer(offer->sdp, offer->iceCandidates, PeerConnection::ConnectionSettings(false, false, false, true));
+    }
+
+    void Client::HandleAnswer(CloudRenderingProtocol::Signaling::AnswerMessage *answer)
+    {
+        serverPeer_->HandleOfferOrAnswer(answer->sdp, answer->iceCandidates, PeerConnection::ConnectionSettings());
+    }
+
+    void Client::HandleIceCandidates(CloudRenderingProtocol::Signaling::IceCandidatesMessage *candidates)
+    {
+        serverPeer_->AddRemoteIceCandidates(candidates->iceCandidates);
+    }
+
+    void Client::HandleRoomAssigned(CloudRenderingProtocol::Room::RoomAssignedMessage *assigned)
+    {
+        room_.Reset();
+
+        if (assigned->error == CloudRenderingProtocol::Room::RoomAssignedMessage::RQE_NoError)
+        {
+            room_.id = assigned->roomId;
+            LogInfo(LC + "Client was assigned to room " + room_.id);
+        }
+        else
+            LogError(LC + QString("RoomAssignedMessage sent a error code %1 to renderer, this should never happen as we are not requesting for a room!")
+                .arg(static_cast<int>(assigned->error)));
+    }
+
+    void Client::HandleRoomUserJoined(CloudRenderingProtocol::Room::RoomUserJoinedMessage *joined)
+    {
+        LogInfo(LC + "Peers joined to the clients room");
+        foreach(const QString &joinedPeerId, joined->peerIds)
+        {
+            LogInfo(LC + QString("  peerId = %1").arg(joinedPeerId));
+            room_.AddPeer(joinedPeerId);
+        }
+    }
+
+    void Client::HandleRoomUserLeft(CloudRenderingProtocol::Room::RoomUserLeftMessage *left)
+    {
+        LogInfo(LC + "Peers left from the renderers room");
+        foreach(const QString &leftPeerId, left->peerIds)
         {
-            // Signaling
-            case CloudRenderingProtocol::CT_Signaling:
-            {
-                switch (message->Type())
-                {
-                    // Offer
-                    case CloudRenderingProtocol::MT_Offer:
-                    {
-                        CloudRenderingProtocol::Signaling::OfferMessage *offer = dynamic_cast<CloudRenderingProtocol::Signaling::OfferMessage*>(message.get());
-                        if (offer)
-                            serverPeer_->HandleOfferOrAnswer(offer->sdp, offer->iceCandidates, PeerConnection::ConnectionSettings());
-                        else
-                            LogError(LC + "Failed to cast MT_Offer message to OfferMessage*");
-                        break;
-                    }
-                    // Answer
-                    case CloudRenderingProtocol::MT_Answer:
-                    {
-                        CloudRenderingProtocol::Signaling::AnswerMessage *answer = dynamic_cast<CloudRenderingProtocol::Signaling::AnswerMessage*>(message.get());
-                        if (answer)
-                            serverPeer_->HandleOfferOrAnswer(answer->sdp, answer->iceCandidates, PeerConnection::ConnectionSettings());
-                        else
-                            LogError(LC + "Failed to cast MT_Answer message to AnswerMessage*");
-                        break;
-                    }
-                    // Ice candidates
-                    case CloudRenderingProtocol::MT_IceCandidates:
-                    {
-                        CloudRenderingProtocol::Signaling::IceCandidatesMessage *candidates = dynamic_cast<CloudRenderingProtocol::Signaling::IceCandidatesMessage*>(message.get());
-                        if (candidates)
-                            serverPeer_->AddRemoteIceCandidates(candidates->iceCandidates);
-                        else
-                            LogError(LC + "Failed to cast MT_IceCandidates message to IceCandidatesMessage*");
-                        break;
-                    }
-                }
-                break;
-            }
-            // Room
-            case CloudRenderingProtocol::CT_Room:
-            {
-                switch (message->Type())
-                {
-                    case CloudRenderingProtocol::MT_RoomAssigned:
-                    {
-                        room_.Reset();
-
-                        CloudRenderingProtocol::Room::RoomAssignedMessage *assigned = dynamic_cast<CloudRenderingProtocol::Room::RoomAssignedMessage*>(message.get());
-                        if (assigned)
-                        {
-                            if (assigned->error == CloudRenderingProtocol::Room::RoomAssignedMessage::RQE_NoError)
-                            {
-                                room_.id = assigned->roomId;
-                                LogInfo(LC + "Client was assigned to room " + room_.id);
-                            }
-                            else
-                                LogError(LC + QString("RoomAssignedMessage sent a error code %1 to renderer, this should never happen as we are not requesting for a room!")
-                                    .arg(static_cast<int>(assigned->error)));
-                        }
-                        else
-                            LogError(LC + "Failed to cast MT_RoomAssigned message to RoomAssignedMessage*");
-                        break;
-                    }
-                    case CloudRenderingProtocol::MT_RoomUserJoined:
-                    {
-                        CloudRenderingProtocol::Room::RoomUserJoinedMessage *joined = dynamic_cast<CloudRenderingProtocol::Room::RoomUserJoinedMessage*>(message.get());
-                        if (joined)
-                        {
-                            LogInfo(LC + "Peers joined to the clients room");
-                            foreach(const QString &joinedPeerId, joined->peerIds)
-                            {
-                                LogInfo(LC + QString("  peerId = %1").arg(joinedPeerId));
-                                room_.AddPeer(joinedPeerId);
-                            }
-                        }
-                        else
-                            LogError(LC + "Failed to cast MT_RoomUserJoined message to RoomUserJoinedMessage*");
-                        break;
-                    }
-                    case CloudRenderingProtocol::MT_RoomUserLeft:
-                    {
-                        CloudRenderingProtocol::Room::RoomUserLeftMessage *left = dynamic_cast<CloudRenderingProtocol::Room::RoomUserLeftMessage*>(message.get());
-                        if (left)
-                        {
-                            LogInfo(LC + "Peers left from the renderers room");
-                            foreach(const QString &leftPeerId, left->peerIds)
-                            {
-                                LogInfo(LC + QString("  peerId = %1").arg(leftPeerId));
-                                room_.RemovePeer(leftPeerId);
-                            }
-                        }
-                        else
-                            LogError(LC + "Failed to cast MT_RoomUserLeft message to RoomUserJoinedMessage*");
-                        break;
-                    }
-                }
-                break;
-            }
+            LogInfo(LC + QString("  peerId = %1").arg(leftPeerId));
+            room_.RemovePeer(leftPeerId);
         }
     }
 
@@ -198,26 +170,42 @@ namespace WebRTC
             LogError(LC + "Signal sender not same as server peer. This should never happen!");
             return;
         }
-        
-        if (sdp.type.compare("answer", Qt::CaseInsensitive))
+        SendLocalDescription(sdp, candidates);
+    }
+
+    void Client::OnLocalSDPResolved(WebRTC::SDP sdp)
+    {
+        if (serverPeer_->IsTrickleIce())
+            SendLocalDescription(sdp, WebRTC::ICECandidateList());
+    }
+
+    void Client::OnLocalIceCandidatesTrickled(WebRTC::ICECandidateList candidates)
+    {
+        CloudRenderingProtocol::Signaling::IceCandidatesValue message("renderer", candidates);
+        if (!websocket_->Send(message))
+            LogWarning(LC + "Failed to send " + CloudRenderingProtocol::IceCandidates);
+    }
+
+    void Client::SendLocalDescription(const WebRTC::SDP &sdp, const WebRTC::ICECandidateList &candidates)
+    {
+        // The server peer is always the renderer of the room.
+        if (sdp.type.compare("answer", Qt::CaseInsensitive) == 0)
         {
-            CloudRenderingProtocol::Signaling::AnswerMessage *message = new CloudRenderingProtocol::Signaling::AnswerMessage(peer->Id());
-            message->deleteLater();
-            message->sdp = sdp;
-            message->iceCandidates = candidates;
+            CloudRenderingProtocol::Signaling::AnswerMessage message("renderer");
+            message.sdp = sdp;
+            message.iceCandidates = candidates;
 
-            if (!websocket_->Send(message))
-                LogWarning(LC + "Failed to send " + message->MessageTypeName());
+            if (!websocket_->Send(&message))
+                LogWarning(LC + "Failed to send " + message.MessageTypeName());
         }
-        else if (sdp.type.compare("offer", Qt::CaseInsensitive))
+        else if (sdp.type.compare("offer", Qt::CaseInsensitive) == 0)
         {
-            CloudRenderingProtocol::Signaling::OfferMessage *message = new CloudRenderingProtocol::Signaling::OfferMessage(peer->Id());
-            message->deleteLater();
-            message->sdp = sdp;
-            message->iceCandidates = candidates;
+            CloudRenderingProtocol::Signaling::OfferMessage message("renderer");
+            message.sdp = sdp;
+            message.iceCandidates = candidates;
 
-            if (!websocket_->Send(message))
-                LogWarning(LC + "Failed to send " + message->MessageTypeName());
+            if (!websocket_->Send(&message))
+                LogWarning(LC + "Failed to send " + message.MessageTypeName());
         }
         else
             LogError(LC + QString("Resolved SDP type is not 'offer' or 'answer' but '%1', doing nothing.").arg(sdp.type));
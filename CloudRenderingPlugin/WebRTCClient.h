@@ -13,6 +13,7 @@
 #include "CloudRenderingPluginFwd.h"
 #include "CloudRenderingDefines.h"
 #include "CloudRenderingProtocol.h"
+#include "CloudRenderingMessageDispatcher.h"
 
 namespace WebRTC
 {
@@ -28,6 +29,12 @@ namespace WebRTC
         /// Returns the current room.
         CloudRenderingProtocol::CloudRenderingRoom Room() const;
 
+    public slots:
+        /// Connects to the Cloud Rendering Service at @c host.
+        /** Done automatically on construction for --cloudRenderingClient <host>.
+            @param roomId Room to join, a new room is requested if empty. */
+        void Connect(const QString &host, const QString &roomId = "");
+
     private slots:
         void OnServiceConnected();
         void OnServiceDisconnected();
@@ -37,13 +44,30 @@ namespace WebRTC
         /// Signal handler when peers local data information has been resolved and we can send the AnswerMessage.
         void OnLocalConnectionDataResolved(WebRTC::SDP sdp, WebRTC::ICECandidateList candidates);
 
+        /// Trickle ICE signal handlers, used when the renderer offer came without candidates.
+        void OnLocalSDPResolved(WebRTC::SDP sdp);
+        void OnLocalIceCandidatesTrickled(WebRTC::ICECandidateList candidates);
+
     private:
+        /// Service message handlers.
+        void HandleOffer(CloudRenderingProtocol::Signaling::OfferMessage *offer);
+        void HandleAnswer(CloudRenderingProtocol::Signaling::AnswerMessage *answer);
+        void HandleIceCandidates(CloudRenderingProtocol::Signaling::IceCandidatesMessage *candidates);
+        void HandleRoomAssigned(CloudRenderingProtocol::Room::RoomAssignedMessage *assigned);
+        void HandleRoomUserJoined(CloudRenderingProtocol::Room::RoomUserJoinedMessage *joined);
+        void HandleRoomUserLeft(CloudRenderingProtocol::Room::RoomUserLeftMessage *left);
+
+        /// Sends the offer or answer to the renderer.
+        void SendLocalDescription(const WebRTC::SDP &sdp, const WebRTC::ICECandidateList &candidates);
+
         QString LC;
         QString serviceHost_;
+        QString roomId_;
         
         WebRTCPeerConnectionPtr serverPeer_;
 
         CloudRenderingProtocol::CloudRenderingRoom room_;
+        CloudRenderingProtocol::MessageDispatcher dispatcher_;
 
         CloudRenderingPlugin *plugin_;
         WebRTCWebSocketClientPtr websocket_;
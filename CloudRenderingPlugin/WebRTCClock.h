@@ -0,0 +1,45 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "HighPerfClock.h"
+
+namespace WebRTC
+{
+    /// Converts a HighPerfClock tick count to seconds.
+    inline double TicksToSeconds(tick_t ticks)
+    {
+        return static_cast<double>(ticks) / static_cast<double>(GetCurrentClockFreq());
+    }
+
+    /// Converts a HighPerfClock tick count to milliseconds.
+    inline double TicksToMs(tick_t ticks)
+    {
+        return TicksToSeconds(ticks) * 1000.0;
+    }
+
+    /// Converts seconds to a HighPerfClock tick count.
+    inline tick_t SecondsToTicks(double seconds)
+    {
+        return static_cast<tick_t>(seconds * static_cast<double>(GetCurrentClockFreq()));
+    }
+
+    /// Returns the seconds elapsed since @c start, a GetCurrentClockTime() value.
+    inline double SecondsSince(tick_t start)
+    {
+        return TicksToSeconds(GetCurrentClockTime() - start);
+    }
+
+    /// Returns the milliseconds elapsed since @c start, a GetCurrentClockTime() value.
+    inline double MsSince(tick_t start)
+    {
+        return TicksToMs(GetCurrentClockTime() - start);
+    }
+}
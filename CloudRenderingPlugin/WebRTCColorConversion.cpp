@@ -0,0 +1,571 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file
+    @brief   */
+
+#include "WebRTCColorConversion.h"
+#include "WebRTCFrameBuffer.h"
+#include "WebRTCWorkerPool.h"
+
+#include <vector>
+
+#include "talk/media/base/videocommon.h"
+
+#ifdef CLOUDRENDERING_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace WebRTC
+{
+namespace ColorConversion
+{
+    // CPU detection
+
+    /// @cond PRIVATE
+
+#ifdef CLOUDRENDERING_SSE2
+    static void CpuId(int leaf, int subLeaf, unsigned int regs[4])
+    {
+#if defined(_MSC_VER)
+        int info[4] = { 0, 0, 0, 0 };
+        __cpuidex(info, leaf, subLeaf);
+        for (int i=0; i<4; ++i)
+            regs[i] = static_cast<unsigned int>(info[i]);
+#else
+        regs[0] = regs[1] = regs[2] = regs[3] = 0;
+        __cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    static bool OSSavesYmmRegisters()
+    {
+#if defined(_MSC_VER) && (_MSC_VER >= 1600)
+        return ((_xgetbv(0) & 6) == 6);
+#elif defined(_MSC_VER)
+        return false;
+#else
+        unsigned int eax = 0, edx = 0;
+        __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return ((eax & 6) == 6);
+#endif
+    }
+#endif
+
+    static Implementation DetectImplementationOnce()
+    {
+#ifdef CLOUDRENDERING_SSE2
+        unsigned int regs[4];
+        CpuId(0, 0, regs);
+        const unsigned int maxLeaf = regs[0];
+
+        CpuId(1, 0, regs);
+        const bool sse2 = (regs[3] & (1u << 26)) != 0;
+        const bool osxsave = (regs[2] & (1u << 27)) != 0;
+        const bool avx = (regs[2] & (1u << 28)) != 0;
+#ifdef CLOUDRENDERING_AVX2
+        if (maxLeaf >= 7 && osxsave && avx && OSSavesYmmRegisters())
+        {
+            CpuId(7, 0, regs);
+            if ((regs[1] & (1u << 5)) != 0)
+                return CCI_AVX2;
+        }
+#else
+        (void)maxLeaf; (void)osxsave; (void)avx;
+#endif
+        if (sse2)
+            return CCI_SSE2;
+#endif
+        return CCI_Scalar;
+    }
+
+    static RowPairFunction RowPairFunctionFor(Implementation impl)
+    {
+        if (impl == CCI_Auto || !IsSupported(impl))
+            impl = DetectImplementation();
+#ifdef CLOUDRENDERING_AVX2
+        if (impl == CCI_AVX2)
+            return &RowPairAVX2;
+#endif
+#ifdef CLOUDRENDERING_SSE2
+        if (impl == CCI_SSE2)
+            return &RowPairSSE2;
+#endif
+        return &RowPairScalar;
+    }
+
+    /// @endcond
+
+    Implementation DetectImplementation()
+    {
+        static const Implementation detected = DetectImplementationOnce();
+        return detected;
+    }
+
+    bool IsSupported(Implementation impl)
+    {
+        if (impl == CCI_Auto || impl == CCI_Scalar)
+            return true;
+        return (static_cast<int>(impl) <= static_cast<int>(DetectImplementation()));
+    }
+
+    QString ImplementationName(Implementation impl)
+    {
+        switch(impl)
+        {
+            case CCI_Scalar: return "scalar";
+            case CCI_SSE2: return "sse2";
+            case CCI_AVX2: return "avx2";
+            default: break;
+        }
+        return "auto";
+    }
+
+    Implementation ImplementationFromName(const QString &name)
+    {
+        QString n = name.trimmed().toLower();
+        if (n == "scalar")
+            return CCI_Scalar;
+        else if (n == "sse2")
+            return CCI_SSE2;
+        else if (n == "avx2")
+            return CCI_AVX2;
+        return CCI_Auto;
+    }
+
+    int FrameSize(u32 fourcc, int width, int height)
+    {
+        if (width <= 0 || height <= 0)
+            return 0;
+        const int chroma = ((width + 1) / 2) * ((height + 1) / 2);
+        if (fourcc == cricket::FOURCC_ARGB)
+            return width * height * 4;
+        else if (fourcc == cricket::FOURCC_I420 || fourcc == cricket::FOURCC_NV12)
+            return width * height + chroma * 2;
+        return 0;
+    }
+
+    // Scalar kernel
+
+    /// @cond PRIVATE
+
+    static inline uchar LumaFromBGR(const uchar *p)
+    {
+        return static_cast<uchar>(((66 * p[2] + 129 * p[1] + 25 * p[0] + 128) >> 8) + 16);
+    }
+
+    static inline void ChromaFromBGRSum(int sumB, int sumG, int sumR, uchar &u, uchar &v)
+    {
+        const int b = (sumB + 2) >> 2;
+        const int g = (sumG + 2) >> 2;
+        const int r = (sumR + 2) >> 2;
+        u = static_cast<uchar>(((112 * b - 74 * g - 38 * r + 128) >> 8) + 128);
+        v = static_cast<uchar>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+
+    /// @endcond
+
+    void RowPairScalar(const uchar *argb0, const uchar *argb1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width, bool interleaved)
+    {
+        int x = 0;
+        for (; x + 1 < width; x += 2)
+        {
+            const uchar *p00 = argb0 + x * 4;
+            const uchar *p01 = p00 + 4;
+            const uchar *p10 = argb1 + x * 4;
+            const uchar *p11 = p10 + 4;
+
+            y0[x] = LumaFromBGR(p00);
+            y0[x+1] = LumaFromBGR(p01);
+            y1[x] = LumaFromBGR(p10);
+            y1[x+1] = LumaFromBGR(p11);
+
+            uchar cu, cv;
+            ChromaFromBGRSum(p00[0] + p01[0] + p10[0] + p11[0],
+                             p00[1] + p01[1] + p10[1] + p11[1],
+                             p00[2] + p01[2] + p10[2] + p11[2], cu, cv);
+            if (interleaved)
+            {
+                u[x] = cu;
+                u[x+1] = cv;
+            }
+            else
+            {
+                u[x/2] = cu;
+                v[x/2] = cv;
+            }
+        }
+        // Odd width, last chroma sample covers a single column.
+        if (x < width)
+        {
+            const uchar *p00 = argb0 + x * 4;
+            const uchar *p10 = argb1 + x * 4;
+
+            y0[x] = LumaFromBGR(p00);
+            y1[x] = LumaFromBGR(p10);
+
+            uchar cu, cv;
+            ChromaFromBGRSum((p00[0] + p10[0]) * 2, (p00[1] + p10[1]) * 2, (p00[2] + p10[2]) * 2, cu, cv);
+            if (interleaved)
+            {
+                u[x] = cu;
+                u[x+1] = cv;
+            }
+            else
+            {
+                u[x/2] = cu;
+                v[x/2] = cv;
+            }
+        }
+    }
+
+    // SSE2 kernel
+
+#ifdef CLOUDRENDERING_SSE2
+
+    /// @cond PRIVATE
+
+    /// Splits 8 ARGB pixels into 16 bit B, G and R vectors.
+    static inline void SplitSSE2(const uchar *p, __m128i &b, __m128i &g, __m128i &r)
+    {
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        const __m128i px0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i px1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+        b = _mm_packs_epi32(_mm_and_si128(px0, mask), _mm_and_si128(px1, mask));
+        g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(px0, 8), mask), _mm_and_si128(_mm_srli_epi32(px1, 8), mask));
+        r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(px0, 16), mask), _mm_and_si128(_mm_srli_epi32(px1, 16), mask));
+    }
+
+    static inline __m128i LumaSSE2(const __m128i &b, const __m128i &g, const __m128i &r)
+    {
+        // The sum can exceed 32767, wrapping 16 bit arithmetic with a logical shift keeps it exact.
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+        sum = _mm_add_epi16(sum, _mm_set1_epi16(128));
+        return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+    }
+
+    /// Averages 2x2 blocks of two rows of 16 pixels (lo = pixels 0-7, hi = 8-15) into 8 samples.
+    static inline __m128i Average2x2SSE2(const __m128i &row0lo, const __m128i &row0hi, const __m128i &row1lo, const __m128i &row1hi)
+    {
+        const __m128i ones = _mm_set1_epi16(1);
+        const __m128i pairsLo = _mm_madd_epi16(_mm_add_epi16(row0lo, row1lo), ones);
+        const __m128i pairsHi = _mm_madd_epi16(_mm_add_epi16(row0hi, row1hi), ones);
+        return _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(pairsLo, pairsHi), _mm_set1_epi16(2)), 2);
+    }
+
+    static inline __m128i ChromaSSE2(const __m128i &c0, const __m128i &c1, const __m128i &c2, short k0, short k1, short k2)
+    {
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(c0, _mm_set1_epi16(k0)), _mm_mullo_epi16(c1, _mm_set1_epi16(k1)));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(c2, _mm_set1_epi16(k2)));
+        sum = _mm_add_epi16(sum, _mm_set1_epi16(128));
+        return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+    }
+
+    /// @endcond
+
+    void RowPairSSE2(const uchar *argb0, const uchar *argb1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width, bool interleaved)
+    {
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i b0lo, g0lo, r0lo, b0hi, g0hi, r0hi;
+            __m128i b1lo, g1lo, r1lo, b1hi, g1hi, r1hi;
+            SplitSSE2(argb0 + x * 4, b0lo, g0lo, r0lo);
+            SplitSSE2(argb0 + x * 4 + 32, b0hi, g0hi, r0hi);
+            SplitSSE2(argb1 + x * 4, b1lo, g1lo, r1lo);
+            SplitSSE2(argb1 + x * 4 + 32, b1hi, g1hi, r1hi);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x), _mm_packus_epi16(LumaSSE2(b0lo, g0lo, r0lo), LumaSSE2(b0hi, g0hi, r0hi)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x), _mm_packus_epi16(LumaSSE2(b1lo, g1lo, r1lo), LumaSSE2(b1hi, g1hi, r1hi)));
+
+            const __m128i b = Average2x2SSE2(b0lo, b0hi, b1lo, b1hi);
+            const __m128i g = Average2x2SSE2(g0lo, g0hi, g1lo, g1hi);
+            const __m128i r = Average2x2SSE2(r0lo, r0hi, r1lo, r1hi);
+
+            const __m128i cu = ChromaSSE2(b, g, r, 112, -74, -38);
+            const __m128i cv = ChromaSSE2(r, g, b, 112, -94, -18);
+            const __m128i u8 = _mm_packus_epi16(cu, cu);
+            const __m128i v8 = _mm_packus_epi16(cv, cv);
+            if (interleaved)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x), _mm_unpacklo_epi8(u8, v8));
+            else
+            {
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), u8);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2), v8);
+            }
+        }
+        if (x < width)
+            RowPairScalar(argb0 + x * 4, argb1 + x * 4, y0 + x, y1 + x,
+                          interleaved ? u + x : u + x / 2, interleaved ? v : v + x / 2, width - x, interleaved);
+    }
+
+#endif
+
+    // Frame level conversion
+
+    /// @cond PRIVATE
+
+    static void ConvertRows(const uchar *argb, int argbStride, uchar *y, int yStride, uchar *u, int uStride, uchar *v, int vStride,
+                            int width, int height, int firstRow, int lastRow, bool interleaved, Implementation impl)
+    {
+        if (width <= 0 || height <= 0)
+            return;
+        if (firstRow < 0)
+            firstRow = 0;
+        if (lastRow > height)
+            lastRow = height;
+        firstRow &= ~1;
+
+        RowPairFunction rowPair = RowPairFunctionFor(impl);
+        for (int row=firstRow; row<lastRow; row+=2)
+        {
+            // Odd height, the last row is paired with itself.
+            const bool single = (row + 1 >= height);
+            const uchar *src0 = argb + row * argbStride;
+            const uchar *src1 = (single ? src0 : src0 + argbStride);
+            uchar *dst0 = y + row * yStride;
+            uchar *dst1 = (single ? dst0 : dst0 + yStride);
+            rowPair(src0, src1, dst0, dst1, u + (row / 2) * uStride, (v ? v + (row / 2) * vStride : 0), width, interleaved);
+        }
+    }
+
+    /// @endcond
+
+    void ARGBToI420Rows(const uchar *argb, int argbStride, uchar *y, int yStride, uchar *u, int uStride, uchar *v, int vStride,
+                        int width, int height, int firstRow, int lastRow, Implementation impl)
+    {
+        ConvertRows(argb, argbStride, y, yStride, u, uStride, v, vStride, width, height, firstRow, lastRow, false, impl);
+    }
+
+    void ARGBToNV12Rows(const uchar *argb, int argbStride, uchar *y, int yStride, uchar *uv, int uvStride,
+                        int width, int height, int firstRow, int lastRow, Implementation impl)
+    {
+        ConvertRows(argb, argbStride, y, yStride, uv, uvStride, 0, 0, width, height, firstRow, lastRow, true, impl);
+    }
+
+    void ARGBToI420(const uchar *argb, int argbStride, uchar *y, int yStride, uchar *u, int uStride, uchar *v, int vStride,
+                    int width, int height, Implementation impl)
+    {
+        ARGBToI420Rows(argb, argbStride, y, yStride, u, uStride, v, vStride, width, height, 0, height, impl);
+    }
+
+    void ARGBToNV12(const uchar *argb, int argbStride, uchar *y, int yStride, uchar *uv, int uvStride,
+                    int width, int height, Implementation impl)
+    {
+        ARGBToNV12Rows(argb, argbStride, y, yStride, uv, uvStride, width, height, 0, height, impl);
+    }
+
+    // Scaling
+
+    /// @cond PRIVATE
+
+    /// Interpolates two ARGB pixels with an 8 bit weight, two channels at a time.
+    static inline u32 LerpARGB(u32 a, u32 b, u32 weight)
+    {
+        const u32 mask = 0x00FF00FF;
+        const u32 rb = ((a & mask) * (256 - weight) + (b & mask) * weight + 0x00800080) >> 8;
+        const u32 ag = ((a >> 8) & mask) * (256 - weight) + ((b >> 8) & mask) * weight + 0x00800080;
+        return (rb & mask) | (ag & ~mask);
+    }
+
+    /// @endcond
+
+    void ScaleARGBRows(const uchar *src, int srcStride, int srcWidth, int srcHeight,
+                       uchar *dst, int dstStride, int dstWidth, int dstHeight, int firstRow, int lastRow)
+    {
+        if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0)
+            return;
+        if (firstRow < 0)
+            firstRow = 0;
+        if (lastRow > dstHeight)
+            lastRow = dstHeight;
+
+        // 16.16 fixed point source positions of the destination pixel centers.
+        std::vector<int> xIndices(dstWidth), xNext(dstWidth);
+        std::vector<u32> xWeights(dstWidth);
+        const qint64 maxX = static_cast<qint64>(srcWidth - 1) << 16;
+        for (int x=0; x<dstWidth; ++x)
+        {
+            qint64 fx = ((static_cast<qint64>(2 * x + 1) * srcWidth - dstWidth) * 65536) / (2 * dstWidth);
+            fx = qBound(static_cast<qint64>(0), fx, maxX);
+            xIndices[x] = static_cast<int>(fx >> 16);
+            xNext[x] = qMin(xIndices[x] + 1, srcWidth - 1);
+            xWeights[x] = static_cast<u32>((fx >> 8) & 0xFF);
+        }
+
+        const qint64 maxY = static_cast<qint64>(srcHeight - 1) << 16;
+        for (int y=firstRow; y<lastRow; ++y)
+        {
+            qint64 fy = ((static_cast<qint64>(2 * y + 1) * srcHeight - dstHeight) * 65536) / (2 * dstHeight);
+            fy = qBound(static_cast<qint64>(0), fy, maxY);
+            const int sy = static_cast<int>(fy >> 16);
+            const u32 wy = static_cast<u32>((fy >> 8) & 0xFF);
+            const u32 *row0 = reinterpret_cast<const u32*>(src + sy * srcStride);
+            const u32 *row1 = (sy + 1 < srcHeight ? reinterpret_cast<const u32*>(src + (sy + 1) * srcStride) : row0);
+            u32 *out = reinterpret_cast<u32*>(dst + y * dstStride);
+
+            if (wy == 0)
+            {
+                for (int x=0; x<dstWidth; ++x)
+                    out[x] = LerpARGB(row0[xIndices[x]], row0[xNext[x]], xWeights[x]);
+            }
+            else
+            {
+                for (int x=0; x<dstWidth; ++x)
+                {
+                    const u32 top = LerpARGB(row0[xIndices[x]], row0[xNext[x]], xWeights[x]);
+                    const u32 bottom = LerpARGB(row1[xIndices[x]], row1[xNext[x]], xWeights[x]);
+                    out[x] = LerpARGB(top, bottom, wy);
+                }
+            }
+        }
+    }
+
+    // Band jobs
+
+    /// @cond PRIVATE
+
+    struct ConvertBandJob : public IBandJob
+    {
+        void ProcessBand(int firstRow, int lastRow)
+        {
+            ConvertRows(argb, argbStride, y, yStride, u, uStride, v, vStride, width, height, firstRow, lastRow, interleaved, impl);
+        }
+
+        const uchar *argb;
+        int argbStride;
+        uchar *y, *u, *v;
+        int yStride, uStride, vStride;
+        int width, height;
+        bool interleaved;
+        Implementation impl;
+    };
+
+    struct ScaleBandJob : public IBandJob
+    {
+        void ProcessBand(int firstRow, int lastRow)
+        {
+            ScaleARGBRows(src, srcStride, srcWidth, srcHeight, dst, dstStride, dstWidth, dstHeight, firstRow, lastRow);
+        }
+
+        const uchar *src;
+        int srcStride, srcWidth, srcHeight;
+        uchar *dst;
+        int dstStride, dstWidth, dstHeight;
+    };
+
+    /// @endcond
+
+    void FitSize(int srcWidth, int srcHeight, int maxWidth, int maxHeight, int &width, int &height)
+    {
+        width = srcWidth;
+        height = srcHeight;
+        if (srcWidth <= 0 || srcHeight <= 0 || maxWidth <= 0 || maxHeight <= 0 || (srcWidth <= maxWidth && srcHeight <= maxHeight))
+            return;
+
+        width = maxWidth;
+        height = static_cast<int>(static_cast<qint64>(srcHeight) * maxWidth / srcWidth);
+        if (height > maxHeight)
+        {
+            height = maxHeight;
+            width = static_cast<int>(static_cast<qint64>(srcWidth) * maxHeight / srcHeight);
+        }
+        width = qMax(2, width & ~1);
+        height = qMax(2, height & ~1);
+    }
+
+    WebRTCFrameBufferPtr ScaleFrame(FrameBufferPool *pool, const WebRTCFrameBufferPtr &source, int width, int height, WorkerPool *workers)
+    {
+        if (!pool || !source.get() || source->fourcc != cricket::FOURCC_ARGB || width <= 0 || height <= 0)
+            return WebRTCFrameBufferPtr();
+        if (source->width == width && source->height == height)
+            return source;
+
+        WebRTCFrameBufferPtr out = pool->AcquireARGB(width, height);
+        if (!out.get())
+            return out;
+
+        ScaleBandJob job;
+        job.src = source->Data();
+        job.srcStride = source->stride;
+        job.srcWidth = source->width;
+        job.srcHeight = source->height;
+        job.dst = out->Data();
+        job.dstStride = out->stride;
+        job.dstWidth = width;
+        job.dstHeight = height;
+        if (workers)
+            workers->Run(&job, height);
+        else
+            job.ProcessBand(0, height);
+        return out;
+    }
+
+    WebRTCFrameBufferPtr ConvertFrame(FrameBufferPool *pool, const WebRTCFrameBufferPtr &source, u32 fourcc, Implementation impl, WorkerPool *workers)
+    {
+        if (!pool || !source.get())
+            return WebRTCFrameBufferPtr();
+        if (source->fourcc == fourcc)
+            return source;
+        if (source->fourcc != cricket::FOURCC_ARGB)
+            return WebRTCFrameBufferPtr();
+
+        const int width = source->width;
+        const int height = source->height;
+        const int numBytes = FrameSize(fourcc, width, height);
+        if (numBytes <= 0)
+            return WebRTCFrameBufferPtr();
+
+        WebRTCFrameBufferPtr out = pool->Acquire(numBytes);
+        if (!out.get())
+            return out;
+        out->width = width;
+        out->height = height;
+        out->stride = width;
+        out->fourcc = fourcc;
+
+        const int chromaWidth = (width + 1) / 2;
+        const int chromaHeight = (height + 1) / 2;
+
+        ConvertBandJob job;
+        job.argb = source->Data();
+        job.argbStride = source->stride;
+        job.y = out->Data();
+        job.yStride = width;
+        job.u = job.y + width * height;
+        job.width = width;
+        job.height = height;
+        job.impl = impl;
+        if (fourcc == cricket::FOURCC_I420)
+        {
+            job.uStride = chromaWidth;
+            job.v = job.u + chromaWidth * chromaHeight;
+            job.vStride = chromaWidth;
+            job.interleaved = false;
+        }
+        else
+        {
+            job.uStride = chromaWidth * 2;
+            job.v = 0;
+            job.vStride = 0;
+            job.interleaved = true;
+        }
+
+        // Bands start on even rows so each one owns whole chroma rows.
+        if (workers)
+            workers->Run(&job, height, 2);
+        else
+            job.ProcessBand(0, height);
+        return out;
+    }
+}
+}
@@ -0,0 +1,121 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include <QString>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CLOUDRENDERING_SSE2
+#if !defined(_MSC_VER) || (_MSC_VER >= 1700)
+#define CLOUDRENDERING_AVX2
+#endif
+#endif
+
+namespace WebRTC
+{
+    /// ARGB to YUV color conversion for the capture pipeline.
+    /** Converts 32 bit ARGB frames (B, G, R, A byte order in memory, same as QImage::Format_ARGB32
+        and Ogre::PF_A8R8G8B8 on little endian) to I420 or NV12. The coefficients are the BT.601
+        studio swing ones libjingle/libyuv uses, chroma is the average of each 2x2 pixel block.
+
+        All implementations produce bit identical output, the SIMD kernels only differ in speed. */
+    namespace ColorConversion
+    {
+        /// Conversion kernel implementation.
+        enum Implementation
+        {
+            CCI_Auto = 0,   ///< Fastest implementation supported by the CPU.
+            CCI_Scalar = 1,
+            CCI_SSE2 = 2,
+            CCI_AVX2 = 3
+        };
+
+        /// Returns the fastest implementation the CPU supports, detected once at runtime.
+        CLOUDRENDERING_API Implementation DetectImplementation();
+
+        /// Returns if @c impl can run on this CPU and was compiled in.
+        CLOUDRENDERING_API bool IsSupported(Implementation impl);
+
+        /// Returns "scalar", "sse2", "avx2" or "auto".
+        CLOUDRENDERING_API QString ImplementationName(Implementation impl);
+
+        /// Returns implementation for a name returned by ImplementationName(), CCI_Auto if not recognized.
+        CLOUDRENDERING_API Implementation ImplementationFromName(const QString &name);
+
+        /// Returns the byte size of a @c width x @c height frame in @c fourcc, 0 if the format is not supported.
+        /** Supported formats are cricket::FOURCC_ARGB, cricket::FOURCC_I420 and cricket::FOURCC_NV12. */
+        CLOUDRENDERING_API int FrameSize(u32 fourcc, int width, int height);
+
+        /// Converts rows [@c firstRow, @c lastRow) of an ARGB image to I420.
+        /** @c firstRow must be even. Chroma rows [@c firstRow/2, (@c lastRow+1)/2) are written.
+            Distinct row ranges can be converted in parallel. */
+        CLOUDRENDERING_API void ARGBToI420Rows(const uchar *argb, int argbStride,
+                                               uchar *y, int yStride, uchar *u, int uStride, uchar *v, int vStride,
+                                               int width, int height, int firstRow, int lastRow, Implementation impl = CCI_Auto);
+
+        /// Converts rows [@c firstRow, @c lastRow) of an ARGB image to NV12.
+        /** @c firstRow must be even. Interleaved chroma rows [@c firstRow/2, (@c lastRow+1)/2) are written.
+            Distinct row ranges can be converted in parallel. */
+        CLOUDRENDERING_API void ARGBToNV12Rows(const uchar *argb, int argbStride,
+                                               uchar *y, int yStride, uchar *uv, int uvStride,
+                                               int width, int height, int firstRow, int lastRow, Implementation impl = CCI_Auto);
+
+        /// Converts a full ARGB image to I420.
+        CLOUDRENDERING_API void ARGBToI420(const uchar *argb, int argbStride,
+                                           uchar *y, int yStride, uchar *u, int uStride, uchar *v, int vStride,
+                                           int width, int height, Implementation impl = CCI_Auto);
+
+        /// Converts a full ARGB image to NV12.
+        CLOUDRENDERING_API void ARGBToNV12(const uchar *argb, int argbStride,
+                                           uchar *y, int yStride, uchar *uv, int uvStride,
+                                           int width, int height, Implementation impl = CCI_Auto);
+
+        /// Bilinear scales rows [@c firstRow, @c lastRow) of a @c dstWidth x @c dstHeight ARGB image from a @c srcWidth x @c srcHeight one.
+        /** Distinct row ranges can be scaled in parallel. */
+        CLOUDRENDERING_API void ScaleARGBRows(const uchar *src, int srcStride, int srcWidth, int srcHeight,
+                                              uchar *dst, int dstStride, int dstWidth, int dstHeight, int firstRow, int lastRow);
+
+        /// Returns the size a @c srcWidth x @c srcHeight frame is scaled to so that it fits @c maxWidth x @c maxHeight.
+        /** The aspect ratio is kept and the result is rounded down to even dimensions. Frames that already fit,
+            or a non-positive max size, return the source size as is. */
+        CLOUDRENDERING_API void FitSize(int srcWidth, int srcHeight, int maxWidth, int maxHeight, int &width, int &height);
+
+        /// Converts an ARGB frame to @c fourcc into a buffer acquired from @c pool.
+        /** The output planes are stored contiguously without padding. If @c workers is given the frame
+            is split into bands that are converted in parallel, the call returns once all bands are done.
+            @return Converted frame, @c source itself if it already is in @c fourcc or null ptr if the conversion is not supported. */
+        CLOUDRENDERING_API WebRTCFrameBufferPtr ConvertFrame(FrameBufferPool *pool, const WebRTCFrameBufferPtr &source, u32 fourcc,
+                                                             Implementation impl = CCI_Auto, WorkerPool *workers = 0);
+
+        /// Scales an ARGB frame to @c width x @c height into a buffer acquired from @c pool.
+        /** If @c workers is given the frame is scaled in parallel bands, the call returns once all bands are done.
+            @return Scaled frame, @c source itself if it already has the requested size or null ptr if @c source is not ARGB. */
+        CLOUDRENDERING_API WebRTCFrameBufferPtr ScaleFrame(FrameBufferPool *pool, const WebRTCFrameBufferPtr &source, int width, int height,
+                                                           WorkerPool *workers = 0);
+
+        /// @cond PRIVATE
+
+        /// Two source rows to one chroma row kernel. If @c interleaved is true @c u receives UV pairs and @c v is ignored.
+        typedef void (*RowPairFunction)(const uchar *argb0, const uchar *argb1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width, bool interleaved);
+
+        void RowPairScalar(const uchar *argb0, const uchar *argb1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width, bool interleaved);
+#ifdef CLOUDRENDERING_SSE2
+        void RowPairSSE2(const uchar *argb0, const uchar *argb1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width, bool interleaved);
+#endif
+#ifdef CLOUDRENDERING_AVX2
+        void RowPairAVX2(const uchar *argb0, const uchar *argb1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width, bool interleaved);
+#endif
+
+        /// @endcond
+    }
+}
@@ -0,0 +1,113 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file
+    @brief   AVX2 color conversion kernel. This file is compiled with AVX2 code generation enabled,
+             nothing in here may run before ColorConversion::DetectImplementation() has approved it. */
+
+#include "WebRTCColorConversion.h"
+
+#ifdef CLOUDRENDERING_AVX2
+
+#include <immintrin.h>
+
+namespace WebRTC
+{
+namespace ColorConversion
+{
+    /// @cond PRIVATE
+
+    // Packs in AVX2 work per 128 bit lane, this reorders the 64 bit quads back to linear order.
+    #define CR_LINEAR_QUADS(v) _mm256_permute4x64_epi64((v), _MM_SHUFFLE(3, 1, 2, 0))
+
+    /// Splits 16 ARGB pixels into 16 bit B, G and R vectors.
+    static inline void SplitAVX2(const uchar *p, __m256i &b, __m256i &g, __m256i &r)
+    {
+        const __m256i mask = _mm256_set1_epi32(0xFF);
+        const __m256i px0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const __m256i px1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+        b = CR_LINEAR_QUADS(_mm256_packs_epi32(_mm256_and_si256(px0, mask), _mm256_and_si256(px1, mask)));
+        g = CR_LINEAR_QUADS(_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(px0, 8), mask), _mm256_and_si256(_mm256_srli_epi32(px1, 8), mask)));
+        r = CR_LINEAR_QUADS(_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(px0, 16), mask), _mm256_and_si256(_mm256_srli_epi32(px1, 16), mask)));
+    }
+
+    static inline __m256i LumaAVX2(const __m256i &b, const __m256i &g, const __m256i &r)
+    {
+        __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(66)), _mm256_mullo_epi16(g, _mm256_set1_epi16(129)));
+        sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(b, _mm256_set1_epi16(25)));
+        sum = _mm256_add_epi16(sum, _mm256_set1_epi16(128));
+        return _mm256_add_epi16(_mm256_srli_epi16(sum, 8), _mm256_set1_epi16(16));
+    }
+
+    /// Averages 2x2 blocks of two rows of 32 pixels (lo = pixels 0-15, hi = 16-31) into 16 samples.
+    static inline __m256i Average2x2AVX2(const __m256i &row0lo, const __m256i &row0hi, const __m256i &row1lo, const __m256i &row1hi)
+    {
+        const __m256i ones = _mm256_set1_epi16(1);
+        const __m256i pairsLo = _mm256_madd_epi16(_mm256_add_epi16(row0lo, row1lo), ones);
+        const __m256i pairsHi = _mm256_madd_epi16(_mm256_add_epi16(row0hi, row1hi), ones);
+        const __m256i sums = CR_LINEAR_QUADS(_mm256_packs_epi32(pairsLo, pairsHi));
+        return _mm256_srli_epi16(_mm256_add_epi16(sums, _mm256_set1_epi16(2)), 2);
+    }
+
+    static inline __m256i ChromaAVX2(const __m256i &c0, const __m256i &c1, const __m256i &c2, short k0, short k1, short k2)
+    {
+        __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(c0, _mm256_set1_epi16(k0)), _mm256_mullo_epi16(c1, _mm256_set1_epi16(k1)));
+        sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(c2, _mm256_set1_epi16(k2)));
+        sum = _mm256_add_epi16(sum, _mm256_set1_epi16(128));
+        return _mm256_add_epi16(_mm256_srai_epi16(sum, 8), _mm256_set1_epi16(128));
+    }
+
+    /// Packs 16 16 bit samples to 16 bytes.
+    static inline __m128i PackBytesAVX2(const __m256i &v)
+    {
+        return _mm256_castsi256_si128(CR_LINEAR_QUADS(_mm256_packus_epi16(v, v)));
+    }
+
+    /// @endcond
+
+    void RowPairAVX2(const uchar *argb0, const uchar *argb1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width, bool interleaved)
+    {
+        int x = 0;
+        for (; x + 32 <= width; x += 32)
+        {
+            __m256i b0lo, g0lo, r0lo, b0hi, g0hi, r0hi;
+            __m256i b1lo, g1lo, r1lo, b1hi, g1hi, r1hi;
+            SplitAVX2(argb0 + x * 4, b0lo, g0lo, r0lo);
+            SplitAVX2(argb0 + x * 4 + 64, b0hi, g0hi, r0hi);
+            SplitAVX2(argb1 + x * 4, b1lo, g1lo, r1lo);
+            SplitAVX2(argb1 + x * 4 + 64, b1hi, g1hi, r1hi);
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(y0 + x), CR_LINEAR_QUADS(_mm256_packus_epi16(LumaAVX2(b0lo, g0lo, r0lo), LumaAVX2(b0hi, g0hi, r0hi))));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(y1 + x), CR_LINEAR_QUADS(_mm256_packus_epi16(LumaAVX2(b1lo, g1lo, r1lo), LumaAVX2(b1hi, g1hi, r1hi))));
+
+            const __m256i b = Average2x2AVX2(b0lo, b0hi, b1lo, b1hi);
+            const __m256i g = Average2x2AVX2(g0lo, g0hi, g1lo, g1hi);
+            const __m256i r = Average2x2AVX2(r0lo, r0hi, r1lo, r1hi);
+
+            const __m128i u8 = PackBytesAVX2(ChromaAVX2(b, g, r, 112, -74, -38));
+            const __m128i v8 = PackBytesAVX2(ChromaAVX2(r, g, b, 112, -94, -18));
+            if (interleaved)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x), _mm_unpacklo_epi8(u8, v8));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x + 16), _mm_unpackhi_epi8(u8, v8));
+            }
+            else
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x / 2), u8);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x / 2), v8);
+            }
+        }
+        // Finish the remaining pixels with the narrower kernels.
+        if (x < width)
+            RowPairSSE2(argb0 + x * 4, argb1 + x * 4, y0 + x, y1 + x,
+                        interleaved ? u + x : u + x / 2, interleaved ? v : v + x / 2, width - x, interleaved);
+    }
+
+    #undef CR_LINEAR_QUADS
+}
+}
+
+#endif
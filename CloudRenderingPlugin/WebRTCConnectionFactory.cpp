@@ -0,0 +1,116 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#ifdef _WIN32
+#include "Win.h"
+#include <tlhelp32.h>
+#endif
+
+#include "WebRTCConnectionFactory.h"
+
+#include "WebRTCClock.h"
+#include "LoggingFunctions.h"
+
+#include <QFile>
+
+#include "talk/base/ssladapter.h"
+
+namespace WebRTC
+{
+    ConnectionFactory::ConnectionFactory() :
+        LC("[WebRTC::ConnectionFactory]: "),
+        threadsBeforeFactory_(ProcessThreadCount()),
+        factoryCreateMs_(0.0),
+        peersCreated_(0),
+        lastPeerCreateMs_(0.0),
+        totalPeerCreateMs_(0.0)
+    {
+        tick_t start = GetCurrentClockTime();
+
+        talk_base::InitializeSSL();
+        factory_ = webrtc::CreatePeerConnectionFactory();
+
+        factoryCreateMs_ = MsSince(start);
+        if (factory_.get())
+            LogDebug(LC + QString("Created shared PeerConnectionFactory in %1 msec, process threads %2 -> %3")
+                .arg(factoryCreateMs_, 0, 'f', 2).arg(threadsBeforeFactory_).arg(ProcessThreadCount()));
+        else
+            LogError(LC + "Failed to create PeerConnectionFactory!");
+    }
+
+    ConnectionFactory::~ConnectionFactory()
+    {
+        // The factory threads stop once the last peer has released its reference. Peers that are still
+        // alive keep using SSL, it is only cleaned up if this was the last reference.
+        webrtc::PeerConnectionFactoryInterface *factory = factory_.release();
+        if (factory && factory->Release() > 0)
+        {
+            LogWarning(LC + "PeerConnectionFactory is still referenced by peers, not cleaning up SSL.");
+            return;
+        }
+        talk_base::CleanupSSL();
+    }
+
+    webrtc::PeerConnectionFactoryInterface *ConnectionFactory::Factory() const
+    {
+        return factory_.get();
+    }
+
+    void ConnectionFactory::RecordPeerCreated(double ms)
+    {
+        peersCreated_++;
+        lastPeerCreateMs_ = ms;
+        totalPeerCreateMs_ += ms;
+    }
+
+    QVariantMap ConnectionFactory::Statistics() const
+    {
+        QVariantMap stats;
+        stats["threads"] = ProcessThreadCount();
+        stats["threadsBeforeFactory"] = threadsBeforeFactory_;
+        stats["factoryCreateMs"] = factoryCreateMs_;
+        stats["peersCreated"] = peersCreated_;
+        stats["lastPeerCreateMs"] = lastPeerCreateMs_;
+        stats["averagePeerCreateMs"] = (peersCreated_ > 0 ? totalPeerCreateMs_ / peersCreated_ : 0.0);
+        return stats;
+    }
+
+    int ConnectionFactory::ProcessThreadCount()
+    {
+#if defined(_WIN32)
+        HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+        if (snapshot == INVALID_HANDLE_VALUE)
+            return -1;
+        const DWORD pid = GetCurrentProcessId();
+        int threads = 0;
+        THREADENTRY32 entry;
+        entry.dwSize = sizeof(entry);
+        if (Thread32First(snapshot, &entry))
+        {
+            do
+            {
+                if (entry.th32OwnerProcessID == pid)
+                    threads++;
+            } while(Thread32Next(snapshot, &entry));
+        }
+        CloseHandle(snapshot);
+        return threads;
+#elif defined(__linux__)
+        QFile status("/proc/self/status");
+        if (!status.open(QIODevice::ReadOnly))
+            return -1;
+        foreach(const QByteArray &line, status.readAll().split('\n'))
+            if (line.startsWith("Threads:"))
+                return line.mid(8).trimmed().toInt();
+        return -1;
+#else
+        return -1;
+#endif
+    }
+}
@@ -0,0 +1,60 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include "talk/app/webrtc/peerconnectioninterface.h"
+#include "talk/base/scoped_ref_ptr.h"
+
+#include <QVariant>
+
+namespace WebRTC
+{
+    /// Process wide PeerConnectionFactory shared by every PeerConnection.
+    /** Each webrtc::PeerConnectionFactory starts its own signaling and worker threads and media engine.
+        Creating one per peer multiplies the threads and engine state by the peer count, so the plugin
+        owns a single factory that is created on first use. SSL is initialized once for the factory
+        lifetime instead of once per peer.
+
+        Access with CloudRenderingPlugin::ConnectionFactory(). */
+    class CLOUDRENDERING_API ConnectionFactory
+    {
+    public:
+        ConnectionFactory();
+        ~ConnectionFactory();
+
+        /// Returns the shared factory, null if it could not be created.
+        webrtc::PeerConnectionFactoryInterface *Factory() const;
+
+        /// Records the time it took to set up a peer connection with the shared factory.
+        void RecordPeerCreated(double ms);
+
+        /// Returns factory and peer creation statistics.
+        /** Contains "threads" (current process thread count), "threadsBeforeFactory", "factoryCreateMs",
+            "peersCreated", "lastPeerCreateMs" and "averagePeerCreateMs". */
+        QVariantMap Statistics() const;
+
+        /// Returns the number of threads in this process, -1 if it cannot be queried on this platform.
+        static int ProcessThreadCount();
+
+    private:
+        QString LC;
+
+        talk_base::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory_;
+
+        int threadsBeforeFactory_;
+        double factoryCreateMs_;
+        int peersCreated_;
+        double lastPeerCreateMs_;
+        double totalPeerCreateMs_;
+    };
+}
@@ -0,0 +1,236 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file
+    @brief   */
+
+#include "WebRTCFrameBuffer.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <vector>
+
+#include "talk/media/base/videocommon.h"
+
+namespace WebRTC
+{
+    static const int cFrameBufferAlignment = 32;
+
+    // FrameBufferPoolStorage
+
+    /// @cond PRIVATE
+
+    /// State shared between the pool and its outstanding buffers.
+    struct FrameBufferPoolStorage
+    {
+        FrameBufferPoolStorage(int maxFree_) :
+            maxFree(maxFree_),
+            closed(false)
+        {
+        }
+
+        ~FrameBufferPoolStorage()
+        {
+            FreeAll();
+        }
+
+        FrameBuffer *Take(int numBytes)
+        {
+            QMutexLocker lock(&mutex);
+            for (size_t i=0; i<free.size(); ++i)
+            {
+                FrameBuffer *buffer = free[i];
+                if (buffer->capacity_ >= numBytes)
+                {
+                    free.erase(free.begin() + i);
+                    stats.reuses++;
+                    return buffer;
+                }
+            }
+            // Nothing fits, most likely the frame size changed.
+            // Drop a stale buffer so the pool does not keep growing.
+            if (!free.empty())
+            {
+                delete free.front();
+                free.erase(free.begin());
+            }
+            stats.allocations++;
+            stats.bytesAllocated += static_cast<u64>(numBytes);
+            return new FrameBuffer(numBytes);
+        }
+
+        void Recycle(FrameBuffer *buffer)
+        {
+            if (!buffer)
+                return;
+            {
+                QMutexLocker lock(&mutex);
+                if (!closed && static_cast<int>(free.size()) < maxFree)
+                {
+                    free.push_back(buffer);
+                    return;
+                }
+            }
+            delete buffer;
+        }
+
+        void FreeAll()
+        {
+            QMutexLocker lock(&mutex);
+            for (size_t i=0; i<free.size(); ++i)
+                delete free[i];
+            free.clear();
+        }
+
+        QMutex mutex;
+        std::vector<FrameBuffer*> free;
+        FrameBufferPool::Statistics stats;
+        int maxFree;
+        bool closed;
+    };
+
+    /// Shared ptr deleter that returns the buffer to its pool.
+    struct FrameBufferRecycler
+    {
+        FrameBufferRecycler(const shared_ptr<FrameBufferPoolStorage> &storage_) : storage(storage_) {}
+
+        void operator()(FrameBuffer *buffer) const
+        {
+            storage->Recycle(buffer);
+        }
+
+        shared_ptr<FrameBufferPoolStorage> storage;
+    };
+
+    /// @endcond
+
+    // FrameBuffer
+
+    FrameBuffer::FrameBuffer(int capacity) :
+        width(0),
+        height(0),
+        stride(0),
+        fourcc(0),
+        size(0),
+        capacity_(capacity)
+    {
+        memory_ = new uchar[capacity_ + cFrameBufferAlignment];
+        data_ = memory_ + ((cFrameBufferAlignment - (reinterpret_cast<size_t>(memory_) % cFrameBufferAlignment)) % cFrameBufferAlignment);
+    }
+
+    FrameBuffer::~FrameBuffer()
+    {
+        delete[] memory_;
+    }
+
+    uchar *FrameBuffer::Data() const
+    {
+        return data_;
+    }
+
+    int FrameBuffer::Capacity() const
+    {
+        return capacity_;
+    }
+
+    QImage FrameBuffer::ToImage() const
+    {
+        if (fourcc != cricket::FOURCC_ARGB || width <= 0 || height <= 0)
+            return QImage();
+        return QImage(data_, width, height, stride, QImage::Format_ARGB32);
+    }
+
+    // FrameBufferPool::Statistics
+
+    FrameBufferPool::Statistics::Statistics() :
+        allocations(0),
+        bytesAllocated(0),
+        reuses(0),
+        copies(0),
+        bytesCopied(0)
+    {
+    }
+
+    QVariantMap FrameBufferPool::Statistics::ToVariant() const
+    {
+        QVariantMap v;
+        v["allocations"] = static_cast<qulonglong>(allocations);
+        v["bytesAllocated"] = static_cast<qulonglong>(bytesAllocated);
+        v["reuses"] = static_cast<qulonglong>(reuses);
+        v["copies"] = static_cast<qulonglong>(copies);
+        v["bytesCopied"] = static_cast<qulonglong>(bytesCopied);
+        return v;
+    }
+
+    // FrameBufferPool
+
+    FrameBufferPool::FrameBufferPool(int maxFreeBuffers) :
+        storage_(new FrameBufferPoolStorage(maxFreeBuffers > 0 ? maxFreeBuffers : 1))
+    {
+    }
+
+    FrameBufferPool::~FrameBufferPool()
+    {
+        // Outstanding buffers keep the storage alive, make them free themselves on release.
+        {
+            QMutexLocker lock(&storage_->mutex);
+            storage_->closed = true;
+        }
+        storage_->FreeAll();
+    }
+
+    WebRTCFrameBufferPtr FrameBufferPool::Acquire(int numBytes)
+    {
+        if (numBytes <= 0)
+            return WebRTCFrameBufferPtr();
+
+        FrameBuffer *buffer = storage_->Take(numBytes);
+        buffer->width = 0;
+        buffer->height = 0;
+        buffer->stride = 0;
+        buffer->fourcc = 0;
+        buffer->size = numBytes;
+        return WebRTCFrameBufferPtr(buffer, FrameBufferRecycler(storage_));
+    }
+
+    WebRTCFrameBufferPtr FrameBufferPool::AcquireARGB(int width, int height)
+    {
+        WebRTCFrameBufferPtr buffer = Acquire(width * height * 4);
+        if (buffer.get())
+        {
+            buffer->width = width;
+            buffer->height = height;
+            buffer->stride = width * 4;
+            buffer->fourcc = cricket::FOURCC_ARGB;
+        }
+        return buffer;
+    }
+
+    void FrameBufferPool::RecordCopy(int numBytes)
+    {
+        QMutexLocker lock(&storage_->mutex);
+        storage_->stats.copies++;
+        storage_->stats.bytesCopied += static_cast<u64>(numBytes);
+    }
+
+    FrameBufferPool::Statistics FrameBufferPool::Stats() const
+    {
+        QMutexLocker lock(&storage_->mutex);
+        return storage_->stats;
+    }
+
+    void FrameBufferPool::ResetStats()
+    {
+        QMutexLocker lock(&storage_->mutex);
+        storage_->stats = Statistics();
+    }
+
+    void FrameBufferPool::Trim()
+    {
+        storage_->FreeAll();
+    }
+}
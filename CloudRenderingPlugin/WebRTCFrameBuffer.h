@@ -0,0 +1,123 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include <QImage>
+#include <QVariant>
+
+namespace WebRTC
+{
+    /// @cond PRIVATE
+    struct FrameBufferPoolStorage;
+    /// @endcond
+
+    /// Pixel data of a single captured frame.
+    /** Frame buffers are acquired from a FrameBufferPool and handed around as
+        WebRTCFrameBufferPtr. When the last reference is released the buffer
+        returns to the pool and its memory is reused for a later frame.
+
+        @note Consumers must treat the pixel data as read only, the same buffer
+        is shared with every consumer of the frame. */
+    class CLOUDRENDERING_API FrameBuffer
+    {
+    public:
+        /// Frame width in pixels.
+        int width;
+
+        /// Frame height in pixels.
+        int height;
+
+        /// Bytes per line of the first plane.
+        int stride;
+
+        /// libjingle FOURCC of the pixel data, eg. cricket::FOURCC_ARGB.
+        u32 fourcc;
+
+        /// Number of bytes in use, never more than Capacity().
+        int size;
+
+        /// Returns the pixel data.
+        /** @note The data is aligned to 32 bytes. */
+        uchar *Data() const;
+
+        /// Returns the allocated size of the buffer in bytes.
+        int Capacity() const;
+
+        /// Returns a QImage that references the pixel data without copying.
+        /** Only valid for 32 bit ARGB frames and only as long as this buffer is alive. */
+        QImage ToImage() const;
+
+    private:
+        friend struct FrameBufferPoolStorage;
+
+        FrameBuffer(int capacity);
+        ~FrameBuffer();
+
+        uchar *memory_;
+        uchar *data_;
+        int capacity_;
+    };
+
+    /// Pool of reusable, reference counted frame buffers.
+    /** The pool is thread safe. Buffers may outlive the pool, in that case
+        they are freed when released instead of being recycled. */
+    class CLOUDRENDERING_API FrameBufferPool
+    {
+    public:
+        /// Pool allocation and copy statistics.
+        struct Statistics
+        {
+            /// Number of buffers allocated from the heap.
+            u64 allocations;
+            /// Number of bytes allocated from the heap.
+            u64 bytesAllocated;
+            /// Number of acquires served from the pool without allocating.
+            u64 reuses;
+            /// Number of frame data copies reported with RecordCopy().
+            u64 copies;
+            /// Number of bytes copied reported with RecordCopy().
+            u64 bytesCopied;
+
+            Statistics();
+
+            QVariantMap ToVariant() const;
+        };
+
+        /// @param maxFreeBuffers Maximum number of released buffers kept for reuse.
+        FrameBufferPool(int maxFreeBuffers = 8);
+        ~FrameBufferPool();
+
+        /// Returns a buffer with at least @c numBytes capacity.
+        /** The returned buffer has its metadata reset and size set to @c numBytes.
+            @return Null ptr if @c numBytes is not positive. */
+        WebRTCFrameBufferPtr Acquire(int numBytes);
+
+        /// Acquires a 32 bit ARGB buffer for a @c width x @c height frame and fills its metadata.
+        WebRTCFrameBufferPtr AcquireARGB(int width, int height);
+
+        /// Records a copy of frame data so it shows up in Stats().
+        void RecordCopy(int numBytes);
+
+        /// Returns the current statistics.
+        Statistics Stats() const;
+
+        /// Resets the statistics counters.
+        void ResetStats();
+
+        /// Frees all currently unused buffers.
+        void Trim();
+
+    private:
+        shared_ptr<FrameBufferPoolStorage> storage_;
+    };
+}
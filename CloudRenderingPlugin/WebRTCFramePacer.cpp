@@ -0,0 +1,134 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "WebRTCFramePacer.h"
+
+#include <QVariantList>
+
+namespace WebRTC
+{
+    /// @cond PRIVATE
+
+    /// Upper bounds of the jitter histogram buckets in milliseconds, the last bucket is open ended.
+    static const double cJitterBucketsMs[] = { 1.0, 2.0, 4.0, 8.0, 16.0, 33.0 };
+    static const size_t cNumJitterBuckets = sizeof(cJitterBucketsMs) / sizeof(cJitterBucketsMs[0]) + 1;
+
+    /// @endcond
+
+    FramePacer::FramePacer(double fps) :
+        fps_(0.0),
+        intervalTicks_(0.0),
+        clockFreq_(static_cast<double>(GetCurrentClockFreq())),
+        started_(false),
+        epoch_(0),
+        deadline_(0)
+    {
+        ResetStatistics();
+        SetFps(fps > 0.0 ? fps : 30.0);
+    }
+
+    void FramePacer::SetFps(double fps)
+    {
+        if (fps <= 0.0 || fps == fps_)
+            return;
+        fps_ = fps;
+        intervalTicks_ = clockFreq_ / fps_;
+        Restart();
+    }
+
+    double FramePacer::Fps() const
+    {
+        return fps_;
+    }
+
+    void FramePacer::Restart()
+    {
+        started_ = false;
+        deadline_ = 0;
+    }
+
+    bool FramePacer::IsDue(tick_t now)
+    {
+        if (!started_)
+        {
+            started_ = true;
+            epoch_ = now;
+            deadline_ = 0;
+        }
+
+        // Compute the deadline from the epoch every time, adding up intervals would accumulate rounding errors.
+        const double sinceEpoch = static_cast<double>(now - epoch_);
+        const double deadlineTicks = static_cast<double>(deadline_) * intervalTicks_;
+        if (sinceEpoch < deadlineTicks)
+            return false;
+
+        // Skip the deadlines that already passed, only the latest one is captured.
+        const u64 current = qMax(deadline_, static_cast<u64>(sinceEpoch / intervalTicks_));
+        missedDeadlines_ += current - deadline_;
+        deadline_ = current + 1;
+
+        if (captures_ == 0)
+            firstCapture_ = now;
+        lastCapture_ = now;
+        captures_++;
+
+        // Jitter is the time between the captured deadline and now.
+        const double jitterMs = TicksToMs(sinceEpoch - static_cast<double>(current) * intervalTicks_);
+        jitterTotalMs_ += jitterMs;
+        if (jitterMs > jitterMaxMs_)
+            jitterMaxMs_ = jitterMs;
+        size_t bucket = 0;
+        while(bucket < cNumJitterBuckets - 1 && jitterMs >= cJitterBucketsMs[bucket])
+            ++bucket;
+        histogram_[bucket]++;
+        return true;
+    }
+
+    QVariantMap FramePacer::Statistics() const
+    {
+        QVariantMap stats;
+        stats["targetFps"] = fps_;
+        stats["captures"] = static_cast<qulonglong>(captures_);
+        stats["missedDeadlines"] = static_cast<qulonglong>(missedDeadlines_);
+
+        const double elapsedMs = (captures_ > 1 ? TicksToMs(static_cast<double>(lastCapture_ - firstCapture_)) : 0.0);
+        stats["effectiveFps"] = (elapsedMs > 0.0 ? static_cast<double>(captures_ - 1) * 1000.0 / elapsedMs : 0.0);
+        stats["jitterAverageMs"] = (captures_ > 0 ? jitterTotalMs_ / static_cast<double>(captures_) : 0.0);
+        stats["jitterMaxMs"] = jitterMaxMs_;
+
+        QVariantList histogram;
+        for (size_t i=0; i<cNumJitterBuckets; ++i)
+        {
+            QVariantMap bucket;
+            bucket["fromMs"] = (i > 0 ? cJitterBucketsMs[i-1] : 0.0);
+            if (i < cNumJitterBuckets - 1)
+                bucket["toMs"] = cJitterBucketsMs[i];
+            bucket["count"] = static_cast<qulonglong>(histogram_[i]);
+            histogram << bucket;
+        }
+        stats["jitterHistogram"] = histogram;
+        return stats;
+    }
+
+    void FramePacer::ResetStatistics()
+    {
+        captures_ = 0;
+        missedDeadlines_ = 0;
+        firstCapture_ = 0;
+        lastCapture_ = 0;
+        jitterTotalMs_ = 0.0;
+        jitterMaxMs_ = 0.0;
+        histogram_.assign(cNumJitterBuckets, 0);
+    }
+
+    double FramePacer::TicksToMs(double ticks) const
+    {
+        return (clockFreq_ > 0.0 ? ticks * 1000.0 / clockFreq_ : 0.0);
+    }
+}
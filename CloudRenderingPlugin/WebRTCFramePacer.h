@@ -0,0 +1,78 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include "HighPerfClock.h"
+
+#include <QVariant>
+#include <vector>
+
+namespace WebRTC
+{
+    /// Schedules frame captures at a fixed rate from monotonic timestamps.
+    /** Capture deadline k is at epoch + k * interval, so the rate does not drift with the main
+        loop frame time and rounding errors do not accumulate. When a capture happens late the
+        lateness is not added to the next interval. Deadlines that were missed completely, because
+        a main loop frame took longer than the interval, are skipped and counted.
+
+        Fractional rates such as 29.97 are supported. The pacer does not read the clock itself,
+        the caller passes the current GetCurrentClockTime() so the pacer can be driven by any clock. */
+    class CLOUDRENDERING_API FramePacer
+    {
+    public:
+        /// @param fps Target capture rate in frames per second.
+        FramePacer(double fps = 30.0);
+
+        /// Sets the target capture rate, restarts the deadline schedule if the rate changes.
+        /** Non-positive rates are ignored. */
+        void SetFps(double fps);
+
+        /// Returns the target capture rate.
+        double Fps() const;
+
+        /// Returns if a capture is due at @c now and advances the schedule if it is.
+        /** Call once per main loop frame. The first call always returns true and starts the schedule. */
+        bool IsDue(tick_t now);
+
+        /// Restarts the deadline schedule from the next IsDue() call.
+        void Restart();
+
+        /// Returns pacing statistics.
+        /** Contains "targetFps", "effectiveFps", "captures", "missedDeadlines", "jitterAverageMs",
+            "jitterMaxMs" and "jitterHistogram", a list of {"fromMs", "toMs", "count"} buckets of the
+            time between the deadline and the actual capture. The last bucket has no "toMs". */
+        QVariantMap Statistics() const;
+
+        /// Resets the statistics counters.
+        void ResetStatistics();
+
+    private:
+        double TicksToMs(double ticks) const;
+
+        double fps_;
+        double intervalTicks_;
+        double clockFreq_;
+
+        bool started_;
+        tick_t epoch_;
+        u64 deadline_;
+
+        u64 captures_;
+        u64 missedDeadlines_;
+        tick_t firstCapture_;
+        tick_t lastCapture_;
+        double jitterTotalMs_;
+        double jitterMaxMs_;
+        std::vector<u64> histogram_;
+    };
+}
@@ -0,0 +1,120 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "WebRTCFrameStamp.h"
+
+#include <string.h>
+
+namespace WebRTC
+{
+namespace FrameStamp
+{
+    /// @cond PRIVATE
+
+    static const int cColumns = 16;
+    static const int cRows = 4;
+    static const int cMinBlockSize = 4;
+    static const uchar cSync = 0xA5;
+    static const uchar cBlack = 16;
+    static const uchar cWhite = 235;
+
+    /// Packs the pattern to 8 bytes: sync, timestamp, sequence and checksum.
+    static void Pack(u32 timestampMs, u16 sequence, uchar *bytes)
+    {
+        bytes[0] = cSync;
+        bytes[1] = static_cast<uchar>(timestampMs >> 24);
+        bytes[2] = static_cast<uchar>(timestampMs >> 16);
+        bytes[3] = static_cast<uchar>(timestampMs >> 8);
+        bytes[4] = static_cast<uchar>(timestampMs);
+        bytes[5] = static_cast<uchar>(sequence >> 8);
+        bytes[6] = static_cast<uchar>(sequence);
+        bytes[7] = 0x5A;
+        for (int i=1; i<7; ++i)
+            bytes[7] ^= bytes[i];
+    }
+
+    /// @endcond
+
+    int BlockSize(int width, int height)
+    {
+        // At most a quarter of the frame width and height.
+        int block = width / 4 / cColumns;
+        if (height / 4 / cRows < block)
+            block = height / 4 / cRows;
+        return (block >= cMinBlockSize ? block : 0);
+    }
+
+    bool Write(uchar *y, int stride, int width, int height, u32 timestampMs, u16 sequence)
+    {
+        const int block = BlockSize(width, height);
+        if (!y || block == 0)
+            return false;
+
+        uchar bytes[8];
+        Pack(timestampMs, sequence, bytes);
+        for (int row=0; row<cRows; ++row)
+        {
+            for (int line=0; line<block; ++line)
+            {
+                uchar *dst = y + (row * block + line) * stride;
+                for (int col=0; col<cColumns; ++col)
+                {
+                    const int bit = row * cColumns + col;
+                    const bool set = ((bytes[bit / 8] >> (7 - bit % 8)) & 1) != 0;
+                    memset(dst + col * block, set ? cWhite : cBlack, block);
+                }
+            }
+        }
+        return true;
+    }
+
+    bool Read(const uchar *y, int stride, int width, int height, u32 &timestampMs, u16 &sequence)
+    {
+        const int block = BlockSize(width, height);
+        if (!y || block == 0)
+            return false;
+
+        // Sample the inner half of each block, the edges bleed in lossy encoding.
+        const int margin = block / 4;
+        const int threshold = (static_cast<int>(cBlack) + static_cast<int>(cWhite)) / 2;
+        uchar bytes[8];
+        memset(bytes, 0, sizeof(bytes));
+        for (int row=0; row<cRows; ++row)
+        {
+            for (int col=0; col<cColumns; ++col)
+            {
+                int sum = 0, count = 0;
+                for (int py = row * block + margin; py < (row + 1) * block - margin; ++py)
+                {
+                    const uchar *src = y + py * stride;
+                    for (int px = col * block + margin; px < (col + 1) * block - margin; ++px, ++count)
+                        sum += src[px];
+                }
+                if (count > 0 && sum / count >= threshold)
+                {
+                    const int bit = row * cColumns + col;
+                    bytes[bit / 8] |= static_cast<uchar>(1 << (7 - bit % 8));
+                }
+            }
+        }
+
+        const u32 ts = (static_cast<u32>(bytes[1]) << 24) | (static_cast<u32>(bytes[2]) << 16) |
+                       (static_cast<u32>(bytes[3]) << 8) | static_cast<u32>(bytes[4]);
+        const u16 seq = static_cast<u16>((bytes[5] << 8) | bytes[6]);
+        uchar expected[8];
+        Pack(ts, seq, expected);
+        if (memcmp(bytes, expected, sizeof(bytes)) != 0)
+            return false;
+
+        timestampMs = ts;
+        sequence = seq;
+        return true;
+    }
+}
+}
@@ -0,0 +1,37 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+namespace WebRTC
+{
+    /// Machine readable timestamp pattern stamped into the luma plane of video frames.
+    /** The pattern is a 16 x 4 grid of black and white blocks in the top left corner of the frame.
+        It carries a sync byte, a 32 bit millisecond timestamp, a 16 bit frame sequence number and a
+        checksum. The block size is derived from the frame size so the pattern survives the encoder
+        scaling the frame, and the blocks are large enough to survive lossy encoding.
+
+        Used by the loopback benchmark to measure capture to decode latency and frame drops. */
+    namespace FrameStamp
+    {
+        /// Returns the block size in pixels used for a @c width x @c height frame, 0 if the frame is too small for the pattern.
+        CLOUDRENDERING_API int BlockSize(int width, int height);
+
+        /// Writes the pattern to an 8 bit luma plane.
+        /** @return False if the frame is too small for the pattern. */
+        CLOUDRENDERING_API bool Write(uchar *y, int stride, int width, int height, u32 timestampMs, u16 sequence);
+
+        /// Reads the pattern from an 8 bit luma plane.
+        /** @return False if the frame is too small or the pattern is not found or corrupted. */
+        CLOUDRENDERING_API bool Read(const uchar *y, int stride, int width, int height, u32 &timestampMs, u16 &sequence);
+    }
+}
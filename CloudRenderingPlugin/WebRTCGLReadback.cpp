@@ -0,0 +1,324 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "Win.h"
+
+#include "WebRTCGLReadback.h"
+#include "WebRTCFrameBuffer.h"
+#include "WebRTCClock.h"
+
+#include "LoggingFunctions.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#if defined(__APPLE__)
+#include <OpenGL/gl.h>
+#else
+#include <GL/gl.h>
+#if !defined(_WIN32)
+#include <GL/glx.h>
+#endif
+#endif
+
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY 0x88B8
+#endif
+
+#if defined(_WIN32)
+#define CR_GLAPIENTRY __stdcall
+#else
+#define CR_GLAPIENTRY
+#endif
+
+namespace WebRTC
+{
+    /// @cond PRIVATE
+
+    static const int cMaxRingSize = 8;
+
+    // GL 1.5 buffer object entry points, not exported by the Windows or Linux GL libraries.
+    typedef void (CR_GLAPIENTRY *GenBuffersFunc)(GLsizei n, GLuint *buffers);
+    typedef void (CR_GLAPIENTRY *DeleteBuffersFunc)(GLsizei n, const GLuint *buffers);
+    typedef void (CR_GLAPIENTRY *BindBufferFunc)(GLenum target, GLuint buffer);
+    typedef void (CR_GLAPIENTRY *BufferDataFunc)(GLenum target, ptrdiff_t size, const void *data, GLenum usage);
+    typedef void *(CR_GLAPIENTRY *MapBufferFunc)(GLenum target, GLenum access);
+    typedef GLboolean (CR_GLAPIENTRY *UnmapBufferFunc)(GLenum target);
+
+    static GenBuffersFunc glGenBuffersFunc = 0;
+    static DeleteBuffersFunc glDeleteBuffersFunc = 0;
+    static BindBufferFunc glBindBufferFunc = 0;
+    static BufferDataFunc glBufferDataFunc = 0;
+    static MapBufferFunc glMapBufferFunc = 0;
+    static UnmapBufferFunc glUnmapBufferFunc = 0;
+
+    static void *GetGLProcAddress(const char *name)
+    {
+#if defined(__APPLE__)
+        (void)name;
+        return 0;
+#elif defined(_WIN32)
+        return reinterpret_cast<void*>(wglGetProcAddress(name));
+#else
+        return reinterpret_cast<void*>(glXGetProcAddressARB(reinterpret_cast<const GLubyte*>(name)));
+#endif
+    }
+
+    /// Resolves the core name first and the ARB suffixed one second.
+    template <typename Func>
+    static bool ResolveGLFunction(Func &func, const char *name, const char *arbName)
+    {
+        func = reinterpret_cast<Func>(GetGLProcAddress(name));
+        if (!func)
+            func = reinterpret_cast<Func>(GetGLProcAddress(arbName));
+        return (func != 0);
+    }
+
+    static bool ResolveGLFunctions()
+    {
+#if defined(__APPLE__)
+        // OS X links GL 2.1 directly.
+        glGenBuffersFunc = &glGenBuffers;
+        glDeleteBuffersFunc = &glDeleteBuffers;
+        glBindBufferFunc = &glBindBuffer;
+        glBufferDataFunc = reinterpret_cast<BufferDataFunc>(&glBufferData);
+        glMapBufferFunc = &glMapBuffer;
+        glUnmapBufferFunc = &glUnmapBuffer;
+        return true;
+#else
+        return (ResolveGLFunction(glGenBuffersFunc, "glGenBuffers", "glGenBuffersARB") &&
+                ResolveGLFunction(glDeleteBuffersFunc, "glDeleteBuffers", "glDeleteBuffersARB") &&
+                ResolveGLFunction(glBindBufferFunc, "glBindBuffer", "glBindBufferARB") &&
+                ResolveGLFunction(glBufferDataFunc, "glBufferData", "glBufferDataARB") &&
+                ResolveGLFunction(glMapBufferFunc, "glMapBuffer", "glMapBufferARB") &&
+                ResolveGLFunction(glUnmapBufferFunc, "glUnmapBuffer", "glUnmapBufferARB"));
+#endif
+    }
+
+    /// Returns if the context supports pixel buffer objects, either GL 2.1 or the ARB extension.
+    static bool HasPixelBufferObjects()
+    {
+        const char *version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+        int major = 0, minor = 0;
+        if (version && sscanf(version, "%d.%d", &major, &minor) == 2 && (major > 2 || (major == 2 && minor >= 1)))
+            return true;
+        const char *extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+        return (extensions && strstr(extensions, "GL_ARB_pixel_buffer_object") != 0);
+    }
+
+    /// @endcond
+
+    GLReadback::GLReadback(int ringSize) :
+        next_(0),
+        width_(0),
+        height_(0),
+        resolved_(0),
+        reads_(0),
+        delivered_(0),
+        dropped_(0),
+        issueMs_(0.0),
+        mapMs_(0.0),
+        copyMs_(0.0)
+    {
+        slots_.resize(qBound(1, ringSize, cMaxRingSize));
+    }
+
+    GLReadback::~GLReadback()
+    {
+        // The GL context might already be gone, Release() is explicit.
+    }
+
+    int GLReadback::RingSize() const
+    {
+        return static_cast<int>(slots_.size());
+    }
+
+    bool GLReadback::IsAvailable()
+    {
+        if (resolved_ == 0)
+        {
+            const char *renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+            glRenderer_ = (renderer ? QString::fromLatin1(renderer) : QString());
+            if (!renderer)
+                Fail("No current GL context");
+            else if (!HasPixelBufferObjects())
+                Fail("Pixel buffer objects not supported by " + glRenderer_);
+            else if (!ResolveGLFunctions())
+                Fail("Failed to resolve GL buffer object functions");
+            else
+            {
+                resolved_ = 1;
+                LogInfo(QString("[GLReadback]: Using %1 pixel buffer object ring on %2").arg(RingSize()).arg(glRenderer_));
+            }
+        }
+        return (resolved_ == 1);
+    }
+
+    QString GLReadback::FailureReason() const
+    {
+        return failure_;
+    }
+
+    void GLReadback::Fail(const QString &reason)
+    {
+        resolved_ = -1;
+        failure_ = reason;
+        LogWarning("[GLReadback]: " + reason + ", falling back to synchronous readback");
+    }
+
+    bool GLReadback::Allocate(int width, int height)
+    {
+        Reset();
+        for (size_t i=0; i<slots_.size(); ++i)
+        {
+            Slot &slot = slots_[i];
+            if (slot.pbo == 0)
+                glGenBuffersFunc(1, &slot.pbo);
+            glBindBufferFunc(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            glBufferDataFunc(GL_PIXEL_PACK_BUFFER, static_cast<ptrdiff_t>(width) * height * 4, 0, GL_STREAM_READ);
+        }
+        glBindBufferFunc(GL_PIXEL_PACK_BUFFER, 0);
+        if (glGetError() != GL_NO_ERROR)
+        {
+            Fail(QString("Failed to allocate %1x%2 pixel buffer objects").arg(width).arg(height));
+            return false;
+        }
+        width_ = width;
+        height_ = height;
+        return true;
+    }
+
+    void GLReadback::Reset()
+    {
+        for (size_t i=0; i<slots_.size(); ++i)
+        {
+            if (slots_[i].pending)
+                dropped_++;
+            slots_[i].pending = false;
+        }
+        next_ = 0;
+    }
+
+    void GLReadback::Release()
+    {
+        // Also after a failure, the buffers may have been created before it. A buffer implies resolved functions.
+        for (size_t i=0; i<slots_.size(); ++i)
+        {
+            if (slots_[i].pbo != 0)
+                glDeleteBuffersFunc(1, &slots_[i].pbo);
+            slots_[i] = Slot();
+        }
+        width_ = 0;
+        height_ = 0;
+        next_ = 0;
+    }
+
+    WebRTCFrameBufferPtr GLReadback::Read(int width, int height, bool frontBuffer, FrameBufferPool *pool)
+    {
+        if (!pool || width <= 0 || height <= 0 || !IsAvailable())
+            return WebRTCFrameBufferPtr();
+
+        // Window size changed, the queued frames are stale.
+        if ((width != width_ || height != height_) && !Allocate(width, height))
+            return WebRTCFrameBufferPtr();
+
+        // Clear errors left behind by others so they are not taken as ours.
+        for (int i=0; i<16 && glGetError() != GL_NO_ERROR; ++i) {}
+
+        // Ogre expects its own pack state, restore what we change.
+        GLint packAlignment = 4, readBuffer = GL_BACK;
+        glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+        glGetIntegerv(GL_READ_BUFFER, &readBuffer);
+
+        // Queue the transfer of this frame, returns without waiting for the GPU.
+        tick_t start = GetCurrentClockTime();
+        Slot &queued = slots_[next_];
+        glBindBufferFunc(GL_PIXEL_PACK_BUFFER, queued.pbo);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadBuffer(frontBuffer ? GL_FRONT : GL_BACK);
+        glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+        queued.pending = true;
+        next_ = (next_ + 1) % static_cast<int>(slots_.size());
+        reads_++;
+        issueMs_ += MsSince(start);
+
+        // The next slot holds the frame queued RingSize() - 1 reads ago. With a ring of one it is the frame just queued.
+        WebRTCFrameBufferPtr frame;
+        Slot &oldest = slots_[next_];
+        if (oldest.pending)
+            frame = Map(oldest, pool);
+
+        glBindBufferFunc(GL_PIXEL_PACK_BUFFER, 0);
+        glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+        glReadBuffer(static_cast<GLenum>(readBuffer));
+
+        if (glGetError() != GL_NO_ERROR)
+        {
+            Fail("GL error during readback");
+            Reset();
+            return WebRTCFrameBufferPtr();
+        }
+        return frame;
+    }
+
+    WebRTCFrameBufferPtr GLReadback::Map(Slot &slot, FrameBufferPool *pool)
+    {
+        slot.pending = false;
+
+        tick_t start = GetCurrentClockTime();
+        glBindBufferFunc(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        const uchar *mapped = static_cast<const uchar*>(glMapBufferFunc(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+        mapMs_ += MsSince(start);
+        if (!mapped)
+            return WebRTCFrameBufferPtr();
+
+        // Mapped memory cannot be handed out. The copy also flips the bottom up GL rows,
+        // same as the synchronous Ogre readback.
+        start = GetCurrentClockTime();
+        WebRTCFrameBufferPtr frame = pool->AcquireARGB(width_, height_);
+        if (frame.get())
+        {
+            const int rowBytes = width_ * 4;
+            for (int y=0; y<height_; ++y)
+                memcpy(frame->Data() + y * frame->stride, mapped + (height_ - 1 - y) * rowBytes, rowBytes);
+            pool->RecordCopy(frame->size);
+            delivered_++;
+        }
+        glUnmapBufferFunc(GL_PIXEL_PACK_BUFFER);
+        copyMs_ += MsSince(start);
+        return frame;
+    }
+
+    QVariantMap GLReadback::Statistics() const
+    {
+        QVariantMap stats;
+        stats["ringSize"] = RingSize();
+        stats["available"] = (resolved_ == 1);
+        if (!failure_.isEmpty())
+            stats["failure"] = failure_;
+        if (!glRenderer_.isEmpty())
+            stats["glRenderer"] = glRenderer_;
+        stats["reads"] = static_cast<qulonglong>(reads_);
+        stats["delivered"] = static_cast<qulonglong>(delivered_);
+        stats["dropped"] = static_cast<qulonglong>(dropped_);
+        stats["averageIssueMs"] = (reads_ > 0 ? issueMs_ / static_cast<double>(reads_) : 0.0);
+        stats["averageMapMs"] = (delivered_ > 0 ? mapMs_ / static_cast<double>(delivered_) : 0.0);
+        stats["averageCopyMs"] = (delivered_ > 0 ? copyMs_ / static_cast<double>(delivered_) : 0.0);
+        return stats;
+    }
+}
@@ -0,0 +1,93 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include <QString>
+#include <QVariant>
+
+#include <vector>
+
+namespace WebRTC
+{
+    /// Asynchronous OpenGL framebuffer readback through a ring of pixel buffer objects.
+    /** Each Read() queues a glReadPixels into the next pixel buffer object and maps the one
+        queued RingSize() - 1 reads earlier. The GPU has that many frames to finish the
+        transfer, so the main thread does not stall on a pipeline flush like
+        Ogre::RenderTarget::copyContentsToMemory does. The price is RingSize() - 1 frames of latency.
+
+        Only uses GL 2.1 / ARB_pixel_buffer_object functionality, which is also provided by software
+        implementations like Mesa llvmpipe (LIBGL_ALWAYS_SOFTWARE=1).
+
+        @note All functions must be called from the thread the Ogre GL context is current in. */
+    class CLOUDRENDERING_API GLReadback
+    {
+    public:
+        /// @param ringSize Number of pixel buffer objects, clamped to [1, 8].
+        GLReadback(int ringSize);
+        ~GLReadback();
+
+        /// Returns the number of pixel buffer objects in the ring.
+        int RingSize() const;
+
+        /// Returns if asynchronous readback can be used.
+        /** Resolves the GL entry points on first call. Returns false if they are not available
+            or if a GL error has occurred, callers should then fall back to synchronous readback. */
+        bool IsAvailable();
+
+        /// Returns why IsAvailable() returned false.
+        QString FailureReason() const;
+
+        /// Queues readback of the current framebuffer and returns the oldest finished frame.
+        /** @param frontBuffer Read the front buffer instead of the back buffer.
+            @return ARGB frame queued RingSize() - 1 reads ago, null ptr while the ring fills up, after a size change or on error. */
+        WebRTCFrameBufferPtr Read(int width, int height, bool frontBuffer, FrameBufferPool *pool);
+
+        /// Drops all queued frames.
+        void Reset();
+
+        /// Releases the GL objects. The GL context must still be valid.
+        void Release();
+
+        /// Returns timing and frame counters.
+        QVariantMap Statistics() const;
+
+    private:
+        struct Slot
+        {
+            uint pbo;
+            bool pending;
+
+            Slot() : pbo(0), pending(false) {}
+        };
+
+        bool Allocate(int width, int height);
+        WebRTCFrameBufferPtr Map(Slot &slot, FrameBufferPool *pool);
+        void Fail(const QString &reason);
+
+        std::vector<Slot> slots_;
+        int next_;
+        int width_;
+        int height_;
+        int resolved_;
+        QString failure_;
+        QString glRenderer_;
+
+        // Statistics
+        u64 reads_;
+        u64 delivered_;
+        u64 dropped_;
+        double issueMs_;
+        double mapMs_;
+        double copyMs_;
+    };
+}
@@ -0,0 +1,337 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "WebRTCInputInjector.h"
+
+#include "CoreDefines.h"
+#include "LoggingFunctions.h"
+
+#include <QApplication>
+#include <QGraphicsView>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include <QKeySequence>
+#include <QDebug>
+
+namespace WebRTC
+{
+    /// @cond PRIVATE
+
+    /// Maps a [0.0, 1.0] position to @c view coordinates and to global coordinates.
+    static void MapToView(QGraphicsView *view, QWidget *window, float x, float y, QPoint &pos, QPoint &globalPos)
+    {
+        QRect renderingSurfaceRect = view->geometry();
+        pos = QPoint(renderingSurfaceRect.width() * x, renderingSurfaceRect.height() * y);
+        globalPos = (window ? window->geometry().topLeft() : QPoint()) + renderingSurfaceRect.topLeft() + pos;
+    }
+
+    /// @endcond
+
+    InputInjector::InputInjector() :
+        LC("[WebRTC::InputInjector]: "),
+        mouseButtons_(Qt::NoButton),
+        keyboardModifiers_(Qt::NoModifier)
+    {
+    }
+
+    Qt::Key InputInjector::KeyFromHtmlKeyCode(int c)
+    {
+        switch(c)
+        {
+            case 8:     return Qt::Key_Backspace;
+            case 9:     return Qt::Key_Tab;
+            case 13:    return Qt::Key_Enter;
+            case 16:    return Qt::Key_Shift;
+            case 17:    return Qt::Key_Control;
+            case 18:    return Qt::Key_Alt;
+            case 19:    return Qt::Key_Pause;
+            case 20:    return Qt::Key_CapsLock;
+            case 219:   return Qt::Key_BracketLeft;  // open bracket
+            case 220:   return Qt::Key_Backslash;
+            case 221:   return Qt::Key_BracketRight; // close bracket
+            case 222:   return Qt::Key_QuoteLeft;    // single quote
+        }
+        return Qt::Key_unknown;
+    }
+
+    Qt::MouseButton InputInjector::ButtonFromWhich(int which)
+    {
+        if (which == 1)
+            return Qt::LeftButton;
+        else if (which == 3)
+            return Qt::RightButton;
+        else if (which == 2)
+            return Qt::MiddleButton;
+        return Qt::NoButton;
+    }
+
+    Qt::MouseButtons InputInjector::MouseButtons() const
+    {
+        return mouseButtons_;
+    }
+
+    Qt::KeyboardModifiers InputInjector::KeyboardModifiers() const
+    {
+        return keyboardModifiers_;
+    }
+
+    void InputInjector::Reset()
+    {
+        mouseButtons_ = Qt::NoButton;
+        keyboardModifiers_ = Qt::NoModifier;
+    }
+
+    bool InputInjector::PostKeyboardEvent(QGraphicsView *view, const QVariantMap &data)
+    {
+        return PostKeyboardEvent(view, CloudRenderingProtocol::Application::InputPayload::FromVariant(data));
+    }
+
+    bool InputInjector::PostKeyboardEvent(QGraphicsView *view, const CloudRenderingProtocol::Application::InputPayload &input)
+    {
+        if (!view)
+            return false;
+
+        // type: 'keyDown' or 'keyUp'
+        bool press = (input.action == CloudRenderingProtocol::Application::InputPayload::IPA_KeyDown);
+
+        // modifiers
+        Qt::KeyboardModifiers modifiers = Qt::NoModifier;
+        if (input.altKey)
+            modifiers |= Qt::AltModifier;
+        if (input.shiftKey)
+            modifiers |= Qt::ShiftModifier;
+        if (input.ctrlKey)
+            modifiers |= Qt::ControlModifier;
+        if (input.metaKey)
+            modifiers |= Qt::MetaModifier;
+
+        return SendKeyEvent(view, press, input.key, modifiers);
+    }
+
+    bool InputInjector::PostMouseEvent(QGraphicsView *view, QWidget *window, const QVariantMap &data, bool *pressed)
+    {
+        return PostMouseEvent(view, window, CloudRenderingProtocol::Application::InputPayload::FromVariant(data), pressed);
+    }
+
+    bool InputInjector::PostMouseEvent(QGraphicsView *view, QWidget *window, const CloudRenderingProtocol::Application::InputPayload &input, bool *pressed)
+    {
+        typedef CloudRenderingProtocol::Application::InputPayload InputPayload;
+
+        if (pressed)
+            *pressed = false;
+        if (!view)
+            return false;
+
+        if (!input.hasPosition)
+            return false;
+
+        float x = input.x;
+        if (x < 0.0f)
+        {
+            LogWarning(LC + "Received mouse event with x < 0.0 - Clamping to 0.0.");
+            x = 0.0f;
+        }
+        else if (x > 1.0f)
+        {
+            LogWarning(LC + "Received mouse event with x > 1.0 - Clamping to 1.0.");
+            x = 1.0f;
+        }
+        float y = input.y;
+        if (y < 0.0f)
+        {
+            LogWarning(LC + "Received mouse event with y < 0.0 - Clamping to 0.0");
+            y = 0.0f;
+        }
+        else if (y > 1.0f)
+        {
+            LogWarning(LC + "Received mouse event with y > 1.0 - Clamping to 1.0");
+            y = 1.0f;
+        }
+
+        // type: 'move', 'press', 'doublepress' or 'release'
+        if (input.action == InputPayload::IPA_None)
+            return false;
+        QEvent::Type type = (input.action == InputPayload::IPA_Move ? QEvent::MouseMove : (input.action == InputPayload::IPA_Press ? QEvent::MouseButtonPress :
+            (input.action == InputPayload::IPA_DoublePress ? QEvent::MouseButtonDblClick : QEvent::MouseButtonRelease)));
+
+        // buttons
+        Qt::MouseButton button = Qt::NoButton;
+        mouseButtons_ = Qt::NoButton;
+
+        // Check another extra prop if button could not be resolved.
+        if (type == QEvent::MouseButtonRelease || type == QEvent::MouseButtonDblClick || type == QEvent::MouseButtonPress)
+        {
+            int releaseExtraCheck = input.which;
+            if (releaseExtraCheck == -1)
+                releaseExtraCheck = input.button;
+
+            button = ButtonFromWhich(releaseExtraCheck);
+            if (button != Qt::NoButton)
+                mouseButtons_ = button;
+        }
+
+        // Additionally check all the buttons pressed down at the moment.
+        if (button != Qt::LeftButton && input.leftButton)
+        {
+            if (button == Qt::NoButton)
+                button = Qt::LeftButton;
+            mouseButtons_ |= Qt::LeftButton;
+        }
+        if (button != Qt::RightButton && input.rightButton)
+        {
+            if (button == Qt::NoButton)
+                button = Qt::RightButton;
+            mouseButtons_ |= Qt::RightButton;
+        }
+        if (button != Qt::MiddleButton && input.middleButton)
+        {
+            if (button == Qt::NoButton)
+                button = Qt::MiddleButton;
+            mouseButtons_ |= Qt::MiddleButton;
+        }
+
+        SendMouseEvent(view, window, type, x, y, button);
+
+        if (pressed)
+            *pressed = (type == QEvent::MouseButtonPress || type == QEvent::MouseButtonDblClick);
+        return true;
+    }
+
+    bool InputInjector::PostEvent(QGraphicsView *view, QWidget *window, const CloudRenderingProtocol::BinaryInput::InputEvent &event, bool *pressed)
+    {
+        using namespace CloudRenderingProtocol::BinaryInput;
+
+        if (pressed)
+            *pressed = false;
+        if (!view)
+            return false;
+
+        Qt::KeyboardModifiers modifiers = Qt::NoModifier;
+        if (event.modifiers & IM_Alt)
+            modifiers |= Qt::AltModifier;
+        if (event.modifiers & IM_Shift)
+            modifiers |= Qt::ShiftModifier;
+        if (event.modifiers & IM_Ctrl)
+            modifiers |= Qt::ControlModifier;
+        if (event.modifiers & IM_Meta)
+            modifiers |= Qt::MetaModifier;
+
+        if (event.type == IET_Key)
+            return SendKeyEvent(view, event.action != IA_Release, event.keyCode, modifiers);
+
+        // Binary events carry the full modifier and button state.
+        keyboardModifiers_ = modifiers;
+        mouseButtons_ = Qt::NoButton;
+        if (event.buttons & IB_Left)
+            mouseButtons_ |= Qt::LeftButton;
+        if (event.buttons & IB_Right)
+            mouseButtons_ |= Qt::RightButton;
+        if (event.buttons & IB_Middle)
+            mouseButtons_ |= Qt::MiddleButton;
+
+        switch(event.type)
+        {
+            case IET_MouseMove:
+            {
+                // Same as the JSON path, moves while dragging report the held button.
+                Qt::MouseButton button = Qt::NoButton;
+                if (mouseButtons_ & Qt::LeftButton)
+                    button = Qt::LeftButton;
+                else if (mouseButtons_ & Qt::RightButton)
+                    button = Qt::RightButton;
+                else if (mouseButtons_ & Qt::MiddleButton)
+                    button = Qt::MiddleButton;
+                SendMouseEvent(view, window, QEvent::MouseMove, event.x, event.y, button);
+                return true;
+            }
+            case IET_MouseButton:
+            {
+                QEvent::Type type = (event.action == IA_Press ? QEvent::MouseButtonPress : 
+                    (event.action == IA_DoublePress ? QEvent::MouseButtonDblClick : QEvent::MouseButtonRelease));
+                Qt::MouseButton button = ButtonFromWhich(event.button);
+                if (type != QEvent::MouseButtonRelease)
+                    mouseButtons_ |= button;
+                SendMouseEvent(view, window, type, event.x, event.y, button);
+                if (pressed)
+                    *pressed = (type != QEvent::MouseButtonRelease);
+                return true;
+            }
+            case IET_MouseWheel:
+            {
+                QPoint mousePos, globalPos;
+                MapToView(view, window, event.x, event.y, mousePos, globalPos);
+                QWheelEvent e(mousePos, globalPos, event.wheelDelta, mouseButtons_, keyboardModifiers_, Qt::Vertical);
+                QApplication::sendEvent(view->viewport(), &e);
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    bool InputInjector::SendKeyEvent(QGraphicsView *view, bool press, int keyCode, Qt::KeyboardModifiers modifiers)
+    {
+        keyboardModifiers_ = modifiers;
+            
+        Qt::Key key = KeyFromHtmlKeyCode(keyCode);
+        if (key == Qt::Key_unknown)
+        {
+            if (IsLogChannelEnabled(LogChannelDebug))
+                qWarning() << "Failed to map HTML keyCode" << keyCode << "to a Qt key";
+            return false;
+        }
+        
+        QString text = (key != Qt::Key_unknown ? QKeySequence(key).toString(QKeySequence::NativeText).toLower() : "");
+        if (text == "space")
+            text = " ";
+        else if (text == "tab")
+            text = "    ";
+        else if (key == Qt::Key_Shift || key == Qt::Key_Control || key == Qt::Key_Alt || key == Qt::Key_AltGr)
+            text = "";
+        if (modifiers & Qt::ShiftModifier)
+            text = text.toUpper();
+        
+        QKeyEvent e(press ? QEvent::KeyPress : QEvent::KeyRelease, key, modifiers, text);
+        if (IsLogChannelEnabled(LogChannelDebug))
+            qDebug() << &e;
+        QApplication::sendEvent(view, &e);
+        return true;
+    }
+
+    void InputInjector::SendMouseEvent(QGraphicsView *view, QWidget *window, QEvent::Type type, float x, float y, Qt::MouseButton button)
+    {
+        // position from [0.0, 1.0] to application window coordinates
+        QPoint mousePos, globalPos;
+        MapToView(view, window, x, y, mousePos, globalPos);
+
+        // release or press event: fake a mouse move to this coordinate first
+        if (type == QEvent::MouseButtonPress)
+        {
+            Qt::MouseButton moveButton = (type == QEvent::MouseButtonRelease ? button : Qt::NoButton);
+            QMouseEvent *e = QMouseEvent::createExtendedMouseEvent(QEvent::MouseMove, mousePos, globalPos, 
+                 moveButton, moveButton, keyboardModifiers_); 
+            QApplication::sendEvent(view->viewport(), e);
+            SAFE_DELETE(e);
+        }
+
+        QMouseEvent *e = QMouseEvent::createExtendedMouseEvent(type, mousePos, globalPos, button, mouseButtons_, keyboardModifiers_); 
+        QApplication::sendEvent(view->viewport(), e);
+        SAFE_DELETE(e);
+        
+        // double press: fake a release event to make it register correctly
+        if (type == QEvent::MouseButtonDblClick)
+        {
+            QMouseEvent *e = QMouseEvent::createExtendedMouseEvent(QEvent::MouseButtonRelease, mousePos, globalPos, 
+                button, mouseButtons_, keyboardModifiers_); 
+            QApplication::sendEvent(view->viewport(), e);
+            SAFE_DELETE(e);
+        }
+    }
+}
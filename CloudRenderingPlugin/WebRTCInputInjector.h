@@ -0,0 +1,81 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+#include "CloudRenderingBinaryInput.h"
+#include "CloudRenderingProtocol.h"
+
+#include <QVariant>
+#include <QEvent>
+
+class QGraphicsView;
+class QWidget;
+
+namespace WebRTC
+{
+    /// Translates browser input events received from peers to Qt input events.
+    /** The payloads are the "InputMouse" and "InputKeyboard" PeerCustomMessage payloads sent by
+        the web client, or CloudRenderingProtocol::BinaryInput events. Events are delivered synchronously with QApplication::sendEvent to the given
+        view, so the injector does not depend on the Tundra UI and can be driven with any QGraphicsView.
+
+        The injector keeps the mouse button and keyboard modifier state between events. */
+    class CLOUDRENDERING_API InputInjector
+    {
+    public:
+        InputInjector();
+
+        /// Sends a key press or release event to @c view.
+        /** @return True if the event was delivered, false if the payload was invalid or the key could not be mapped. */
+        bool PostKeyboardEvent(QGraphicsView *view, const CloudRenderingProtocol::Application::InputPayload &input);
+        bool PostKeyboardEvent(QGraphicsView *view, const QVariantMap &data); /**< @overload */
+
+        /// Sends a mouse event to the viewport of @c view.
+        /** The x and y of the payload are in [0.0, 1.0] range and are mapped to the view geometry.
+            @param window Top level window of @c view for the global position, can be null.
+            @param pressed Set to true if the event pressed a mouse button.
+            @return True if the event was delivered, false if the payload was invalid. */
+        bool PostMouseEvent(QGraphicsView *view, QWidget *window, const CloudRenderingProtocol::Application::InputPayload &input, bool *pressed = 0);
+        bool PostMouseEvent(QGraphicsView *view, QWidget *window, const QVariantMap &data, bool *pressed = 0); /**< @overload */
+
+        /// Sends a decoded binary input event to @c view.
+        /** @param window Top level window of @c view for the global position, can be null.
+            @param pressed Set to true if the event pressed a mouse button.
+            @return True if the event was delivered, false if the key could not be mapped. */
+        bool PostEvent(QGraphicsView *view, QWidget *window, const CloudRenderingProtocol::BinaryInput::InputEvent &event, bool *pressed = 0);
+
+        /// Returns the mouse buttons currently held down.
+        Qt::MouseButtons MouseButtons() const;
+
+        /// Returns the keyboard modifiers currently held down.
+        Qt::KeyboardModifiers KeyboardModifiers() const;
+
+        /// Resets the button and modifier state, eg. when the peer that owns the input leaves.
+        void Reset();
+
+        /// Maps a HTML keyCode to a Qt key, returns Qt::Key_unknown if there is no mapping.
+        static Qt::Key KeyFromHtmlKeyCode(int keyCode);
+
+    private:
+        /// Sends a key event for a HTML keyCode.
+        bool SendKeyEvent(QGraphicsView *view, bool press, int keyCode, Qt::KeyboardModifiers modifiers);
+
+        /// Sends a mouse event at [0.0, 1.0] position @c x, @c y with the current button state.
+        void SendMouseEvent(QGraphicsView *view, QWidget *window, QEvent::Type type, float x, float y, Qt::MouseButton button);
+
+        /// Maps a DOM MouseEvent.which value to a Qt button.
+        static Qt::MouseButton ButtonFromWhich(int which);
+
+        QString LC;
+        Qt::MouseButtons mouseButtons_;
+        Qt::KeyboardModifiers keyboardModifiers_;
+    };
+}
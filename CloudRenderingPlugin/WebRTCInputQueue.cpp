@@ -0,0 +1,191 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "WebRTCInputQueue.h"
+
+#include "talk/base/timeutils.h"
+
+namespace WebRTC
+{
+    InputQueue::Event::Event() :
+        binary(false),
+        move(false),
+        received(0),
+        sent(0)
+    {
+    }
+
+    InputQueue::Statistics::Statistics() :
+        received(0),
+        coalesced(0),
+        dropped(0),
+        delivered(0)
+    {
+    }
+
+    QVariantMap InputQueue::Statistics::ToVariant() const
+    {
+        QVariantMap result;
+        result["received"] = static_cast<qulonglong>(received);
+        result["coalesced"] = static_cast<qulonglong>(coalesced);
+        result["dropped"] = static_cast<qulonglong>(dropped);
+        result["delivered"] = static_cast<qulonglong>(delivered);
+        return result;
+    }
+
+    InputQueue::PeerState::PeerState() :
+        hasSequence(false),
+        lastSequence(0),
+        hasOffset(false),
+        offset(0),
+        tailMove(-1)
+    {
+    }
+
+    InputQueue::InputQueue(int maxAgeMs) :
+        maxAgeMs_(maxAgeMs > 0 ? maxAgeMs : 0)
+    {
+    }
+
+    void InputQueue::SetMaxAge(int maxAgeMs)
+    {
+        maxAgeMs_ = (maxAgeMs > 0 ? maxAgeMs : 0);
+    }
+
+    int InputQueue::MaxAge() const
+    {
+        return maxAgeMs_;
+    }
+
+    void InputQueue::Push(const QString &peerId, const CloudRenderingProtocol::BinaryInput::InputEvent &input)
+    {
+        stats_.received++;
+
+        PeerState &peer = peers_[peerId];
+        Event event;
+        event.peerId = peerId;
+        event.binary = true;
+        event.input = input;
+        event.move = (input.type == CloudRenderingProtocol::BinaryInput::IET_MouseMove);
+        event.received = talk_base::Time();
+
+        // Out of order moves are stale, the newer position has already been queued.
+        const bool newer = (!peer.hasSequence || static_cast<s32>(input.sequence - peer.lastSequence) > 0);
+        if (!newer && event.move)
+        {
+            stats_.dropped++;
+            return;
+        }
+        if (newer)
+        {
+            peer.hasSequence = true;
+            peer.lastSequence = input.sequence;
+        }
+
+        // Smallest receive to client time difference is the best estimate of the clock offset.
+        const s32 offset = static_cast<s32>(event.received - input.timestamp);
+        if (!peer.hasOffset || offset < peer.offset)
+        {
+            peer.hasOffset = true;
+            peer.offset = offset;
+        }
+        event.sent = input.timestamp + static_cast<u32>(peer.offset);
+
+        Enqueue(peer, event);
+    }
+
+    void InputQueue::Push(const QString &peerId, const CloudRenderingProtocol::Application::InputPayload &payload)
+    {
+        stats_.received++;
+
+        Event event;
+        event.peerId = peerId;
+        event.payload = payload;
+        event.move = payload.IsMove();
+        event.received = talk_base::Time();
+        event.sent = event.received;
+
+        Enqueue(peers_[peerId], event);
+    }
+
+    void InputQueue::Enqueue(PeerState &peer, const Event &event)
+    {
+        if (event.move && peer.tailMove >= 0 && peer.tailMove < pending_.size())
+        {
+            pending_[peer.tailMove] = event;
+            stats_.coalesced++;
+            return;
+        }
+
+        pending_.append(event);
+        peer.tailMove = (event.move ? pending_.size() - 1 : -1);
+    }
+
+    void InputQueue::Take(EventList &events)
+    {
+        events.clear();
+        if (pending_.isEmpty())
+            return;
+
+        const u32 now = talk_base::Time();
+        for (int i=0; i<pending_.size(); ++i)
+        {
+            const Event &event = pending_[i];
+            if (event.move && maxAgeMs_ > 0 && static_cast<s32>(now - event.sent) > maxAgeMs_)
+            {
+                stats_.dropped++;
+                continue;
+            }
+            events.append(event);
+        }
+        stats_.delivered += events.size();
+
+        pending_.clear();
+        for (QHash<QString, PeerState>::iterator iter = peers_.begin(); iter != peers_.end(); ++iter)
+            iter.value().tailMove = -1;
+    }
+
+    bool InputQueue::IsEmpty() const
+    {
+        return pending_.isEmpty();
+    }
+
+    void InputQueue::RemovePeer(const QString &peerId)
+    {
+        if (!peers_.contains(peerId))
+            return;
+
+        EventList kept;
+        for (int i=0; i<pending_.size(); ++i)
+            if (pending_[i].peerId != peerId)
+                kept.append(pending_[i]);
+        pending_ = kept;
+        peers_.remove(peerId);
+
+        // Queue indexes have changed, recompute the tail moves.
+        for (QHash<QString, PeerState>::iterator iter = peers_.begin(); iter != peers_.end(); ++iter)
+            iter.value().tailMove = -1;
+        for (int i=0; i<pending_.size(); ++i)
+        {
+            QHash<QString, PeerState>::iterator iter = peers_.find(pending_[i].peerId);
+            if (iter != peers_.end())
+                iter.value().tailMove = (pending_[i].move ? i : -1);
+        }
+    }
+
+    InputQueue::Statistics InputQueue::Stats() const
+    {
+        return stats_;
+    }
+
+    void InputQueue::ResetStats()
+    {
+        stats_ = Statistics();
+    }
+}
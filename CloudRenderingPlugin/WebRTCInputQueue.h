@@ -0,0 +1,122 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+#include "CloudRenderingBinaryInput.h"
+#include "CloudRenderingProtocol.h"
+
+#include <QString>
+#include <QVariant>
+#include <QList>
+#include <QHash>
+
+namespace WebRTC
+{
+    /// Queue of peer input events that are delivered once per Tundra frame.
+    /** Browsers send mouse moves at hundreds of events per second while the scene updates at the
+        capture rate, so consecutive moves of a peer are coalesced to the latest position. A move is
+        only replaced while it is the last queued event of its peer, button and key events are never
+        coalesced or dropped and keep their order relative to the moves around them.
+
+        Moves older than MaxAge() when the queue is taken are dropped. The age of binary events is
+        estimated from their client timestamp: the smallest observed difference between the local receive
+        time and the client timestamp is taken as the clock offset of the peer, which makes the age
+        the network and queueing delay on top of the fastest delivery seen. JSON events have no timestamp,
+        their age is the time spent in the queue. Binary moves with a sequence number older than the latest
+        event of the peer are dropped as well, the data channel does not guarantee order. */
+    class CLOUDRENDERING_API InputQueue
+    {
+    public:
+        /// Queued input event.
+        struct Event
+        {
+            QString peerId;
+            /// If the event is a binary event in @c input, otherwise a JSON PeerCustomMessage input in @c payload.
+            bool binary;
+            CloudRenderingProtocol::BinaryInput::InputEvent input;
+            CloudRenderingProtocol::Application::InputPayload payload;
+            /// If the event is a mouse move.
+            bool move;
+            /// Local time in milliseconds the event was received.
+            u32 received;
+            /// Estimated local time in milliseconds the client sent the event.
+            u32 sent;
+
+            Event();
+        };
+        typedef QList<Event> EventList;
+
+        /// Event counters.
+        struct Statistics
+        {
+            /// Number of events pushed to the queue.
+            u64 received;
+            /// Number of moves replaced by a newer move of the same peer.
+            u64 coalesced;
+            /// Number of moves dropped as too old or out of order.
+            u64 dropped;
+            /// Number of events taken out for delivery.
+            u64 delivered;
+
+            Statistics();
+
+            QVariantMap ToVariant() const;
+        };
+
+        /// @param maxAgeMs Moves older than this are dropped, 0 never drops.
+        InputQueue(int maxAgeMs = 200);
+
+        /// Sets the age in milliseconds after which moves are dropped, 0 never drops.
+        void SetMaxAge(int maxAgeMs);
+        int MaxAge() const;
+
+        /// Queues a binary input event of @c peerId.
+        void Push(const QString &peerId, const CloudRenderingProtocol::BinaryInput::InputEvent &event);
+
+        /// Queues an "InputMouse" or "InputKeyboard" PeerCustomMessage payload of @c peerId.
+        void Push(const QString &peerId, const CloudRenderingProtocol::Application::InputPayload &payload);
+
+        /// Moves the queued events to @c events in the order they were received and empties the queue.
+        /** Stale moves are dropped here. */
+        void Take(EventList &events);
+
+        /// Returns if there are no queued events.
+        bool IsEmpty() const;
+
+        /// Forgets the queued events and the sequence and clock state of @c peerId.
+        void RemovePeer(const QString &peerId);
+
+        Statistics Stats() const;
+        void ResetStats();
+
+    private:
+        struct PeerState
+        {
+            bool hasSequence;
+            u32 lastSequence;
+            bool hasOffset;
+            s32 offset;
+            /// Index of the last queued event in the queue if it is a move, -1 otherwise.
+            int tailMove;
+
+            PeerState();
+        };
+
+        /// Appends @c event or coalesces it into the queued move of its peer.
+        void Enqueue(PeerState &peer, const Event &event);
+
+        EventList pending_;
+        QHash<QString, PeerState> peers_;
+        int maxAgeMs_;
+        Statistics stats_;
+    };
+}
@@ -0,0 +1,741 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file
+    @brief   */
+
+#include "WebRTCLocalService.h"
+#include "WebRTCClock.h"
+
+#include "CloudRenderingProtocol.h"
+#include "CloudRenderingDefines.h"
+#include "CoreJsonUtils.h"
+#include "LoggingFunctions.h"
+
+#include <QMutexLocker>
+#include <QStringList>
+#include <QUuid>
+
+namespace WebRTC
+{
+    /// Time a room is held for the resume token of a renderer that lost its connection.
+    static const double cResumeGraceSeconds = 30.0;
+
+    // LocalService::ScriptSettings
+
+    LocalService::ScriptSettings::ScriptSettings() :
+        clients(0),
+        joinRate(1.0),
+        stay(0.0),
+        iceRate(10.0),
+        candidates(4),
+        customRate(0.0)
+    {
+    }
+
+    LocalService::ScriptSettings LocalService::ScriptSettings::FromString(const QString &script)
+    {
+        ScriptSettings settings;
+        foreach(const QString &pair, script.split(",", QString::SkipEmptyParts))
+        {
+            const QString key = pair.section('=', 0, 0).trimmed();
+            const QString value = pair.section('=', 1).trimmed();
+            if (key.compare("clients", Qt::CaseInsensitive) == 0)
+                settings.clients = qMax(0, value.toInt());
+            else if (key.compare("joinRate", Qt::CaseInsensitive) == 0)
+                settings.joinRate = qMax(0.0, value.toDouble());
+            else if (key.compare("stay", Qt::CaseInsensitive) == 0)
+                settings.stay = qMax(0.0, value.toDouble());
+            else if (key.compare("iceRate", Qt::CaseInsensitive) == 0)
+                settings.iceRate = qMax(0.0, value.toDouble());
+            else if (key.compare("candidates", Qt::CaseInsensitive) == 0)
+                settings.candidates = qMax(0, value.toInt());
+            else if (key.compare("customRate", Qt::CaseInsensitive) == 0)
+                settings.customRate = qMax(0.0, value.toDouble());
+            else
+                LogWarning("[WebRTC::LocalService]: Unknown script key '" + key + "'");
+        }
+        return settings;
+    }
+
+    QVariantMap LocalService::ScriptSettings::ToVariant() const
+    {
+        QVariantMap v;
+        v["clients"] = clients;
+        v["joinRate"] = joinRate;
+        v["stay"] = stay;
+        v["iceRate"] = iceRate;
+        v["candidates"] = candidates;
+        v["customRate"] = customRate;
+        return v;
+    }
+
+    // LocalService::Participant
+
+    LocalService::Participant::Participant() :
+        id(0),
+        registered(false),
+        renderer(false),
+        scripted(false),
+        connectionKey(0),
+        joined(0),
+        leaveAt(0),
+        nextCandidate(0),
+        nextCustom(0),
+        offerReceived(false),
+        candidatesSent(0)
+    {
+    }
+
+    // LocalService
+
+    LocalService::LocalService(u16 port, const ScriptSettings &script) :
+        LC("[WebRTC::LocalService]: "),
+        port_(port),
+        script_(script),
+        nextParticipantId_(1),
+        nextPeerId_(1),
+        nextRoomId_(1),
+        nextScriptedJoin_(0),
+        listening_(false),
+        bytesReceived_(0),
+        bytesSent_(0),
+        connectionsOpened_(0),
+        rendererResumes_(0),
+        scriptedJoins_(0),
+        scriptedLeaves_(0),
+        offersToScripted_(0),
+        offerLatencyTotalMs_(0.0),
+        offerLatencyMaxMs_(0.0)
+    {
+        server_.clear_access_channels(websocketpp::log::alevel::all);
+        server_.clear_error_channels(websocketpp::log::elevel::all);
+        if (IsLogChannelEnabled(LogChannelDebug))
+        {
+            server_.set_access_channels(websocketpp::log::alevel::connect | websocketpp::log::alevel::disconnect);
+            server_.set_error_channels(websocketpp::log::elevel::all);
+        }
+
+        server_.set_open_handler(bind(&LocalService::OnConnectionOpened, this, ::_1));
+        server_.set_close_handler(bind(&LocalService::OnConnectionClosed, this, ::_1));
+        server_.set_message_handler(bind(&LocalService::OnMessage, this, ::_1, ::_2));
+    }
+
+    LocalService::~LocalService()
+    {
+        Stop();
+    }
+
+    QString LocalService::Host() const
+    {
+        return QString("ws://127.0.0.1:%1").arg(port_);
+    }
+
+    u16 LocalService::Port() const
+    {
+        return port_;
+    }
+
+    bool LocalService::Start()
+    {
+        QMutexLocker lock(&mutexStart_);
+        if (isRunning())
+            return listening_;
+        moveToThread(this);
+        start(QThread::NormalPriority);
+        started_.wait(&mutexStart_);
+        return listening_;
+    }
+
+    void LocalService::Stop()
+    {
+        if (isRunning())
+        {
+            // io_service::stop() is thread safe, run() returns right after the handler in progress.
+            server_.stop();
+            wait(2000);
+        }
+    }
+
+    void LocalService::DropRenderers()
+    {
+        if (isRunning())
+            server_.get_io_service().post(bind(&LocalService::CloseRendererConnections, this));
+    }
+
+    void LocalService::CloseRendererConnections()
+    {
+        LogInfo(LC + "Dropping renderer connections");
+        foreach(const Participant &participant, participants_)
+        {
+            if (!participant.renderer || participant.scripted)
+                continue;
+            websocketpp::lib::error_code ec;
+            server_.close(participant.connection, websocketpp::close::status::going_away, "", ec);
+        }
+    }
+
+    void LocalService::run()
+    {
+        {
+            QMutexLocker lock(&mutexStart_);
+            try
+            {
+                server_.init_asio();
+                server_.set_reuse_addr(true);
+                server_.listen(port_);
+                server_.start_accept();
+                listening_ = true;
+            }
+            catch(const std::exception &e)
+            {
+                LogError(LC + QString("Failed to listen to port %1: %2").arg(port_).arg(e.what()));
+                listening_ = false;
+            }
+            started_.wakeAll();
+        }
+        if (!listening_)
+            return;
+        LogInfo(LC + QString("Listening on %1").arg(Host()));
+        if (script_.clients > 0)
+            LogInfo(LC + "Running scripted clients " + TundraJson::Serialize(script_.ToVariant(), TundraJson::IndentNone));
+
+        // Run the script at ~200 FPS, the I/O itself is handled as it happens.
+        if (script_.clients > 0)
+            server_.set_timer(5, bind(&LocalService::OnScriptTimer, this, ::_1));
+        try
+        {
+            server_.run();
+        }
+        catch(const std::exception &e)
+        {
+            LogError(LC + "I/O loop failed: " + e.what());
+        }
+
+        server_.stop();
+        participants_.clear();
+        connections_.clear();
+        rooms_.clear();
+
+        LogInfo(LC + "Stopped " + TundraJson::Serialize(Statistics(), TundraJson::IndentNone));
+    }
+
+    void LocalService::OnScriptTimer(const websocketpp::lib::error_code &error)
+    {
+        // Cancelled when the service stops.
+        if (error)
+            return;
+        UpdateScript(GetCurrentClockTime());
+        server_.set_timer(5, bind(&LocalService::OnScriptTimer, this, ::_1));
+    }
+
+    QVariantMap LocalService::Statistics() const
+    {
+        QMutexLocker lock(&mutexStats_);
+        QVariantMap stats;
+        stats["received"] = received_;
+        stats["sent"] = sent_;
+        stats["bytesReceived"] = bytesReceived_;
+        stats["bytesSent"] = bytesSent_;
+        stats["connectionsOpened"] = connectionsOpened_;
+        stats["rendererResumes"] = rendererResumes_;
+        stats["scriptedJoins"] = scriptedJoins_;
+        stats["scriptedLeaves"] = scriptedLeaves_;
+        stats["offersToScripted"] = offersToScripted_;
+        stats["joinToOfferAverageMs"] = (offersToScripted_ > 0 ? offerLatencyTotalMs_ / static_cast<double>(offersToScripted_) : 0.0);
+        stats["joinToOfferMaxMs"] = offerLatencyMaxMs_;
+        return stats;
+    }
+
+    void LocalService::RecordReceived(const QString &type, int bytes)
+    {
+        QMutexLocker lock(&mutexStats_);
+        received_[type] = received_.value(type).toULongLong() + 1;
+        bytesReceived_ += bytes;
+    }
+
+    void LocalService::RecordSent(const QString &type, int bytes)
+    {
+        QMutexLocker lock(&mutexStats_);
+        sent_[type] = sent_.value(type).toULongLong() + 1;
+        bytesSent_ += bytes;
+    }
+
+    void LocalService::OnConnectionOpened(websocketpp::connection_hdl connection)
+    {
+        Participant participant;
+        participant.id = nextParticipantId_++;
+        participant.connection = connection;
+        participant.connectionKey = server_.get_con_from_hdl(connection).get();
+        participants_[participant.id] = participant;
+        connections_[participant.connectionKey] = participant.id;
+
+        QMutexLocker lock(&mutexStats_);
+        connectionsOpened_++;
+    }
+
+    void LocalService::OnConnectionClosed(websocketpp::connection_hdl connection)
+    {
+        Participant *participant = ParticipantFor(connection);
+        if (!participant)
+            return;
+        const quint32 id = participant->id;
+        Leave(participant);
+        connections_.remove(participant->connectionKey);
+        participants_.remove(id);
+    }
+
+    void LocalService::OnMessage(websocketpp::connection_hdl connection, WebSocket::Server::message_ptr msg)
+    {
+        Participant *participant = ParticipantFor(connection);
+        if (!participant)
+            return;
+        if (msg->get_opcode() != websocketpp::frame::opcode::TEXT)
+        {
+            LogWarning(LC + "Got BINARY type message from a client... not supported!");
+            return;
+        }
+        HandleMessage(participant, QByteArray(msg->get_payload().data(), static_cast<int>(msg->get_payload().size())));
+    }
+
+    LocalService::Participant *LocalService::ParticipantFor(websocketpp::connection_hdl connection)
+    {
+        websocketpp::lib::error_code ec;
+        WebSocket::Server::connection_ptr con = server_.get_con_from_hdl(connection, ec);
+        if (ec || !con)
+            return 0;
+        QHash<void*, quint32>::const_iterator iter = connections_.find(con.get());
+        if (iter == connections_.end())
+            return 0;
+        QHash<quint32, Participant>::iterator participant = participants_.find(iter.value());
+        return (participant != participants_.end() ? &participant.value() : 0);
+    }
+
+    LocalService::Participant *LocalService::Find(const Room &room, const QString &peerId)
+    {
+        if (peerId.compare("renderer", Qt::CaseInsensitive) == 0)
+        {
+            QHash<quint32, Participant>::iterator iter = participants_.find(room.renderer);
+            return (room.renderer != 0 && iter != participants_.end() ? &iter.value() : 0);
+        }
+        foreach(quint32 id, room.clients)
+        {
+            QHash<quint32, Participant>::iterator iter = participants_.find(id);
+            if (iter != participants_.end() && iter.value().peerId == peerId)
+                return &iter.value();
+        }
+        return 0;
+    }
+
+    void LocalService::HandleMessage(Participant *sender, const QByteArray &json)
+    {
+        // Relayed messages are handled as plain data, the sender does not fill the ids the service injects.
+        bool ok = false;
+        QVariantMap envelope = TundraJson::Parse(json, &ok).toMap();
+        QVariantMap message = TundraJson::ValueForAnyKey(envelope, QStringList() << "message" << "Message", QVariantMap()).toMap();
+        const QString type = TundraJson::ValueForAnyKey(message, QStringList() << "type" << "Type", "").toString().trimmed();
+        QVariantMap data = TundraJson::ValueForAnyKey(message, QStringList() << "data" << "Data", QVariantMap()).toMap();
+        if (!ok || type.isEmpty())
+        {
+            LogError(LC + "Error while parsing incoming JSON message");
+            return;
+        }
+        RecordReceived(type, json.size());
+
+        const CloudRenderingProtocol::MessageType messageType = CloudRenderingProtocol::ToMessageType(type);
+        if (messageType == CloudRenderingProtocol::MT_Registration)
+            HandleRegistration(sender, data);
+        else if (!sender->registered)
+            LogWarning(LC + QString("Ignoring %1 from a connection that has not registered").arg(type));
+        else if (messageType == CloudRenderingProtocol::MT_Offer || messageType == CloudRenderingProtocol::MT_Answer ||
+                 messageType == CloudRenderingProtocol::MT_IceCandidates)
+            HandleSignaling(sender, type, data);
+        else if (messageType == CloudRenderingProtocol::MT_RoomCustomMessage)
+            HandleCustomMessage(sender, data);
+        else if (messageType == CloudRenderingProtocol::MT_RendererStateChange)
+            LogDebug(LC + "Renderer state changed to " + data.value("state").toString());
+        else
+            LogWarning(LC + "Unhandled message type " + type);
+    }
+
+    void LocalService::HandleRegistration(Participant *sender, const QVariantMap &data)
+    {
+        if (sender->registered)
+        {
+            LogWarning(LC + "Ignoring a second Registration from the same connection");
+            return;
+        }
+
+        const QString registrant = data.value("registrant", "").toString();
+        if (registrant == "renderer")
+        {
+            sender->registered = true;
+            sender->renderer = true;
+
+            // Drop empty rooms whose renderer did not come back in time.
+            const tick_t now = GetCurrentClockTime();
+            for (QMap<QString, Room>::iterator iter = rooms_.begin(); iter != rooms_.end();)
+            {
+                if (iter.value().renderer == 0 && iter.value().clients.isEmpty() && !iter.value().IsReserved(now))
+                    iter = rooms_.erase(iter);
+                else
+                    ++iter;
+            }
+
+            QString roomId;
+            const QString resumeToken = data.value("resumeToken", "").toString();
+            if (!resumeToken.isEmpty())
+            {
+                for (QMap<QString, Room>::const_iterator iter = rooms_.begin(); iter != rooms_.end(); ++iter)
+                    if (iter.value().IsReserved(now) && iter.value().resumeToken == resumeToken)
+                    {
+                        roomId = iter.key();
+                        break;
+                    }
+                if (roomId.isEmpty())
+                    LogInfo(LC + "Renderer resume token is unknown or expired, assigning a room as for a new renderer");
+            }
+            const bool resumed = !roomId.isEmpty();
+
+            if (!resumed && !data.value("createPrivateRoom", false).toBool())
+            {
+                for (QMap<QString, Room>::const_iterator iter = rooms_.begin(); iter != rooms_.end(); ++iter)
+                    if (iter.value().renderer == 0 && !iter.value().IsReserved(now))
+                    {
+                        roomId = iter.key();
+                        break;
+                    }
+            }
+            if (roomId.isEmpty())
+            {
+                roomId = QString::number(nextRoomId_++);
+                rooms_[roomId].id = roomId;
+            }
+            if (resumed)
+            {
+                LogInfo(LC + "Renderer resumed room " + roomId);
+                QMutexLocker lock(&mutexStats_);
+                rendererResumes_++;
+            }
+            Join(sender, rooms_[roomId], resumed);
+        }
+        else if (registrant == "client")
+        {
+            const QString roomId = data.value("roomId", "").toString();
+            if (!roomId.isEmpty() && !rooms_.contains(roomId))
+            {
+                CloudRenderingProtocol::Room::RoomAssignedMessage assigned("", CloudRenderingProtocol::Room::RoomAssignedMessage::RQE_DoesNotExist);
+                Send(sender, &assigned);
+                return;
+            }
+            sender->registered = true;
+            sender->peerId = QString::number(nextPeerId_++);
+
+            QString joinRoomId = roomId;
+            if (joinRoomId.isEmpty())
+            {
+                joinRoomId = QString::number(nextRoomId_++);
+                rooms_[joinRoomId].id = joinRoomId;
+            }
+            Join(sender, rooms_[joinRoomId]);
+        }
+        else
+            LogError(LC + QString("Registration with unknown registrant '%1'").arg(registrant));
+    }
+
+    void LocalService::Join(Participant *participant, Room &room, bool resumed)
+    {
+        participant->roomId = room.id;
+        if (participant->renderer)
+        {
+            room.renderer = participant->id;
+            // A new token on every assignment, a token can be used once.
+            room.resumeToken = QUuid::createUuid().toString();
+            room.reservedUntil = 0;
+        }
+        else
+            room.clients << participant->id;
+
+        CloudRenderingProtocol::Room::RoomAssignedMessage assigned(room.id);
+        assigned.peerId = participant->peerId;
+        if (participant->renderer)
+        {
+            assigned.resumeToken = room.resumeToken;
+            assigned.resumed = resumed;
+        }
+        Send(participant, &assigned);
+
+        // Full peer list to the participant, the new peer to everyone else.
+        QStringList peerIds;
+        foreach(quint32 id, room.clients)
+            peerIds << participants_.value(id).peerId;
+        if (!peerIds.isEmpty())
+        {
+            CloudRenderingProtocol::Room::RoomUserJoinedMessage joined(peerIds);
+            Send(participant, &joined);
+        }
+        if (participant->renderer)
+        {
+            if (resumed && !room.leftWhileAway.isEmpty())
+            {
+                CloudRenderingProtocol::Room::RoomUserLeftMessage left(room.leftWhileAway);
+                Send(participant, &left);
+            }
+            room.leftWhileAway.clear();
+        }
+        else
+        {
+            CloudRenderingProtocol::Room::RoomUserJoinedMessage joined(QStringList() << participant->peerId);
+            const QByteArray json = joined.ToJSON();
+            QList<quint32> others = room.clients;
+            if (room.renderer != 0)
+                others << room.renderer;
+            foreach(quint32 id, others)
+                if (id != participant->id && participants_.contains(id))
+                    Send(&participants_[id], joined.MessageTypeName(), json);
+        }
+    }
+
+    void LocalService::Leave(Participant *participant)
+    {
+        QMap<QString, Room>::iterator iter = rooms_.find(participant->roomId);
+        if (iter == rooms_.end())
+            return;
+        Room &room = iter.value();
+        participant->roomId = "";
+
+        const tick_t now = GetCurrentClockTime();
+        if (participant->renderer)
+        {
+            // The room stays open for the clients. It is held for the renderer to resume for a while,
+            // after that the next registering renderer is assigned to it.
+            if (room.renderer == participant->id)
+            {
+                room.renderer = 0;
+                room.reservedUntil = now + SecondsToTicks(cResumeGraceSeconds);
+            }
+        }
+        else
+        {
+            room.clients.removeAll(participant->id);
+            if (room.IsReserved(now))
+                room.leftWhileAway << participant->peerId;
+
+            CloudRenderingProtocol::Room::RoomUserLeftMessage left(QStringList() << participant->peerId);
+            const QByteArray json = left.ToJSON();
+            QList<quint32> others = room.clients;
+            if (room.renderer != 0)
+                others << room.renderer;
+            foreach(quint32 id, others)
+                if (participants_.contains(id))
+                    Send(&participants_[id], left.MessageTypeName(), json);
+        }
+
+        if (room.renderer == 0 && room.clients.isEmpty() && !room.IsReserved(now))
+            rooms_.erase(iter);
+    }
+
+    void LocalService::HandleSignaling(Participant *sender, const QString &type, QVariantMap data)
+    {
+        QMap<QString, Room>::iterator room = rooms_.find(sender->roomId);
+        if (room == rooms_.end())
+            return;
+
+        QString receiverId = data.value("receiverId", "").toString();
+        if (receiverId.isEmpty() && !sender->renderer)
+            receiverId = "renderer";
+        Participant *receiver = Find(room.value(), receiverId);
+        if (!receiver)
+        {
+            LogWarning(LC + QString("Cannot relay %1, receiver '%2' is not in room %3").arg(type).arg(receiverId).arg(room.key()));
+            return;
+        }
+
+        data["senderId"] = (sender->renderer ? QString("renderer") : sender->peerId);
+        data["receiverId"] = receiverId;
+        Send(receiver, "Signaling", type, data);
+    }
+
+    void LocalService::HandleCustomMessage(Participant *sender, QVariantMap data)
+    {
+        QMap<QString, Room>::iterator iter = rooms_.find(sender->roomId);
+        if (iter == rooms_.end())
+            return;
+        const Room &room = iter.value();
+
+        data["sender"] = (sender->renderer ? QString("renderer") : sender->peerId);
+
+        QList<Participant*> receivers;
+        QVariantList receiverIds = data.value("receivers").toList();
+        if (receiverIds.isEmpty())
+        {
+            QList<quint32> everyone = room.clients;
+            if (room.renderer != 0)
+                everyone << room.renderer;
+            foreach(quint32 id, everyone)
+                if (id != sender->id && participants_.contains(id))
+                    receivers << &participants_[id];
+        }
+        else
+        {
+            foreach(const QVariant &receiverId, receiverIds)
+            {
+                // Messages to the service are consumed here.
+                if (receiverId.toString().compare("service", Qt::CaseInsensitive) == 0)
+                    continue;
+                Participant *receiver = Find(room, receiverId.toString());
+                if (receiver && receiver->id != sender->id)
+                    receivers << receiver;
+            }
+        }
+
+        // Serialize once for the whole fan-out.
+        QVariantMap message;
+        message["type"] = "RoomCustomMessage";
+        message["data"] = data;
+        QVariantMap envelope;
+        envelope["channel"] = "Application";
+        envelope["message"] = message;
+        const QByteArray json = TundraJson::Serialize(envelope, TundraJson::IndentNone);
+        foreach(Participant *receiver, receivers)
+            Send(receiver, "RoomCustomMessage", json);
+    }
+
+    void LocalService::Send(Participant *receiver, const QString &channel, const QString &type, const QVariantMap &data)
+    {
+        QVariantMap message;
+        message["type"] = type;
+        message["data"] = data;
+        QVariantMap envelope;
+        envelope["channel"] = channel;
+        envelope["message"] = message;
+        Send(receiver, type, TundraJson::Serialize(envelope, TundraJson::IndentNone));
+    }
+
+    void LocalService::Send(Participant *receiver, CloudRenderingProtocol::IMessage *message)
+    {
+        bool ok = false;
+        QByteArray json = message->ToJSON(&ok);
+        if (ok)
+            Send(receiver, message->MessageTypeName(), json);
+    }
+
+    void LocalService::Send(Participant *receiver, const QString &type, const QByteArray &json)
+    {
+        if (!receiver)
+            return;
+        RecordSent(type, json.size());
+
+        if (receiver->scripted)
+        {
+            HandleScriptedMessage(receiver, type, TundraJson::Parse(json).toMap().value("message").toMap().value("data").toMap());
+            return;
+        }
+
+        websocketpp::lib::error_code ec;
+        server_.send(receiver->connection, static_cast<const void*>(json.constData()), json.size(), websocketpp::frame::opcode::TEXT, ec);
+        if (ec)
+            LogError(LC + "Failed to send " + type + ": " + ec.message().c_str());
+    }
+
+    void LocalService::HandleScriptedMessage(Participant *receiver, const QString &type, const QVariantMap &data)
+    {
+        if (type == "Offer" && !receiver->offerReceived && data.value("senderId").toString() == "renderer")
+        {
+            tick_t now = GetCurrentClockTime();
+            receiver->offerReceived = true;
+            receiver->nextCandidate = now;
+
+            const double latencyMs = TicksToMs(now - receiver->joined);
+            QMutexLocker lock(&mutexStats_);
+            offersToScripted_++;
+            offerLatencyTotalMs_ += latencyMs;
+            offerLatencyMaxMs_ = qMax(offerLatencyMaxMs_, latencyMs);
+        }
+    }
+
+    void LocalService::UpdateScript(tick_t now)
+    {
+        if (script_.clients <= 0)
+            return;
+
+        // Scripted clients join the first room that has a renderer.
+        QMap<QString, Room>::iterator roomIter = rooms_.end();
+        for (QMap<QString, Room>::iterator iter = rooms_.begin(); iter != rooms_.end(); ++iter)
+            if (iter.value().renderer != 0)
+            {
+                roomIter = iter;
+                break;
+            }
+        if (roomIter == rooms_.end())
+            return;
+
+        QList<quint32> scripted;
+        foreach(quint32 id, roomIter.value().clients)
+            if (participants_.value(id).scripted)
+                scripted << id;
+
+        // Leave, trickle ICE and send custom messages.
+        const QString roomId = roomIter.key();
+        foreach(quint32 id, scripted)
+        {
+            Participant *participant = &participants_[id];
+            if (participant->leaveAt != 0 && now >= participant->leaveAt)
+            {
+                Leave(participant);
+                participants_.remove(id);
+                QMutexLocker lock(&mutexStats_);
+                scriptedLeaves_++;
+                continue;
+            }
+            if (participant->offerReceived && participant->candidatesSent < script_.candidates && script_.iceRate > 0.0 &&
+                now >= participant->nextCandidate)
+            {
+                QVariantList candidates;
+                candidates << WebRTC::ICECandidate(participant->candidatesSent % 3, (participant->candidatesSent % 3 == 0 ? "audio" : "video"),
+                    QString("a=candidate:%1 1 udp 2122260223 127.0.0.1 %2 typ host generation 0")
+                        .arg(1000000 + participant->id).arg(40000 + participant->candidatesSent)).ToVariant();
+                QVariantMap data;
+                data["iceCandidates"] = candidates;
+                participant->candidatesSent++;
+                participant->nextCandidate = now + SecondsToTicks(1.0 / script_.iceRate);
+                RecordReceived("IceCandidates", 0);
+                HandleSignaling(participant, "IceCandidates", data);
+            }
+            if (rooms_.contains(roomId) && script_.customRate > 0.0 && now >= participant->nextCustom)
+            {
+                QVariantMap payload;
+                payload["type"] = "ScriptedClient";
+                payload["peerId"] = participant->peerId;
+                QVariantMap data;
+                data["payload"] = payload;
+                participant->nextCustom = now + SecondsToTicks(1.0 / script_.customRate);
+                RecordReceived("RoomCustomMessage", 0);
+                HandleCustomMessage(participant, data);
+            }
+        }
+
+        // Join at the configured rate until the target client count is reached.
+        roomIter = rooms_.find(roomId);
+        if (roomIter == rooms_.end() || scripted.size() >= script_.clients || script_.joinRate <= 0.0 || now < nextScriptedJoin_)
+            return;
+        nextScriptedJoin_ = now + SecondsToTicks(1.0 / script_.joinRate);
+
+        Participant participant;
+        participant.id = nextParticipantId_++;
+        participant.registered = true;
+        participant.scripted = true;
+        participant.peerId = QString::number(nextPeerId_++);
+        participant.joined = now;
+        participant.leaveAt = (script_.stay > 0.0 ? now + SecondsToTicks(script_.stay) : 0);
+        participant.nextCustom = now + (script_.customRate > 0.0 ? SecondsToTicks(1.0 / script_.customRate) : 0);
+        participants_[participant.id] = participant;
+        Join(&participants_[participant.id], roomIter.value());
+
+        QMutexLocker lock(&mutexStats_);
+        scriptedJoins_++;
+    }
+}
@@ -0,0 +1,232 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include "HighPerfClock.h"
+
+#include <QThread>
+#include <QString>
+#include <QVariant>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QHash>
+#include <QMap>
+#include <QStringList>
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/server.hpp>
+
+namespace WebRTC
+{
+    /// @cond PRIVATE
+    namespace WebSocket
+    {
+        typedef websocketpp::server<websocketpp::config::asio> Server;
+    }
+    /// @endcond
+
+    /// In-process stand-in for the Cloud Rendering Service.
+    /** Implements the room protocol of CloudRenderingProtocol on a local WebSocket server so that
+        the renderer signaling path can be exercised and load tested on a single machine:
+        - Registration: renderers are assigned to the first room without a renderer or a new room,
+          clients join the requested room or get a new one. Answered with RoomAssigned and RoomUserJoined.
+        - Resume: renderers get a resume token in RoomAssigned. When a renderer connection is lost its room
+          is held for the token for 30 seconds, a renderer registering with the token gets the same room back
+          and a RoomUserLeft for the clients that left in the meantime. The clients are not notified.
+        - RoomUserJoined and RoomUserLeft are sent to the rest of the room when participants come and go.
+        - Offer, Answer and IceCandidates are relayed to the receiver with the sender id injected,
+          a missing receiver id from a client means the renderer.
+        - RoomCustomMessage is fanned out to the receivers, or to everyone else in the room if there are none.
+
+        Real clients, eg. web browsers, can connect to the service normally. In addition the service
+        can run scripted clients that live inside the service. Scripted clients join the first room that
+        has a renderer, wait for the renderer offer, trickle ICE candidates to the renderer, send room custom
+        messages and leave, each at the rate given in ScriptSettings. They do not answer the offer,
+        so no media is ever sent to them.
+
+        The service runs in its own thread and its I/O is event driven, messages are relayed as soon as they
+        arrive. The script is run from a 5 ms timer on the I/O loop only when there are scripted clients. Started with --cloudRenderingLocalService [port], the
+        script is read from --cloudRenderingLocalServiceScript <key=value,...>, see ScriptSettings::FromString(). */
+    class CLOUDRENDERING_API LocalService : public QThread
+    {
+        Q_OBJECT
+
+    public:
+        /// Scripted client behavior.
+        struct CLOUDRENDERING_API ScriptSettings
+        {
+            /// Number of scripted clients in the room at the same time.
+            int clients;
+            /// Scripted client joins per second.
+            double joinRate;
+            /// Seconds a scripted client stays before leaving, 0 stays until the service stops.
+            /** Clients that leave are replaced by new ones at @c joinRate. */
+            double stay;
+            /// ICE candidates trickled to the renderer per second per client, once the renderer offer has arrived.
+            double iceRate;
+            /// Number of ICE candidates each client trickles.
+            int candidates;
+            /// RoomCustomMessages sent to the room per second per client, 0 sends none.
+            double customRate;
+
+            ScriptSettings();
+
+            /// Parses comma separated key=value pairs, eg. "clients=20,joinRate=5,stay=30,iceRate=10,candidates=8,customRate=1".
+            /** Keys that are not given keep their default values. */
+            static ScriptSettings FromString(const QString &script);
+
+            QVariantMap ToVariant() const;
+        };
+
+        /// @param port Port to listen to on all interfaces.
+        LocalService(u16 port, const ScriptSettings &script = ScriptSettings());
+        ~LocalService();
+
+        /// Returns the host to connect to, eg. "ws://127.0.0.1:9002".
+        QString Host() const;
+
+        /// Returns the listen port.
+        u16 Port() const;
+
+        /// Returns message counters per message type, connection and scripted client counts and the latency
+        /// from a scripted client join to the renderer offer arriving to it.
+        QVariantMap Statistics() const;
+
+        /// Starts the service thread and waits until the server is listening.
+        /** @return True if the server is listening, false if the port could not be opened. */
+        bool Start();
+
+        /// Stops the service and waits for the thread to exit.
+        void Stop();
+
+        /// Closes the WebSocket connections of all renderers from the service side, as if their network had dropped.
+        /** Rooms and clients are kept, the renderers can resume them with their resume token. Can be called from any thread. */
+        void DropRenderers();
+
+    protected:
+        /// QThread override.
+        void run();
+
+    private:
+        /// Connected or scripted room participant.
+        struct Participant
+        {
+            quint32 id;
+            websocketpp::connection_hdl connection;
+            bool registered;
+            bool renderer;
+            bool scripted;
+            void *connectionKey;
+            QString roomId;
+            QString peerId;
+
+            // Scripted clients only.
+            tick_t joined;
+            tick_t leaveAt;
+            tick_t nextCandidate;
+            tick_t nextCustom;
+            bool offerReceived;
+            int candidatesSent;
+
+            Participant();
+        };
+
+        struct Room
+        {
+            QString id;
+            quint32 renderer; ///< Participant id of the renderer, 0 if none.
+            QList<quint32> clients;
+
+            /// Token of the last renderer, it can resume the room until @c reservedUntil once it has left.
+            QString resumeToken;
+            tick_t reservedUntil;
+            /// Clients that left while the renderer was away, sent to the renderer when it resumes.
+            QStringList leftWhileAway;
+
+            Room() : renderer(0), reservedUntil(0) {}
+
+            /// Returns if the room is held for the resume token of its last renderer.
+            bool IsReserved(tick_t now) const { return (renderer == 0 && !resumeToken.isEmpty() && reservedUntil > now); }
+        };
+
+        void OnConnectionOpened(websocketpp::connection_hdl connection);
+        void OnConnectionClosed(websocketpp::connection_hdl connection);
+        void OnMessage(websocketpp::connection_hdl connection, WebSocket::Server::message_ptr msg);
+
+        /// Returns the participant for a connection, null if not found.
+        Participant *ParticipantFor(websocketpp::connection_hdl connection);
+
+        void HandleMessage(Participant *sender, const QByteArray &json);
+        void HandleRegistration(Participant *sender, const QVariantMap &data);
+        void HandleSignaling(Participant *sender, const QString &type, QVariantMap data);
+        void HandleCustomMessage(Participant *sender, QVariantMap data);
+        void HandleScriptedMessage(Participant *receiver, const QString &type, const QVariantMap &data);
+
+        /// Adds a participant to a room and notifies the room.
+        /** @param resumed If a renderer re-claimed its room with its resume token. */
+        void Join(Participant *participant, Room &room, bool resumed = false);
+
+        /// Removes a participant from its room and notifies the room.
+        void Leave(Participant *participant);
+
+        /// Sends @c json to a participant, scripted clients handle it in place.
+        void Send(Participant *receiver, const QString &type, const QByteArray &json);
+        void Send(Participant *receiver, CloudRenderingProtocol::IMessage *message);
+        void Send(Participant *receiver, const QString &channel, const QString &type, const QVariantMap &data);
+
+        /// Returns the participant with @c peerId, or the renderer for "renderer", in @c room. Null if not found.
+        Participant *Find(const Room &room, const QString &peerId);
+
+        /// Closes the renderer connections. Runs in the I/O loop.
+        void CloseRendererConnections();
+
+        /// Runs the scripted clients.
+        void UpdateScript(tick_t now);
+
+        /// Runs the script and schedules the next script update on the I/O loop.
+        void OnScriptTimer(const websocketpp::lib::error_code &error);
+
+        void RecordReceived(const QString &type, int bytes);
+        void RecordSent(const QString &type, int bytes);
+
+        QString LC;
+        u16 port_;
+        ScriptSettings script_;
+        WebSocket::Server server_;
+
+        QHash<quint32, Participant> participants_;
+        QHash<void*, quint32> connections_;
+        QMap<QString, Room> rooms_;
+        quint32 nextParticipantId_;
+        quint32 nextPeerId_;
+        quint32 nextRoomId_;
+        tick_t nextScriptedJoin_;
+
+        QMutex mutexStart_;
+        QWaitCondition started_;
+        bool listening_;
+
+        mutable QMutex mutexStats_;
+        QVariantMap received_;
+        QVariantMap sent_;
+        qulonglong bytesReceived_;
+        qulonglong bytesSent_;
+        qulonglong connectionsOpened_;
+        qulonglong rendererResumes_;
+        qulonglong scriptedJoins_;
+        qulonglong scriptedLeaves_;
+        qulonglong offersToScripted_;
+        double offerLatencyTotalMs_;
+        double offerLatencyMaxMs_;
+    };
+}
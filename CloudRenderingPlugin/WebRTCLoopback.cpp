@@ -0,0 +1,256 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "WebRTCLoopback.h"
+#include "WebRTCFrameStamp.h"
+#include "WebRTCRenderer.h"
+#include "WebRTCClient.h"
+#include "WebRTCLocalService.h"
+#include "WebRTCBenchmark.h"
+
+#include "CloudRenderingPlugin.h"
+
+#include "Framework.h"
+#include "LoggingFunctions.h"
+
+#include <QTimer>
+#include <QMutexLocker>
+
+#include <algorithm>
+
+#include "talk/base/timeutils.h"
+#include "talk/media/base/videoframe.h"
+
+namespace WebRTC
+{
+    /// @cond PRIVATE
+
+    /// Milliseconds ignored after the first frame while the encoder ramps up.
+    static const int cWarmupMs = 2000;
+    /// Milliseconds to wait for the first frame before giving up.
+    static const int cConnectTimeoutMs = 60000;
+
+    /// Returns the @c percent percentile of sorted @c values.
+    static double Percentile(const std::vector<double> &values, int percent)
+    {
+        if (values.empty())
+            return 0.0;
+        size_t index = values.size() * percent / 100;
+        return values[std::min(index, values.size() - 1)];
+    }
+
+    /// @endcond
+
+    Loopback::Loopback(CloudRenderingPlugin *plugin, double seconds) :
+        LC("[WebRTC::Loopback]: "),
+        plugin_(plugin),
+        seconds_(seconds > 0.0 ? seconds : 30.0),
+        clientConnected_(false),
+        started_(0),
+        clientConnectedAt_(0),
+        firstFrame_(0),
+        measureStart_(0),
+        lastFrame_(0),
+        hasSequence_(false),
+        lastSequence_(0),
+        frames_(0),
+        drops_(0),
+        decodeFailures_(0),
+        width_(0),
+        height_(0)
+    {
+    }
+
+    Loopback::~Loopback()
+    {
+        QMutexLocker lock(&mutex_);
+        if (track_.get())
+            track_->RemoveRenderer(this);
+        track_ = 0;
+    }
+
+    void Loopback::Attach(webrtc::VideoTrackInterface *track)
+    {
+        QMutexLocker lock(&mutex_);
+        if (!track || track_.get())
+            return;
+        track_ = track;
+        track_->AddRenderer(this);
+        LogInfo(LC + "Decoding frame stamps from the client remote video track");
+    }
+
+    void Loopback::SetSize(int width, int height)
+    {
+        QMutexLocker lock(&mutex_);
+        width_ = width;
+        height_ = height;
+    }
+
+    void Loopback::RenderFrame(const cricket::VideoFrame *frame)
+    {
+        if (!frame)
+            return;
+
+        u32 timestamp = 0;
+        u16 sequence = 0;
+        const bool decoded = FrameStamp::Read(frame->GetYPlane(), frame->GetYPitch(),
+            static_cast<int>(frame->GetWidth()), static_cast<int>(frame->GetHeight()), timestamp, sequence);
+        const uint32 now = talk_base::Time();
+
+        QMutexLocker lock(&mutex_);
+        if (firstFrame_ == 0)
+        {
+            firstFrame_ = now;
+            measureStart_ = now + cWarmupMs;
+        }
+        if (talk_base::TimeDiff(now, measureStart_) < 0)
+        {
+            // Warm up, only track the sequence.
+            if (decoded)
+            {
+                hasSequence_ = true;
+                lastSequence_ = sequence;
+            }
+            return;
+        }
+
+        lastFrame_ = now;
+        ++frames_;
+        if (!decoded)
+        {
+            ++decodeFailures_;
+            return;
+        }
+
+        latenciesMs_.push_back(static_cast<double>(talk_base::TimeDiff(now, timestamp)));
+        if (hasSequence_)
+        {
+            // Reordered or repeated frames do not count as drops.
+            const u16 gap = static_cast<u16>(sequence - lastSequence_);
+            if (gap > 1 && gap < 0x8000)
+                drops_ += gap - 1;
+        }
+        hasSequence_ = true;
+        lastSequence_ = sequence;
+    }
+
+    QVariantMap Loopback::Results() const
+    {
+        QMutexLocker lock(&mutex_);
+
+        std::vector<double> sorted(latenciesMs_);
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (size_t i=0; i<sorted.size(); ++i)
+            total += sorted[i];
+
+        const double measuredSeconds = (frames_ > 0 ? static_cast<double>(talk_base::TimeDiff(lastFrame_, measureStart_)) / 1000.0 : 0.0);
+
+        QVariantMap results;
+        results["durationSeconds"] = measuredSeconds;
+        results["warmupSeconds"] = static_cast<double>(cWarmupMs) / 1000.0;
+        results["width"] = width_;
+        results["height"] = height_;
+        results["frames"] = frames_;
+        results["fps"] = (measuredSeconds > 0.0 ? static_cast<double>(frames_) / measuredSeconds : 0.0);
+        results["drops"] = drops_;
+        results["decodeFailures"] = decodeFailures_;
+        results["latencyP50Ms"] = Percentile(sorted, 50);
+        results["latencyP90Ms"] = Percentile(sorted, 90);
+        results["latencyP99Ms"] = Percentile(sorted, 99);
+        results["latencyMaxMs"] = (sorted.empty() ? 0.0 : sorted.back());
+        results["latencyMeanMs"] = (sorted.empty() ? 0.0 : total / static_cast<double>(sorted.size()));
+        results["timeToFirstFrameMs"] = (firstFrame_ != 0 && clientConnectedAt_ != 0 ? talk_base::TimeDiff(firstFrame_, clientConnectedAt_) : 0);
+        results["trickleIce"] = plugin_->GetFramework()->HasCommandLineParameter("--cloudRenderingTrickleIce");
+
+        QVariantMap metrics;
+        foreach(const QString &key, QStringList() << "fps" << "drops" << "decodeFailures" << "latencyP50Ms" << "latencyP90Ms" << "latencyP99Ms" << "latencyMaxMs" << "timeToFirstFrameMs")
+            metrics["loopback." + key] = results[key];
+        results["metrics"] = metrics;
+        return results;
+    }
+
+    void Loopback::Start()
+    {
+        started_ = talk_base::Time();
+        LogInfo(LC + QString("Running for %1 seconds after the first frame").arg(seconds_));
+
+        QTimer *timer = new QTimer(this);
+        connect(timer, SIGNAL(timeout()), SLOT(OnUpdate()));
+        timer->start(100);
+    }
+
+    void Loopback::OnUpdate()
+    {
+        const uint32 now = talk_base::Time();
+
+        // Connect the client to the renderers room.
+        if (!clientConnected_)
+        {
+            WebRTCRendererPtr renderer = plugin_->Renderer();
+            WebRTCClientPtr client = plugin_->Client();
+            WebRTCLocalServicePtr service = plugin_->LocalService();
+            if (!renderer.get() || !client.get() || !service.get())
+            {
+                Finish("Renderer, client or local service is not running");
+                return;
+            }
+            const QString roomId = renderer->Room().id;
+            if (!roomId.isEmpty())
+            {
+                LogInfo(LC + "Renderer assigned to room " + roomId + ", connecting client");
+                client->Connect(service->Host(), roomId);
+                clientConnected_ = true;
+                clientConnectedAt_ = now;
+            }
+        }
+
+        uint32 firstFrame = 0, measureStart = 0;
+        {
+            QMutexLocker lock(&mutex_);
+            firstFrame = firstFrame_;
+            measureStart = measureStart_;
+        }
+        if (firstFrame == 0)
+        {
+            if (talk_base::TimeDiff(now, started_) > cConnectTimeoutMs)
+                Finish(QString("No frames received in %1 seconds").arg(cConnectTimeoutMs / 1000));
+            return;
+        }
+        if (talk_base::TimeDiff(now, measureStart) >= static_cast<int>(seconds_ * 1000.0))
+            Finish();
+    }
+
+    void Loopback::Finish(const QString &error)
+    {
+        foreach(QTimer *timer, findChildren<QTimer*>())
+            timer->stop();
+
+        QVariantMap results = Results();
+        if (!error.isEmpty())
+        {
+            LogError(LC + error);
+            results["error"] = error;
+        }
+        else
+            LogInfo(LC + QString("%1 frames, latency p50 %2 ms p99 %3 ms, %4 drops").arg(results["frames"].toInt())
+                .arg(results["latencyP50Ms"].toDouble(), 0, 'f', 1).arg(results["latencyP99Ms"].toDouble(), 0, 'f', 1)
+                .arg(results["drops"].toInt()));
+
+        QVariantMap suites;
+        suites["loopback"] = results;
+        QVariantMap report;
+        report["suites"] = suites;
+
+        Benchmark benchmark(plugin_);
+        benchmark.WriteReport(report);
+
+        plugin_->GetFramework()->Exit();
+    }
+}
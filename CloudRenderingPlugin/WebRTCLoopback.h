@@ -0,0 +1,97 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include <QObject>
+#include <QMutex>
+#include <QVariant>
+
+#include <vector>
+
+#include "talk/app/webrtc/mediastreaminterface.h"
+
+namespace WebRTC
+{
+    /// End to end latency benchmark with a renderer and a client in the same process.
+    /** Started with --cloudRenderingLoopback [seconds]. The plugin starts the LocalService, a Renderer
+        and a Client. Once the renderer has been assigned a room the client is connected to the same room.
+        The peers use host ICE candidates only, so the media flows over the loopback interface.
+
+        TundraCapturer stamps each captured frame with its capture time and a sequence number, see FrameStamp.
+        The remote video track of the client is decoded here, which gives the capture to decode latency of
+        the whole pipeline: conversion, encoding, RTP over loopback and decoding. Sequence gaps are counted as
+        drops, this includes frames dropped by the libjingle frame rate adapter and the encoder.
+
+        The time from connecting the client to its first decoded frame is reported as the time to first frame,
+        it includes the signaling, ICE and DTLS setup. Compare runs with and without --cloudRenderingTrickleIce.
+        The first two seconds after the first frame are ignored while the encoder ramps up. After the run the
+        report is written to --cloudRenderingBenchmarkOutput <file> or to the log, after which Tundra exits.
+        Needs a window and a GPU, Tundra is rendered normally. */
+    class CLOUDRENDERING_API Loopback : public QObject, public webrtc::VideoRendererInterface
+    {
+        Q_OBJECT
+
+    public:
+        /// @param seconds Measurement duration after the warm up.
+        Loopback(CloudRenderingPlugin *plugin, double seconds);
+        ~Loopback();
+
+        /// Decodes the frame stamps of @c track. Called for the remote video track of the client.
+        /** Can be called from any thread. */
+        void Attach(webrtc::VideoTrackInterface *track);
+
+        /// webrtc::VideoRendererInterface override.
+        void SetSize(int width, int height);
+
+        /// webrtc::VideoRendererInterface override.
+        /** Called from the libjingle worker thread. */
+        void RenderFrame(const cricket::VideoFrame *frame);
+
+        /// Returns the results measured so far.
+        QVariantMap Results() const;
+
+    public slots:
+        /// Starts the run, connects the client once the renderer has a room.
+        void Start();
+
+    private slots:
+        void OnUpdate();
+
+    private:
+        /// Writes the report and exits.
+        void Finish(const QString &error = "");
+
+        QString LC;
+        CloudRenderingPlugin *plugin_;
+        double seconds_;
+        bool clientConnected_;
+        uint32 started_;
+        /// Time the client was connected, the time to first frame is measured from here.
+        uint32 clientConnectedAt_;
+
+        talk_base::scoped_refptr<webrtc::VideoTrackInterface> track_;
+
+        mutable QMutex mutex_;
+        uint32 firstFrame_;
+        uint32 measureStart_;
+        uint32 lastFrame_;
+        bool hasSequence_;
+        u16 lastSequence_;
+        int frames_;
+        int drops_;
+        int decodeFailures_;
+        int width_;
+        int height_;
+        std::vector<double> latenciesMs_;
+    };
+}
@@ -0,0 +1,164 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "WebRTCOutboundQueue.h"
+#include "WebRTCClock.h"
+
+#include <QMutexLocker>
+
+namespace WebRTC
+{
+    OutboundQueue::Statistics::Statistics() :
+        pushed(0),
+        rejected(0),
+        sent(0),
+        merged(0),
+        drains(0),
+        depth(0),
+        maxDepth(0),
+        latencyAverageMs(0.0),
+        latencyMaxMs(0.0)
+    {
+    }
+
+    QVariantMap OutboundQueue::Statistics::ToVariant() const
+    {
+        QVariantMap result;
+        result["pushed"] = static_cast<qulonglong>(pushed);
+        result["rejected"] = static_cast<qulonglong>(rejected);
+        result["sent"] = static_cast<qulonglong>(sent);
+        result["merged"] = static_cast<qulonglong>(merged);
+        result["writes"] = static_cast<qulonglong>(sent - merged);
+        result["drains"] = static_cast<qulonglong>(drains);
+        result["messagesPerDrain"] = (drains > 0 ? static_cast<double>(sent) / static_cast<double>(drains) : 0.0);
+        result["depth"] = depth;
+        result["maxDepth"] = maxDepth;
+        result["latencyAverageMs"] = latencyAverageMs;
+        result["latencyMaxMs"] = latencyMaxMs;
+        return result;
+    }
+
+    OutboundQueue::OutboundQueue(int maxDepth) :
+        head_(new Node()),
+        tail_(0),
+        depth_(0),
+        maxDepthSeen_(0),
+        pushed_(0),
+        rejected_(0),
+        maxDepth_(maxDepth > 0 ? maxDepth : 1),
+        sent_(0),
+        merged_(0),
+        drains_(0),
+        latencyTotalMs_(0.0),
+        latencyMaxMs_(0.0)
+    {
+        // Both ends start at the same empty node.
+        tail_ = head_;
+    }
+
+    OutboundQueue::~OutboundQueue()
+    {
+        QByteArray data;
+        while (Pop(data)) {}
+        delete head_;
+    }
+
+    int OutboundQueue::MaxDepth() const
+    {
+        return maxDepth_;
+    }
+
+    bool OutboundQueue::Push(QByteArray &data, bool *wakeUp, const QString &mergeKey)
+    {
+        if (wakeUp)
+            *wakeUp = false;
+
+        // Reserve a slot first, the depth can overshoot by the number of concurrent producers for a moment.
+        const int depth = depth_.fetchAndAddOrdered(1);
+        if (depth >= maxDepth_)
+        {
+            depth_.fetchAndAddOrdered(-1);
+            rejected_.fetchAndAddRelaxed(1);
+            return false;
+        }
+        pushed_.fetchAndAddRelaxed(1);
+
+        int seen = maxDepthSeen_;
+        while (depth + 1 > seen && !maxDepthSeen_.testAndSetRelaxed(seen, depth + 1))
+            seen = maxDepthSeen_;
+
+        Node *node = new Node();
+        qSwap(node->data, data);
+        node->mergeKey = mergeKey;
+        node->pushed = GetCurrentClockTime();
+
+        // The node is visible to the consumer once the previous node links to it.
+        Node *previous = tail_.fetchAndStoreOrdered(node);
+        previous->next.fetchAndStoreRelease(node);
+
+        if (wakeUp)
+            *wakeUp = (depth == 0);
+        return true;
+    }
+
+    bool OutboundQueue::Pop(QByteArray &data, double *queuedMs, QString *mergeKey)
+    {
+        // Qt 4 has no loadAcquire(), an add of zero is an acquire load.
+        Node *next = head_->next.fetchAndAddAcquire(0);
+        if (!next)
+            return false;
+
+        // The popped node becomes the new empty head node.
+        data.clear();
+        qSwap(data, next->data);
+        if (queuedMs)
+            *queuedMs = MsSince(next->pushed);
+        if (mergeKey)
+            qSwap(*mergeKey, next->mergeKey);
+        delete head_;
+        head_ = next;
+
+        depth_.fetchAndAddOrdered(-1);
+        return true;
+    }
+
+    void OutboundQueue::RecordDrain(int messages, int merged, double totalMs, double maxMs)
+    {
+        if (messages <= 0)
+            return;
+        QMutexLocker lock(&mutexStats_);
+        sent_ += messages;
+        merged_ += qMax(0, merged);
+        drains_++;
+        latencyTotalMs_ += totalMs;
+        latencyMaxMs_ = qMax(latencyMaxMs_, maxMs);
+    }
+
+    int OutboundQueue::Depth() const
+    {
+        return qMax(0, static_cast<int>(depth_));
+    }
+
+    OutboundQueue::Statistics OutboundQueue::Stats() const
+    {
+        Statistics stats;
+        stats.pushed = static_cast<u64>(static_cast<uint>(pushed_));
+        stats.rejected = static_cast<u64>(static_cast<uint>(rejected_));
+        stats.depth = Depth();
+        stats.maxDepth = maxDepthSeen_;
+
+        QMutexLocker lock(&mutexStats_);
+        stats.sent = sent_;
+        stats.merged = merged_;
+        stats.drains = drains_;
+        stats.latencyAverageMs = (sent_ > 0 ? latencyTotalMs_ / static_cast<double>(sent_) : 0.0);
+        stats.latencyMaxMs = latencyMaxMs_;
+        return stats;
+    }
+}
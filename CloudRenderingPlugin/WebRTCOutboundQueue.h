@@ -0,0 +1,130 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include "HighPerfClock.h"
+
+#include <QByteArray>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QMutex>
+#include <QString>
+#include <QVariant>
+
+namespace WebRTC
+{
+    /// Outgoing message queue from any thread to the WebSocket thread.
+    /** Multiple producer, single consumer linked queue. Push() is lock free and wait free apart from the
+        node allocation: the node is linked in with one atomic exchange of the tail. Pop() is only called
+        from the consumer thread.
+
+        The number of queued messages is limited to MaxDepth(), Push() fails when the queue is full so that
+        a stalled connection does not grow the queue without bounds. Push() reports when the queue goes from
+        empty to non-empty, the producer then wakes up the consumer once for the whole burst.
+
+        A message can be pushed with a merge key. Consecutive messages with the same key can be combined
+        into one by the consumer, the queue itself only carries the key along. */
+    class CLOUDRENDERING_API OutboundQueue
+    {
+    public:
+        /// Queue counters.
+        struct Statistics
+        {
+            /// Number of messages pushed to the queue.
+            u64 pushed;
+            /// Number of messages rejected because the queue was full.
+            u64 rejected;
+            /// Number of messages taken out of the queue.
+            u64 sent;
+            /// Number of the sent messages that were merged into the message before them.
+            /** Every other message is written to the socket on its own, sent - merged is the number of socket writes. */
+            u64 merged;
+            /// Number of drains. A burst of messages pushed before the consumer wakes up takes one drain.
+            u64 drains;
+            /// Messages currently in the queue.
+            int depth;
+            /// Highest depth seen.
+            int maxDepth;
+            /// Average and max time in milliseconds from Push() to Pop().
+            double latencyAverageMs;
+            double latencyMaxMs;
+
+            Statistics();
+
+            QVariantMap ToVariant() const;
+        };
+
+        /// @param maxDepth Maximum number of queued messages.
+        explicit OutboundQueue(int maxDepth = 1024);
+        ~OutboundQueue();
+
+        int MaxDepth() const;
+
+        /// Queues @c data, can be called from any thread.
+        /** The contents of @c data are moved to the queue and @c data is left empty, there is no copy.
+            @param wakeUp Set to true if the queue was empty, the consumer needs to be woken up.
+            @param mergeKey Messages with the same non-empty key may be merged by the consumer.
+            @return False if the queue is full, @c data is left untouched. */
+        bool Push(QByteArray &data, bool *wakeUp = 0, const QString &mergeKey = QString());
+
+        /// Takes the oldest message out of the queue. Consumer thread only.
+        /** Returns false also while a producer is between reserving its slot and linking its message in.
+            Depth() is then above zero and the consumer must try again, the producer does not wake it up.
+            @param queuedMs Time the message spent in the queue.
+            @param mergeKey The merge key the message was pushed with.
+            @return False if there is no message to take. */
+        bool Pop(QByteArray &data, double *queuedMs = 0, QString *mergeKey = 0);
+
+        /// Records a drain of @c messages with @c totalMs and @c maxMs time spent in the queue. Consumer thread only.
+        /** @param merged Number of the messages that were merged into the message before them. */
+        void RecordDrain(int messages, int merged, double totalMs, double maxMs);
+
+        /// Returns the number of queued messages.
+        int Depth() const;
+
+        /// Can be called from any thread.
+        Statistics Stats() const;
+
+    private:
+        Q_DISABLE_COPY(OutboundQueue)
+
+        struct Node
+        {
+            QAtomicPointer<Node> next;
+            QByteArray data;
+            QString mergeKey;
+            tick_t pushed;
+
+            Node() : next(0), pushed(0) {}
+        };
+
+        /// Consumer end, the node before the oldest message.
+        Node *head_;
+        /// Producer end, the newest node.
+        QAtomicPointer<Node> tail_;
+
+        QAtomicInt depth_;
+        QAtomicInt maxDepthSeen_;
+        QAtomicInt pushed_;
+        QAtomicInt rejected_;
+        const int maxDepth_;
+
+        /// Consumer side counters.
+        mutable QMutex mutexStats_;
+        u64 sent_;
+        u64 merged_;
+        u64 drains_;
+        double latencyTotalMs_;
+        double latencyMaxMs_;
+    };
+}
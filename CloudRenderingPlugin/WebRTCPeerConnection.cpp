@@ -11,18 +11,21 @@
 #include "WebRTCUtils.h"
 #include "WebRTCVideoRenderer.h"
 #include "WebRTCTundraCapturer.h"
+#include "WebRTCLoopback.h"
+#include "WebRTCBroadcastSource.h"
+#include "WebRTCConnectionFactory.h"
 
 #include "CloudRenderingPlugin.h"
 
 #include "Framework.h"
 #include "LoggingFunctions.h"
+#include "WebRTCClock.h"
 
 #include <QTimer>
 
 #include "talk/app/webrtc/videosourceinterface.h"
 #include "talk/media/devices/devicemanager.h"
 #include "talk/base/windowpicker.h"
-#include "talk/base/ssladapter.h"
 
 namespace WebRTC
 {       
@@ -41,8 +44,12 @@ namespace WebRTC
         localIceCandidatesResolved_(false),
         localSDPEmitted_(false),
         localIceEmitted_(false),
-        localBothEmitted_(false)
+        localBothEmitted_(false),
+        trickle_(false),
+        trickleBatchMsec_(5)
     {       
+        trickleTimer_.setSingleShot(true);
+        connect(&trickleTimer_, SIGNAL(timeout()), SLOT(FlushTrickle()));
     }
 
     PeerConnection::~PeerConnection()
@@ -75,10 +82,36 @@ namespace WebRTC
         peerCustomData_[key] = value;
     }
     
-    void PeerConnection::Reset()
+    void PeerConnection::SetBroadcastSource(const WebRTCBroadcastSourcePtr &source)
+    {
+        if (peerConnection_.get())
+            LogWarning(LC + "SetBroadcastSource: Connection already initialized, change applies after reconnect.");
+        broadcastSource_ = source;
+    }
+    
+    WebRTCBroadcastSourcePtr PeerConnection::BroadcastSource() const
     {
-        talk_base::CleanupSSL();
+        return broadcastSource_;
+    }
+
+    void PeerConnection::SetTrickleIce(bool enabled, int batchMsec)
+    {
+        if (peerConnection_.get())
+        {
+            LogWarning(LC + "SetTrickleIce: Connection already initialized, ignoring.");
+            return;
+        }
+        trickle_ = enabled;
+        trickleBatchMsec_ = qMax(0, batchMsec);
+    }
 
+    bool PeerConnection::IsTrickleIce() const
+    {
+        return trickle_;
+    }
+    
+    void PeerConnection::Reset()
+    {
         // Release media/track shader ptrs
         foreach(QPointer<VideoRenderer> renderer, activeRenderers_)
             if (renderer) renderer->Close();
@@ -95,6 +128,10 @@ namespace WebRTC
         localSDPEmitted_ = false;
         localIceEmitted_ = false;
         localBothEmitted_ = false;
+
+        trickleTimer_.stop();
+        QMutexLocker lock(&mutexTrickle_);
+        trickleBatch_.clear();
     }
     
     void PeerConnection::CreateOffer(ConnectionSettings settings)
@@ -118,7 +155,8 @@ namespace WebRTC
             return;
         }
         
-        if (!localIceCandidatesResolved_)
+        // Trickled candidates only need the remote SDP, bundled ones wait until the local candidates are gathered.
+        if (trickle_ ? !remoteSDPSet_ : !localIceCandidatesResolved_)
         {
             LogDebug(QString("  >> Storing %1 remote ICE candidates for later use...").arg(iceCandidates.size()));
             pendingRemoteIceCandidates_ += iceCandidates;
@@ -172,7 +210,13 @@ namespace WebRTC
             peerConnection_->CreateAnswer(this, NULL);
         }
         
-        AddRemoteIceCandidates(iceCandidates);
+        if (trickle_ && !pendingRemoteIceCandidates_.isEmpty())
+        {
+            AddRemoteIceCandidates(pendingRemoteIceCandidates_ + iceCandidates);
+            pendingRemoteIceCandidates_.clear();
+        }
+        else
+            AddRemoteIceCandidates(iceCandidates);
     }
     
     void PeerConnection::AddStreams(const ConnectionSettings &settings)
@@ -211,12 +255,22 @@ namespace WebRTC
             if (IsLogChannelEnabled(LogChannelDebug))
                 qDebug() << "  >> Adding 3D rendering stream";
 
-            talk_base::scoped_refptr<webrtc::VideoTrackInterface> videoTrack(peerConnectionFactory_->CreateVideoTrack(
-                kVideoLabel, peerConnectionFactory_->CreateVideoSource(OpenTundraCaptureDevice(), NULL)));
-            stream->AddTrack(videoTrack);
+            // Broadcast mode attaches a new track to the one shared source.
+            talk_base::scoped_refptr<webrtc::VideoTrackInterface> videoTrack;
+            if (broadcastSource_.get())
+                videoTrack = broadcastSource_->CreateVideoTrack(kVideoLabel);
+            else
+                videoTrack = peerConnectionFactory_->CreateVideoTrack(kVideoLabel, 
+                    peerConnectionFactory_->CreateVideoSource(OpenTundraCaptureDevice(), NULL));
+            if (videoTrack.get())
+            {
+                stream->AddTrack(videoTrack);
 
-            if (IsPreviewRenderingEnabled())
-                activeRenderers_ << new VideoRenderer(videoTrack, false, "Local Tundra Stream"); 
+                if (IsPreviewRenderingEnabled())
+                    activeRenderers_ << new VideoRenderer(videoTrack, false, "Local Tundra Stream"); 
+            }
+            else
+                LogError(LC + "Failed to create 3D rendering video track");
         }
         
         if (settings.data)
@@ -341,6 +395,10 @@ namespace WebRTC
                 
             if (IsPreviewRenderingEnabled())
                 activeRenderers_ << new VideoRenderer(videoTrack, false, QString("Remote Stream %1").arg(activeRenderers_.size()+1));
+
+            CloudRenderingPlugin *plugin = (framework_ ? framework_->Module<CloudRenderingPlugin>() : 0);
+            if (plugin && plugin->Loopback().get())
+                plugin->Loopback()->Attach(videoTrack);
         }
         
         //stream->Release();
@@ -381,7 +439,21 @@ namespace WebRTC
         localIceCandidatesResolved_ = false;
         
         std::string sdp; candidate->ToString(&sdp);
-        pendingLocalIceCandidates_ << WebRTC::ICECandidate(candidate->sdp_mline_index(), QString::fromStdString(candidate->sdp_mid()), QString::fromStdString(sdp));
+        WebRTC::ICECandidate iceCandidate(candidate->sdp_mline_index(), QString::fromStdString(candidate->sdp_mid()), QString::fromStdString(sdp));
+        pendingLocalIceCandidates_ << iceCandidate;
+
+        if (trickle_)
+        {
+            bool first = false;
+            {
+                QMutexLocker lock(&mutexTrickle_);
+                first = trickleBatch_.isEmpty();
+                trickleBatch_ << iceCandidate;
+            }
+            // Called in the libjingle signaling thread, the batch timer runs in the thread of this object.
+            if (first)
+                QMetaObject::invokeMethod(this, "ScheduleTrickle", Qt::QueuedConnection);
+        }
     }
 
     void PeerConnection::OnIceComplete()
@@ -391,11 +463,19 @@ namespace WebRTC
             qDebug() << "  >> Pending remote ICE candidates" << pendingRemoteIceCandidates_.size();
         
         localIceCandidatesResolved_ = true;
+
+        // Gathering is done, send the last batch without waiting for the timer.
+        if (trickle_)
+            QMetaObject::invokeMethod(this, "FlushTrickle", Qt::QueuedConnection);
         
         /// @todo Move to last block of EmitResolvedSignals??
-        if (pendingRemoteIceCandidates_.size() > 0)
-            AddRemoteIceCandidates(pendingRemoteIceCandidates_);
-        pendingRemoteIceCandidates_.clear();
+        // Trickled remote candidates wait for the remote SDP instead, HandleOfferOrAnswer() adds them.
+        if (!trickle_)
+        {
+            if (pendingRemoteIceCandidates_.size() > 0)
+                AddRemoteIceCandidates(pendingRemoteIceCandidates_);
+            pendingRemoteIceCandidates_.clear();
+        }
 
         EmitResolvedSignals();
     }
@@ -439,7 +519,8 @@ namespace WebRTC
             emit LocaleIceCandidatesResolved(pendingLocalIceCandidates_);
         }
 
-        if (localSDPResolved_ && localIceCandidatesResolved_ && !localBothEmitted_)
+        // The SDP and the candidates have already gone out separately in trickle mode.
+        if (localSDPResolved_ && localIceCandidatesResolved_ && !localBothEmitted_ && !trickle_)
         {
             LogDebug(LC + "Emitting BOTH local SDP and ICE");
             localBothEmitted_ = true;
@@ -447,6 +528,26 @@ namespace WebRTC
         }
     }
 
+    void PeerConnection::ScheduleTrickle()
+    {
+        if (!trickleTimer_.isActive())
+            trickleTimer_.start(trickleBatchMsec_);
+    }
+
+    void PeerConnection::FlushTrickle()
+    {
+        trickleTimer_.stop();
+        ICECandidateList candidates;
+        {
+            QMutexLocker lock(&mutexTrickle_);
+            qSwap(candidates, trickleBatch_);
+        }
+        if (candidates.isEmpty())
+            return;
+        LogDebug(LC + QString("Trickling %1 local ICE candidates").arg(candidates.size()));
+        emit LocalIceCandidatesTrickled(candidates);
+    }
+
     int PeerConnection::AddRef()
     {
         /// @todo Mutex?
@@ -484,17 +585,38 @@ namespace WebRTC
     {
         if (!buffer.binary)
         {
-            QByteArray json = QString::fromUtf8(buffer.data.data(), buffer.data.length()).toUtf8();
+            QByteArray json(buffer.data.data(), static_cast<int>(buffer.data.length()));
+
+            CloudRenderingProtocol::ChannelType channelType = CloudRenderingProtocol::CT_Invalid;
+            CloudRenderingProtocol::MessageType messageType = CloudRenderingProtocol::MT_Invalid;
 
-            CloudRenderingProtocol::MessageSharedPtr message = CloudRenderingProtocol::CreateMessageFromJSON(json);
-            if (!message.get())
+            // Input is read straight into its typed fields with the streaming fast path,
+            // other messages and custom payloads go through the generic QVariantMap path.
+            CloudRenderingProtocol::JsonReader reader(json);
+            int dataPosition = -1;
+            if (CloudRenderingProtocol::ReadMessageEnvelope(reader, channelType, messageType, dataPosition) &&
+                messageType == CloudRenderingProtocol::MT_PeerCustomMessage && dataPosition >= 0)
+            {
+                CloudRenderingProtocol::Application::PeerCustomValue message;
+                reader.Seek(dataPosition);
+                if (message.Deserialize(reader))
+                {
+                    if (IsLogChannelEnabled(LogChannelDebug))
+                        qDebug() << "PEER DATA CHANNEL - Received new input message    raw size =" << json.size() << "bytes";
+                    emit DataChannelMessage(message);
+                    return;
+                }
+            }
+
+            QVariantMap data;
+            if (!CloudRenderingProtocol::ParseMessage(json, channelType, messageType, data))
             {
                 LogError(LC + "Error while parsing incoming JSON message");
                 if (IsLogChannelEnabled(LogChannelDebug))
                     CloudRenderingProtocol::DumpPrettyJSON(json);
                 return;
             }
-            if (!message->IsValid())
+            if (messageType == CloudRenderingProtocol::MT_Invalid)
             {
                 LogError(LC + "Failed to resolve incoming JSON messages type");
                 return;
@@ -502,15 +624,32 @@ namespace WebRTC
 
             if (IsLogChannelEnabled(LogChannelDebug))
             {
-                qDebug() << "PEER DATA CHANNEL - Received new message: channel =" << message->ChannelTypeName() << "type =" << message->MessageTypeName() << "    raw size =" << json.size() << "bytes";
+                qDebug() << "PEER DATA CHANNEL - Received new message: channel =" << CloudRenderingProtocol::ToChannelTypeName(channelType) 
+                         << "type =" << CloudRenderingProtocol::ToMessageTypeName(messageType) << "    raw size =" << json.size() << "bytes";
                 CloudRenderingProtocol::DumpPrettyJSON(json);
             }
-            
+
+            // Input arrives as PeerCustomMessages at a high rate, they are handed over as values.
+            if (messageType == CloudRenderingProtocol::MT_PeerCustomMessage)
+            {
+                CloudRenderingProtocol::Application::PeerCustomValue message;
+                if (message.Deserialize(data))
+                    emit DataChannelMessage(message);
+                return;
+            }
+
+            CloudRenderingProtocol::MessageSharedPtr message = CloudRenderingProtocol::CreateMessage(messageType);
+            if (!message.get() || !message->FromData(data))
+            {
+                LogError(LC + "Error while parsing incoming " + CloudRenderingProtocol::ToMessageTypeName(messageType) + " message");
+                return;
+            }
             emit DataChannelMessage(message);
         }
         else
         {
-            CloudRenderingProtocol::BinaryMessageData data = CloudRenderingProtocol::BinaryMessageData::fromRawData(buffer.data.data(), buffer.data.length());
+            // Deep copy, the signal is queued and the buffer is only valid during this call.
+            CloudRenderingProtocol::BinaryMessageData data(buffer.data.data(), static_cast<int>(buffer.data.length()));
             
             if (IsLogChannelEnabled(LogChannelDebug))
                 qDebug() << "PEER DATA CHANNEL - Received new binary message of" << data.size() << "bytes";
@@ -527,14 +666,23 @@ namespace WebRTC
             return false;
         }
 
-        peerConnectionFactory_ = webrtc::CreatePeerConnectionFactory();
+        tick_t start = GetCurrentClockTime();
+
+        // All peers share the plugins factory and its threads.
+        CloudRenderingPlugin *plugin = (framework_ ? framework_->Module<CloudRenderingPlugin>() : 0);
+        WebRTCConnectionFactoryPtr connectionFactory = (plugin ? plugin->ConnectionFactory() : WebRTCConnectionFactoryPtr());
+        if (connectionFactory.get())
+            peerConnectionFactory_ = connectionFactory->Factory();
         if (peerConnectionFactory_.get())
         {            
-            webrtc::PeerConnectionInterface::IceServer server;
-            server.uri = WebRTC::GetPeerConnectionString();
-
+            // The loopback benchmark peers are on the same host, host candidates are enough.
             webrtc::PeerConnectionInterface::IceServers servers;
-            servers.push_back(server);
+            if (!plugin || !plugin->Loopback().get())
+            {
+                webrtc::PeerConnectionInterface::IceServer server;
+                server.uri = WebRTC::GetPeerConnectionString();
+                servers.push_back(server);
+            }
 
             if (!settings.data)
                 peerConnection_ = peerConnectionFactory_->CreatePeerConnection(servers, NULL, NULL, this);
@@ -543,12 +691,16 @@ namespace WebRTC
                 mediaConstraints_.Reset();
                 mediaConstraints_.SetAllowRtpDataChannels();
                 //mediaConstraints_.SetAllowDtlsSctpDataChannels(); // Does not work on current webrtc lib, should work in Chrome >=31.
-                talk_base::InitializeSSL();
                 peerConnection_ = peerConnectionFactory_->CreatePeerConnection(servers, &mediaConstraints_, NULL, this);
             }
             if (peerConnection_.get())
             {
                 AddStreams(settings);
+                
+                const double ms = MsSince(start);
+                connectionFactory->RecordPeerCreated(ms);
+                LogDebug(LC + QString("Peer %1 created in %2 msec, process threads %3").arg(peerId_).arg(ms, 0, 'f', 2)
+                    .arg(WebRTC::ConnectionFactory::ProcessThreadCount()));
                 return true;
             }
             else
@@ -565,6 +717,15 @@ namespace WebRTC
         return (framework_ ? framework_->HasCommandLineParameter("--cloudRenderingShowStreamPreview") : false);
     }
 
+    bool PeerConnection::IsConnected() const
+    {
+        if (!peerConnection_.get())
+            return false;
+        webrtc::PeerConnectionInterface::IceConnectionState state = peerConnection_->ice_connection_state();
+        return (state == webrtc::PeerConnectionInterface::kIceConnectionConnected ||
+                state == webrtc::PeerConnectionInterface::kIceConnectionCompleted);
+    }
+
     bool PeerConnection::AreLocalIceCandidatesResolved() const
     {
         return localIceCandidatesResolved_;
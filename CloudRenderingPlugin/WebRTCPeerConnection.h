@@ -24,6 +24,8 @@
 
 #include <QVariant>
 #include <QPointer>
+#include <QMutex>
+#include <QTimer>
 #include <QDebug>
 
 namespace WebRTC
@@ -69,6 +71,26 @@ namespace WebRTC
             }
         };
 
+        /// Makes the rendering video track use a shared broadcast source.
+        /** Must be set before the connection is initialized with CreateOffer() or HandleOfferOrAnswer().
+            Null ptr creates a capturer and video source for this peer only, which is the default. */
+        void SetBroadcastSource(const WebRTCBroadcastSourcePtr &source);
+        
+        /// Returns the shared broadcast source, null ptr if the peer has its own.
+        WebRTCBroadcastSourcePtr BroadcastSource() const;
+
+        /// Enables trickle ICE.
+        /** By default the offer or answer is emitted with LocalConnectionDataResolved() once ICE gathering has
+            completed, with all the local candidates. In trickle mode the SDP is emitted with LocalSDPResolved()
+            as soon as it is created and the local candidates follow with LocalIceCandidatesTrickled() as they are
+            gathered, in batches of the candidates found within @c batchMsec. LocalConnectionDataResolved() is not
+            emitted. Remote candidates are added as soon as the remote SDP is set.
+            Must be set before the connection is initialized with CreateOffer() or HandleOfferOrAnswer(). */
+        void SetTrickleIce(bool enabled, int batchMsec = 5);
+
+        /// Returns if trickle ICE is enabled.
+        bool IsTrickleIce() const;
+
     public slots:
         /// Returns the peer id.
         QString Id() const;
@@ -102,6 +124,9 @@ namespace WebRTC
         /// Add remote ICE candidates.
         void AddRemoteIceCandidates(const WebRTC::ICECandidateList iceCandidates);
 
+        /// Returns if the ICE connection to the peer is up, ie. media and data flow.
+        bool IsConnected() const;
+
         /// Returns if local ICE candidates have been resolved.
         bool AreLocalIceCandidatesResolved() const;
         
@@ -119,6 +144,12 @@ namespace WebRTC
         cricket::VideoCapturer* OpenVideoCaptureDevice();
         
         void EmitResolvedSignals();
+
+        /// Starts the trickle batch timer if it is not running.
+        void ScheduleTrickle();
+
+        /// Emits the trickle batch.
+        void FlushTrickle();
         
     signals:
         /// Emitted when creating a offer or an answer when both SDP and ICE candidates have been resolved.
@@ -130,10 +161,18 @@ namespace WebRTC
         
         /// Emitted when local ICE candidates information has been resolved.
         void LocaleIceCandidatesResolved(WebRTC::ICECandidateList candidates);
+
+        /// Emitted in trickle mode with the local ICE candidates gathered since the last batch.
+        /** Emitted after LocalSDPResolved(), the candidates can be sent to the other peer right away. */
+        void LocalIceCandidatesTrickled(WebRTC::ICECandidateList candidates);
         
         /// Emitted when a data channel message has been received.
+        /** PeerCustomMessages are emitted as values with the overload below. */
         void DataChannelMessage(CloudRenderingProtocol::MessageSharedPtr message);
 
+        /// Emitted when a PeerCustomMessage has been received from the data channel, eg. an input event.
+        void DataChannelMessage(const CloudRenderingProtocol::Application::PeerCustomValue &message);
+
         /// Emitted when a binary data channel message has been received.    
         void DataChannelMessage(const CloudRenderingProtocol::BinaryMessageData &data);
 
@@ -184,6 +223,8 @@ namespace WebRTC
         talk_base::scoped_refptr<webrtc::DataChannelInterface> dataChannel_;
         
         MediaConstraints mediaConstraints_;
+        
+        WebRTCBroadcastSourcePtr broadcastSource_;
 
         QList<QPointer<VideoRenderer> > activeRenderers_;
 
@@ -200,6 +241,13 @@ namespace WebRTC
         bool localSDPEmitted_;
         bool localIceEmitted_;
         bool localBothEmitted_;
+
+        bool trickle_;
+        int trickleBatchMsec_;
+        /// Candidates gathered for the next trickle batch, filled from the libjingle signaling thread.
+        QMutex mutexTrickle_;
+        ICECandidateList trickleBatch_;
+        QTimer trickleTimer_;
     };
     
     /// @cond PRIVATE
@@ -15,6 +15,10 @@
 #include "WebRTCRenderer.h"
 #include "WebRTCWebSocketClient.h"
 #include "WebRTCPeerConnection.h"
+#include "WebRTCGLReadback.h"
+#include "WebRTCBroadcastSource.h"
+#include "WebRTCLocalService.h"
+#include "WebRTCClock.h"
 
 #include "CloudRenderingPlugin.h"
 
@@ -29,11 +33,12 @@
 #include "InputAPI.h"
 
 #include <QImage>
-#include <QKeyEvent>
-#include <QMouseEvent>
+#include <QFocusEvent>
 #include <QGraphicsScene>
 #include <QGraphicsItem>
 #include <QDebug>
+#include <QThread>
+#include <QPair>
 
 #include "OgreRenderingModule.h"
 #include "Renderer.h"
@@ -44,6 +49,10 @@
 #include "OgreHardwarePixelBuffer.h"
 
 #include <OgreRenderWindow.h>
+#include <OgreRenderTexture.h>
+#include <OgreViewport.h>
+#include <OgreCamera.h>
+#include <OgreResourceGroupManager.h>
 #ifdef DIRECTX_ENABLED
 #include <OgreD3D9HardwarePixelBuffer.h>
 #include <OgreD3D9RenderWindow.h>
@@ -56,11 +65,23 @@ namespace WebRTC
 {
     // Renderer
     
-    Renderer::Renderer(CloudRenderingPlugin *plugin) :
+    Renderer::Renderer(CloudRenderingPlugin *plugin, const QString &serviceHost) :
         LC("[WebRTC::Renderer]: "),
         plugin_(plugin),
+        tundraRenderer_(new TundraRenderer(plugin)),
         websocket_(new WebRTC::WebSocketClient(plugin)),
-        tundraRenderer_(new TundraRenderer(plugin))
+        disconnectedAt_(0),
+        disconnects_(0),
+        reconnectAttempts_(0),
+        resumes_(0),
+        roomsLost_(0),
+        peersKept_(0),
+        lastRecoveryMs_(0.0),
+        maxRecoveryMs_(0.0),
+        broadcast_(false),
+        broadcastDefault_(false),
+        trickleIce_(false),
+        trickleIceBatchMsec_(5)
     {
         WebRTC::RegisterMetaTypes();
         CloudRenderingProtocol::RegisterMetaTypes();
@@ -68,14 +89,42 @@ namespace WebRTC
         connect(websocket_.get(), SIGNAL(Connected()), SLOT(OnServiceConnected()));
         connect(websocket_.get(), SIGNAL(Disconnected()), SLOT(OnServiceDisconnected()));
         connect(websocket_.get(), SIGNAL(ConnectingFailed()), SLOT(OnServiceConnectingFailed()));
+        connect(websocket_.get(), SIGNAL(Reconnecting(int, int)), SLOT(OnServiceReconnecting(int, int)));
         connect(websocket_.get(), SIGNAL(Message(CloudRenderingProtocol::MessageSharedPtr)),
             SLOT(OnServiceMessage(CloudRenderingProtocol::MessageSharedPtr)));
+        
+        dispatcher_.On(this, &Renderer::HandleOffer);
+        dispatcher_.On(this, &Renderer::HandleAnswer);
+        dispatcher_.On(this, &Renderer::HandleIceCandidates);
+        dispatcher_.On(this, &Renderer::HandleRoomAssigned);
+        dispatcher_.On(this, &Renderer::HandleRoomUserJoined);
+        dispatcher_.On(this, &Renderer::HandleRoomUserLeft);
             
         // We are going to be injecting input events when the window is inactive, disable auto releasing keys.
         plugin_->GetFramework()->Input()->SetReleaseInputWhenApplicationInactive(false);
         
-        // Connect to service
-        serviceHost_ = WebRTC::WebSocketClient::CleanHost(plugin_->GetFramework()->CommandLineParameters("--cloudRenderer").first());
+        broadcastDefault_ = plugin_->GetFramework()->HasCommandLineParameter("--cloudRenderingBroadcast");
+        broadcast_ = broadcastDefault_;
+
+        // Offers go out before ICE gathering completes, clients that trickle their own offer are always answered this way.
+        trickleIce_ = plugin_->GetFramework()->HasCommandLineParameter("--cloudRenderingTrickleIce");
+        QStringList trickleParam = plugin_->GetFramework()->CommandLineParameters("--cloudRenderingTrickleIce");
+        if (!trickleParam.isEmpty())
+            trickleIceBatchMsec_ = qMax(0, trickleParam.first().toInt());
+        
+        // Peer input is delivered once per frame.
+        QStringList maxAgeParam = plugin_->GetFramework()->CommandLineParameters("--cloudRenderingInputMaxAge");
+        if (!maxAgeParam.isEmpty())
+            inputQueue_.SetMaxAge(maxAgeParam.first().toInt());
+        connect(plugin_->GetFramework()->Frame(), SIGNAL(Updated(float)), SLOT(OnFrameUpdated(float)));
+        
+        // Connect to service, a lost connection is retried and the room resumed.
+        QStringList reconnectParam = plugin_->GetFramework()->CommandLineParameters("--cloudRenderingReconnectMaxDelay");
+        websocket_->SetAutoReconnect(true, 500, !reconnectParam.isEmpty() ? reconnectParam.first().toInt() : 30000);
+
+        serviceHost_ = WebRTC::WebSocketClient::CleanHost(!serviceHost.isEmpty() ? serviceHost : plugin_->GetFramework()->CommandLineParameters("--cloudRenderer").value(0));
+        if (serviceHost_.isEmpty() && plugin_->LocalService().get())
+            serviceHost_ = plugin_->LocalService()->Host();
         if (!serviceHost_.isEmpty())
             websocket_->Connect(serviceHost_);
         else
@@ -87,6 +136,24 @@ namespace WebRTC
         tundraRenderer_.reset();
         websocket_.reset();
         connections_.clear();
+        broadcastSource_.reset();
+    }
+    
+    void Renderer::SetBroadcastMode(bool enabled)
+    {
+        if (broadcast_ == enabled)
+            return;
+        broadcast_ = enabled;
+        LogInfo(LC + QString("Broadcast mode %1").arg(broadcast_ ? "enabled" : "disabled"));
+        
+        // Connected peers keep the source they were created with.
+        if (!broadcast_)
+            broadcastSource_.reset();
+    }
+    
+    bool Renderer::IsBroadcastMode() const
+    {
+        return broadcast_;
     }
     
     CloudRenderingProtocol::CloudRenderingRoom Renderer::Room() const
@@ -108,10 +175,22 @@ namespace WebRTC
         if (!peer.get())
         {
             peer = WebRTCPeerConnectionPtr(new WebRTC::PeerConnection(plugin_->GetFramework(), peerId));
+            if (broadcast_)
+            {
+                if (!broadcastSource_.get())
+                    broadcastSource_ = WebRTCBroadcastSourcePtr(new WebRTC::BroadcastSource(plugin_->GetFramework()));
+                peer->SetBroadcastSource(broadcastSource_);
+            }
+            peer->SetTrickleIce(trickleIce_, trickleIceBatchMsec_);
             connect(peer.get(), SIGNAL(LocalConnectionDataResolved(WebRTC::SDP, WebRTC::ICECandidateList)), 
                 SLOT(OnLocalConnectionDataResolved(WebRTC::SDP, WebRTC::ICECandidateList)), Qt::QueuedConnection);
+            connect(peer.get(), SIGNAL(LocalSDPResolved(WebRTC::SDP)), SLOT(OnLocalSDPResolved(WebRTC::SDP)), Qt::QueuedConnection);
+            connect(peer.get(), SIGNAL(LocalIceCandidatesTrickled(WebRTC::ICECandidateList)), 
+                SLOT(OnLocalIceCandidatesTrickled(WebRTC::ICECandidateList)), Qt::QueuedConnection);
             connect(peer.get(), SIGNAL(DataChannelMessage(CloudRenderingProtocol::MessageSharedPtr)), 
                 SLOT(OnDataChannelMessage(CloudRenderingProtocol::MessageSharedPtr)), Qt::QueuedConnection);
+            connect(peer.get(), SIGNAL(DataChannelMessage(const CloudRenderingProtocol::Application::PeerCustomValue&)), 
+                SLOT(OnDataChannelMessage(const CloudRenderingProtocol::Application::PeerCustomValue&)), Qt::QueuedConnection);
             connect(peer.get(), SIGNAL(DataChannelMessage(const CloudRenderingProtocol::BinaryMessageData&)), 
                 SLOT(OnDataChannelMessage(const CloudRenderingProtocol::BinaryMessageData&)), Qt::QueuedConnection);
             connections_ << peer;
@@ -121,467 +200,275 @@ namespace WebRTC
     
     void Renderer::OnServiceConnected()
     {
-        CloudRenderingProtocol::State::RegistrationMessage *message = new CloudRenderingProtocol::State::RegistrationMessage(
-            CloudRenderingProtocol::State::RegistrationMessage::R_Renderer);
-        message->deleteLater();
-        websocket_->Send(message);
-        
-        room_.Reset();
+        // The room and its peers are kept until the service answers, the token asks for the same room back.
+        CloudRenderingProtocol::State::RegistrationMessage message(CloudRenderingProtocol::State::RegistrationMessage::R_Renderer);
+        message.resumeToken = resumeToken_;
+        websocket_->Send(&message);
     }
     
     void Renderer::OnServiceDisconnected()
     {
         LogInfo(LC + QString("WebSocket connection disconnected from %1").arg(serviceHost_));
-        room_.Reset();
+        disconnects_++;
+        if (disconnectedAt_ == 0)
+            disconnectedAt_ = GetCurrentClockTime();
     }
 
     void Renderer::OnServiceConnectingFailed()
     {
         LogError(LC + QString("WebSocket connection failed to Cloud Rendering Service at %1").arg(serviceHost_));
-        room_.Reset();
+        if (disconnectedAt_ == 0)
+            disconnectedAt_ = GetCurrentClockTime();
     }
 
-    void Renderer::OnServiceMessage(CloudRenderingProtocol::MessageSharedPtr message)
+    void Renderer::OnServiceReconnecting(int /*attempt*/, int /*delayMsec*/)
     {
-        switch (message->Channel())
-        {
-            // Signaling
-            case CloudRenderingProtocol::CT_Signaling:
-            {
-                switch (message->Type())
-                {
-                    // Offer
-                    case CloudRenderingProtocol::MT_Offer:
-                    {
-                        CloudRenderingProtocol::Signaling::OfferMessage *offer = dynamic_cast<CloudRenderingProtocol::Signaling::OfferMessage*>(message.get());
-                        if (offer)
-                        {
-                            bool sendWebCamera = plugin_->GetFramework()->HasCommandLineParameter("--cloudRenderingSendWebCamera");
-                            
-                            WebRTCPeerConnectionPtr peer = GetOrCreatePeer(offer->senderId);
-                            peer->HandleOfferOrAnswer(offer->sdp, offer->iceCandidates, PeerConnection::ConnectionSettings(false, sendWebCamera, !sendWebCamera, true));
-                        }
-                        else
-                            LogError(LC + "Failed to cast MT_Offer message to OfferMessage*");
-                        break;
-                    }
-                    // Answer
-                    case CloudRenderingProtocol::MT_Answer:
-                    {
-                        CloudRenderingProtocol::Signaling::AnswerMessage *answer = dynamic_cast<CloudRenderingProtocol::Signaling::AnswerMessage*>(message.get());
-                        if (answer)
-                        {
-                            bool sendWebCamera = plugin_->GetFramework()->HasCommandLineParameter("--cloudRenderingSendWebCamera");
-                            
-                            WebRTCPeerConnectionPtr peer = GetOrCreatePeer(answer->senderId);
-                            peer->HandleOfferOrAnswer(answer->sdp, answer->iceCandidates, PeerConnection::ConnectionSettings(false, sendWebCamera, !sendWebCamera, true));
-                        }
-                        else
-                            LogError(LC + "Failed to cast MT_Answer message to AnswerMessage*");
-                        break;
-                    }
-                    // Ice candidates
-                    case CloudRenderingProtocol::MT_IceCandidates:
-                    {
-                        CloudRenderingProtocol::Signaling::IceCandidatesMessage *candidates = dynamic_cast<CloudRenderingProtocol::Signaling::IceCandidatesMessage*>(message.get());
-                        if (candidates)
-                        {
-                            WebRTCPeerConnectionPtr peer = Peer(candidates->senderId);
-                            if (peer.get())
-                                peer->AddRemoteIceCandidates(candidates->iceCandidates);
-                            else
-                                LogError(LC + QString("Failed to find sender peer with id %1 for a IceCandidatesMessage.").arg(candidates->senderId));
-                        }
-                        else
-                            LogError(LC + "Failed to cast MT_IceCandidates message to IceCandidatesMessage*");
-                        break;
-                    }
-                }
-                break;
-            }
-            // Room
-            case CloudRenderingProtocol::CT_Room:
-            {
-                switch (message->Type())
-                {
-                    case CloudRenderingProtocol::MT_RoomAssigned:
-                    {
-                        room_.Reset();
-
-                        CloudRenderingProtocol::Room::RoomAssignedMessage *assigned = dynamic_cast<CloudRenderingProtocol::Room::RoomAssignedMessage*>(message.get());
-                        if (assigned)
-                        {
-                            if (assigned->error == CloudRenderingProtocol::Room::RoomAssignedMessage::RQE_NoError)
-                            {
-                                room_.id = assigned->roomId;
-                                LogDebug(LC + "Renderer was assigned to room " + room_.id);
-                            }
-                            else
-                                LogError(LC + QString("RoomAssignedMessage sent a error code %1 to renderer, this should never happen as we are not requesting for a room!")
-                                    .arg(static_cast<int>(assigned->error)));
-                        }
-                        else
-                            LogError(LC + "Failed to cast MT_RoomAssigned message to RoomAssignedMessage*");
-                        break;
-                    }
-                    case CloudRenderingProtocol::MT_RoomUserJoined:
-                    {
-                        CloudRenderingProtocol::Room::RoomUserJoinedMessage *joined = dynamic_cast<CloudRenderingProtocol::Room::RoomUserJoinedMessage*>(message.get());
-                        if (joined)
-                        {
-                            LogDebug(LC + "Peers joined to the renderers room");
-                            foreach(const QString &joinedPeerId, joined->peerIds)
-                            {
-                                LogDebug(LC + QString("  peerId = %1").arg(joinedPeerId));
-                                room_.AddPeer(joinedPeerId);
-                                
-                                /// @todo This will be changed to something else in the future, for now send offer to each joining client.
-                                bool sendWebCamera = plugin_->GetFramework()->HasCommandLineParameter("--cloudRenderingSendWebCamera");
-                                
-                                WebRTCPeerConnectionPtr peer = GetOrCreatePeer(joinedPeerId);
-                                peer->CreateOffer(PeerConnection::ConnectionSettings(false, sendWebCamera, !sendWebCamera, true));
-                            }
-                        }
-                        else
-                            LogError(LC + "Failed to cast MT_RoomUserJoined message to RoomUserJoinedMessage*");
-                        break;
-                    }
-                    case CloudRenderingProtocol::MT_RoomUserLeft:
-                    {
-                        CloudRenderingProtocol::Room::RoomUserLeftMessage *left = dynamic_cast<CloudRenderingProtocol::Room::RoomUserLeftMessage*>(message.get());
-                        if (left)
-                        {
-                            LogInfo(LC + "Peers left from the renderers room");
-                            foreach(const QString &leftPeerId, left->peerIds)
-                            {
-                                LogInfo(LC + QString("  peerId = %1").arg(leftPeerId));
-                                room_.RemovePeer(leftPeerId);
-                            }
-                        }
-                        else
-                            LogError(LC + "Failed to cast MT_RoomUserLeft message to RoomUserJoinedMessage*");
-                        break;
-                    }
-                }
-                break;
-            }
-        }
+        reconnectAttempts_++;
+        if (!room_.id.isEmpty())
+            LogInfo(LC + QString("Keeping room %1 with %2 peers while reconnecting").arg(room_.id).arg(connections_.size()));
     }
-    
-    void Renderer::OnDataChannelMessage(CloudRenderingProtocol::MessageSharedPtr message)
+
+    QVariantMap Renderer::ReconnectStatistics() const
     {
-        OnDataChannelMessage(dynamic_cast<WebRTC::PeerConnection*>(sender()), message);
+        QVariantMap stats;
+        stats["disconnects"] = static_cast<qulonglong>(disconnects_);
+        stats["reconnectAttempts"] = static_cast<qulonglong>(reconnectAttempts_);
+        stats["resumes"] = static_cast<qulonglong>(resumes_);
+        stats["roomsLost"] = static_cast<qulonglong>(roomsLost_);
+        stats["peersKept"] = peersKept_;
+        stats["lastRecoveryMs"] = lastRecoveryMs_;
+        stats["maxRecoveryMs"] = maxRecoveryMs_;
+        stats["connected"] = (disconnectedAt_ == 0 && !room_.id.isEmpty());
+
+        int peersConnected = 0;
+        foreach(const WebRTCPeerConnectionPtr &peer, connections_)
+            if (peer->IsConnected())
+                peersConnected++;
+        stats["peers"] = connections_.size();
+        stats["peersConnected"] = peersConnected;
+        return stats;
     }
-    
-    void Renderer::OnDataChannelMessage(WebRTC::PeerConnection *sender, CloudRenderingProtocol::MessageSharedPtr message)
+
+    int Renderer::RemoveDisconnectedPeers()
     {
-        if (!sender)
-            return;
-            
-        switch (message->Channel())
+        // Peers that were still negotiating lost their offer or answer with the connection, they are offered
+        // again when the service lists them in RoomUserJoined.
+        for (int i=connections_.size()-1; i>=0; --i)
         {
-            // Application
-            case CloudRenderingProtocol::CT_Application:
-            {
-                switch (message->Type())
-                {
-                    case CloudRenderingProtocol::MT_PeerCustomMessage:
-                    {
-                        CloudRenderingProtocol::Application::PeerCustomMessage *peerMessage = dynamic_cast<CloudRenderingProtocol::Application::PeerCustomMessage*>(message.get());
-                        if (peerMessage)
-                        {
-                            QString type = peerMessage->payload.value("type", "").toString();
-                            if (type == "InputKeyboard")
-                                PostKeyboardEvent(peerMessage->payload);
-                            else if (type == "InputMouse")
-                                PostMouseEvent(peerMessage->payload);
-                            else
-                                LogWarning("Unknown PeerCustomMessage with type " + type);
-                        }
-                        break;
-                    }
-                }
-            }
+            if (connections_[i]->IsConnected())
+                continue;
+            const QString peerId = connections_[i]->Id();
+            LogInfo(LC + QString("Peer %1 did not survive the reconnect, renegotiating").arg(peerId));
+            room_.RemovePeer(peerId);
+            inputQueue_.RemovePeer(peerId);
+            connections_.removeAt(i);
         }
+        return connections_.size();
     }
 
-    Qt::Key KeyFromHtmlKeyCode(int c)
+    void Renderer::OnServiceMessage(CloudRenderingProtocol::MessageSharedPtr message)
     {
-        switch(c)
-        {
-            case 8:     return Qt::Key_Backspace;
-            case 9:     return Qt::Key_Tab;
-            case 13:    return Qt::Key_Enter;
-            case 16:    return Qt::Key_Shift;
-            case 17:    return Qt::Key_Control;
-            case 18:    return Qt::Key_Alt;
-            case 19:    return Qt::Key_Pause;
-            case 20:    return Qt::Key_CapsLock;
-            case 27:    return Qt::Key_Escape;
-            
-            case 32:    return Qt::Key_Space;
-            case 33:    return Qt::Key_PageUp;
-            case 34:    return Qt::Key_PageDown;
-            
-            case 35:    return Qt::Key_End;
-            case 36:    return Qt::Key_Home;
-            case 37:    return Qt::Key_Left;
-            case 38:    return Qt::Key_Up;
-            case 39:    return Qt::Key_Right;
-            case 40:    return Qt::Key_Down;
-            
-            case 45:    return Qt::Key_Insert;
-            case 46:    return Qt::Key_Delete;
-            
-            case 48:    return Qt::Key_0;
-            case 49:    return Qt::Key_1;
-            case 50:    return Qt::Key_2;
-            case 51:    return Qt::Key_3;
-            case 52:    return Qt::Key_4;
-            case 53:    return Qt::Key_5;
-            case 54:    return Qt::Key_6;
-            case 55:    return Qt::Key_7;
-            case 56:    return Qt::Key_8;
-            case 57:    return Qt::Key_9;
-            
-            case 65:    return Qt::Key_A;
-            case 66:    return Qt::Key_B;
-            case 67:    return Qt::Key_C;
-            case 68:    return Qt::Key_D;
-            case 69:    return Qt::Key_E;
-            case 70:    return Qt::Key_F;
-            case 71:    return Qt::Key_G;
-            case 72:    return Qt::Key_H;
-            case 73:    return Qt::Key_I;
-            case 74:    return Qt::Key_J;
-            case 75:    return Qt::Key_K;
-            case 76:    return Qt::Key_L;
-            case 77:    return Qt::Key_M;
-            case 78:    return Qt::Key_N;
-            case 79:    return Qt::Key_O;
-            case 80:    return Qt::Key_P;
-            case 81:    return Qt::Key_Q;
-            case 82:    return Qt::Key_R;
-            case 83:    return Qt::Key_S;
-            case 84:    return Qt::Key_T;
-            case 85:    return Qt::Key_U;
-            case 86:    return Qt::Key_V;
-            case 87:    return Qt::Key_W;
-            case 88:    return Qt::Key_X;
-            case 89:    return Qt::Key_Y;
-            case 90:    return Qt::Key_Z;
-
-            //case 91:    return Qt::Key_; // left window key?
-            //case 92:    return Qt::Key_; // right window key?
-            case 93:    return Qt::Key_Select;
-
-            case 96:    return Qt::Key_0; // Numpad numbers
-            case 97:    return Qt::Key_1;
-            case 98:    return Qt::Key_2;
-            case 99:    return Qt::Key_3;
-            case 100:   return Qt::Key_4;
-            case 101:   return Qt::Key_5;
-            case 102:   return Qt::Key_6;
-            case 103:   return Qt::Key_7;
-            case 104:   return Qt::Key_8;
-            case 105:   return Qt::Key_9;
-            
-            case 106:   return Qt::Key_Asterisk; // multiply
-            case 107:   return Qt::Key_Plus;     // add
-            case 109:   return Qt::Key_Minus;    // subtract
-            case 110:   return Qt::Key_Comma;    // decimal point
-            case 111:   return Qt::Key_Slash;    // divide
-            
-            case 112:   return Qt::Key_F1;
-            case 113:   return Qt::Key_F2;
-            case 114:   return Qt::Key_F3;
-            case 115:   return Qt::Key_F4;
-            case 116:   return Qt::Key_F5;
-            case 117:   return Qt::Key_F6;
-            case 118:   return Qt::Key_F7;
-            case 119:   return Qt::Key_F8;
-            case 120:   return Qt::Key_F9;
-            case 121:   return Qt::Key_F10;
-            case 122:   return Qt::Key_F11;
-            case 123:   return Qt::Key_F12;
-            
-            case 144:   return Qt::Key_NumLock;
-            case 145:   return Qt::Key_ScrollLock;
-            
-            case 186:   return Qt::Key_Semicolon;
-            case 187:   return Qt::Key_Equal;
-            case 188:   return Qt::Key_Comma;
-            //case 189:   return Qt::Key_;     // dash
-            case 190:   return Qt::Key_Period;
-            case 191:   return Qt::Key_Slash;  // forward slash
-            //case 192:   return Qt::Key_;     // grave accent
-            
-            case 219:   return Qt::Key_BracketLeft;  // open bracket
-            case 220:   return Qt::Key_Backslash;
-            case 221:   return Qt::Key_BracketRight; // close bracket
-            case 222:   return Qt::Key_QuoteLeft;    // single quote
-        }
-        return Qt::Key_unknown;
+        if (!dispatcher_.Dispatch(message))
+            LogDebug(LC + "No handler for " + message->MessageTypeName() + " message");
     }
 
-    void Renderer::PostKeyboardEvent(const QVariantMap &data)
+    void Renderer::HandleOffer(CloudRenderingProtocol::Signaling::OfferMessage *offer)
     {
-        UiGraphicsView *view = (plugin_ ? plugin_->GetFramework()->Ui()->GraphicsView() : 0);
-        if (!view)
-            return;
-
-        // type: 'keyDown' or 'keyUp'
-        QEvent::Type type = (data.value("action", "").toString() == "keyDown" ? QEvent::KeyPress : QEvent::KeyRelease);
-
-        // modifiers
-        Qt::KeyboardModifiers modifiers = Qt::NoModifier;
-        if (data.value("altKey", false).toBool())
-            modifiers |= Qt::AltModifier;
-        if (data.value("shiftKey", false).toBool())
-            modifiers |= Qt::ShiftModifier;
-        if (data.value("ctrlKey", false).toBool())
-            modifiers |= Qt::ControlModifier;
-        if (data.value("metaKey", false).toBool())
-            modifiers |= Qt::MetaModifier;
-            
-        inputState_.keyboardModifiers = modifiers;
-            
-        Qt::Key key = KeyFromHtmlKeyCode(data.value("key").toInt());
-        if (key == Qt::Key_unknown)
-        {
-            if (IsLogChannelEnabled(LogChannelDebug))
-                qWarning() << "Failed to map HTML keyCode" << data.value("key").toInt() << "to a Qt key";
-            return;
-        }
+        bool sendWebCamera = plugin_->GetFramework()->HasCommandLineParameter("--cloudRenderingSendWebCamera");
         
-        QString text = (key != Qt::Key_unknown ? QKeySequence(key).toString(QKeySequence::NativeText).toLower() : "");
-        if (text == "space")
-            text = " ";
-        else if (text == "tab")
-            text = "    ";
-        else if (key == Qt::Key_Shift || key == Qt::Key_Control || key == Qt::Key_Alt || key == Qt::Key_AltGr)
-            text = "";
-        if (data.value("shiftKey", false).toBool())
-            text = text.toUpper();
+        // A new peer answers the way the client offered: an offer without candidates comes from a client
+        // that trickles them, one with its candidates expects them all in the answer too.
+        const bool newPeer = !Peer(offer->senderId).get();
+        WebRTCPeerConnectionPtr peer = GetOrCreatePeer(offer->senderId);
+        if (newPeer)
+            peer->SetTrickleIce(offer->iceCandidates.isEmpty(), trickleIceBatchMsec_);
+        peer->HandleOfferOrAnswer(offer->sdp, offer->iceCandidates, PeerConnection::ConnectionSettings(false, sendWebCamera, !sendWebCamera, true));
+    }
+
+    void Renderer::HandleAnswer(CloudRenderingProtocol::Signaling::AnswerMessage *answer)
+    {
+        bool sendWebCamera = plugin_->GetFramework()->HasCommandLineParameter("--cloudRenderingSendWebCamera");
         
-        QKeyEvent e(type, key, modifiers, text);
-        if (IsLogChannelEnabled(LogChannelDebug))
-            qDebug() << &e;
-        QApplication::sendEvent(view, &e);
+        WebRTCPeerConnectionPtr peer = GetOrCreatePeer(answer->senderId);
+        peer->HandleOfferOrAnswer(answer->sdp, answer->iceCandidates, PeerConnection::ConnectionSettings(false, sendWebCamera, !sendWebCamera, true));
     }
 
-    void Renderer::PostMouseEvent(const QVariantMap &data)
+    void Renderer::HandleIceCandidates(CloudRenderingProtocol::Signaling::IceCandidatesMessage *candidates)
     {
-        UiGraphicsView *view = (plugin_ ? plugin_->GetFramework()->Ui()->GraphicsView() : 0);
-        UiMainWindow *window = (plugin_ ? plugin_->GetFramework()->Ui()->MainWindow() : 0);
-        if (!view || !window)
-            return;
+        WebRTCPeerConnectionPtr peer = Peer(candidates->senderId);
+        if (peer.get())
+            peer->AddRemoteIceCandidates(candidates->iceCandidates);
+        else
+            LogError(LC + QString("Failed to find sender peer with id %1 for a IceCandidatesMessage.").arg(candidates->senderId));
+    }
+
+    void Renderer::HandleRoomAssigned(CloudRenderingProtocol::Room::RoomAssignedMessage *assigned)
+    {
+        if (disconnectedAt_ != 0)
+        {
+            lastRecoveryMs_ = MsSince(disconnectedAt_);
+            maxRecoveryMs_ = qMax(maxRecoveryMs_, lastRecoveryMs_);
+            disconnectedAt_ = 0;
+        }
+        resumeToken_ = assigned->resumeToken;
 
-        if (!data.contains("x") || !data.contains("y"))
+        if (assigned->error == CloudRenderingProtocol::Room::RoomAssignedMessage::RQE_NoError &&
+            assigned->resumed && !room_.id.isEmpty() && assigned->roomId == room_.id)
+        {
+            // Media and data channels are peer to peer and did not go through the service.
+            peersKept_ = RemoveDisconnectedPeers();
+            resumes_++;
+            LogInfo(LC + QString("Resumed room %1 after %2 msec, kept %3 peers").arg(room_.id).arg(lastRecoveryMs_, 0, 'f', 0).arg(peersKept_));
             return;
+        }
 
-        bool ok = false;
-        float x = data.value("x").toFloat(&ok);
-        if (!ok) return; ok = false;       
-        if (x < 0.0f)
+        // The peers of a room that could not be resumed are gone, they get offers again if they join the new room.
+        if (!room_.id.isEmpty())
         {
-            LogWarning(LC + "Received mouse event with x < 0.0 - Clamping to 0.0.");
-            x = 0.0f;
+            LogInfo(LC + QString("Room %1 was not resumed, dropping %2 peers").arg(room_.id).arg(connections_.size()));
+            foreach(const QString &peerId, room_.peers)
+                inputQueue_.RemovePeer(peerId);
+            connections_.clear();
+            roomsLost_++;
         }
-        else if (x > 1.0f)
+        room_.Reset();
+
+        if (assigned->error == CloudRenderingProtocol::Room::RoomAssignedMessage::RQE_NoError)
         {
-            LogWarning(LC + "Received mouse event with x > 1.0 - Clamping to 1.0.");
-            x = 1.0f;
+            room_.id = assigned->roomId;
+            LogDebug(LC + "Renderer was assigned to room " + room_.id);
+            
+            // A new room starts with a fresh shared source.
+            broadcastSource_.reset();
+            SetBroadcastMode(assigned->data.value("broadcast", broadcastDefault_).toBool());
         }
-        float y = data.value("y").toFloat(&ok);
-        if (!ok) return;
-        if (y < 0.0f)
+        else
+            LogError(LC + QString("RoomAssignedMessage sent a error code %1 to renderer, this should never happen as we are not requesting for a room!")
+                .arg(static_cast<int>(assigned->error)));
+    }
+
+    void Renderer::HandleRoomUserJoined(CloudRenderingProtocol::Room::RoomUserJoinedMessage *joined)
+    {
+        LogDebug(LC + "Peers joined to the renderers room");
+        foreach(const QString &joinedPeerId, joined->peerIds)
         {
-            LogWarning(LC + "Received mouse event with y < 0.0 - Clamping to 0.0");
-            x = 0.0f;
+            LogDebug(LC + QString("  peerId = %1").arg(joinedPeerId));
+            room_.AddPeer(joinedPeerId);
+
+            // Listed again after a resume, the connection is still up.
+            WebRTCPeerConnectionPtr existing = Peer(joinedPeerId);
+            if (existing.get() && existing->IsConnected())
+                continue;
+            
+            /// @todo This will be changed to something else in the future, for now send offer to each joining client.
+            bool sendWebCamera = plugin_->GetFramework()->HasCommandLineParameter("--cloudRenderingSendWebCamera");
+            
+            WebRTCPeerConnectionPtr peer = GetOrCreatePeer(joinedPeerId);
+            peer->CreateOffer(PeerConnection::ConnectionSettings(false, sendWebCamera, !sendWebCamera, true));
         }
-        else if (y > 1.0f)
+    }
+
+    void Renderer::HandleRoomUserLeft(CloudRenderingProtocol::Room::RoomUserLeftMessage *left)
+    {
+        LogInfo(LC + "Peers left from the renderers room");
+        foreach(const QString &leftPeerId, left->peerIds)
         {
-            LogWarning(LC + "Received mouse event with y > 1.0 - Clamping to 1.0");
-            y = 1.0f;
+            LogInfo(LC + QString("  peerId = %1").arg(leftPeerId));
+            room_.RemovePeer(leftPeerId);
+            inputQueue_.RemovePeer(leftPeerId);
         }
+    }
+    
+    void Renderer::OnDataChannelMessage(CloudRenderingProtocol::MessageSharedPtr message)
+    {
+        OnDataChannelMessage(dynamic_cast<WebRTC::PeerConnection*>(sender()), message);
+    }
+    
+    void Renderer::OnDataChannelMessage(WebRTC::PeerConnection *sender, CloudRenderingProtocol::MessageSharedPtr message)
+    {
+        if (!sender)
+            return;
+            
+        // Messages from CreateMessageFromJSON are instances of the class registered for their type.
+        if (message->Type() == CloudRenderingProtocol::MT_PeerCustomMessage)
+            OnDataChannelMessage(sender, static_cast<CloudRenderingProtocol::Application::PeerCustomMessage*>(message.get())->Value());
+        else
+            LogDebug(LC + "Unhandled data channel message " + message->MessageTypeName());
+    }
 
-        // type: 'move', 'press', 'doublepress' or 'release'
-        QString typeStr = data.value("action", "").toString();
-        if (typeStr.isEmpty())
+    void Renderer::OnDataChannelMessage(const CloudRenderingProtocol::Application::PeerCustomValue &message)
+    {
+        OnDataChannelMessage(dynamic_cast<WebRTC::PeerConnection*>(sender()), message);
+    }
+
+    void Renderer::OnDataChannelMessage(WebRTC::PeerConnection *sender, const CloudRenderingProtocol::Application::PeerCustomValue &message)
+    {
+        if (!sender)
             return;
-        QEvent::Type type = (typeStr == "move" ? QEvent::MouseMove : (typeStr == "press" ? QEvent::MouseButtonPress : (typeStr == "doublepress" ? QEvent::MouseButtonDblClick : QEvent::MouseButtonRelease)));       
 
-        // buttons
-        Qt::MouseButton button = Qt::NoButton;
-        inputState_.mouseButtons = Qt::NoButton;
+        if (message.input.IsValid())
+            inputQueue_.Push(sender->Id(), message.input);
+        else
+            LogWarning("Unknown PeerCustomMessage with type " + message.payload.value("type", "").toString());
+    }
 
-        // Check another extra prop if button could not be resolved.
-        if (type == QEvent::MouseButtonRelease || type == QEvent::MouseButtonDblClick || type == QEvent::MouseButtonPress)
-        {
-            int releaseExtraCheck = data.value("which", -1).toInt();
-            if (releaseExtraCheck == -1)
-                releaseExtraCheck = data.value("button", -1).toInt();
+    QVariantMap Renderer::InputStatistics() const
+    {
+        QVariantMap stats = inputQueue_.Stats().ToVariant();
+        stats["maxAgeMs"] = inputQueue_.MaxAge();
+        return stats;
+    }
 
-            if (releaseExtraCheck == 1)
-                button = Qt::LeftButton;
-            else if (releaseExtraCheck == 3)
-                button = Qt::RightButton;
-            else if (releaseExtraCheck == 2)
-                button = Qt::MiddleButton;
-            if (button != Qt::NoButton)
-                inputState_.mouseButtons = button;
-        }
+    void Renderer::OnFrameUpdated(float /*frametime*/)
+    {
+        if (inputQueue_.IsEmpty())
+            return;
 
-        // Additionally check all the buttons pressed down at the moment.
-        if (button != Qt::LeftButton && data.value("leftButton", false).toBool())
-        {
-            if (button == Qt::NoButton)
-                button = Qt::LeftButton;
-            inputState_.mouseButtons |= Qt::LeftButton;
-        }
-        if (button != Qt::RightButton && data.value("rightButton", false).toBool())
-        {
-            if (button == Qt::NoButton)
-                button = Qt::RightButton;
-            inputState_.mouseButtons |= Qt::RightButton;
-        }
-        if (button != Qt::MiddleButton && data.value("middleButton", false).toBool())
+        PROFILE(CloudRendering_Renderer_DeliverInput)
+
+        InputQueue::EventList events;
+        inputQueue_.Take(events);
+        foreach(const InputQueue::Event &event, events)
         {
-            if (button == Qt::NoButton)
-                button = Qt::MiddleButton;
-            inputState_.mouseButtons |= Qt::MiddleButton;
+            if (event.binary)
+                PostInputEvent(event.input);
+            else if (event.payload.type == CloudRenderingProtocol::Application::InputPayload::IPT_Keyboard)
+                PostKeyboardEvent(event.payload);
+            else
+                PostMouseEvent(event.payload);
         }
+    }
 
-        // position from [0.0, 1.0] to application window coordinates
-        QRect renderingSurfaceRect = view->geometry();
-        QPoint mousePos(renderingSurfaceRect.width() * x, renderingSurfaceRect.height() * y);
-        QPoint globalPos(window->geometry().topLeft() + renderingSurfaceRect.topLeft() + mousePos);
+    void Renderer::PostKeyboardEvent(const CloudRenderingProtocol::Application::InputPayload &input)
+    {
+        UiGraphicsView *view = (plugin_ ? plugin_->GetFramework()->Ui()->GraphicsView() : 0);
+        if (!view)
+            return;
 
-        // release or press event: fake a mouse move to this coordinate first
-        if (type == QEvent::MouseButtonPress)
-        {
-            Qt::MouseButton moveButton = (type == QEvent::MouseButtonRelease ? button : Qt::NoButton);
-            QMouseEvent *e = QMouseEvent::createExtendedMouseEvent(QEvent::MouseMove, mousePos, globalPos, 
-                 moveButton, moveButton, inputState_.keyboardModifiers); 
-            QApplication::sendEvent(view->viewport(), e);
-            SAFE_DELETE(e);
-        }
+        input_.PostKeyboardEvent(view, input);
+    }
 
-        QMouseEvent *e = QMouseEvent::createExtendedMouseEvent(type, mousePos, globalPos, button, inputState_.mouseButtons, inputState_.keyboardModifiers); 
-        QApplication::sendEvent(view->viewport(), e);
-        SAFE_DELETE(e);
-        
-        // double press: fake a release event to make it register correctly
-        if (type == QEvent::MouseButtonDblClick)
-        {
-            QMouseEvent *e = QMouseEvent::createExtendedMouseEvent(QEvent::MouseButtonRelease, mousePos, globalPos, 
-                button, inputState_.mouseButtons, inputState_.keyboardModifiers); 
-            QApplication::sendEvent(view->viewport(), e);
-            SAFE_DELETE(e);
-        }
+    void Renderer::PostMouseEvent(const CloudRenderingProtocol::Application::InputPayload &input)
+    {
+        UiGraphicsView *view = (plugin_ ? plugin_->GetFramework()->Ui()->GraphicsView() : 0);
+        UiMainWindow *window = (plugin_ ? plugin_->GetFramework()->Ui()->MainWindow() : 0);
+        if (!view || !window)
+            return;
+
+        bool pressed = false;
+        if (input_.PostMouseEvent(view, window, input, &pressed) && pressed && plugin_->GetFramework()->Input()->ItemUnderMouse() == 0)
+            ClearInputFocus();
+    }
+    
+    void Renderer::PostInputEvent(const CloudRenderingProtocol::BinaryInput::InputEvent &event)
+    {
+        UiGraphicsView *view = (plugin_ ? plugin_->GetFramework()->Ui()->GraphicsView() : 0);
+        UiMainWindow *window = (plugin_ ? plugin_->GetFramework()->Ui()->MainWindow() : 0);
+        if (!view || !window)
+            return;
 
-        if ((type == QEvent::MouseButtonPress || type == QEvent::MouseButtonDblClick) && plugin_->GetFramework()->Input()->ItemUnderMouse() == 0)
+        bool pressed = false;
+        if (input_.PostEvent(view, window, event, &pressed) && pressed && plugin_->GetFramework()->Input()->ItemUnderMouse() == 0)
             ClearInputFocus();
     }
     
@@ -611,8 +498,13 @@ namespace WebRTC
         if (!sender)
             return;
             
-        LogWarning(LC + "Handling binary data channel messages not implemented!");
-        UNREFERENCED_PARAM(data);
+        CloudRenderingProtocol::BinaryInput::InputEvent event;
+        if (!CloudRenderingProtocol::BinaryInput::Decode(data.constData(), data.size(), event))
+        {
+            LogWarning(LC + QString("Unknown binary data channel message of %1 bytes").arg(data.size()));
+            return;
+        }
+        inputQueue_.Push(sender->Id(), event);
     }
 
     void Renderer::OnLocalConnectionDataResolved(WebRTC::SDP sdp, WebRTC::ICECandidateList candidates)
@@ -623,26 +515,54 @@ namespace WebRTC
             LogError(LC + "Failed to cast signal sender as WebRTC::PeerConnection*");
             return;
         }
+        SendLocalDescription(peer, sdp, candidates);
+    }
+
+    void Renderer::OnLocalSDPResolved(WebRTC::SDP sdp)
+    {
+        WebRTC::PeerConnection *peer = dynamic_cast<WebRTC::PeerConnection*>(sender());
+        if (!peer)
+        {
+            LogError(LC + "Failed to cast signal sender as WebRTC::PeerConnection*");
+            return;
+        }
+        // Bundled peers send the SDP with the candidates from OnLocalConnectionDataResolved().
+        if (peer->IsTrickleIce())
+            SendLocalDescription(peer, sdp, WebRTC::ICECandidateList());
+    }
+
+    void Renderer::OnLocalIceCandidatesTrickled(WebRTC::ICECandidateList candidates)
+    {
+        WebRTC::PeerConnection *peer = dynamic_cast<WebRTC::PeerConnection*>(sender());
+        if (!peer)
+        {
+            LogError(LC + "Failed to cast signal sender as WebRTC::PeerConnection*");
+            return;
+        }
+        CloudRenderingProtocol::Signaling::IceCandidatesValue message(peer->Id(), candidates);
+        if (!websocket_->Send(message))
+            LogWarning(LC + "Failed to send " + CloudRenderingProtocol::IceCandidates);
+    }
 
+    void Renderer::SendLocalDescription(WebRTC::PeerConnection *peer, const WebRTC::SDP &sdp, const WebRTC::ICECandidateList &candidates)
+    {
         if (sdp.type.compare("answer", Qt::CaseInsensitive) == 0)
         {
-            CloudRenderingProtocol::Signaling::AnswerMessage *message = new CloudRenderingProtocol::Signaling::AnswerMessage(peer->Id());
-            message->deleteLater();
-            message->sdp = sdp;
-            message->iceCandidates = candidates;
+            CloudRenderingProtocol::Signaling::AnswerMessage message(peer->Id());
+            message.sdp = sdp;
+            message.iceCandidates = candidates;
 
-            if (!websocket_->Send(message))
-                LogWarning(LC + "Failed to send " + message->MessageTypeName());
+            if (!websocket_->Send(&message))
+                LogWarning(LC + "Failed to send " + message.MessageTypeName());
         }
         else if (sdp.type.compare("offer", Qt::CaseInsensitive) == 0)
         {
-            CloudRenderingProtocol::Signaling::OfferMessage *message = new CloudRenderingProtocol::Signaling::OfferMessage(peer->Id());
-            message->deleteLater();
-            message->sdp = sdp;
-            message->iceCandidates = candidates;
+            CloudRenderingProtocol::Signaling::OfferMessage message(peer->Id());
+            message.sdp = sdp;
+            message.iceCandidates = candidates;
 
-            if (!websocket_->Send(message))
-                LogWarning(LC + "Failed to send " + message->MessageTypeName());
+            if (!websocket_->Send(&message))
+                LogWarning(LC + "Failed to send " + message.MessageTypeName());
         }
         else
             LogError(LC + QString("Resolved SDP type is not 'offer' or 'answer' but '%1', doing nothing.").arg(sdp.type));
@@ -655,22 +575,69 @@ namespace WebRTC
 
     // TundraRendererConsumer
 
+    /// Returns the worker thread count from --cloudRenderingWorkerThreads, or one less than the core count.
+    static int WorkerThreadCount(Framework *framework)
+    {
+        QStringList param = framework->CommandLineParameters("--cloudRenderingWorkerThreads");
+        bool ok = false;
+        int numThreads = (!param.isEmpty() ? param.first().toInt(&ok) : -1);
+        if (!ok || numThreads < 0)
+            numThreads = qMax(0, QThread::idealThreadCount() - 1);
+        return numThreads;
+    }
+
     TundraRenderer::TundraRenderer(CloudRenderingPlugin *plugin, uint updateFps) :
         plugin_(plugin),
         framework_(plugin->GetFramework()),
 #ifdef DIRECTX_ENABLED
         d3dTexture_(0),
 #endif
-        interval_(1.0f / static_cast<float>(updateFps)),
-        t_(1.0f),
-        fatalTextureError_(false)
+        offscreen_(false),
+        offscreenSize_(1280, 720),
+        fatalTextureError_(false),
+        pacer_(static_cast<double>(updateFps > 0 ? updateFps : 1)),
+        conversion_(ColorConversion::CCI_Auto),
+        idleFps_(1.0),
+        workers_(WorkerThreadCount(plugin->GetFramework()))
     {
         connect(framework_->Frame(), SIGNAL(PostFrameUpdate(float)), SLOT(OnPostFrameUpdate(float)));
+        
+        if (framework_->HasCommandLineParameter("--cloudRenderingOffscreen"))
+            SetOffscreen(true);
+        
+        QStringList ringParam = framework_->CommandLineParameters("--cloudRenderingReadbackRing");
+        if (!ringParam.isEmpty())
+            SetReadbackRing(ringParam.first().toInt());
+            
+        QStringList idleParam = framework_->CommandLineParameters("--cloudRenderingIdleFps");
+        if (!idleParam.isEmpty())
+            SetIdleFps(idleParam.first().toDouble());
+
+        // Override the runtime CPU detection, mostly useful for comparing the kernels.
+        QStringList conversionParam = framework_->CommandLineParameters("--cloudRenderingColorConversion");
+        if (!conversionParam.isEmpty())
+        {
+            conversion_ = ColorConversion::ImplementationFromName(conversionParam.first());
+            if (!ColorConversion::IsSupported(conversion_))
+            {
+                LogWarning(QString("[TundraRenderer]: Color conversion '%1' is not supported by this CPU, using auto detection.").arg(conversionParam.first()));
+                conversion_ = ColorConversion::CCI_Auto;
+            }
+        }
+        LogDebug("[TundraRenderer]: Using " + ColorConversion::ImplementationName(conversion_ == ColorConversion::CCI_Auto ? 
+            ColorConversion::DetectImplementation() : conversion_) + " color conversion");
     }
     
     TundraRenderer::~TundraRenderer()
     {
         consumers_.clear();
+        
+        // Pixel buffers can only be freed while the GL context is alive.
+        if (readback_.get() && OgreRenderWindow())
+            readback_->Release();
+        readback_.reset();
+        
+        ReleaseOffscreen();
 
 #ifdef DIRECTX_ENABLED
         if (d3dTexture_)
@@ -734,27 +701,225 @@ namespace WebRTC
     {
         if (updateFps == 0)
             updateFps = 1;
-        interval_ = 1.0f / static_cast<float>(updateFps);
+        SetFrameRate(static_cast<double>(updateFps));
+    }
+    
+    void TundraRenderer::SetFrameRate(double fps)
+    {
+        if (fps <= 0.0)
+            return;
+        pacer_.SetFps(fps);
     }
 
     void TundraRenderer::SetSize(int width, int height)
     {
+        if (offscreen_)
+        {
+            if (width > 0 && height > 0)
+                offscreenSize_ = QSize(width, height);
+            return;
+        }
         pendingWindowResize_ = QSize(width, height + 21); // + 21 is the magic hack for QMenuBar height
     }
 
-    void TundraRenderer::Register(TundraRendererConsumerWeakPtr consumer)
+    void TundraRenderer::SetOffscreen(bool enabled)
+    {
+        if (offscreen_ == enabled)
+            return;
+        offscreen_ = enabled;
+        if (offscreen_)
+            pendingWindowResize_ = QSize();
+        else
+            ReleaseOffscreen();
+        LogInfo(QString("[TundraRenderer]: Offscreen capture %1").arg(offscreen_ ? "enabled" : "disabled"));
+    }
+
+    bool TundraRenderer::IsOffscreen() const
+    {
+        return offscreen_;
+    }
+
+    void TundraRenderer::ReleaseOffscreen()
+    {
+        if (offscreenTextureName_.isEmpty())
+            return;
+        Ogre::TextureManager *textureManager = Ogre::TextureManager::getSingletonPtr();
+        if (textureManager)
+        {
+            Ogre::TexturePtr texture = textureManager->getByName(offscreenTextureName_.toStdString());
+            if (!texture.isNull())
+            {
+                texture->getBuffer()->getRenderTarget()->removeAllViewports();
+                textureManager->remove(texture->getHandle());
+            }
+        }
+        offscreenTextureName_.clear();
+    }
+
+    WebRTCFrameBufferPtr TundraRenderer::RenderOffscreen()
+    {
+        EC_Camera *cameraComponent = framework_->Renderer()->MainCameraComponent();
+        Ogre::Camera *camera = (cameraComponent ? cameraComponent->GetCamera() : 0);
+        if (!camera || !offscreenSize_.isValid())
+            return WebRTCFrameBufferPtr();
+
+        const int width = offscreenSize_.width();
+        const int height = offscreenSize_.height();
+
+        // (Re)create the render texture for the requested size.
+        Ogre::TexturePtr texture;
+        if (!offscreenTextureName_.isEmpty())
+            texture = Ogre::TextureManager::getSingleton().getByName(offscreenTextureName_.toStdString());
+        if (!texture.isNull() && (static_cast<int>(texture->getWidth()) != width || static_cast<int>(texture->getHeight()) != height))
+        {
+            ReleaseOffscreen();
+            texture.setNull();
+        }
+        if (texture.isNull())
+        {
+            offscreenTextureName_ = QString("CloudRendering Offscreen RTT %1x%2").arg(width).arg(height);
+            try
+            {
+                texture = Ogre::TextureManager::getSingleton().createManual(offscreenTextureName_.toStdString(),
+                    Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME, Ogre::TEX_TYPE_2D,
+                    width, height, 0, Ogre::PF_A8R8G8B8, Ogre::TU_RENDERTARGET);
+            }
+            catch(Ogre::Exception &ex)
+            {
+                LogError("[TundraRenderer]: Failed to create offscreen render texture: " + QString::fromStdString(ex.getDescription()));
+                offscreenTextureName_.clear();
+                return WebRTCFrameBufferPtr();
+            }
+            texture->getBuffer()->getRenderTarget()->setAutoUpdated(false);
+            LogDebug(QString("[TundraRenderer]: Created %1x%2 offscreen render texture").arg(width).arg(height));
+        }
+        Ogre::RenderTarget *target = texture->getBuffer()->getRenderTarget();
+
+        // The viewport only lives for the duration of the update. This way it never
+        // holds on to a main camera that the scene might destroy in between captures.
+        const Ogre::Real aspectRatio = camera->getAspectRatio();
+        Ogre::Viewport *viewport = target->addViewport(camera);
+        viewport->setClearEveryFrame(true);
+        viewport->setOverlaysEnabled(false);
+        camera->setAspectRatio(static_cast<Ogre::Real>(width) / static_cast<Ogre::Real>(height));
+
+        WebRTCFrameBufferPtr frame;
+        try
+        {
+            target->update(false);
+            frame = framePool_.AcquireARGB(width, height);
+            if (frame.get())
+            {
+                Ogre::PixelBox dest(width, height, 1, Ogre::PF_A8R8G8B8, static_cast<void*>(frame->Data()));
+                target->copyContentsToMemory(dest, Ogre::RenderTarget::FB_AUTO);
+            }
+        }
+        catch(Ogre::Exception &ex)
+        {
+            LogError("[TundraRenderer]: Offscreen capture failed: " + QString::fromStdString(ex.getDescription()));
+            frame.reset();
+        }
+
+        camera->setAspectRatio(aspectRatio);
+        target->removeAllViewports();
+        return frame;
+    }
+
+    QVariantMap TundraRenderer::Statistics() const
+    {
+        QVariantMap stats;
+        stats["framePool"] = framePool_.Stats().ToVariant();
+        stats["workers"] = workers_.Statistics();
+        stats["pacer"] = pacer_.Statistics();
+        stats["convertedPool"] = convertedFrames_.Stats().ToVariant();
+        
+        QVariantMap idle = changeDetector_.Statistics();
+        idle["idleFps"] = idleFps_;
+        stats["idle"] = idle;
+        
+        QVariantList consumers;
+        foreach(const Consumer &entry, consumers_)
+        {
+            QVariantMap consumer;
+            consumer["fps"] = entry.settings.fps;
+            consumer["width"] = entry.settings.width;
+            consumer["height"] = entry.settings.height;
+            consumer["fourcc"] = entry.settings.fourcc;
+            consumer["frames"] = static_cast<qulonglong>(entry.frames);
+            if (entry.pacer.get())
+                consumer["pacer"] = entry.pacer->Statistics();
+            consumers << consumer;
+        }
+        stats["consumers"] = consumers;
+        if (readback_.get())
+            stats["readback"] = readback_->Statistics();
+        return stats;
+    }
+
+    void TundraRenderer::SetReadbackRing(int ringSize)
+    {
+        if (readback_.get() && readback_->RingSize() == ringSize)
+            return;
+        if (readback_.get() && OgreRenderWindow())
+            readback_->Release();
+        readback_.reset();
+        
+        if (ringSize > 0)
+            readback_ = WebRTCGLReadbackPtr(new GLReadback(ringSize));
+    }
+
+    void TundraRenderer::SetWorkerThreads(int numThreads)
+    {
+        // Frames are processed synchronously on the main thread, no jobs are in flight here.
+        workers_.SetNumThreads(numThreads);
+    }
+
+    FrameBufferPool *TundraRenderer::FramePool()
+    {
+        return &framePool_;
+    }
+
+    WorkerPool *TundraRenderer::Workers()
+    {
+        return &workers_;
+    }
+
+    void TundraRenderer::Register(TundraRendererConsumerWeakPtr consumer, const ConsumerSettings &settings)
     {
         if (consumer.expired())
             return;
 
-        // Already registered?
+        // Already registered? Update the settings.
+        Consumer *entry = 0;
         for (int i=0; i<consumers_.size(); ++i)
         {
-            TundraRendererConsumerWeakPtr &iter = consumers_[i];
-            if (iter.lock().get() == consumer.lock().get())
-                return;
+            if (consumers_[i].consumer.lock().get() == consumer.lock().get())
+            {
+                entry = &consumers_[i];
+                break;
+            }
+        }
+        if (!entry)
+        {
+            Consumer added;
+            added.consumer = consumer;
+            added.frames = 0;
+            added.generation = 0;
+            added.lastDelivery = 0;
+            consumers_ << added;
+            entry = &consumers_.last();
+        }
+        
+        entry->settings = settings;
+        if (settings.fps > 0.0)
+        {
+            if (!entry->pacer.get())
+                entry->pacer = shared_ptr<FramePacer>(new FramePacer(settings.fps));
+            else
+                entry->pacer->SetFps(settings.fps);
         }
-        consumers_ << consumer;
+        else
+            entry->pacer.reset();
     }
     
     void TundraRenderer::Unregister(TundraRendererConsumerWeakPtr consumer)
@@ -762,7 +927,7 @@ namespace WebRTC
         for (int i=0; i<consumers_.size(); ++i)
         {
             // Throw out expired consumers and the consumer that unregistered
-            TundraRendererConsumerWeakPtr &iter = consumers_[i];
+            TundraRendererConsumerWeakPtr &iter = consumers_[i].consumer;
             if (iter.expired() || iter.lock().get() == consumer.lock().get())
             {
                 consumers_.removeAt(i);
@@ -770,17 +935,58 @@ namespace WebRTC
             }
         }
     }
+    
+    void TundraRenderer::SetIdleFps(double fps)
+    {
+        idleFps_ = qMax(0.0, fps);
+        changeDetector_.Reset();
+        LogDebug(QString("[TundraRenderer]: Static scene detection %1").arg(idleFps_ > 0.0 ? 
+            QString("enabled with %1 fps heartbeat").arg(idleFps_) : QString("disabled")));
+    }
 
-    void TundraRenderer::OnPostFrameUpdate(float frametime)
+    ColorConversion::Implementation TundraRenderer::Conversion() const
+    {
+        return conversion_;
+    }
+
+    void TundraRenderer::OnPostFrameUpdate(float /*frametime*/)
     {       
-        // Choking
-        t_ += frametime;
-        if (t_ < interval_)
+        // Throw out expired consumers.
+        for (int i=0; i<consumers_.size(); ++i)
+        {
+            if (consumers_[i].consumer.expired())
+            {
+                consumers_.removeAt(i);
+                i--;
+            }
+        }
+        
+        // Choking, each consumer is paced on its own. The pacers keep the rates
+        // from drifting with the main loop frame time.
+        const tick_t now = GetCurrentClockTime();
+        bool defaultDue = false, defaultChecked = false;
+        QList<int> due;
+        for (int i=0; i<consumers_.size(); ++i)
+        {
+            Consumer &entry = consumers_[i];
+            if (!entry.pacer.get())
+            {
+                if (!defaultChecked)
+                {
+                    defaultDue = pacer_.IsDue(now);
+                    defaultChecked = true;
+                }
+                if (defaultDue)
+                    due << i;
+            }
+            else if (entry.pacer->IsDue(now))
+                due << i;
+        }
+        if (due.isEmpty() && !pendingWindowResize_.isValid())
             return;
-        t_ = 0.0f;
 
         // Apply pending window resize
-        if (pendingWindowResize_.isValid() && framework_->Ui()->MainWindow())
+        if (!offscreen_ && pendingWindowResize_.isValid() && framework_->Ui()->MainWindow())
         {
             LogDebug(QString("[TundraRenderer]: Executing appication window resize to requested video size %1 x %2").arg(pendingWindowResize_.width()).arg(pendingWindowResize_.height()));
             if (framework_->Ui()->MainWindow()->isMinimized() || framework_->Ui()->MainWindow()->isMaximized())
@@ -793,14 +999,24 @@ namespace WebRTC
 
         PROFILE(CloudRendering_TundraRenderer_PostFrameUpdate)
 
-        // No consumers, don't do any work.
-        if (consumers_.isEmpty())
+        // No consumer is due, don't do any work.
+        if (due.isEmpty())
             return;
 
-        QImage imageOut;
+        WebRTCFrameBufferPtr frame;
+        
+        // Offscreen render texture
+        if (offscreen_)
+        {
+            PROFILE(CloudRendering_TundraRenderer_Offscreen)
+            frame = RenderOffscreen();
+            ELIFORP(CloudRendering_TundraRenderer_Offscreen)
+            if (!frame.get())
+                return;
+        }
 
 #ifdef DIRECTX_ENABLED
-        Ogre::D3D9RenderWindow *renderWindow = D3DRenderWindow();
+        Ogre::D3D9RenderWindow *renderWindow = (!frame.get() ? D3DRenderWindow() : 0);
         IDirect3DDevice9 *d3dDevice = (renderWindow != 0 ? renderWindow->getD3D9Device() : 0);
         
         // Is DirectX really in use?
@@ -909,8 +1125,21 @@ namespace WebRTC
             ELIFORP(CloudRendering_TundraRenderer_Texture_Lock)
             PROFILE(CloudRendering_TundraRenderer_Copy_Data)
             
-            imageOut = QImage(texture->getWidth(), texture->getHeight(), QImage::Format_ARGB32);        
-            memcpy(static_cast<void*>(imageOut.bits()), lock.pBits, imageOut.byteCount()); 
+            // The locked surface cannot be handed out, this is the one copy the DirectX path needs.
+            frame = framePool_.AcquireARGB(texture->getWidth(), texture->getHeight());
+            if (!frame.get())
+            {
+                surfaceTexture->UnlockRect();
+                return;
+            }
+            if (lock.Pitch == frame->stride)
+                memcpy(static_cast<void*>(frame->Data()), lock.pBits, frame->size);
+            else
+            {
+                for (int y=0; y<frame->height; ++y)
+                    memcpy(static_cast<void*>(frame->Data() + y * frame->stride), static_cast<const char*>(lock.pBits) + y * lock.Pitch, frame->stride);
+            }
+            framePool_.RecordCopy(frame->size);
             surfaceTexture->UnlockRect();
             
             ELIFORP(CloudRendering_TundraRenderer_Copy_Data)
@@ -919,43 +1148,112 @@ namespace WebRTC
         // OpenGL
         /** @note Even if built with DIRECTX_ENABLED --opengl renderer 
             might have been selected and this code needs to run! */
-        if (imageOut.isNull())
+        if (!frame.get())
         {
-            PROFILE(CloudRendering_TundraRenderer_GL_Copy_Data)
-
             Ogre::RenderWindow *renderWindow = OgreRenderWindow();
             if (!renderWindow)
                 return;
 
-            // Simply set all the dimensions correctly and pass the QImage data 
-            // ptr for Ogre to blit to. This is not possible with DirectX renderer.
-            imageOut = QImage(renderWindow->getWidth(), renderWindow->getHeight(), QImage::Format_ARGB32);
-            Ogre::PixelBox dest(renderWindow->getWidth(), renderWindow->getHeight(), 1, Ogre::PF_A8R8G8B8, static_cast<void*>(imageOut.bits()));
-
-            try
+            // Asynchronous readback, only for GL windows.
+            void *glContext = 0;
+            if (readback_.get())
+                renderWindow->getCustomAttribute("GLCONTEXT", &glContext);
+            if (glContext && readback_->IsAvailable())
             {
-                renderWindow->copyContentsToMemory(dest, Ogre::RenderTarget::FB_AUTO);
+                PROFILE(CloudRendering_TundraRenderer_GL_Async_Readback)
+                
+                // FB_AUTO equivalent: front buffer in full screen, back buffer otherwise.
+                frame = readback_->Read(renderWindow->getWidth(), renderWindow->getHeight(), renderWindow->isFullScreen(), &framePool_);
+                
+                ELIFORP(CloudRendering_TundraRenderer_GL_Async_Readback)
+                
+                // Ring is still filling up or failed, in which case the next capture is synchronous.
+                if (!frame.get())
+                    return;
             }
-            catch(Ogre::Exception &ex) { return; }
+            else
+            {
+                PROFILE(CloudRendering_TundraRenderer_GL_Copy_Data)
 
-            ELIFORP(CloudRendering_TundraRenderer_GL_Copy_Data)
+                // Simply set all the dimensions correctly and pass the pooled buffer 
+                // for Ogre to blit to. This is not possible with DirectX renderer.
+                frame = framePool_.AcquireARGB(renderWindow->getWidth(), renderWindow->getHeight());
+                if (!frame.get())
+                    return;
+                Ogre::PixelBox dest(frame->width, frame->height, 1, Ogre::PF_A8R8G8B8, static_cast<void*>(frame->Data()));
+
+                try
+                {
+                    renderWindow->copyContentsToMemory(dest, Ogre::RenderTarget::FB_AUTO);
+                }
+                catch(Ogre::Exception &ex) { return; }
+
+                ELIFORP(CloudRendering_TundraRenderer_GL_Copy_Data)
+            }
         }
 
         PROFILE(CloudRendering_TundraRenderer_UpdateConsumers)
 
-        if (!imageOut.isNull())
+        if (frame.get())
         {
-            for (int i=0; i<consumers_.size(); ++i)
+            // Static scene detection, consumers that already have the current scene only get heartbeat frames.
+            const bool detectChanges = (idleFps_ > 0.0);
+            if (detectChanges)
             {
-                TundraRendererConsumerWeakPtr &iter = consumers_[i];
-                if (!iter.expired())
-                    iter.lock()->OnTundraFrame(&imageOut);
-                else
+                PROFILE(CloudRendering_TundraRenderer_DetectChanges)
+                changeDetector_.Update(frame, &workers_);
+                ELIFORP(CloudRendering_TundraRenderer_DetectChanges)
+            }
+            const u64 generation = changeDetector_.Generation();
+            const double heartbeatTicks = (detectChanges ? static_cast<double>(GetCurrentClockFreq()) / idleFps_ : 0.0);
+
+            // Scaled and converted frames of this tick, shared by consumers with the same settings.
+            QList<WebRTCFrameBufferPtr> prepared;
+            QList<QPair<shared_ptr<TundraRendererConsumer>, WebRTCFrameBufferPtr> > deliveries;
+            foreach(int index, due)
+            {
+                Consumer &entry = consumers_[index];
+                if (detectChanges && entry.generation == generation && static_cast<double>(now - entry.lastDelivery) < heartbeatTicks)
                 {
-                    consumers_.removeAt(i);
-                    i--;   
-                }            
+                    changeDetector_.RecordDelivery(false, now);
+                    continue;
+                }
+                
+                int width = 0, height = 0;
+                ColorConversion::FitSize(frame->width, frame->height, entry.settings.width, entry.settings.height, width, height);
+                const u32 fourcc = (entry.settings.fourcc != 0 ? entry.settings.fourcc : frame->fourcc);
+                
+                WebRTCFrameBufferPtr delivered;
+                foreach(const WebRTCFrameBufferPtr &candidate, prepared)
+                {
+                    if (candidate->width == width && candidate->height == height && candidate->fourcc == fourcc)
+                    {
+                        delivered = candidate;
+                        break;
+                    }
+                }
+                if (!delivered.get())
+                {
+                    PROFILE(CloudRendering_TundraRenderer_PrepareFrame)
+                    WebRTCFrameBufferPtr scaled = ColorConversion::ScaleFrame(&convertedFrames_, frame, width, height, &workers_);
+                    delivered = ColorConversion::ConvertFrame(&convertedFrames_, scaled, fourcc, conversion_, &workers_);
+                    ELIFORP(CloudRendering_TundraRenderer_PrepareFrame)
+                    if (!delivered.get())
+                        continue;
+                    prepared << delivered;
+                }
+                
+                entry.frames++;
+                entry.generation = generation;
+                entry.lastDelivery = now;
+                changeDetector_.RecordDelivery(true, now);
+                deliveries << qMakePair(entry.consumer.lock(), delivered);
             }
+            
+            // Consumers may register or unregister from the callback, the list is not touched from here on.
+            for (int i=0; i<deliveries.size(); ++i)
+                if (deliveries[i].first.get())
+                    deliveries[i].first->OnTundraFrame(deliveries[i].second);
         }
     }
 }
@@ -13,6 +13,14 @@
 #include "CloudRenderingPluginFwd.h"
 #include "CloudRenderingDefines.h"
 #include "CloudRenderingProtocol.h"
+#include "CloudRenderingMessageDispatcher.h"
+#include "WebRTCFrameBuffer.h"
+#include "WebRTCWorkerPool.h"
+#include "WebRTCFramePacer.h"
+#include "WebRTCColorConversion.h"
+#include "WebRTCSceneChangeDetector.h"
+#include "WebRTCInputInjector.h"
+#include "WebRTCInputQueue.h"
 
 #include <QSize>
 
@@ -32,7 +40,8 @@ namespace WebRTC
         Q_OBJECT
 
     public:
-        Renderer(CloudRenderingPlugin *plugin);
+        /// @param serviceHost Cloud Rendering Service to connect to. If empty, --cloudRenderer <host> or the local service of the plugin.
+        Renderer(CloudRenderingPlugin *plugin, const QString &serviceHost = "");
         ~Renderer();
         
         /// Returns the current room.
@@ -42,15 +51,45 @@ namespace WebRTC
         /** This can be used to register frame consumers. */
         TundraRenderer *ApplicationRenderer() const;
 
+    public slots:
+        /// Sets if peers share one capture pipeline.
+        /** In broadcast mode the frame is captured, scaled and converted once and fanned out to all peers
+            of the room. Otherwise each peer gets its own capturer. Applies to peers created after the call.
+            Defaults to the @c --cloudRenderingBroadcast command line parameter, the service can override it
+            per room with the "broadcast" property of the RoomAssigned message. */
+        void SetBroadcastMode(bool enabled);
+        
+        /// Returns if peers share one capture pipeline.
+        bool IsBroadcastMode() const;
+
+        /// Returns the peer input counters: received, coalesced, dropped and delivered events and the max age of moves.
+        /** Mouse moves of a peer are coalesced to the latest position per frame, see InputQueue. The max age is
+            set with --cloudRenderingInputMaxAge <msec>, defaults to 200 and 0 never drops moves. */
+        QVariantMap InputStatistics() const;
+
+        /// Returns the service reconnect counters: disconnects, reconnect attempts, resumed and lost rooms,
+        /// peers kept over a resume and the time from losing the connection to being assigned a room again.
+        /// The current peer count and the number of those with an open connection are included.
+        /** The connection is retried with a jittered exponential backoff, the max delay is set with
+            --cloudRenderingReconnectMaxDelay <msec> and defaults to 30000. */
+        QVariantMap ReconnectStatistics() const;
+
     private slots:
         void OnServiceConnected();
         void OnServiceDisconnected();
         void OnServiceConnectingFailed();
+        void OnServiceReconnecting(int attempt, int delayMsec);
         void OnServiceMessage(CloudRenderingProtocol::MessageSharedPtr message);
+        
+        /// Delivers the queued peer input.
+        void OnFrameUpdated(float frametime);
 
         /// UTF8 data channel message handlers.
         void OnDataChannelMessage(CloudRenderingProtocol::MessageSharedPtr message);
         void OnDataChannelMessage(WebRTC::PeerConnection *sender, CloudRenderingProtocol::MessageSharedPtr message);
+
+        void OnDataChannelMessage(const CloudRenderingProtocol::Application::PeerCustomValue &message);
+        void OnDataChannelMessage(WebRTC::PeerConnection *sender, const CloudRenderingProtocol::Application::PeerCustomValue &message);
         
         /// Binary data channel message handlers.
         void OnDataChannelMessage(const CloudRenderingProtocol::BinaryMessageData &data);
@@ -58,6 +97,10 @@ namespace WebRTC
         
         /// Signal handler when peers local data information has been resolved and we can send the AnswerMessage.
         void OnLocalConnectionDataResolved(WebRTC::SDP sdp, WebRTC::ICECandidateList candidates);
+
+        /// Trickle ICE signal handlers, the SDP is sent as soon as it is created and the candidates follow in batches.
+        void OnLocalSDPResolved(WebRTC::SDP sdp);
+        void OnLocalIceCandidatesTrickled(WebRTC::ICECandidateList candidates);
         
         /// Returns peer for a peer id, or null ptr if not found.
         WebRTCPeerConnectionPtr Peer(const QString &peerId) const;
@@ -65,37 +108,71 @@ namespace WebRTC
         /// Gets or created peer with id.
         WebRTCPeerConnectionPtr GetOrCreatePeer(const QString &peerId);
         
-        void PostKeyboardEvent(const QVariantMap &data);
-        void PostMouseEvent(const QVariantMap &data);
+        void PostKeyboardEvent(const CloudRenderingProtocol::Application::InputPayload &input);
+        void PostMouseEvent(const CloudRenderingProtocol::Application::InputPayload &input);
+        void PostInputEvent(const CloudRenderingProtocol::BinaryInput::InputEvent &event);
         void ClearInputFocus();
 
     private:
+        /// Service message handlers.
+        void HandleOffer(CloudRenderingProtocol::Signaling::OfferMessage *offer);
+        void HandleAnswer(CloudRenderingProtocol::Signaling::AnswerMessage *answer);
+        void HandleIceCandidates(CloudRenderingProtocol::Signaling::IceCandidatesMessage *candidates);
+        void HandleRoomAssigned(CloudRenderingProtocol::Room::RoomAssignedMessage *assigned);
+        void HandleRoomUserJoined(CloudRenderingProtocol::Room::RoomUserJoinedMessage *joined);
+        void HandleRoomUserLeft(CloudRenderingProtocol::Room::RoomUserLeftMessage *left);
+
+        /// Removes peers whose connection did not survive a service reconnect, returns the number of peers kept.
+        int RemoveDisconnectedPeers();
+
+        /// Sends the offer or answer of @c peer.
+        void SendLocalDescription(WebRTC::PeerConnection *peer, const WebRTC::SDP &sdp, const WebRTC::ICECandidateList &candidates);
+
         QString LC;
         QString serviceHost_;
         
         CloudRenderingProtocol::CloudRenderingRoom room_;
+        /// Token to re-claim room_ after a reconnect, from the last RoomAssigned message.
+        QString resumeToken_;
+
+        CloudRenderingProtocol::MessageDispatcher dispatcher_;
 
         CloudRenderingPlugin *plugin_;
         
         WebRTCTundraRendererPtr tundraRenderer_;
         WebRTCWebSocketClientPtr websocket_;
         WebRTCPeerConnectionList connections_;
+
+        /// Reconnect counters.
+        tick_t disconnectedAt_;
+        u64 disconnects_;
+        u64 reconnectAttempts_;
+        u64 resumes_;
+        u64 roomsLost_;
+        int peersKept_;
+        double lastRecoveryMs_;
+        double maxRecoveryMs_;
         
-        struct InputState
-        {
-            Qt::MouseButtons mouseButtons;
-            Qt::KeyboardModifiers keyboardModifiers;
-            
-            InputState() : mouseButtons(Qt::NoButton), keyboardModifiers(Qt::NoModifier) {}
-        };
-        InputState inputState_;
+        bool broadcast_;
+        bool broadcastDefault_;
+        WebRTCBroadcastSourcePtr broadcastSource_;
+
+        /// If the renderer offers trickle ICE, and the candidate batching interval.
+        bool trickleIce_;
+        int trickleIceBatchMsec_;
+        
+        InputInjector input_;
+        InputQueue inputQueue_;
     };
     
     /// Tundra renderer consumer receives frame updates from TundraRenderer.
     class CLOUDRENDERING_API TundraRendererConsumer
     {
         public:
-            virtual void OnTundraFrame(const QImage *frame) = 0;
+            /// Called with a pooled frame buffer shared by all consumers.
+            /** The buffer returns to the pool once every consumer has released it.
+                Keep the ptr only if you need the data after returning. */
+            virtual void OnTundraFrame(const WebRTCFrameBufferPtr &frame) = 0;
     };
     typedef weak_ptr<TundraRendererConsumer> TundraRendererConsumerWeakPtr;
     
@@ -107,13 +184,85 @@ namespace WebRTC
     public:
         TundraRenderer(CloudRenderingPlugin *plugin, uint updateFps = 30);
         ~TundraRenderer();
+        
+        /// Frame rate, size and pixel format requested by a consumer.
+        struct ConsumerSettings
+        {
+            /// Frames per second, 0 follows the default rate set with SetFrameRate().
+            double fps;
+            /// Maximum frame width, 0 delivers frames as rendered. Frames are scaled to fit keeping the aspect ratio.
+            int width;
+            /// Maximum frame height, 0 delivers frames as rendered.
+            int height;
+            /// libjingle FOURCC of the delivered frames, 0 delivers ARGB frames as rendered.
+            u32 fourcc;
+            
+            ConsumerSettings(double _fps = 0.0, int _width = 0, int _height = 0, u32 _fourcc = 0) :
+                fps(_fps),
+                width(_width),
+                height(_height),
+                fourcc(_fourcc)
+            {
+            }
+        };
       
     public slots:
+        /// Sets the default capture rate in whole frames per second.
         void SetInterval(uint updateFps);
+        
+        /// Sets the default capture rate in frames per second, fractional rates like 29.97 are supported.
+        /** Applies to consumers that were registered without a rate of their own. */
+        void SetFrameRate(double fps);
+        
+        /// Sets the captured frame size.
+        /** In offscreen mode frames are exactly @c width x @c height. Otherwise the main window is
+            resized so that its height including the menu bar is @c height + 21. */
         void SetSize(int width, int height);
-        void Register(TundraRendererConsumerWeakPtr consumer);
+        
+        /// Enables rendering the main camera into a dedicated render texture instead of capturing the main window.
+        /** The main window and its UI are not touched and frames are exactly the size given to SetSize().
+            The Qt UI is not part of the offscreen frames. Can be enabled at startup with --cloudRenderingOffscreen. */
+        void SetOffscreen(bool enabled);
+        
+        /// Returns if offscreen capture is enabled.
+        bool IsOffscreen() const;
+
+        /// Registers a frame consumer, or updates its settings if it is already registered.
+        /** Each consumer is paced independently and receives frames in its requested size and format.
+            Frames are read back only on ticks where at least one consumer is due, consumers that
+            request the same size and format on the same tick share the scaled and converted frame. */
+        void Register(TundraRendererConsumerWeakPtr consumer, const ConsumerSettings &settings = ConsumerSettings());
         void Unregister(TundraRendererConsumerWeakPtr consumer);
         
+        /// Returns the color conversion implementation, can be forced with --cloudRenderingColorConversion.
+        ColorConversion::Implementation Conversion() const;
+        
+        /// Returns capture statistics, including the frame pool allocation and copy counters,
+        /// the worker pool band timings and the capture pacing jitter.
+        QVariantMap Statistics() const;
+        
+        /// Sets the number of frame processing worker threads, negative uses one per core.
+        void SetWorkerThreads(int numThreads);
+        
+        /// Sets the heartbeat rate used while the scene is static, 0 disables static scene detection.
+        /** Captured frames are compared tile by tile to the previous one. Consumers do not receive frames
+            that did not change since the last frame they got, except at @c fps heartbeat rate. Full rate
+            resumes with the first changed frame. Defaults to 1 and can be set with --cloudRenderingIdleFps <fps>. */
+        void SetIdleFps(double fps);
+        
+        /// Sets the OpenGL asynchronous readback ring depth, 0 uses synchronous readback.
+        /** With a ring of N pixel buffers a frame is delivered to consumers N-1 captures after it was rendered. */
+        void SetReadbackRing(int ringSize);
+        
+        /// Returns the pool frames are read back to.
+        /** Consumers can acquire their own buffers from here to get them recycled the same way. */
+        FrameBufferPool *FramePool();
+        
+        /// Returns the worker pool for parallel frame processing.
+        /** The thread count defaults to one less than the core count as the thread waiting on a job
+            processes bands too, and can be set with --cloudRenderingWorkerThreads <n>. */
+        WorkerPool *Workers();
+        
     private slots:
         void OnPostFrameUpdate(float frametime);
         
@@ -126,6 +275,12 @@ namespace WebRTC
 
         // Get the Ogre rendering window.
         Ogre::RenderWindow *OgreRenderWindow() const;
+        
+        // Renders the main camera to the offscreen render texture and reads it back.
+        WebRTCFrameBufferPtr RenderOffscreen();
+        
+        // Destroys the offscreen render texture.
+        void ReleaseOffscreen();
 
 #ifdef DIRECTX_ENABLED
         Ogre::D3D9RenderWindow *D3DRenderWindow() const;
@@ -134,9 +289,29 @@ namespace WebRTC
 #endif
 
         QSize pendingWindowResize_;
+        bool offscreen_;
+        QSize offscreenSize_;
+        QString offscreenTextureName_;
         bool fatalTextureError_;
-        float interval_;
-        float t_;
-        QList<TundraRendererConsumerWeakPtr> consumers_;
+        FramePacer pacer_;
+        
+        struct Consumer
+        {
+            TundraRendererConsumerWeakPtr consumer;
+            ConsumerSettings settings;
+            shared_ptr<FramePacer> pacer; ///< Null if the default rate is followed.
+            u64 frames;
+            u64 generation; ///< Scene change generation of the last delivered frame.
+            tick_t lastDelivery;
+        };
+        QList<Consumer> consumers_;
+        
+        FrameBufferPool framePool_;
+        FrameBufferPool convertedFrames_;
+        ColorConversion::Implementation conversion_;
+        SceneChangeDetector changeDetector_;
+        double idleFps_;
+        WorkerPool workers_;
+        WebRTCGLReadbackPtr readback_;
     };
 }
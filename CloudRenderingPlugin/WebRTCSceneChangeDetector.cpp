@@ -0,0 +1,202 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "WebRTCSceneChangeDetector.h"
+#include "WebRTCFrameBuffer.h"
+#include "WebRTCWorkerPool.h"
+#include "WebRTCClock.h"
+
+#include <string.h>
+
+#include "talk/media/base/videocommon.h"
+
+namespace WebRTC
+{
+    /// @cond PRIVATE
+
+    static const u64 cHashSeed = 0xCBF29CE484222325ULL;
+    static const u64 cHashMultiplier = 0x9E3779B97F4A7C15ULL;
+
+    /// Hashes the tiles of rows [firstRow, lastRow). Bands start at tile boundaries so they write distinct tiles.
+    struct TileHashJob : public IBandJob
+    {
+        void ProcessBand(int firstRow, int lastRow)
+        {
+            const int rowBytes = tileSize * 4;
+            for (int tileY = firstRow / tileSize; tileY * tileSize < lastRow; ++tileY)
+            {
+                u64 *tileHashes = hashes + tileY * tilesX;
+                for (int x=0; x<tilesX; ++x)
+                    tileHashes[x] = cHashSeed;
+
+                const int yEnd = qMin(lastRow, (tileY + 1) * tileSize);
+                for (int y=tileY * tileSize; y<yEnd; ++y)
+                {
+                    const uchar *line = data + y * stride;
+                    for (int x=0; x<tilesX; ++x)
+                    {
+                        const uchar *p = line + x * rowBytes;
+                        const int bytes = qMin(rowBytes, width * 4 - x * rowBytes);
+                        u64 h = tileHashes[x];
+                        int i = 0;
+                        for (; i + 8 <= bytes; i += 8)
+                        {
+                            u64 word;
+                            memcpy(&word, p + i, 8);
+                            h = (h ^ word) * cHashMultiplier;
+                        }
+                        if (i < bytes)
+                        {
+                            u32 word;
+                            memcpy(&word, p + i, 4);
+                            h = (h ^ word) * cHashMultiplier;
+                        }
+                        tileHashes[x] = h;
+                    }
+                }
+            }
+        }
+
+        const uchar *data;
+        int stride, width, tileSize, tilesX;
+        u64 *hashes;
+    };
+
+    /// @endcond
+
+    SceneChangeDetector::SceneChangeDetector(int tileSize) :
+        tileSize_(qMax(8, tileSize)),
+        width_(0),
+        height_(0),
+        generation_(0),
+        frames_(0),
+        changedFrames_(0),
+        lastChangedTiles_(0),
+        totalHashMs_(0.0),
+        delivered_(0),
+        skipped_(0),
+        windowStart_(0),
+        windowDelivered_(0),
+        windowSkipped_(0),
+        lastSecondDelivered_(0),
+        lastSecondSkipped_(0)
+    {
+    }
+
+    int SceneChangeDetector::Update(const WebRTCFrameBufferPtr &frame, WorkerPool *workers)
+    {
+        if (!frame.get() || frame->fourcc != cricket::FOURCC_ARGB || frame->width <= 0 || frame->height <= 0)
+        {
+            Reset();
+            generation_++;
+            return 1;
+        }
+
+        tick_t start = GetCurrentClockTime();
+
+        const int tilesX = (frame->width + tileSize_ - 1) / tileSize_;
+        const int tilesY = (frame->height + tileSize_ - 1) / tileSize_;
+        const bool resized = (frame->width != width_ || frame->height != height_);
+        if (resized)
+        {
+            width_ = frame->width;
+            height_ = frame->height;
+            previous_.clear();
+        }
+        hashes_.swap(previous_);
+        hashes_.resize(static_cast<size_t>(tilesX * tilesY));
+
+        TileHashJob job;
+        job.data = frame->Data();
+        job.stride = frame->stride;
+        job.width = frame->width;
+        job.tileSize = tileSize_;
+        job.tilesX = tilesX;
+        job.hashes = &hashes_[0];
+        if (workers)
+            workers->Run(&job, frame->height, tileSize_);
+        else
+            job.ProcessBand(0, frame->height);
+
+        int changed = 0;
+        if (previous_.size() != hashes_.size())
+            changed = static_cast<int>(hashes_.size());
+        else
+        {
+            for (size_t i=0; i<hashes_.size(); ++i)
+                if (hashes_[i] != previous_[i])
+                    changed++;
+        }
+
+        frames_++;
+        lastChangedTiles_ = changed;
+        if (changed > 0)
+        {
+            changedFrames_++;
+            generation_++;
+        }
+        totalHashMs_ += MsSince(start);
+        return changed;
+    }
+
+    u64 SceneChangeDetector::Generation() const
+    {
+        return generation_;
+    }
+
+    void SceneChangeDetector::Reset()
+    {
+        width_ = 0;
+        height_ = 0;
+        hashes_.clear();
+        previous_.clear();
+    }
+
+    void SceneChangeDetector::RecordDelivery(bool delivered, tick_t now)
+    {
+        if (delivered)
+        {
+            delivered_++;
+            windowDelivered_++;
+        }
+        else
+        {
+            skipped_++;
+            windowSkipped_++;
+        }
+
+        if (windowStart_ == 0)
+            windowStart_ = now;
+        else if (now - windowStart_ >= GetCurrentClockFreq())
+        {
+            lastSecondDelivered_ = windowDelivered_;
+            lastSecondSkipped_ = windowSkipped_;
+            windowDelivered_ = 0;
+            windowSkipped_ = 0;
+            windowStart_ = now;
+        }
+    }
+
+    QVariantMap SceneChangeDetector::Statistics() const
+    {
+        QVariantMap stats;
+        stats["tileSize"] = tileSize_;
+        stats["tiles"] = static_cast<int>(hashes_.size());
+        stats["frames"] = static_cast<qulonglong>(frames_);
+        stats["changedFrames"] = static_cast<qulonglong>(changedFrames_);
+        stats["lastChangedTiles"] = lastChangedTiles_;
+        stats["averageHashMs"] = (frames_ > 0 ? totalHashMs_ / static_cast<double>(frames_) : 0.0);
+        stats["delivered"] = static_cast<qulonglong>(delivered_);
+        stats["skipped"] = static_cast<qulonglong>(skipped_);
+        stats["deliveredPerSecond"] = static_cast<qulonglong>(lastSecondDelivered_);
+        stats["skippedPerSecond"] = static_cast<qulonglong>(lastSecondSkipped_);
+        stats["skippedToDelivered"] = (lastSecondDelivered_ > 0 ? static_cast<double>(lastSecondSkipped_) / static_cast<double>(lastSecondDelivered_) : 0.0);
+        return stats;
+    }
+}
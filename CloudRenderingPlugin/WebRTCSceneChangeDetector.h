@@ -0,0 +1,77 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include "HighPerfClock.h"
+
+#include <QVariant>
+#include <vector>
+
+namespace WebRTC
+{
+    /// Detects frames that did not change from the previous one with per tile hashes.
+    /** The frame is divided into square tiles and a 64 bit hash is computed for each tile.
+        A frame is changed if any tile hash differs from the previous frame. Every detected
+        change increments Generation(), so consumers that skip frames can tell if the scene
+        changed since the last frame they received.
+
+        Also keeps the delivered and skipped frame counters reported by TundraRenderer. */
+    class CLOUDRENDERING_API SceneChangeDetector
+    {
+    public:
+        /// @param tileSize Tile width and height in pixels.
+        SceneChangeDetector(int tileSize = 64);
+
+        /// Hashes @c frame and compares it to the previous frame.
+        /** If @c workers is given, tile rows are hashed in parallel. Frames that are not ARGB,
+            or have a different size than the previous frame, are always changed.
+            @return Number of changed tiles, 0 if the frame is identical to the previous one. */
+        int Update(const WebRTCFrameBufferPtr &frame, WorkerPool *workers = 0);
+
+        /// Returns the change generation, incremented on every frame with changed tiles.
+        u64 Generation() const;
+
+        /// Forgets the previous frame, the next Update() reports all tiles changed.
+        void Reset();
+
+        /// Records a frame delivery decision for the per second counters.
+        void RecordDelivery(bool delivered, tick_t now);
+
+        /// Returns detection statistics.
+        /** Contains "tileSize", "tiles", "frames", "changedFrames", "lastChangedTiles", "averageHashMs",
+            "delivered", "skipped" and, over the last full second, "deliveredPerSecond", "skippedPerSecond"
+            and "skippedToDelivered". */
+        QVariantMap Statistics() const;
+
+    private:
+        int tileSize_;
+        int width_;
+        int height_;
+        std::vector<u64> hashes_;
+        std::vector<u64> previous_;
+        u64 generation_;
+
+        u64 frames_;
+        u64 changedFrames_;
+        int lastChangedTiles_;
+        double totalHashMs_;
+
+        u64 delivered_;
+        u64 skipped_;
+        tick_t windowStart_;
+        u64 windowDelivered_;
+        u64 windowSkipped_;
+        u64 lastSecondDelivered_;
+        u64 lastSecondSkipped_;
+    };
+}
@@ -0,0 +1,144 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QList>
+
+#include <vector>
+
+namespace WebRTC
+{
+    /// Single producer, single consumer queue with a pending wakeup flag.
+    /** Values go through a fixed size ring buffer, the producer and the consumer each own one index and
+        publish it with a release store, there are no locks on the way. If the consumer falls behind and the
+        ring is full the producer spills to an overflow list under a mutex instead of blocking or dropping.
+        Values keep their order across the ring and the overflow.
+
+        Push() reports when the consumer has to be woken up: only the first value after the consumer
+        started its last drain sets the pending wakeup flag, so a burst of values causes one wakeup.
+        The consumer calls BeginDrain() to clear the flag before it drains the queue with Pop().
+
+        @code
+        // Producer thread
+        if (queue.Push(value))
+            emit NewValues(); // Queued connection
+        // Consumer thread, slot of NewValues()
+        queue.BeginDrain();
+        while (queue.Pop(value))
+            Handle(value);
+        @endcode */
+    template <typename T>
+    class SpscQueue
+    {
+    public:
+        /// @param capacity Ring capacity, rounded up to a power of two.
+        explicit SpscQueue(int capacity = 1024) :
+            head_(0),
+            tail_(0),
+            overflowCount_(0),
+            wakeUpPending_(0)
+        {
+            uint size = 2;
+            while (size < static_cast<uint>(capacity))
+                size <<= 1;
+            ring_.resize(size);
+            mask_ = size - 1;
+        }
+
+        /// Returns the ring capacity.
+        int Capacity() const { return static_cast<int>(mask_ + 1); }
+
+        /// Queues @c value. Producer thread only.
+        /** @return True if the consumer needs to be woken up. */
+        bool Push(const T &value)
+        {
+            const uint tail = static_cast<uint>(static_cast<int>(tail_));
+            const uint head = static_cast<uint>(head_.fetchAndAddAcquire(0)); // Qt 4 has no loadAcquire().
+            // Once spilled, keep spilling until the consumer has taken the overflow to preserve the order.
+            if (static_cast<int>(overflowCount_) == 0 && tail - head <= mask_)
+            {
+                ring_[tail & mask_] = value;
+                tail_.fetchAndStoreRelease(static_cast<int>(tail + 1));
+            }
+            else
+            {
+                QMutexLocker lock(&mutexOverflow_);
+                overflow_ << value;
+                overflowCount_.fetchAndStoreOrdered(overflow_.size());
+            }
+            return wakeUpPending_.testAndSetOrdered(0, 1);
+        }
+
+        /// Clears the pending wakeup flag. Consumer thread only, call before draining with Pop().
+        void BeginDrain()
+        {
+            wakeUpPending_.fetchAndStoreOrdered(0);
+        }
+
+        /// Takes the oldest value. Consumer thread only.
+        /** @return False if the queue is empty. */
+        bool Pop(T &value)
+        {
+            // Overflow taken earlier is newer than anything that was in the ring, older than anything pushed since.
+            if (!taken_.isEmpty())
+            {
+                value = taken_.takeFirst();
+                return true;
+            }
+
+            // Read before the ring: once the producer spills it stays off the ring until the overflow is taken,
+            // so if a spill is seen here an empty ring below means everything older than the overflow is consumed.
+            const bool spilled = (overflowCount_.fetchAndAddAcquire(0) > 0);
+
+            const uint head = static_cast<uint>(static_cast<int>(head_));
+            const uint tail = static_cast<uint>(tail_.fetchAndAddAcquire(0));
+            if (head != tail)
+            {
+                value = ring_[head & mask_];
+                ring_[head & mask_] = T(); // Release the reference now, not when the slot is reused.
+                head_.fetchAndStoreRelease(static_cast<int>(head + 1));
+                return true;
+            }
+            if (!spilled)
+                return false;
+
+            {
+                QMutexLocker lock(&mutexOverflow_);
+                qSwap(taken_, overflow_);
+                overflowCount_.fetchAndStoreOrdered(0);
+            }
+            if (taken_.isEmpty())
+                return false;
+            value = taken_.takeFirst();
+            return true;
+        }
+
+    private:
+        Q_DISABLE_COPY(SpscQueue)
+
+        std::vector<T> ring_;
+        uint mask_;
+        /// Next slot to read, written by the consumer.
+        QAtomicInt head_;
+        /// Next slot to write, written by the producer.
+        QAtomicInt tail_;
+
+        QMutex mutexOverflow_;
+        QList<T> overflow_;
+        QAtomicInt overflowCount_;
+        /// Overflow moved to the consumer side, consumer only.
+        QList<T> taken_;
+
+        QAtomicInt wakeUpPending_;
+    };
+}
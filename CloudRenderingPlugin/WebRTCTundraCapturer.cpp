@@ -12,16 +12,17 @@
 #include "EC_Camera.h"
 
 #include "WebRTCTundraCapturer.h"
+#include "WebRTCFrameStamp.h"
 #include "CloudRenderingPlugin.h"
 
 #include "Framework.h"
+#include "LoggingFunctions.h"
 #include "FrameAPI.h"
 #include "IRenderer.h"
 #include "Profiler.h"
 #include "UiAPI.h"
 #include "UiMainWindow.h"
 
-#include <QImage>
 #include <QDebug>
 
 #include "OgreRenderingModule.h"
@@ -36,25 +37,35 @@
 #include <OgreD3D9RenderWindow.h>
 #endif
 
-#include "talk/base/scoped_ptr.h"
-
 namespace WebRTC
 {
+    /// @cond PRIVATE
+
+    /// The capturer is owned by its libjingle video source, the shared ptr given to TundraRenderer must never delete it.
+    struct NullCapturerDeleter
+    {
+        void operator()(TundraCapturer* /*capturer*/) const {}
+    };
+
+    /// @endcond
+
     TundraCapturer::TundraCapturer(Framework *framework) :
         framework_(framework),
         running_(false),
-        time_(talk_base::Time())
+        time_(talk_base::Time()),
+        conversion_(ColorConversion::CCI_Auto),
+        stamp_(framework->HasCommandLineParameter("--cloudRenderingLoopback")),
+        stampSequence_(0)
     {        
         // Default supported formats. Use ResetSupportedFormats to over write.
+        // Frames are converted to I420 and NV12 here, ARGB is kept for consumers that want the raw frame.
+        const int sizes[4][2] = { { 1280, 720 }, { 640, 480 }, { 320, 240 }, { 160, 120 } };
+        const uint32 fourccs[3] = { cricket::FOURCC_I420, cricket::FOURCC_NV12, cricket::FOURCC_ARGB };
         std::vector<cricket::VideoFormat> formats;
-        formats.push_back(cricket::VideoFormat(1280, 720,
-            cricket::VideoFormat::FpsToInterval(30), cricket::FOURCC_ARGB));
-        formats.push_back(cricket::VideoFormat(640, 480,
-            cricket::VideoFormat::FpsToInterval(30), cricket::FOURCC_ARGB));
-        formats.push_back(cricket::VideoFormat(320, 240,
-            cricket::VideoFormat::FpsToInterval(30), cricket::FOURCC_ARGB));
-        formats.push_back(cricket::VideoFormat(160, 120,
-            cricket::VideoFormat::FpsToInterval(30), cricket::FOURCC_ARGB));
+        for (int i=0; i<4; ++i)
+            for (int k=0; k<3; ++k)
+                formats.push_back(cricket::VideoFormat(sizes[i][0], sizes[i][1],
+                    cricket::VideoFormat::FpsToInterval(30), fourccs[k]));
         SetSupportedFormats(formats);
     }
 
@@ -63,40 +74,84 @@ namespace WebRTC
         selfShared_.reset();
     }
     
-    void TundraCapturer::OnTundraFrame(const QImage *frame)
+    void TundraCapturer::OnTundraFrame(const WebRTCFrameBufferPtr &frame)
     {
         PROFILE(CloudRendering_TundraCapturer_OnTundraFrame)
         
         const cricket::VideoFormat *format = GetCaptureFormat();
-        if (!frame || !running_ || !format || format->fourcc != cricket::FOURCC_ARGB)
+        if (!frame.get() || !running_ || !format)
             return;
         
-        // Frame
-        cricket::CapturedFrame out;
+        // Band parallel processing on the renderer worker pool, if available.
+        WorkerPool *workers = 0;
+        CloudRenderingPlugin *plugin = framework_->Module<CloudRenderingPlugin>();
+        if (plugin && plugin->Renderer() && plugin->Renderer()->ApplicationRenderer())
+            workers = plugin->Renderer()->ApplicationRenderer()->Workers();
+
+        // Scale down to fit the negotiated size, keeping the aspect ratio. Frames from
+        // TundraRenderer already are in the registered size and format, then this is a no-op.
+        WebRTCFrameBufferPtr scaled = frame;
+        int width = 0, height = 0;
+        ColorConversion::FitSize(frame->width, frame->height, format->width, format->height, width, height);
+        if (width != frame->width || height != frame->height)
+        {
+            scaled = ColorConversion::ScaleFrame(&convertedFrames_, frame, width, height, workers);
+            if (!scaled.get())
+                return;
+        }
 
+        // Convert to the negotiated format, ARGB frames are passed as is.
+        WebRTCFrameBufferPtr captured = ColorConversion::ConvertFrame(&convertedFrames_, scaled, format->fourcc, conversion_, workers);
+        if (!captured.get())
+            return;
+        
         // Time
         uint64 currentTime = talk_base::Time();
+
+        // Loopback benchmark: stamp capture time and sequence to the luma plane. 
+        // The source frame is shared with other consumers, stamp a copy of it.
+        if (stamp_ && (captured->fourcc == cricket::FOURCC_I420 || captured->fourcc == cricket::FOURCC_NV12))
+        {
+            if (captured.get() == frame.get())
+            {
+                WebRTCFrameBufferPtr copy = convertedFrames_.Acquire(frame->size);
+                if (!copy.get())
+                    return;
+                memcpy(copy->Data(), frame->Data(), frame->size);
+                copy->width = frame->width;
+                copy->height = frame->height;
+                copy->stride = frame->stride;
+                copy->fourcc = frame->fourcc;
+                convertedFrames_.RecordCopy(frame->size);
+                captured = copy;
+            }
+            FrameStamp::Write(captured->Data(), captured->stride, captured->width, captured->height,
+                              static_cast<u32>(currentTime), stampSequence_++);
+        }
+
+        // Frame
+        cricket::CapturedFrame out;
+
         out.elapsed_time = static_cast<int64>(talk_base::TimeDiff(currentTime, time_)) * talk_base::kNumNanosecsPerMillisec;
         out.time_stamp = static_cast<int64>(currentTime) * talk_base::kNumNanosecsPerMillisec;
         time_ = currentTime;
         
-        int numBytes = frame->byteCount();
-#ifdef Q_OS_WIN
-        talk_base::scoped_array<char> data(new char[numBytes]);
-#else
-        talk_base::scoped_ptr<char[]> data(new char[numBytes]);
-#endif
-        memcpy(static_cast<void*>(data.get()), static_cast<const void*>(frame->bits()), numBytes);
-
-        out.fourcc = format->fourcc;
-        out.width = frame->width();
-        out.height = frame->height();
-        out.data_size = numBytes;
-        out.data = data.get();
+        // SignalFrameCaptured is handled synchronously, the pooled 
+        // buffer can be handed out as is without copying it first.
+        out.fourcc = captured->fourcc;
+        out.width = captured->width;
+        out.height = captured->height;
+        out.data_size = captured->size;
+        out.data = static_cast<void*>(captured->Data());
         
         SignalFrameCaptured(this, &out);
     }
     
+    FrameBufferPool::Statistics TundraCapturer::ConversionStatistics() const
+    {
+        return convertedFrames_.Stats();
+    }
+    
     cricket::CaptureState TundraCapturer::Start(const cricket::VideoFormat& format)
     {
         if (IsLogChannelEnabled(LogChannelDebug))
@@ -113,18 +168,31 @@ namespace WebRTC
             SetCaptureFormat(&supported);
         }
 
-        selfShared_ = shared_ptr<TundraCapturer>(this);
+        selfShared_ = shared_ptr<TundraCapturer>(this, NullCapturerDeleter());
 
         CloudRenderingPlugin *plugin = framework_->Module<CloudRenderingPlugin>();
         if (plugin && plugin->Renderer() && plugin->Renderer()->ApplicationRenderer())
         {
-            plugin->Renderer()->ApplicationRenderer()->SetInterval(format.framerate());
-            if (plugin->GetFramework()->HasCommandLineParameter("--cloudRenderingNoForceResize")) // @todo: document this
-                plugin->Renderer()->ApplicationRenderer()->SetSize(format.width, format.height - 21); // Hack for QMenuBar height
+            TundraRenderer *renderer = plugin->Renderer()->ApplicationRenderer();
+            conversion_ = renderer->Conversion();
+            if (renderer->IsOffscreen())
+                renderer->SetSize(format.width, format.height); // Exact size, window is not touched
+            else if (plugin->GetFramework()->HasCommandLineParameter("--cloudRenderingNoForceResize")) // @todo: document this
+                renderer->SetSize(format.width, format.height - 21); // Hack for QMenuBar height
             else
-                plugin->Renderer()->ApplicationRenderer()->SetSize(1280, 720 - 21);
-
-            plugin->Renderer()->ApplicationRenderer()->Register(selfShared_);
+                renderer->SetSize(1280, 720 - 21);
+
+            // The renderer paces, scales and converts for us. Exact rate from the interval, framerate() rounds fractional rates.
+            const cricket::VideoFormat *captureFormat = GetCaptureFormat();
+            TundraRenderer::ConsumerSettings settings;
+            settings.fps = (format.interval > 0 ? static_cast<double>(talk_base::kNumNanosecsPerSec) / static_cast<double>(format.interval) : 0.0);
+            if (captureFormat)
+            {
+                settings.width = captureFormat->width;
+                settings.height = captureFormat->height;
+                settings.fourcc = captureFormat->fourcc;
+            }
+            renderer->Register(selfShared_, settings);
         }
 
         running_ = true;
@@ -156,8 +224,8 @@ namespace WebRTC
     {
         if (IsLogChannelEnabled(LogChannelDebug))
             qDebug() << "TundraCapturer() GetPreferredFourccs";
-        //fourccs->push_back(cricket::FOURCC_I420);
-        //fourccs->push_back(cricket::FOURCC_MJPG);
+        fourccs->push_back(cricket::FOURCC_I420);
+        fourccs->push_back(cricket::FOURCC_NV12);
         fourccs->push_back(cricket::FOURCC_ARGB);
         return true;
     }
@@ -12,6 +12,8 @@
 #include "CloudRenderingPluginApi.h"
 #include "CloudRenderingPluginFwd.h"
 #include "WebRTCRenderer.h"
+#include "WebRTCFrameBuffer.h"
+#include "WebRTCColorConversion.h"
 
 #include <QObject>
 
@@ -38,7 +40,10 @@ namespace WebRTC
         bool IsScreencast() const;
         
         /// TundraRendererConsumer implementation
-        void OnTundraFrame(const QImage *frame);
+        void OnTundraFrame(const WebRTCFrameBufferPtr &frame);
+        
+        /// Returns the allocation counters of the pool frames are scaled and converted to.
+        FrameBufferPool::Statistics ConversionStatistics() const;
         
     protected:
         /// cricket::VideoCapturer overrides.
@@ -51,5 +56,13 @@ namespace WebRTC
         shared_ptr<TundraCapturer> selfShared_;
         
         uint64 time_;
+        
+        /// Pool for frames converted from ARGB to the capture format.
+        FrameBufferPool convertedFrames_;
+        ColorConversion::Implementation conversion_;
+        
+        /// If frames are stamped with FrameStamp for the loopback benchmark.
+        bool stamp_;
+        u16 stampSequence_;
     };
 }
@@ -13,6 +13,7 @@
 #include "Framework.h"
 #include "CoreJsonUtils.h"
 #include "LoggingFunctions.h"
+#include "HighPerfClock.h"
 
 #include <QThread>
 #include <QMutexLocker>
@@ -20,14 +21,39 @@
 
 namespace WebRTC
 {   
+    /// @cond PRIVATE
+
+    /// Returns a number in [0,1) and advances the xorshift @c state.
+    static double NextRandom(quint32 &state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return static_cast<double>(state) / 4294967296.0;
+    }
+
+    /// @endcond
+
     /// WebSocketClient
 
     WebSocketClient::WebSocketClient(CloudRenderingPlugin *plugin) :
         LC("[WebRTC::WebSocketClient]: "),
         plugin_(plugin),
-        thread_(0)
+        thread_(0),
+        connecting_(false),
+        connected_(false),
+        reconnect_(false),
+        reconnectInitialDelayMsec_(500),
+        reconnectMaxDelayMsec_(30000),
+        reconnectAttempt_(0),
+        reconnectRandom_(static_cast<quint32>(GetCurrentClockTime()) ^ static_cast<quint32>(reinterpret_cast<quintptr>(this)))
     {
         CloudRenderingProtocol::RegisterMetaTypes();
+
+        if (reconnectRandom_ == 0)
+            reconnectRandom_ = 0x9E3779B9u;
+        reconnectTimer_.setSingleShot(true);
+        connect(&reconnectTimer_, SIGNAL(timeout()), SLOT(OnReconnectTimer()));
     }
 
     WebSocketClient::~WebSocketClient()
@@ -35,6 +61,25 @@ namespace WebRTC
         Disconnect();
     }
 
+    int WebSocketClient::ReconnectDelay(int attempt, int initialDelayMsec, int maxDelayMsec, double random)
+    {
+        const double maxDelay = static_cast<double>(qMax(1, maxDelayMsec));
+        double delay = static_cast<double>(qMax(1, initialDelayMsec));
+        for (int i=0; i<attempt && delay < maxDelay; ++i)
+            delay *= 2.0;
+        delay = qMin(delay, maxDelay);
+        return static_cast<int>(delay * (0.5 + 0.5 * qBound(0.0, random, 1.0)));
+    }
+
+    void WebSocketClient::SetAutoReconnect(bool enabled, int initialDelayMsec, int maxDelayMsec)
+    {
+        reconnect_ = enabled;
+        reconnectInitialDelayMsec_ = qMax(1, initialDelayMsec);
+        reconnectMaxDelayMsec_ = qMax(reconnectInitialDelayMsec_, maxDelayMsec);
+        if (!reconnect_)
+            reconnectTimer_.stop();
+    }
+
     QString WebSocketClient::CleanHost(QString host, u16 port)
     {
         host = host.trimmed();
@@ -60,9 +105,18 @@ namespace WebRTC
      
     void WebSocketClient::Connect(QString host, u16 port)
     {
-        Disconnect();
+        reconnectTimer_.stop();
+        reconnectAttempt_ = 0;
+        host_ = CleanHost(host, port);
+        Open();
+    }
 
-        thread_ = new WebSocketThread(this, CleanHost(host, port));
+    void WebSocketClient::Open()
+    {
+        Close();
+
+        connecting_ = true;
+        thread_ = new WebSocketThread(this, host_);
         thread_->moveToThread(thread_);
         thread_->start(QThread::NormalPriority);
         
@@ -72,18 +126,33 @@ namespace WebRTC
     }
     
     void WebSocketClient::Disconnect()
-    {       
+    {
+        reconnectTimer_.stop();
+        Close();
+    }
+
+    void WebSocketClient::Close()
+    {
+        // The state changes the closing thread still has queued are ignored.
+        connecting_ = false;
+        connected_ = false;
         if (thread_ && thread_->isRunning())
         {
-            thread_->exit();
-            thread_->wait(1000);
+            thread_->Stop();
+            if (!thread_->wait(1000))
+            {
+                // Close handshake did not finish in time, drop the connection.
+                thread_->client_.stop();
+                thread_->wait(1000);
+            }
         }
         SAFE_DELETE(thread_);
     }
 
     bool WebSocketClient::IsConnected() const
     {
-        return (!thread_ || !thread_->client_.stopped() && !thread_->connectionHandle_.expired());
+        // The websocketpp client belongs to the I/O thread, the main thread follows its queued state changes.
+        return connected_;
     }
     
     bool WebSocketClient::Send(CloudRenderingProtocol::IMessage *message)
@@ -98,53 +167,116 @@ namespace WebRTC
 
         bool ok = false;
         QByteArray json = message->ToJSON(&ok);
-        if (ok)
+        return (ok ? SendJSON(message->MessageTypeName(), json) : false);
+    }
+
+    bool WebSocketClient::Send(const CloudRenderingProtocol::Signaling::IceCandidatesValue &message)
+    {
+        bool ok = false;
+        QByteArray json = CloudRenderingProtocol::ToJSON(message, &ok);
+        return (ok ? SendJSON(CloudRenderingProtocol::IceCandidates, json, message.receiverId) : false);
+    }
+
+    bool WebSocketClient::Send(const CloudRenderingProtocol::Application::RoomCustomValue &message)
+    {
+        bool ok = false;
+        QByteArray json = CloudRenderingProtocol::ToJSON(message, &ok);
+        return (ok ? SendJSON(CloudRenderingProtocol::RoomCustom, json) : false);
+    }
+
+    bool WebSocketClient::SendJSON(const QString &messageTypeName, QByteArray json, const QString &mergeKey)
+    {
+        if (!thread_ || !IsConnected())
         {
-            if (thread_->IsDebugRun())
-            {
-                qDebug() << "Sending message: channel =" << message->ChannelTypeName() << "type =" << message->MessageTypeName() << "    raw size =" << json.size() << "bytes";
-                CloudRenderingProtocol::DumpPrettyJSON(json);
-            }
+            LogError(LC + QString("Cannot send %1 message, WebSocket connection is not open!").arg(messageTypeName));
+            return false;
+        }
 
-            websocketpp::lib::error_code ec = thread_->Send(json);
-            if (ec)
-            {
-                LogError(LC + "Failed to send message: " + ec.message().c_str());
-                ok = false;
-            }
+        if (thread_->IsDebugRun())
+        {
+            qDebug() << "Sending message: type =" << messageTypeName << "    raw size =" << json.size() << "bytes";
+            CloudRenderingProtocol::DumpPrettyJSON(json);
+        }
+
+        // Backpressure: a connection that does not keep up fails the sends instead of queueing without bounds.
+        if (!thread_->Queue(json, mergeKey))
+        {
+            LogWarning(LC + QString("Outbound queue is full with %1 messages, dropping %2 message").arg(thread_->outbound_.MaxDepth()).arg(messageTypeName));
+            return false;
         }
-        return ok;
+        return true;
+    }
+
+    QVariantMap WebSocketClient::OutboundStatistics() const
+    {
+        return (thread_ ? thread_->outbound_.Stats().ToVariant() : QVariantMap());
     }
     
     void WebSocketClient::OnConnectionStateChange(CloudRenderingProtocol::ConnectionState newState)
     {
-        if (!thread_)
+        // A state change the previous thread queued before it was replaced belongs to a connection that is gone.
+        if (!thread_ || sender() != thread_)
             return;
 
         if (newState == CloudRenderingProtocol::CS_Connected)
         {
+            if (!connecting_)
+                return;
+            connecting_ = false;
+            connected_ = true;
+            reconnectAttempt_ = 0;
             if (thread_->IsDebugRun()) qDebug() << "Emitting CS_Connected";
             emit Connected();
         }
         else if (newState == CloudRenderingProtocol::CS_Disconnected)
         {
+            if (!connected_)
+                return;
+            connected_ = false;
             if (thread_->IsDebugRun()) qDebug() << "Emitting CS_Disconnected";
             emit Disconnected();
+            ScheduleReconnect();
         }
         else if (newState == CloudRenderingProtocol::CS_Error)
         {
+            if (!connecting_)
+                return;
+            connecting_ = false;
             if (thread_->IsDebugRun()) qDebug() << "Emitting CS_Error";
             emit ConnectingFailed();
+            ScheduleReconnect();
         }
     }
+
+    void WebSocketClient::ScheduleReconnect()
+    {
+        // A slot of the signal just emitted may have connected or disconnected already.
+        if (!reconnect_ || !thread_ || connecting_ || connected_ || reconnectTimer_.isActive() || host_.isEmpty())
+            return;
+
+        const int delayMsec = ReconnectDelay(reconnectAttempt_, reconnectInitialDelayMsec_, reconnectMaxDelayMsec_, NextRandom(reconnectRandom_));
+        reconnectAttempt_++;
+        LogInfo(LC + QString("Reconnecting to %1 in %2 msec, attempt %3").arg(host_).arg(delayMsec).arg(reconnectAttempt_));
+        reconnectTimer_.start(delayMsec);
+        emit Reconnecting(reconnectAttempt_, delayMsec);
+    }
+
+    void WebSocketClient::OnReconnectTimer()
+    {
+        if (!reconnect_ || host_.isEmpty())
+            return;
+        Open();
+    }
     
     void WebSocketClient::OnNewMessages()
     {
         if (!thread_)
             return;
             
-        CloudRenderingProtocol::MessageSharedPtrList messages = thread_->PendingMessages();
-        foreach(CloudRenderingProtocol::MessageSharedPtr message, messages)
+        // One signal drains everything received so far. A handler can disconnect, check the thread on every round.
+        thread_->BeginDrain();
+        CloudRenderingProtocol::MessageSharedPtr message;
+        while (thread_ && thread_->TakeMessage(message))
             emit Message(message);
     }
 
@@ -177,6 +309,11 @@ namespace WebRTC
         client_.set_close_handler(bind(&WebSocketThread::OnConnectionClosed, this, ::_1));
         client_.set_fail_handler(bind(&WebSocketThread::OnConnectingFailed, this, ::_1));
         client_.set_message_handler(bind(&WebSocketThread::OnMessage, this, ::_1, ::_2));
+
+        // Initialized here so that Stop() can reach the io_service before run() has started.
+        // The perpetual work keeps run() waiting while there is no connection activity.
+        client_.init_asio();
+        client_.start_perpetual();
     }
 
     WebSocketThread::~WebSocketThread()
@@ -188,7 +325,6 @@ namespace WebRTC
         client_.stop();
         client_.reset();
         connectionHandle_.reset();
-        messageQueue_.clear();
         
         emit ConnectionStateChange(CloudRenderingProtocol::CS_Disconnected);
     }
@@ -200,27 +336,138 @@ namespace WebRTC
     
     void WebSocketThread::run()
     {
-        // Initialize ASIO
-        client_.init_asio();
-
-        /// @todo Check error code.
         websocketpp::lib::error_code err;
         WebSocket::Client::connection_ptr connection = client_.get_connection(host_.toStdString(), err);
+        if (err || !connection)
+        {
+            LogError(LC + "Failed to create connection to " + host_ + ": " + err.message().c_str());
+            client_.stop();
+            emit ConnectionStateChange(CloudRenderingProtocol::CS_Error);
+            return;
+        }
 
         connectionHandle_ = connection->get_handle();
         client_.connect(connection);
 
-        // Start poller timer and exec thread ~60 FPS
-        int timerId = startTimer(16);
-        int ret = exec();
-        killTimer(timerId);
-        
+        // Blocks in the io_service until Stop(), handlers are called as soon as there is socket activity.
+        try
+        {
+            client_.run();
+        }
+        catch(const std::exception &e)
+        {
+            LogError(LC + "WebSocket I/O loop failed: " + e.what());
+        }
+
         Reset();
     }
 
-    void WebSocketThread::timerEvent(QTimerEvent *event)
+    void WebSocketThread::Stop()
+    {
+        client_.get_io_service().post(bind(&WebSocketThread::Close, this));
+    }
+
+    void WebSocketThread::Close()
+    {
+        DrainOutbound();
+        client_.stop_perpetual();
+
+        websocketpp::lib::error_code ec;
+        if (!connectionHandle_.expired())
+            client_.close(connectionHandle_, websocketpp::close::status::going_away, "", ec);
+        if (connectionHandle_.expired() || ec)
+            client_.stop();
+    }
+
+    bool WebSocketThread::Queue(QByteArray &data, const QString &iceReceiverId)
+    {
+        bool wakeUp = false;
+        if (!outbound_.Push(data, &wakeUp, iceReceiverId))
+            return false;
+        // Only the first message of a burst posts a drain, the rest are picked up by it.
+        if (wakeUp)
+            client_.get_io_service().post(bind(&WebSocketThread::DrainOutbound, this));
+        return true;
+    }
+
+    void WebSocketThread::DrainOutbound()
+    {
+        // One wakeup for the whole burst. The protocol has one JSON message per frame and websocketpp writes each
+        // frame on its own, so consecutive IceCandidates messages to the same receiver are merged into one message.
+        int messages = 0, merged = 0;
+        double totalMs = 0.0, maxMs = 0.0, queuedMs = 0.0;
+        QByteArray data;
+        QString iceReceiverId, runReceiverId;
+        QList<QByteArray> run;
+        while (outbound_.Pop(data, &queuedMs, &iceReceiverId))
+        {
+            messages++;
+            totalMs += queuedMs;
+            maxMs = qMax(maxMs, queuedMs);
+
+            if (!run.isEmpty() && iceReceiverId != runReceiverId)
+                merged += WriteIceCandidates(run);
+            if (iceReceiverId.isEmpty())
+                Write(data);
+            else
+            {
+                runReceiverId = iceReceiverId;
+                run << data;
+            }
+        }
+        if (!run.isEmpty())
+            merged += WriteIceCandidates(run);
+        outbound_.RecordDrain(messages, merged, totalMs, maxMs);
+
+        // A producer is still linking its message in, come back for it.
+        if (outbound_.Depth() > 0)
+            client_.get_io_service().post(bind(&WebSocketThread::DrainOutbound, this));
+    }
+
+    void WebSocketThread::Write(const QByteArray &data)
+    {
+        websocketpp::lib::error_code ec;
+        client_.send(connectionHandle_, static_cast<const void*>(data.constData()), data.size(), websocketpp::frame::opcode::TEXT, ec);
+        if (ec)
+            LogError(LC + "Failed to send message: " + ec.message().c_str());
+    }
+
+    int WebSocketThread::WriteIceCandidates(QList<QByteArray> &run)
     {
-        client_.poll();
+        int merged = 0;
+        if (run.size() > 1)
+        {
+            // The receiver is the same, the candidates of the rest are appended to the first message.
+            CloudRenderingProtocol::ChannelType channel = CloudRenderingProtocol::CT_Invalid;
+            CloudRenderingProtocol::MessageType type = CloudRenderingProtocol::MT_Invalid;
+            QVariantMap first;
+            QVariantList candidates;
+            bool ok = true;
+            for (int i=0; i<run.size() && ok; ++i)
+            {
+                QVariantMap data;
+                ok = (CloudRenderingProtocol::ParseMessage(run[i], channel, type, data) && type == CloudRenderingProtocol::MT_IceCandidates);
+                if (ok)
+                    candidates << data.value("iceCandidates").toList();
+                if (i == 0)
+                    first = data;
+            }
+            if (ok)
+            {
+                first["iceCandidates"] = candidates;
+                QByteArray json = CloudRenderingProtocol::SerializeMessage(channel, type, first, &ok);
+                if (ok)
+                {
+                    merged = run.size() - 1;
+                    run.clear();
+                    run << json;
+                }
+            }
+        }
+        foreach(const QByteArray &json, run)
+            Write(json);
+        run.clear();
+        return merged;
     }
 
     void WebSocketThread::OnConnectionOpened(websocketpp::connection_hdl connection)
@@ -258,39 +505,27 @@ namespace WebRTC
                 return;
             }
 
-            {
-                QMutexLocker lock(&mutexMessages_);
-                messageQueue_ << message;
-            }
-            
             if (IsDebugRun())
             {
                 qDebug() << "Received new message: channel =" << message->ChannelTypeName() << "type =" << message->MessageTypeName() << "    raw size =" << json.size() << "bytes";
                 CloudRenderingProtocol::DumpPrettyJSON(json);
             }
 
-            emit NewMessages();
+            // Only the first message since the main thread started its last drain signals, the same drain takes the rest.
+            if (inbound_.Push(message))
+                emit NewMessages();
         }
         else
             LogWarning(LC + "Got BINARY type message from server... not supported!");
     }
     
-    websocketpp::lib::error_code WebSocketThread::Send(QByteArray &data, websocketpp::frame::opcode::value opcode)
+    void WebSocketThread::BeginDrain()
     {
-        websocketpp::lib::error_code ec;
-        client_.send(connectionHandle_, static_cast<void*>(data.data()), data.size(), opcode, ec);
-        return ec;
+        inbound_.BeginDrain();
     }
-    
-    CloudRenderingProtocol::MessageSharedPtrList WebSocketThread::PendingMessages()
+
+    bool WebSocketThread::TakeMessage(CloudRenderingProtocol::MessageSharedPtr &message)
     {
-        CloudRenderingProtocol::MessageSharedPtrList pending;
-        {
-            QMutexLocker lock(&mutexMessages_);
-            foreach(CloudRenderingProtocol::MessageSharedPtr message, messageQueue_)
-                pending << message;
-            messageQueue_.clear();
-        }
-        return pending;
+        return inbound_.Pop(message);
     }
 }
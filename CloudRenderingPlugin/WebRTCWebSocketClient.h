@@ -12,11 +12,14 @@
 #include "CloudRenderingPluginApi.h"
 #include "CloudRenderingPluginFwd.h"
 #include "CloudRenderingProtocol.h"
+#include "WebRTCOutboundQueue.h"
+#include "WebRTCSpscQueue.h"
 
 #include <QThread>
 #include <QString>
 #include <QVariant>
 #include <QMutex>
+#include <QTimer>
 #include <QDebug>
 
 #include <websocketpp/config/asio_no_tls_client.hpp>
@@ -35,6 +38,9 @@ namespace WebRTC
        
     // WebSocketClient
 
+    /// WebSocket connection to the Cloud Rendering Service.
+    /** With SetAutoReconnect() a lost connection, or a connection attempt that fails, is retried
+        with a jittered exponential backoff until Connect() or Disconnect() is called. */
     class CLOUDRENDERING_API WebSocketClient : public QObject
     {
         Q_OBJECT
@@ -47,8 +53,26 @@ namespace WebRTC
         /// and not already set in @c host.
         static QString CleanHost(QString host, u16 port = 0);
 
+        /// Returns the delay in milliseconds before reconnect @c attempt, the first attempt is 0.
+        /** The delay doubles from @c initialDelayMsec on each attempt up to @c maxDelayMsec. Half of
+            the delay is fixed and half is scaled by @c random [0,1), so that renderers dropped by the
+            same service outage do not all reconnect at the same moment. */
+        static int ReconnectDelay(int attempt, int initialDelayMsec, int maxDelayMsec, double random);
+
+        /// Enables reconnecting automatically when the connection is lost or cannot be established.
+        /** Disabled by default. Disconnect() stops reconnecting until the next Connect().
+            @see ReconnectDelay() */
+        void SetAutoReconnect(bool enabled, int initialDelayMsec = 500, int maxDelayMsec = 30000);
+
         /// Returns framework ptr.
         Framework *GetFramework() const;
+
+        /// Send a value message to the server.
+        /** Serialized directly from the value, there is no message object to allocate or clean up.
+            ICE candidate messages to the same receiver that are still queued next to each other are sent as one message.
+            @return False if not connected or the outbound queue is full. */
+        bool Send(const CloudRenderingProtocol::Signaling::IceCandidatesValue &message);
+        bool Send(const CloudRenderingProtocol::Application::RoomCustomValue &message); /**< @overload */
         
     public slots:
         /// If port is 0 it wont be appended to the host string.
@@ -59,15 +83,24 @@ namespace WebRTC
         void Disconnect();
         
         /// Returns if currently connected to a server.
+        /** True from Connected() until Disconnected() or the next Connect() or Disconnect(), false while still connecting. */
         bool IsConnected() const;
         
         /// Send a message to the server.
+        /** The message is serialized in the calling thread and queued to the WebSocket thread, this does not block
+            on the socket. A burst of messages wakes the WebSocket thread up once, each message is still a separate write.
+            @return False if not connected or the outbound queue is full. */
         bool Send(CloudRenderingProtocol::IMessage *message);
+
+        /// Returns the outbound queue depth, send latency and drain counters, see OutboundQueue::Statistics.
+        QVariantMap OutboundStatistics() const;
         
     private slots:
         void OnConnectionStateChange(CloudRenderingProtocol::ConnectionState newState);
         
         void OnNewMessages();
+
+        void OnReconnectTimer();
         
     signals:
         /// Emitted once connected to the server.
@@ -79,19 +112,58 @@ namespace WebRTC
         /// Emitted when connection could not be established to the host in Connect().
         void ConnectingFailed();
 
+        /// Emitted when a reconnect is scheduled after Disconnected() or ConnectingFailed().
+        /** @param attempt Number of reconnects since the connection was last open, 1 for the first.
+            @param delayMsec Time until the reconnect. */
+        void Reconnecting(int attempt, int delayMsec);
+
         /// Emitted when a new message is received from the websocket connection.
         /** @note The signal is emitted in the main thread context, do not use Qt::QueuedConnection. */
         void Message(CloudRenderingProtocol::MessageSharedPtr message);
 
     private:        
+        /// Sends serialized @c json of a @c messageTypeName message.
+        /** @param mergeKey See OutboundQueue::Push(). */
+        bool SendJSON(const QString &messageTypeName, QByteArray json, const QString &mergeKey = QString());
+
+        /// Connects to host_ in a new thread.
+        void Open();
+
+        /// Closes the connection and deletes the thread.
+        void Close();
+
+        void ScheduleReconnect();
+
         QString LC;
         
         CloudRenderingPlugin *plugin_;
         WebSocketThread *thread_;
+        QString host_;
+
+        /// Connection state of thread_. State changes queued from earlier threads are ignored by their sender,
+        /// these also ignore the ones that do not fit the state, eg. a disconnect after Close().
+        bool connecting_;
+        bool connected_;
+
+        bool reconnect_;
+        int reconnectInitialDelayMsec_;
+        int reconnectMaxDelayMsec_;
+        int reconnectAttempt_;
+        quint32 reconnectRandom_;
+        QTimer reconnectTimer_;
     };
     
     // WebSocketThread
-    
+
+    /// Runs the WebSocket connection of WebSocketClient.
+    /** The ASIO I/O is event driven: the thread blocks in the io_service until there is socket activity
+        or a send is posted to it from another thread, there is no poll interval and no wakeups when idle.
+        Received messages are handed to the main thread through a SpscQueue, the queued NewMessages() signal
+        is emitted once per burst and the main thread drains everything that has arrived in one go.
+
+        The websocketpp client is only touched from this thread. Outgoing messages are pushed to an OutboundQueue
+        from any thread, the first message of a burst posts a drain to the io_service. The drain merges consecutive
+        IceCandidates messages to the same receiver into one message. */
     class CLOUDRENDERING_API WebSocketThread : public QThread
     {
     Q_OBJECT
@@ -112,29 +184,52 @@ namespace WebRTC
         /// Internal use only for incoming websocket messages.
         void OnMessage(websocketpp::connection_hdl connection, WebSocket::Client::message_ptr msg);
         
-        /// Send message.
-        websocketpp::lib::error_code Send(QByteArray &data, websocketpp::frame::opcode::value opcode = websocketpp::frame::opcode::TEXT);
+        /// Queues a text message, can be called from any thread.
+        /** The contents of @c data are moved to the queue.
+            @param iceReceiverId Receiver of an IceCandidates message, empty for other messages.
+            @return False if the outbound queue is full, @c data is left untouched. */
+        bool Queue(QByteArray &data, const QString &iceReceiverId = QString());
+
+        /// Closes the connection once the queued messages are written and lets run() return after the close handshake.
+        /** Can be called from any thread. If there is no open connection the I/O loop is stopped right away. */
+        void Stop();
         
-        /// Returns the currently pending messages, this thread will forget the ptrs once returned.
-        /** Only fetch the messages if you intend to process them! This should be done as a response to NewMessages() signal. */
-        CloudRenderingProtocol::MessageSharedPtrList PendingMessages();
+        /// Clears the pending wakeup. Call in the main thread as a response to NewMessages(), before TakeMessage().
+        void BeginDrain();
+
+        /// Takes the oldest received message. Main thread only.
+        /** Only take the messages if you intend to process them!
+            @return False if there are no more messages. */
+        bool TakeMessage(CloudRenderingProtocol::MessageSharedPtr &message);
 
         friend class WebSocketClient;
         
     signals:
         void ConnectionStateChange(CloudRenderingProtocol::ConnectionState newState);
+
+        /// Emitted for the first message received after the last BeginDrain().
         void NewMessages();
 
     protected:
         /// QThread override.
         void run();
         
-        /// QObject override.
-        void timerEvent(QTimerEvent *event);
-        
         void Reset();
         
         bool IsDebugRun() const;
+
+        /// Hands the queued messages to websocketpp. Runs in the I/O loop.
+        void DrainOutbound();
+
+        /// Writes @c data as a text frame. Runs in the I/O loop.
+        void Write(const QByteArray &data);
+
+        /// Writes IceCandidates messages @c run to the same receiver as one message and clears @c run. Runs in the I/O loop.
+        /** @return Number of messages merged into the first one, 0 if they were written one by one. */
+        int WriteIceCandidates(QList<QByteArray> &run);
+
+        /// Drains the queue and starts the close handshake. Runs in the I/O loop.
+        void Close();
         
         WebSocket::Client client_;
         websocketpp::connection_hdl connectionHandle_;
@@ -142,8 +237,9 @@ namespace WebRTC
     private:
         WebSocketClient *owner_;
         
-        QMutex mutexMessages_;
-        CloudRenderingProtocol::MessageSharedPtrList messageQueue_;
+        SpscQueue<CloudRenderingProtocol::MessageSharedPtr> inbound_;
+
+        OutboundQueue outbound_;
 
         QString LC;
         QString host_;
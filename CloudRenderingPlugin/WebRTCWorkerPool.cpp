@@ -0,0 +1,406 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#include "WebRTCWorkerPool.h"
+
+#include "WebRTCClock.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+#include <deque>
+#include <vector>
+
+namespace WebRTC
+{
+    /// @cond PRIVATE
+
+    /// Band timings of a job. A plain array so the workers can index it in parallel, QList could detach.
+    typedef std::vector<BandTiming> BandTimingArray;
+
+    static BandTimingList ToBandTimingList(const BandTimingArray &bands)
+    {
+        BandTimingList list;
+        list.reserve(static_cast<int>(bands.size()));
+        for (size_t i=0; i<bands.size(); ++i)
+            list << bands[i];
+        return list;
+    }
+
+    /// State of a submitted job.
+    struct WorkerJob
+    {
+        WorkerJob(IBandJob *job_, WorkerPoolShared *pool_) :
+            job(job_),
+            pool(pool_),
+            remaining(0),
+            submitted(GetCurrentClockTime()),
+            finished(0)
+        {
+        }
+
+        IBandJob *job;
+        WorkerPoolShared *pool;
+        /// Filled before the bands are queued and not resized after that.
+        BandTimingArray bands;
+        int remaining;
+        tick_t submitted;
+        tick_t finished;
+    };
+
+    /// Single queued band.
+    struct WorkerTask
+    {
+        WorkerTask() : band(0) {}
+        WorkerTask(const shared_ptr<WorkerJob> &job_, int band_) : job(job_), band(band_) {}
+
+        shared_ptr<WorkerJob> job;
+        int band;
+    };
+
+    /// State shared between the pool, its threads and job handles.
+    struct WorkerPoolShared
+    {
+        WorkerPoolShared() :
+            quit(false),
+            jobs(0),
+            bands(0),
+            jobMs(0.0),
+            bandMs(0.0),
+            lastJobMs(0.0)
+        {
+        }
+
+        /// Takes the next queued band of @c job. Mutex must be locked.
+        bool TakeTask(WorkerJob *job, WorkerTask &task)
+        {
+            for (std::deque<WorkerTask>::iterator iter = queue.begin(); iter != queue.end(); ++iter)
+            {
+                if (iter->job.get() == job)
+                {
+                    task = *iter;
+                    queue.erase(iter);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /// Processes a band and records its timing. Mutex must not be locked.
+        void Process(const WorkerTask &task, int thread)
+        {
+            WorkerJob *job = task.job.get();
+            const int firstRow = job->bands[task.band].firstRow;
+            const int lastRow = job->bands[task.band].lastRow;
+
+            tick_t start = GetCurrentClockTime();
+            job->job->ProcessBand(firstRow, lastRow);
+            tick_t end = GetCurrentClockTime();
+            const double ms = TicksToMs(end - start);
+
+            QMutexLocker lock(&mutex);
+            BandTiming &timing = job->bands[task.band];
+            timing.thread = thread;
+            timing.ms = ms;
+
+            bands++;
+            bandMs += ms;
+            if (thread >= 0 && thread < threadBands.size())
+            {
+                threadBands[thread]++;
+                threadBusyMs[thread] += ms;
+            }
+
+            if (--job->remaining == 0)
+            {
+                job->finished = end;
+                jobs++;
+                jobMs += TicksToMs(job->finished - job->submitted);
+                lastJob = ToBandTimingList(job->bands);
+                lastJobMs = TicksToMs(job->finished - job->submitted);
+            }
+            bandFinished.wakeAll();
+        }
+
+        QMutex mutex;
+        QWaitCondition workAvailable;
+        QWaitCondition bandFinished;
+        std::deque<WorkerTask> queue;
+        bool quit;
+
+        // Statistics
+        u64 jobs;
+        u64 bands;
+        double jobMs;
+        double bandMs;
+        QList<u64> threadBands;
+        QList<double> threadBusyMs;
+        BandTimingList lastJob;
+        double lastJobMs;
+    };
+
+    /// Worker thread that processes queued bands until the pool quits.
+    class WorkerThread : public QThread
+    {
+    public:
+        WorkerThread(const shared_ptr<WorkerPoolShared> &shared, int index) :
+            shared_(shared),
+            index_(index)
+        {
+        }
+
+    protected:
+        void run()
+        {
+            QMutexLocker lock(&shared_->mutex);
+            while(!shared_->quit)
+            {
+                if (shared_->queue.empty())
+                {
+                    shared_->workAvailable.wait(&shared_->mutex);
+                    continue;
+                }
+                WorkerTask task = shared_->queue.front();
+                shared_->queue.pop_front();
+
+                lock.unlock();
+                shared_->Process(task, index_);
+                lock.relock();
+            }
+        }
+
+    private:
+        shared_ptr<WorkerPoolShared> shared_;
+        int index_;
+    };
+
+    /// @endcond
+
+    // JobHandle
+
+    JobHandle::JobHandle()
+    {
+    }
+
+    bool JobHandle::IsValid() const
+    {
+        return (job_.get() != 0);
+    }
+
+    bool JobHandle::IsFinished() const
+    {
+        if (!job_.get())
+            return true;
+        QMutexLocker lock(&job_->pool->mutex);
+        return (job_->remaining == 0);
+    }
+
+    void JobHandle::Wait()
+    {
+        if (!job_.get())
+            return;
+
+        WorkerPoolShared *pool = job_->pool;
+        QMutexLocker lock(&pool->mutex);
+        while(job_->remaining > 0)
+        {
+            // Help out instead of idling while our bands are still queued.
+            WorkerTask task;
+            if (pool->TakeTask(job_.get(), task))
+            {
+                lock.unlock();
+                pool->Process(task, -1);
+                lock.relock();
+            }
+            else
+                pool->bandFinished.wait(&pool->mutex);
+        }
+    }
+
+    BandTimingList JobHandle::BandTimings() const
+    {
+        if (!job_.get())
+            return BandTimingList();
+        QMutexLocker lock(&job_->pool->mutex);
+        return ToBandTimingList(job_->bands);
+    }
+
+    double JobHandle::ElapsedMs() const
+    {
+        if (!job_.get())
+            return 0.0;
+        QMutexLocker lock(&job_->pool->mutex);
+        if (job_->remaining > 0)
+            return TicksToMs(GetCurrentClockTime() - job_->submitted);
+        return TicksToMs(job_->finished - job_->submitted);
+    }
+
+    // WorkerPool
+
+    WorkerPool::WorkerPool(int numThreads) :
+        shared_(new WorkerPoolShared())
+    {
+        StartThreads(numThreads);
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        StopThreads();
+    }
+
+    int WorkerPool::NumThreads() const
+    {
+        return threads_.size();
+    }
+
+    void WorkerPool::SetNumThreads(int numThreads)
+    {
+        StopThreads();
+        StartThreads(numThreads);
+    }
+
+    void WorkerPool::StartThreads(int numThreads)
+    {
+        if (numThreads < 0)
+            numThreads = QThread::idealThreadCount();
+        if (numThreads < 0)
+            numThreads = 0;
+
+        QMutexLocker lock(&shared_->mutex);
+        shared_->quit = false;
+        shared_->threadBands.clear();
+        shared_->threadBusyMs.clear();
+        for (int i=0; i<numThreads; ++i)
+        {
+            shared_->threadBands << 0;
+            shared_->threadBusyMs << 0.0;
+        }
+        for (int i=0; i<numThreads; ++i)
+        {
+            WorkerThread *thread = new WorkerThread(shared_, i);
+            threads_ << thread;
+            thread->start(QThread::HighPriority);
+        }
+    }
+
+    void WorkerPool::StopThreads()
+    {
+        {
+            QMutexLocker lock(&shared_->mutex);
+            shared_->quit = true;
+            shared_->workAvailable.wakeAll();
+        }
+        foreach(WorkerThread *thread, threads_)
+        {
+            thread->wait();
+            delete thread;
+        }
+        threads_.clear();
+    }
+
+    JobHandle WorkerPool::Submit(IBandJob *job, int rows, int rowAlignment, int numBands)
+    {
+        JobHandle handle;
+        if (!job || rows <= 0)
+            return handle;
+
+        if (rowAlignment < 1)
+            rowAlignment = 1;
+        const int units = (rows + rowAlignment - 1) / rowAlignment;
+        if (numBands <= 0)
+            numBands = threads_.size() + 1;
+        if (numBands > units)
+            numBands = units;
+
+        handle.job_ = shared_ptr<WorkerJob>(new WorkerJob(job, shared_.get()));
+        WorkerJob *state = handle.job_.get();
+        state->bands.resize(numBands);
+        for (int i=0; i<numBands; ++i)
+        {
+            BandTiming &band = state->bands[i];
+            band.firstRow = qMin(rows, (units * i / numBands) * rowAlignment);
+            band.lastRow = qMin(rows, (units * (i + 1) / numBands) * rowAlignment);
+        }
+        state->remaining = numBands;
+
+        // Without workers the job is processed right away on this thread.
+        if (threads_.isEmpty())
+        {
+            for (int i=0; i<numBands; ++i)
+                shared_->Process(WorkerTask(handle.job_, i), -1);
+            return handle;
+        }
+
+        QMutexLocker lock(&shared_->mutex);
+        for (int i=0; i<numBands; ++i)
+            shared_->queue.push_back(WorkerTask(handle.job_, i));
+        shared_->workAvailable.wakeAll();
+        return handle;
+    }
+
+    void WorkerPool::Run(IBandJob *job, int rows, int rowAlignment, int numBands)
+    {
+        Submit(job, rows, rowAlignment, numBands).Wait();
+    }
+
+    QVariantMap WorkerPool::Statistics() const
+    {
+        QMutexLocker lock(&shared_->mutex);
+        QVariantMap stats;
+        stats["threads"] = threads_.size();
+        stats["jobs"] = static_cast<qulonglong>(shared_->jobs);
+        stats["bands"] = static_cast<qulonglong>(shared_->bands);
+        stats["averageJobMs"] = (shared_->jobs > 0 ? shared_->jobMs / static_cast<double>(shared_->jobs) : 0.0);
+        stats["averageBandMs"] = (shared_->bands > 0 ? shared_->bandMs / static_cast<double>(shared_->bands) : 0.0);
+
+        QVariantList threads;
+        for (int i=0; i<shared_->threadBands.size(); ++i)
+        {
+            QVariantMap thread;
+            thread["bands"] = static_cast<qulonglong>(shared_->threadBands[i]);
+            thread["busyMs"] = shared_->threadBusyMs[i];
+            threads << thread;
+        }
+        stats["workers"] = threads;
+
+        QVariantList bands;
+        foreach(const BandTiming &timing, shared_->lastJob)
+        {
+            QVariantMap band;
+            band["firstRow"] = timing.firstRow;
+            band["lastRow"] = timing.lastRow;
+            band["thread"] = timing.thread;
+            band["ms"] = timing.ms;
+            bands << band;
+        }
+        QVariantMap lastJob;
+        lastJob["ms"] = (shared_->lastJob.isEmpty() ? 0.0 : shared_->lastJobMs);
+        lastJob["bands"] = bands;
+        stats["lastJob"] = lastJob;
+        return stats;
+    }
+
+    void WorkerPool::ResetStatistics()
+    {
+        QMutexLocker lock(&shared_->mutex);
+        shared_->jobs = 0;
+        shared_->bands = 0;
+        shared_->jobMs = 0.0;
+        shared_->bandMs = 0.0;
+        for (int i=0; i<shared_->threadBands.size(); ++i)
+        {
+            shared_->threadBands[i] = 0;
+            shared_->threadBusyMs[i] = 0.0;
+        }
+        shared_->lastJob.clear();
+        shared_->lastJobMs = 0.0;
+    }
+}
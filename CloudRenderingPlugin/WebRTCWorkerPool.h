@@ -0,0 +1,121 @@
+/**
+    @author Admino Technologies Oy
+
+    Copyright 2013 Admino Technologies Oy. All rights reserved.
+    See LICENCE for conditions of distribution and use.
+
+    @file   
+    @brief   */
+
+#pragma once
+
+#include "CloudRenderingPluginApi.h"
+#include "CloudRenderingPluginFwd.h"
+
+#include <QList>
+#include <QVariant>
+
+namespace WebRTC
+{
+    /// @cond PRIVATE
+    struct WorkerJob;
+    struct WorkerPoolShared;
+    class WorkerThread;
+    /// @endcond
+
+    /// Work that can be split into horizontal bands of rows.
+    class CLOUDRENDERING_API IBandJob
+    {
+    public:
+        virtual ~IBandJob() {}
+
+        /// Processes rows [@c firstRow, @c lastRow).
+        /** Called from the worker threads, distinct bands of the same job run in parallel. */
+        virtual void ProcessBand(int firstRow, int lastRow) = 0;
+    };
+
+    /// Timing of a single processed band.
+    struct CLOUDRENDERING_API BandTiming
+    {
+        /// First row of the band.
+        int firstRow;
+        /// One past the last row of the band.
+        int lastRow;
+        /// Index of the worker thread that processed the band, -1 for the thread that waited on the job.
+        int thread;
+        /// Processing time in milliseconds.
+        double ms;
+
+        BandTiming() : firstRow(0), lastRow(0), thread(-1), ms(0.0) {}
+    };
+    typedef QList<BandTiming> BandTimingList;
+
+    /// Handle to a job submitted to a WorkerPool.
+    /** @note The handle must not be waited on after the pool has been destroyed. */
+    class CLOUDRENDERING_API JobHandle
+    {
+    public:
+        JobHandle();
+
+        /// Returns if this handle refers to a submitted job.
+        bool IsValid() const;
+
+        /// Returns if all bands of the job have been processed.
+        bool IsFinished() const;
+
+        /// Blocks until all bands are processed.
+        /** Bands of this job that no worker has picked up yet are processed on the calling thread. */
+        void Wait();
+
+        /// Returns timing of each band, in row order. Valid once the job is finished.
+        BandTimingList BandTimings() const;
+
+        /// Returns milliseconds from submitting the job to its last band finishing.
+        double ElapsedMs() const;
+
+    private:
+        friend class WorkerPool;
+        shared_ptr<WorkerJob> job_;
+    };
+
+    /// Persistent pool of worker threads for frame processing.
+    /** Jobs are split into horizontal bands that the workers process in parallel.
+        With zero worker threads jobs are processed on the submitting thread. */
+    class CLOUDRENDERING_API WorkerPool
+    {
+    public:
+        /// @param numThreads Number of worker threads, negative uses QThread::idealThreadCount().
+        WorkerPool(int numThreads = -1);
+        ~WorkerPool();
+
+        /// Returns the number of worker threads.
+        int NumThreads() const;
+
+        /// Restarts the pool with @c numThreads workers, negative uses QThread::idealThreadCount().
+        /** @note No jobs may be in flight when this is called. */
+        void SetNumThreads(int numThreads);
+
+        /// Queues @c job for processing and returns immediately.
+        /** @param rows Number of rows in the job.
+            @param rowAlignment Every band except the last starts and ends at a multiple of this, eg. 2 for 4:2:0 chroma.
+            @param numBands Number of bands, 0 picks one band per worker plus one for the waiting thread.
+            @note @c job must stay alive until the returned handle has been waited on. */
+        JobHandle Submit(IBandJob *job, int rows, int rowAlignment = 1, int numBands = 0);
+
+        /// Submits @c job and waits for it to finish.
+        void Run(IBandJob *job, int rows, int rowAlignment = 1, int numBands = 0);
+
+        /// Returns job counters and the band timings of the last finished job.
+        QVariantMap Statistics() const;
+
+        /// Resets the counters returned by Statistics().
+        void ResetStatistics();
+
+    private:
+        void StartThreads(int numThreads);
+        void StopThreads();
+
+        shared_ptr<WorkerPoolShared> shared_;
+        QList<WorkerThread*> threads_;
+    };
+}